@@ -9,15 +9,16 @@
 #include <SDL3/SDL_init.h>
 #include <SDL3/SDL_main.h>
 
-static inline SDL_Renderer* renderer;
+#include "common/redraw_policy.hpp"
+
 /**
  * @struct AppContext
  * @brief Contains the main SDL-related context for the application.
- * 
+ *
  * This structure holds all the necessary SDL objects and state information
  * required for the application to run, including window, renderer, textures,
  * audio device, and application state.
- * 
+ *
  * @var window          The SDL window handle
  * @var renderer        The SDL renderer associated with the window
  * @var message_tex     Texture for displaying text messages
@@ -25,51 +26,84 @@ static inline SDL_Renderer* renderer;
  * @var message_dest    Rectangle defining the position and size of the message texture
  * @var audio_device    ID of the SDL audio device
  * @var app_quit        Flag indicating whether the application should continue running or quit
+ * @var redraw          Decides when a frame is drawn and presented
+ * @var paused          Color animation stopped (Space toggles it)
+ * @var animation_time  Seconds of animation shown while paused
+ * @var animation_start When the animation started, shifted by the pauses
  */
 struct AppContext {
-    SDL_Window* window;
-    SDL_Renderer* renderer;
-    SDL_Texture *message_tex, *image_tex;
-    SDL_FRect message_dest;
-    SDL_AudioDeviceID audio_device;
+    SDL_Window* window = nullptr;
+    SDL_Renderer* renderer = nullptr;
+    SDL_Texture *message_tex = nullptr, *image_tex = nullptr;
+    SDL_FRect message_dest{};
+    SDL_AudioDeviceID audio_device = 0;
     SDL_AppResult app_quit = SDL_APP_CONTINUE;
+
+    RedrawPolicy redraw;
+    bool paused = false;
+    double animation_time = 0.0;
+    double animation_start = 0.0;
 };
 
-SDL_AppResult SDL_AppInit(void**  /*appstate*/, int  /*argc*/, char*  /*argv*/[]) {
+static double seconds() {
+    return SDL_GetTicksNS() / double(SDL_NS_PER_SECOND);
+}
+
+SDL_AppResult SDL_AppInit(void** appstate, int  /*argc*/, char*  /*argv*/[]) {
     SDL_SetAppMetadata("Example Renderer", "1.0", "Example-Renderer");
     SDL_SetLogPriorities(SDL_LOG_PRIORITY_VERBOSE);
     if (!SDL_Init(SDL_INIT_VIDEO)) {
         SDL_Log("SDL_Init failed: %s", SDL_GetError());
         return SDL_APP_FAILURE;
     }
-    SDL_Log("Hello, SDL3!");
-    SDL_Window* window(
-        SDL_CreateWindow("Hello, SDL3!", 800, 600, SDL_WINDOW_RESIZABLE));
-    if (window == nullptr) {
+    auto* app = new AppContext();
+    *appstate = app;  // Freed in SDL_AppQuit, also after a failure
+    SDL_Log("Hello, SDL3! Space pauses the colors.");
+    app->window =
+        SDL_CreateWindow("Hello, SDL3!", 800, 600, SDL_WINDOW_RESIZABLE);
+    if (app->window == nullptr) {
         SDL_Log("SDL_CreateWindow failed: %s", SDL_GetError());
         return SDL_APP_FAILURE;
     }
-    SDL_SetWindowPosition(window, SDL_WINDOWPOS_CENTERED,
+    SDL_SetWindowPosition(app->window, SDL_WINDOWPOS_CENTERED,
                           SDL_WINDOWPOS_CENTERED);
-    renderer = SDL_CreateRenderer(window, nullptr);
-    if (renderer == nullptr) {
+    app->renderer = SDL_CreateRenderer(app->window, nullptr);
+    if (app->renderer == nullptr) {
         SDL_Log("SDL_CreateRenderer failed: %s", SDL_GetError());
         return SDL_APP_FAILURE;
     }
+    // Animation frames are paced by the display, not drawn as fast as possible
+    SDL_SetRenderVSync(app->renderer, 1);
+    app->animation_start = seconds();
     return SDL_APP_CONTINUE;
 }
 
 SDL_AppResult SDL_AppEvent(void* appstate, SDL_Event* event) {
     auto* app = static_cast<AppContext*>(appstate);
+    app->redraw.onEvent(*event);
     if (event->type == SDL_EVENT_QUIT) {
         app->app_quit = SDL_APP_SUCCESS;
     }
+    if (event->type == SDL_EVENT_KEY_DOWN && event->key.key == SDLK_SPACE &&
+        !event->key.repeat) {
+        app->paused = !app->paused;
+        if (app->paused) {
+            app->animation_time = seconds() - app->animation_start;
+        } else {
+            app->animation_start = seconds() - app->animation_time;
+        }
+    }
     return SDL_APP_CONTINUE;
 }
 
 void SDL_AppQuit(void* appstate, SDL_AppResult  /*result*/) {
     auto* app = static_cast<AppContext*>(appstate);
     if (app) {
+        const RedrawPolicy::Stats& stats = app->redraw.getStats();
+        SDL_Log("Frames built %llu, presented %llu, skipped %llu",
+                (unsigned long long)stats.built,
+                (unsigned long long)stats.presented,
+                (unsigned long long)stats.skipped);
         if (app->renderer) SDL_DestroyRenderer(app->renderer);
         if (app->window) SDL_DestroyWindow(app->window);
         delete app;
@@ -79,12 +113,40 @@ void SDL_AppQuit(void* appstate, SDL_AppResult  /*result*/) {
 
 SDL_AppResult SDL_AppIterate(void* appstate) {
     auto* app = static_cast<AppContext*>(appstate);
-    const auto now = SDL_GetTicks() / 1000.0;
+    if (app->app_quit != SDL_APP_CONTINUE) {
+        return app->app_quit;
+    }
+    // Paused, the window only changes on events
+    if (!app->paused) {
+        app->redraw.requestFrame();
+    }
+    if (!app->redraw.beginFrame()) {
+        return SDL_APP_CONTINUE;
+    }
+
+    const double now = app->paused ? app->animation_time
+                                   : seconds() - app->animation_start;
     const float red = static_cast<float>(0.5 + 0.5 * SDL_sin(now));
     const float green = static_cast<float>(0.5 + 0.5 * SDL_sin(now + SDL_PI_D * 2 / 3));
     const float blue = static_cast<float>(0.5 + 0.5 * SDL_sin(now + SDL_PI_D * 4 / 3));
-    SDL_SetRenderDrawColorFloat(renderer, red, green, blue, SDL_ALPHA_OPAQUE_FLOAT);
-    SDL_RenderClear(renderer);
-    SDL_RenderPresent(renderer);
+
+    // The frame is one color: it looks the same when the 8-bit color and the
+    // size do
+    int width = 0;
+    int height = 0;
+    SDL_GetCurrentRenderOutputSize(app->renderer, &width, &height);
+    auto to8 = [](float c) { return uint64_t(c * 255.0f + 0.5f); };
+    uint64_t hash = to8(red) | to8(green) << 8 | to8(blue) << 16 |
+                    uint64_t(uint32_t(width)) << 24 |
+                    uint64_t(uint32_t(height)) << 44;
+    if (app->redraw.isUnchanged(hash)) {
+        return SDL_APP_CONTINUE;
+    }
+
+    SDL_SetRenderDrawColorFloat(app->renderer, red, green, blue,
+                                SDL_ALPHA_OPAQUE_FLOAT);
+    SDL_RenderClear(app->renderer);
+    SDL_RenderPresent(app->renderer);
+    app->redraw.markPresented(hash);
     return SDL_APP_CONTINUE;
-}
\ No newline at end of file
+}
@@ -8,11 +8,66 @@
 #include <SDL3/SDL.h>
 #include <SDL3/SDL_main.h>
 
+#include "common/redraw_policy.hpp"
+
+#include <cstring>
+
+// After input, UI such as tooltips and fades changes without further events
+constexpr Uint64 INPUT_GRACE_NS = 500 * SDL_NS_PER_MS;
+constexpr Uint64 CURSOR_BLINK_NS = 100 * SDL_NS_PER_MS;  // Text input active
+constexpr Uint64 RETRY_NS = 16 * SDL_NS_PER_MS;  // No swapchain image
+constexpr Uint64 STATS_INTERVAL_NS = SDL_NS_PER_SECOND;
+
 inline SDL_Window* window = nullptr;
 inline bool show_demo_window = true;
 inline SDL_GPUDevice* gpu_device = nullptr;
 inline bool show_another_window = false;
 inline ImVec4 clear_color = ImVec4(0.45f, 0.55f, 0.60f, 1.00f);
+inline RedrawPolicy redraw{INPUT_GRACE_NS};
+inline bool show_redraw_stats = false;
+inline RedrawPolicy::Stats shown_stats;  // Refreshed once a second
+
+// 64-bit FNV-1a over what the frame would show: vertices, indices, draw
+// commands and the clear color. Words instead of bytes, as a busy frame has
+// a few hundred KB of vertices; each step is still a bijection, so a single
+// changed word always changes the hash.
+uint64_t hashWords(uint64_t hash, const void* data, size_t size) {
+    constexpr uint64_t FNV_PRIME = 0x100000001b3ull;
+    const auto* bytes = static_cast<const unsigned char*>(data);
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, bytes + i, sizeof(word));
+        hash = (hash ^ word) * FNV_PRIME;
+    }
+    for (; i < size; ++i) {
+        hash = (hash ^ bytes[i]) * FNV_PRIME;
+    }
+    return hash;
+}
+
+uint64_t hashDrawData(const ImDrawData* drawData, const ImVec4& clearColor) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    hash = hashWords(hash, &clearColor, sizeof(clearColor));
+    hash = hashWords(hash, &drawData->DisplayPos, sizeof(ImVec2));
+    hash = hashWords(hash, &drawData->DisplaySize, sizeof(ImVec2));
+    hash = hashWords(hash, &drawData->FramebufferScale, sizeof(ImVec2));
+    for (const ImDrawList* list : drawData->CmdLists) {
+        // Field by field: ImDrawCmd has padding and per-frame pointers
+        for (const ImDrawCmd& cmd : list->CmdBuffer) {
+            hash = hashWords(hash, &cmd.ClipRect, sizeof(cmd.ClipRect));
+            hash = hashWords(hash, &cmd.TextureId, sizeof(cmd.TextureId));
+            unsigned int offsets[3] = {cmd.VtxOffset, cmd.IdxOffset,
+                                       cmd.ElemCount};
+            hash = hashWords(hash, offsets, sizeof(offsets));
+        }
+        hash = hashWords(hash, list->VtxBuffer.Data,
+                         list->VtxBuffer.size_in_bytes());
+        hash = hashWords(hash, list->IdxBuffer.Data,
+                         list->IdxBuffer.size_in_bytes());
+    }
+    return hash;
+}
 
 SDL_AppResult InitSDL3() {
     SDL_SetAppMetadata("ImGui_SDL3", "1.0", "ImGui-SDL3");
@@ -43,9 +98,10 @@ SDL_AppResult InitSDL3() {
         SDL_Log("SDL_ClaimWindowForGPUDevice failed: %s", SDL_GetError());
         return SDL_APP_FAILURE;
     }
+    // Vsync paces the frames that do change; mailbox would run them uncapped
     SDL_SetGPUSwapchainParameters(gpu_device, window,
                                   SDL_GPU_SWAPCHAINCOMPOSITION_SDR,
-                                  SDL_GPU_PRESENTMODE_MAILBOX);
+                                  SDL_GPU_PRESENTMODE_VSYNC);
     IMGUI_CHECKVERSION();
     ImGui::CreateContext();
     ImGuiIO& io = ImGui::GetIO();
@@ -71,8 +127,8 @@ SDL_AppResult SDL_AppInit(void**  /*appstate*/, int  /*argc*/, char*  /*argv*/[]
 }
 
 SDL_AppResult SDL_AppIterate(void*  /*appstate*/) {
-    if (SDL_GetWindowFlags(window) & SDL_WINDOW_MINIMIZED) {
-        SDL_Delay(10);
+    // Waits for input or a timer while nothing changes, minimized included
+    if (!redraw.beginFrame()) {
         return SDL_APP_CONTINUE;
     }
     ImGui_ImplSDLGPU3_NewFrame();
@@ -110,9 +166,16 @@ SDL_AppResult SDL_AppIterate(void*  /*appstate*/) {
             counter++;
         ImGui::SameLine();
         ImGui::Text("counter = %d", counter);
-        ImGuiIO& io = ImGui::GetIO();
-        ImGui::Text("Application average %.3f ms/frame (%.1f FPS)",
-                    1000.0f / io.Framerate, io.Framerate);
+        // A frame rate changes every frame and would never let the window go
+        // idle; the redraw counters are shown once a second instead
+        ImGui::Checkbox("Redraw stats", &show_redraw_stats);
+        if (show_redraw_stats) {
+            ImGui::Text("Built %llu, presented %llu, skipped %llu, waits %llu",
+                        (unsigned long long)shown_stats.built,
+                        (unsigned long long)shown_stats.presented,
+                        (unsigned long long)shown_stats.skipped,
+                        (unsigned long long)shown_stats.waits);
+        }
         ImGui::End();
     }
     // 3. Show another simple window.
@@ -130,6 +193,26 @@ SDL_AppResult SDL_AppIterate(void*  /*appstate*/) {
     ImDrawData* draw_data = ImGui::GetDrawData();
     const bool is_minimized =
         (draw_data->DisplaySize.x <= 0.0f || draw_data->DisplaySize.y <= 0.0f);
+
+    // Timers for content that changes without input
+    if (ImGui::GetIO().WantTextInput &&
+        ImGui::GetIO().ConfigInputTextCursorBlink) {
+        redraw.wakeIn(CURSOR_BLINK_NS);
+    }
+    if (show_redraw_stats) {
+        static Uint64 stats_updated = 0;
+        if (SDL_GetTicksNS() - stats_updated >= STATS_INTERVAL_NS) {
+            shown_stats = redraw.getStats();
+            stats_updated = SDL_GetTicksNS();
+        }
+        redraw.wakeIn(STATS_INTERVAL_NS);
+    }
+    // Identical to what is on screen: no command buffer, no swapchain image
+    const uint64_t frame_hash = hashDrawData(draw_data, clear_color);
+    if (is_minimized || redraw.isUnchanged(frame_hash)) {
+        return SDL_APP_CONTINUE;
+    }
+
     SDL_GPUCommandBuffer* command_buffer = SDL_AcquireGPUCommandBuffer(
         gpu_device);  // Acquire a GPU command buffer
     SDL_GPUTexture* swapchain_texture;
@@ -154,11 +237,17 @@ SDL_AppResult SDL_AppIterate(void*  /*appstate*/) {
         SDL_EndGPURenderPass(render_pass);
     }
     SDL_SubmitGPUCommandBuffer(command_buffer);
+    if (swapchain_texture != nullptr) {
+        redraw.markPresented(frame_hash);
+    } else {
+        redraw.wakeIn(RETRY_NS);  // Try again shortly
+    }
     return SDL_APP_CONTINUE;
 }
 
 SDL_AppResult SDL_AppEvent(void*  /*appstate*/, SDL_Event* event) {
     ImGui_ImplSDL3_ProcessEvent(event);
+    redraw.onEvent(*event);
     if (event->type == SDL_EVENT_QUIT) {
         return SDL_APP_SUCCESS;
     }
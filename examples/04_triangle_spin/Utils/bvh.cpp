@@ -0,0 +1,573 @@
+/*
+ * @author: Avidel
+ * @LastEditors: Avidel
+ */
+#include "bvh.hpp"
+
+#include "frustum_culling.hpp"
+
+#include <algorithm>
+#include <utility>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define BVH_SSE 1
+#include <immintrin.h>
+#endif
+
+namespace {
+constexpr uint32_t MAX_LEAF_SIZE = 4;
+constexpr int SAH_BINS = 12;
+// Relative cost of visiting a node vs testing one primitive
+constexpr float TRAVERSAL_COST = 1.0f;
+constexpr float INTERSECTION_COST = 1.0f;
+constexpr float INF = std::numeric_limits<float>::max();
+
+struct StackEntry {
+    uint32_t node;
+    uint32_t plane_mask;  // Frustum planes the subtree still straddles
+};
+
+struct RayStackEntry {
+    uint32_t node;
+    float t_near;
+};
+
+bool overlaps(const Aabb& a, const Aabb& b) {
+    return a.min.x <= b.max.x && a.max.x >= b.min.x && a.min.y <= b.max.y &&
+           a.max.y >= b.min.y && a.min.z <= b.max.z && a.max.z >= b.min.z;
+}
+
+// Slab test against one box; returns the entry distance or INF on a miss
+float intersectRayAabb(const Ray& ray, const glm::vec3& invDir,
+                       const Aabb& box) {
+    glm::vec3 t0 = (box.min - ray.origin) * invDir;
+    glm::vec3 t1 = (box.max - ray.origin) * invDir;
+    glm::vec3 t_small = glm::min(t0, t1);
+    glm::vec3 t_big = glm::max(t0, t1);
+    float t_near = std::max(std::max(t_small.x, t_small.y),
+                            std::max(t_small.z, 0.0f));
+    float t_far = std::min(std::min(t_big.x, t_big.y),
+                           std::min(t_big.z, ray.t_max));
+    return t_near <= t_far ? t_near : INF;
+}
+
+// Slab test against the four children of a node at once
+void intersectRayNode(const Bvh4::Node& node, const glm::vec3& origin,
+                      const glm::vec3& invDir, float tMax, float tNear[4]) {
+#if defined(BVH_SSE)
+    const __m128 ox = _mm_set1_ps(origin.x);
+    const __m128 oy = _mm_set1_ps(origin.y);
+    const __m128 oz = _mm_set1_ps(origin.z);
+    const __m128 ix = _mm_set1_ps(invDir.x);
+    const __m128 iy = _mm_set1_ps(invDir.y);
+    const __m128 iz = _mm_set1_ps(invDir.z);
+    __m128 tx0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.min_x), ox), ix);
+    __m128 tx1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.max_x), ox), ix);
+    __m128 ty0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.min_y), oy), iy);
+    __m128 ty1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.max_y), oy), iy);
+    __m128 tz0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.min_z), oz), iz);
+    __m128 tz1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.max_z), oz), iz);
+    __m128 t_enter = _mm_max_ps(
+        _mm_max_ps(_mm_min_ps(tx0, tx1), _mm_min_ps(ty0, ty1)),
+        _mm_max_ps(_mm_min_ps(tz0, tz1), _mm_setzero_ps()));
+    __m128 t_exit = _mm_min_ps(
+        _mm_min_ps(_mm_max_ps(tx0, tx1), _mm_max_ps(ty0, ty1)),
+        _mm_min_ps(_mm_max_ps(tz0, tz1), _mm_set1_ps(tMax)));
+    __m128 hit = _mm_cmple_ps(t_enter, t_exit);
+    _mm_storeu_ps(tNear, _mm_or_ps(_mm_and_ps(hit, t_enter),
+                                   _mm_andnot_ps(hit, _mm_set1_ps(INF))));
+#else
+    for (int c = 0; c < 4; ++c) {
+        Aabb box;
+        box.min = glm::vec3(node.min_x[c], node.min_y[c], node.min_z[c]);
+        box.max = glm::vec3(node.max_x[c], node.max_y[c], node.max_z[c]);
+        Ray ray{origin, glm::vec3(0.0f), tMax};
+        tNear[c] = intersectRayAabb(ray, invDir, box);
+    }
+#endif
+}
+}  // namespace
+
+// --- Aabb ---
+
+void Aabb::expand(const glm::vec3& point) {
+    min = glm::min(min, point);
+    max = glm::max(max, point);
+}
+
+void Aabb::expand(const Aabb& other) {
+    min = glm::min(min, other.min);
+    max = glm::max(max, other.max);
+}
+
+float Aabb::surfaceArea() const {
+    if (isEmpty()) {
+        return 0.0f;
+    }
+    glm::vec3 extent = max - min;
+    return 2.0f * (extent.x * extent.y + extent.y * extent.z +
+                   extent.z * extent.x);
+}
+
+Aabb Aabb::transformed(const glm::mat4& transform) const {
+    // Arvo: per output axis, pick the smaller/larger product per input axis
+    Aabb result;
+    result.min = result.max = glm::vec3(transform[3]);
+    for (int column = 0; column < 3; ++column) {
+        for (int row = 0; row < 3; ++row) {
+            float a = transform[column][row] * min[column];
+            float b = transform[column][row] * max[column];
+            result.min[row] += std::min(a, b);
+            result.max[row] += std::max(a, b);
+        }
+    }
+    return result;
+}
+
+// --- Build ---
+
+void Bvh4::build(std::span<const Aabb> bounds) {
+    nodes.clear();
+    primitive_indices.resize(bounds.size());
+    leaf_bounds.clear();
+    root_bounds = Aabb();
+    ++stats.builds;
+    if (bounds.empty()) {
+        stats.build_cost = stats.current_cost = 0.0f;
+        return;
+    }
+
+    std::vector<BuildPrimitive> primitives(bounds.size());
+    BuildRange root{0, static_cast<uint32_t>(bounds.size()), Aabb()};
+    for (uint32_t i = 0; i < bounds.size(); ++i) {
+        primitives[i] = {bounds[i], bounds[i].center(), i};
+        root.bounds.expand(bounds[i]);
+    }
+    root_bounds = root.bounds;
+    nodes.reserve(bounds.size() / 2 + 1);
+    buildNode(primitives, root);
+
+    // Primitive bounds in leaf order, for the per-primitive tests in leaves
+    leaf_bounds.resize(bounds.size());
+    for (size_t i = 0; i < primitives.size(); ++i) {
+        primitive_indices[i] = primitives[i].index;
+        leaf_bounds[i] = primitives[i].bounds;
+    }
+    stats.build_cost = stats.current_cost = computeCost();
+}
+
+uint32_t Bvh4::buildNode(std::vector<BuildPrimitive>& primitives,
+                         BuildRange range) {
+    uint32_t node_index = static_cast<uint32_t>(nodes.size());
+    nodes.emplace_back();
+
+    // Split the largest splittable range until there are four children
+    BuildRange ranges[4] = {range};
+    bool is_leaf[4] = {false, false, false, false};
+    int range_count = 1;
+    while (range_count < 4) {
+        int largest = -1;
+        for (int i = 0; i < range_count; ++i) {
+            uint32_t count = ranges[i].end - ranges[i].begin;
+            if (!is_leaf[i] &&
+                (largest < 0 ||
+                 count > ranges[largest].end - ranges[largest].begin)) {
+                largest = i;
+            }
+        }
+        if (largest < 0) {
+            break;
+        }
+        BuildRange left, right;
+        if (!splitRange(primitives, ranges[largest], left, right)) {
+            is_leaf[largest] = true;
+            continue;
+        }
+        ranges[largest] = left;
+        ranges[range_count++] = right;
+    }
+
+    Node node{};
+    for (int c = 0; c < 4; ++c) {
+        setChildBounds(node, c, Aabb());
+    }
+    node.child_count = static_cast<uint8_t>(range_count);
+    for (int c = 0; c < range_count; ++c) {
+        const BuildRange& child = ranges[c];
+        setChildBounds(node, c, child.bounds);
+        if (child.end - child.begin <= MAX_LEAF_SIZE) {
+            node.child[c] = child.begin;
+            node.count[c] = static_cast<uint8_t>(child.end - child.begin);
+        } else {
+            node.child[c] = buildNode(primitives, child);
+            node.count[c] = 0;
+        }
+    }
+    nodes[node_index] = node;  // Recursion may have reallocated nodes
+    return node_index;
+}
+
+bool Bvh4::splitRange(std::vector<BuildPrimitive>& primitives,
+                      const BuildRange& range, BuildRange& left,
+                      BuildRange& right) {
+    uint32_t count = range.end - range.begin;
+    if (count <= 1) {
+        return false;
+    }
+    Aabb center_bounds;
+    for (uint32_t i = range.begin; i < range.end; ++i) {
+        center_bounds.expand(primitives[i].center);
+    }
+
+    // Binned SAH over all three axes
+    float best_cost = INF;
+    int best_axis = -1;
+    int best_split = 0;
+    for (int axis = 0; axis < 3; ++axis) {
+        float axis_min = center_bounds.min[axis];
+        float extent = center_bounds.max[axis] - axis_min;
+        if (extent <= 0.0f) {
+            continue;
+        }
+        float scale = SAH_BINS / extent;
+        Aabb bin_bounds[SAH_BINS];
+        uint32_t bin_counts[SAH_BINS] = {};
+        for (uint32_t i = range.begin; i < range.end; ++i) {
+            float offset = primitives[i].center[axis] - axis_min;
+            int bin =
+                std::min(SAH_BINS - 1, static_cast<int>(offset * scale));
+            bin_bounds[bin].expand(primitives[i].bounds);
+            ++bin_counts[bin];
+        }
+        // Sweep from the right, then from the left; split after bin s
+        float right_area[SAH_BINS];
+        uint32_t right_count[SAH_BINS];
+        Aabb accumulated;
+        uint32_t accumulated_count = 0;
+        for (int s = SAH_BINS - 1; s > 0; --s) {
+            accumulated.expand(bin_bounds[s]);
+            accumulated_count += bin_counts[s];
+            right_area[s] = accumulated.surfaceArea();
+            right_count[s] = accumulated_count;
+        }
+        accumulated = Aabb();
+        accumulated_count = 0;
+        for (int s = 0; s < SAH_BINS - 1; ++s) {
+            accumulated.expand(bin_bounds[s]);
+            accumulated_count += bin_counts[s];
+            if (accumulated_count == 0 || right_count[s + 1] == 0) {
+                continue;
+            }
+            float cost = accumulated.surfaceArea() * accumulated_count +
+                         right_area[s + 1] * right_count[s + 1];
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_axis = axis;
+                best_split = s;
+            }
+        }
+    }
+
+    float leaf_cost = range.bounds.surfaceArea() * count * INTERSECTION_COST;
+    float split_cost = TRAVERSAL_COST * range.bounds.surfaceArea() +
+                       INTERSECTION_COST * best_cost;
+    if (count <= MAX_LEAF_SIZE && (best_axis < 0 || split_cost >= leaf_cost)) {
+        return false;
+    }
+
+    BuildPrimitive* first = primitives.data() + range.begin;
+    BuildPrimitive* last = primitives.data() + range.end;
+    BuildPrimitive* middle;
+    if (best_axis >= 0) {
+        float axis_min = center_bounds.min[best_axis];
+        float scale = SAH_BINS / (center_bounds.max[best_axis] - axis_min);
+        middle = std::partition(
+            first, last, [&](const BuildPrimitive& primitive) {
+                float offset = primitive.center[best_axis] - axis_min;
+                int bin =
+                    std::min(SAH_BINS - 1, static_cast<int>(offset * scale));
+                return bin <= best_split;
+            });
+    } else {
+        // All centers coincide: halve by index so leaves stay small
+        middle = first + count / 2;
+    }
+
+    uint32_t mid = range.begin + static_cast<uint32_t>(middle - first);
+    left = {range.begin, mid, Aabb()};
+    right = {mid, range.end, Aabb()};
+    for (uint32_t i = left.begin; i < left.end; ++i) {
+        left.bounds.expand(primitives[i].bounds);
+    }
+    for (uint32_t i = right.begin; i < right.end; ++i) {
+        right.bounds.expand(primitives[i].bounds);
+    }
+    return true;
+}
+
+void Bvh4::setChildBounds(Node& node, int child, const Aabb& box) {
+    node.min_x[child] = box.min.x;
+    node.min_y[child] = box.min.y;
+    node.min_z[child] = box.min.z;
+    node.max_x[child] = box.max.x;
+    node.max_y[child] = box.max.y;
+    node.max_z[child] = box.max.z;
+}
+
+Aabb Bvh4::getChildBounds(const Node& node, int child) const {
+    Aabb box;
+    box.min = glm::vec3(node.min_x[child], node.min_y[child],
+                        node.min_z[child]);
+    box.max = glm::vec3(node.max_x[child], node.max_y[child],
+                        node.max_z[child]);
+    return box;
+}
+
+float Bvh4::computeCost() const {
+    float root_area = root_bounds.surfaceArea();
+    if (nodes.empty() || root_area <= 0.0f) {
+        return 0.0f;
+    }
+    float cost = TRAVERSAL_COST;  // The root is always visited
+    for (const Node& node : nodes) {
+        for (int c = 0; c < node.child_count; ++c) {
+            float area = getChildBounds(node, c).surfaceArea() / root_area;
+            cost += area * (node.count[c] > 0
+                                ? INTERSECTION_COST * node.count[c]
+                                : TRAVERSAL_COST);
+        }
+    }
+    return cost;
+}
+
+// --- Refit ---
+
+void Bvh4::refit(std::span<const Aabb> bounds) {
+    for (size_t i = 0; i < primitive_indices.size(); ++i) {
+        leaf_bounds[i] = bounds[primitive_indices[i]];
+    }
+    // Children always come after their parent, so walking backwards sees
+    // every child node before it is unioned into its parent
+    for (size_t n = nodes.size(); n-- > 0;) {
+        Node& node = nodes[n];
+        for (int c = 0; c < node.child_count; ++c) {
+            Aabb box;
+            if (node.count[c] > 0) {
+                for (uint32_t i = 0; i < node.count[c]; ++i) {
+                    box.expand(leaf_bounds[node.child[c] + i]);
+                }
+            } else {
+                const Node& child = nodes[node.child[c]];
+                for (int g = 0; g < child.child_count; ++g) {
+                    box.expand(getChildBounds(child, g));
+                }
+            }
+            setChildBounds(node, c, box);
+        }
+    }
+    root_bounds = Aabb();
+    if (!nodes.empty()) {
+        for (int c = 0; c < nodes[0].child_count; ++c) {
+            root_bounds.expand(getChildBounds(nodes[0], c));
+        }
+    }
+    ++stats.refits;
+    stats.current_cost = computeCost();
+}
+
+bool Bvh4::update(std::span<const Aabb> bounds) {
+    if (nodes.empty() || bounds.size() != primitive_indices.size()) {
+        build(bounds);
+        return true;
+    }
+    refit(bounds);
+    if (stats.current_cost > stats.build_cost * REBUILD_COST_RATIO) {
+        build(bounds);
+        return true;
+    }
+    return false;
+}
+
+// --- Queries ---
+
+void Bvh4::appendLeaf(const Node& node, int child,
+                      std::vector<uint32_t>& out) const {
+    for (uint32_t i = 0; i < node.count[child]; ++i) {
+        out.push_back(primitive_indices[node.child[child] + i]);
+    }
+}
+
+void Bvh4::appendSubtree(uint32_t nodeIndex,
+                         std::vector<uint32_t>& out) const {
+    const Node& node = nodes[nodeIndex];
+    for (int c = 0; c < node.child_count; ++c) {
+        if (node.count[c] > 0) {
+            appendLeaf(node, c, out);
+        } else {
+            appendSubtree(node.child[c], out);
+        }
+    }
+}
+
+void Bvh4::queryFrustum(const Frustum& frustum,
+                        std::vector<uint32_t>& out) const {
+    if (nodes.empty()) {
+        return;
+    }
+    constexpr uint32_t ALL_PLANES = 0x3F;
+    std::vector<StackEntry> stack;
+    stack.push_back({0, ALL_PLANES});
+    while (!stack.empty()) {
+        StackEntry entry = stack.back();
+        stack.pop_back();
+        const Node& node = nodes[entry.node];
+
+        // Per plane, all four children at once: the corner furthest along
+        // the normal decides "outside", the nearest one "inside"
+        bool outside[4] = {false, false, false, false};
+        uint32_t child_masks[4] = {entry.plane_mask, entry.plane_mask,
+                                   entry.plane_mask, entry.plane_mask};
+        for (int p = 0; p < 6; ++p) {
+            if (!(entry.plane_mask & (1u << p))) {
+                continue;
+            }
+            const glm::vec4& plane = frustum.planes[p];
+            const float* far_x = plane.x >= 0.0f ? node.max_x : node.min_x;
+            const float* far_y = plane.y >= 0.0f ? node.max_y : node.min_y;
+            const float* far_z = plane.z >= 0.0f ? node.max_z : node.min_z;
+            const float* near_x = plane.x >= 0.0f ? node.min_x : node.max_x;
+            const float* near_y = plane.y >= 0.0f ? node.min_y : node.max_y;
+            const float* near_z = plane.z >= 0.0f ? node.min_z : node.max_z;
+            for (int c = 0; c < 4; ++c) {
+                float far_distance = plane.x * far_x[c] + plane.y * far_y[c] +
+                                     plane.z * far_z[c] + plane.w;
+                float near_distance = plane.x * near_x[c] +
+                                      plane.y * near_y[c] +
+                                      plane.z * near_z[c] + plane.w;
+                outside[c] = outside[c] || far_distance < 0.0f;
+                if (near_distance >= 0.0f) {
+                    child_masks[c] &= ~(1u << p);
+                }
+            }
+        }
+
+        for (int c = 0; c < node.child_count; ++c) {
+            if (outside[c]) {
+                continue;
+            }
+            if (child_masks[c] == 0) {
+                // Fully inside: no more plane tests below here
+                if (node.count[c] > 0) {
+                    appendLeaf(node, c, out);
+                } else {
+                    appendSubtree(node.child[c], out);
+                }
+            } else if (node.count[c] > 0) {
+                for (uint32_t i = 0; i < node.count[c]; ++i) {
+                    uint32_t slot = node.child[c] + i;
+                    const Aabb& box = leaf_bounds[slot];
+                    bool visible = true;
+                    for (int p = 0; p < 6 && visible; ++p) {
+                        const glm::vec4& plane = frustum.planes[p];
+                        glm::vec3 corner(
+                            plane.x >= 0.0f ? box.max.x : box.min.x,
+                            plane.y >= 0.0f ? box.max.y : box.min.y,
+                            plane.z >= 0.0f ? box.max.z : box.min.z);
+                        visible = glm::dot(glm::vec3(plane), corner) +
+                                      plane.w >=
+                                  0.0f;
+                    }
+                    if (visible) {
+                        out.push_back(primitive_indices[slot]);
+                    }
+                }
+            } else {
+                stack.push_back({node.child[c], child_masks[c]});
+            }
+        }
+    }
+}
+
+void Bvh4::queryAabb(const Aabb& box, std::vector<uint32_t>& out) const {
+    if (nodes.empty()) {
+        return;
+    }
+    std::vector<uint32_t> stack = {0};
+    while (!stack.empty()) {
+        const Node& node = nodes[stack.back()];
+        stack.pop_back();
+        for (int c = 0; c < node.child_count; ++c) {
+            if (!overlaps(getChildBounds(node, c), box)) {
+                continue;
+            }
+            if (node.count[c] == 0) {
+                stack.push_back(node.child[c]);
+                continue;
+            }
+            for (uint32_t i = 0; i < node.count[c]; ++i) {
+                uint32_t slot = node.child[c] + i;
+                if (overlaps(leaf_bounds[slot], box)) {
+                    out.push_back(primitive_indices[slot]);
+                }
+            }
+        }
+    }
+}
+
+RayHit Bvh4::raycast(const Ray& ray, const PrimitiveRayTest& test) const {
+    RayHit hit;
+    if (nodes.empty()) {
+        return hit;
+    }
+    // Division by a zero component gives +-inf, which the slab test handles
+    glm::vec3 inv_dir(1.0f / ray.direction.x, 1.0f / ray.direction.y,
+                      1.0f / ray.direction.z);
+    Ray clipped = ray;
+    hit.t = ray.t_max;
+
+    std::vector<RayStackEntry> stack;
+    stack.push_back({0, 0.0f});
+    while (!stack.empty()) {
+        RayStackEntry entry = stack.back();
+        stack.pop_back();
+        if (entry.t_near > hit.t) {
+            continue;  // A closer hit was found since this was pushed
+        }
+        const Node& node = nodes[entry.node];
+        float t_near[4];
+        intersectRayNode(node, ray.origin, inv_dir, hit.t, t_near);
+
+        // Visit near children first: push them last
+        int order[4] = {0, 1, 2, 3};
+        std::sort(order, order + node.child_count,
+                  [&t_near](int a, int b) { return t_near[a] > t_near[b]; });
+        for (int k = 0; k < node.child_count; ++k) {
+            int c = order[k];
+            if (t_near[c] == INF) {
+                continue;
+            }
+            if (node.count[c] == 0) {
+                stack.push_back({node.child[c], t_near[c]});
+                continue;
+            }
+            for (uint32_t i = 0; i < node.count[c]; ++i) {
+                uint32_t slot = node.child[c] + i;
+                uint32_t primitive = primitive_indices[slot];
+                clipped.t_max = hit.t;
+                float t = INF;
+                if (test) {
+                    if (!test(primitive, clipped, t)) {
+                        continue;
+                    }
+                } else {
+                    t = intersectRayAabb(clipped, inv_dir, leaf_bounds[slot]);
+                }
+                if (t < hit.t) {
+                    hit.t = t;
+                    hit.primitive = primitive;
+                }
+            }
+        }
+    }
+    return hit;
+}
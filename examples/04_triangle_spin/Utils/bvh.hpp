@@ -0,0 +1,137 @@
+/*
+ * @author: Avidel
+ * @LastEditors: Avidel
+ */
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <span>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+struct Frustum;
+
+struct Aabb {
+    glm::vec3 min{std::numeric_limits<float>::max()};
+    glm::vec3 max{-std::numeric_limits<float>::max()};
+
+    void expand(const glm::vec3& point);
+    void expand(const Aabb& other);
+    bool isEmpty() const { return min.x > max.x; }
+    glm::vec3 center() const { return (min + max) * 0.5f; }
+    float surfaceArea() const;
+
+    // Bounds of this box after an affine transform
+    Aabb transformed(const glm::mat4& transform) const;
+};
+
+struct Ray {
+    glm::vec3 origin{0.0f};
+    glm::vec3 direction{0.0f, 0.0f, -1.0f};  // Need not be normalized
+    float t_max = std::numeric_limits<float>::max();
+};
+
+struct RayHit {
+    uint32_t primitive = UINT32_MAX;  // UINT32_MAX: nothing hit
+    float t = std::numeric_limits<float>::max();  // origin + t * direction
+
+    bool isHit() const { return primitive != UINT32_MAX; }
+};
+
+// --- Dynamic BVH4 ---
+// Bounding volume hierarchy over primitive AABBs (scene nodes, triangles...)
+// with four children per node. Child bounds are stored as SoA inside each
+// node, so one node visit tests all four children with 4-wide SIMD.
+//
+// build() is a binned SAH build. For moving primitives, update() refits the
+// existing tree bottom-up and only rebuilds once refitting has degraded the
+// SAH cost too far or the primitive count changed.
+class Bvh4 {
+public:
+    // Exact test of one primitive; return true and set t on a hit closer
+    // than ray.t_max. Without it, raycast() hits the primitive AABBs.
+    using PrimitiveRayTest =
+        std::function<bool(uint32_t primitive, const Ray& ray, float& t)>;
+
+    struct alignas(16) Node {
+        float min_x[4], min_y[4], min_z[4];
+        float max_x[4], max_y[4], max_z[4];
+        // Internal child: node index. Leaf child: first entry in the
+        // primitive index array, with count > 0.
+        uint32_t child[4];
+        uint8_t count[4];  // Primitives in a leaf child, 0 for internal
+        uint8_t child_count = 0;
+    };
+
+    struct Stats {
+        uint64_t builds = 0;
+        uint64_t refits = 0;
+        float build_cost = 0.0f;    // SAH cost right after the last build
+        float current_cost = 0.0f;  // After the last refit
+    };
+
+    // Rebuild when refitting made the tree this much more expensive
+    static constexpr float REBUILD_COST_RATIO = 1.5f;
+
+    void build(std::span<const Aabb> bounds);
+    // Same primitive count, new bounds; keeps the topology
+    void refit(std::span<const Aabb> bounds);
+    // Refit, or rebuild if needed; returns true if it rebuilt
+    bool update(std::span<const Aabb> bounds);
+
+    // Primitives whose AABB is not fully outside the frustum. Subtrees fully
+    // inside are appended without further plane tests.
+    void queryFrustum(const Frustum& frustum, std::vector<uint32_t>& out) const;
+    // Primitives whose AABB overlaps box
+    void queryAabb(const Aabb& box, std::vector<uint32_t>& out) const;
+    // Closest hit along the ray
+    RayHit raycast(const Ray& ray,
+                   const PrimitiveRayTest& test = PrimitiveRayTest()) const;
+
+    bool isEmpty() const { return nodes.empty(); }
+    // Read-only tree, for traversals specialized outside this class (e.g.
+    // ray packets). Leaf ranges index getPrimitiveIndices().
+    std::span<const Node> getNodes() const { return nodes; }
+    std::span<const uint32_t> getPrimitiveIndices() const {
+        return primitive_indices;
+    }
+    size_t getNodeCount() const { return nodes.size(); }
+    size_t getPrimitiveCount() const { return primitive_indices.size(); }
+    const Stats& getStats() const { return stats; }
+
+private:
+    // Partitioned in place while building, so every pass over a range reads
+    // contiguous memory instead of chasing primitive indices
+    struct BuildPrimitive {
+        Aabb bounds;
+        glm::vec3 center;
+        uint32_t index;
+    };
+    struct BuildRange {
+        uint32_t begin;
+        uint32_t end;
+        Aabb bounds;
+    };
+
+    uint32_t buildNode(std::vector<BuildPrimitive>& primitives,
+                       BuildRange range);
+    // SAH split of range into two; returns false if it should stay a leaf
+    bool splitRange(std::vector<BuildPrimitive>& primitives,
+                    const BuildRange& range, BuildRange& left,
+                    BuildRange& right);
+    void setChildBounds(Node& node, int child, const Aabb& box);
+    Aabb getChildBounds(const Node& node, int child) const;
+    float computeCost() const;
+    void appendSubtree(uint32_t nodeIndex, std::vector<uint32_t>& out) const;
+    void appendLeaf(const Node& node, int child,
+                    std::vector<uint32_t>& out) const;
+
+    std::vector<Node> nodes;  // nodes[0] is the root; children after parents
+    std::vector<uint32_t> primitive_indices;  // Leaf ranges point in here
+    std::vector<Aabb> leaf_bounds;  // Primitive bounds, same order as above
+    Aabb root_bounds;
+    Stats stats;
+};
@@ -0,0 +1,181 @@
+/*
+ * @author: Avidel
+ * @LastEditors: Avidel
+ */
+#include "descriptor_buffer.hpp"
+
+#include "vulkan_util.hpp"
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace {
+constexpr VkDeviceSize UNQUERIED_OFFSET = ~VkDeviceSize(0);
+
+template <typename T>
+T loadDeviceFunction(VkDevice device, const char* name) {
+    auto function = reinterpret_cast<T>(vkGetDeviceProcAddr(device, name));
+    if (!function) {
+        throw std::runtime_error(std::string("Failed to get function pointer "
+                                             "for ") +
+                                 name + "!");
+    }
+    return function;
+}
+
+VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+}  // namespace
+
+DescriptorBufferRing::DescriptorBufferRing(VulkanContextManager* context,
+                                           VkDescriptorSetLayout setLayout,
+                                           uint32_t framesInFlight,
+                                           uint32_t setsPerFrame)
+    : context(context),
+      device(context->getDevice()),
+      set_layout(setLayout),
+      sets_per_frame(setsPerFrame) {
+    get_layout_size = loadDeviceFunction<PFN_vkGetDescriptorSetLayoutSizeEXT>(
+        device, "vkGetDescriptorSetLayoutSizeEXT");
+    get_binding_offset =
+        loadDeviceFunction<PFN_vkGetDescriptorSetLayoutBindingOffsetEXT>(
+            device, "vkGetDescriptorSetLayoutBindingOffsetEXT");
+    get_descriptor = loadDeviceFunction<PFN_vkGetDescriptorEXT>(
+        device, "vkGetDescriptorEXT");
+    cmd_bind_descriptor_buffers =
+        loadDeviceFunction<PFN_vkCmdBindDescriptorBuffersEXT>(
+            device, "vkCmdBindDescriptorBuffersEXT");
+    cmd_set_buffer_offsets =
+        loadDeviceFunction<PFN_vkCmdSetDescriptorBufferOffsetsEXT>(
+            device, "vkCmdSetDescriptorBufferOffsetsEXT");
+
+    VkPhysicalDeviceDescriptorBufferPropertiesEXT descriptor_properties{};
+    descriptor_properties.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_BUFFER_PROPERTIES_EXT;
+    VkPhysicalDeviceProperties2 properties2{};
+    properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    properties2.pNext = &descriptor_properties;
+    vkGetPhysicalDeviceProperties2(context->getPhysicalDevice(), &properties2);
+    uniform_buffer_descriptor_size =
+        descriptor_properties.uniformBufferDescriptorSize;
+    storage_buffer_descriptor_size =
+        descriptor_properties.storageBufferDescriptorSize;
+
+    // Set offsets passed to vkCmdSetDescriptorBufferOffsetsEXT must be aligned
+    get_layout_size(device, set_layout, &set_size);
+    set_size = alignUp(set_size,
+                       descriptor_properties.descriptorBufferOffsetAlignment);
+
+    VkDeviceSize buffer_size =
+        set_size * static_cast<VkDeviceSize>(framesInFlight) * setsPerFrame;
+    context->createBuffer(buffer_size,
+                          VK_BUFFER_USAGE_RESOURCE_DESCRIPTOR_BUFFER_BIT_EXT |
+                              VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                              VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                          buffer, buffer_memory);
+
+    // Mapped for the lifetime of the ring: updates are plain memcpys
+    void* data;
+    if (vkMapMemory(device, buffer_memory, 0, buffer_size, 0, &data) !=
+        VK_SUCCESS) {
+        throw std::runtime_error("failed to map descriptor buffer!");
+    }
+    mapped = static_cast<uint8_t*>(data);
+
+    VkBufferDeviceAddressInfo address_info{};
+    address_info.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO;
+    address_info.buffer = buffer;
+    buffer_address = vkGetBufferDeviceAddress(device, &address_info);
+}
+
+DescriptorBufferRing::~DescriptorBufferRing() {
+    if (mapped) {
+        vkUnmapMemory(device, buffer_memory);
+    }
+    vkDestroyBuffer(device, buffer, nullptr);
+    vkFreeMemory(device, buffer_memory, nullptr);
+}
+
+std::vector<uint8_t> DescriptorBufferRing::getUniformBufferDescriptor(
+    VkBuffer uniformBuffer, VkDeviceSize range) const {
+    return getBufferDescriptor(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+                               uniformBuffer, range);
+}
+
+std::vector<uint8_t> DescriptorBufferRing::getStorageBufferDescriptor(
+    VkBuffer storageBuffer, VkDeviceSize range) const {
+    return getBufferDescriptor(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                               storageBuffer, range);
+}
+
+std::vector<uint8_t> DescriptorBufferRing::getBufferDescriptor(
+    VkDescriptorType type, VkBuffer buffer, VkDeviceSize range) const {
+    VkBufferDeviceAddressInfo address_info{};
+    address_info.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO;
+    address_info.buffer = buffer;
+
+    VkDescriptorAddressInfoEXT descriptor_address{};
+    descriptor_address.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_ADDRESS_INFO_EXT;
+    descriptor_address.address =
+        vkGetBufferDeviceAddress(device, &address_info);
+    descriptor_address.range = range;
+    descriptor_address.format = VK_FORMAT_UNDEFINED;
+
+    VkDescriptorGetInfoEXT get_info{};
+    get_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_GET_INFO_EXT;
+    get_info.type = type;
+    size_t descriptor_size;
+    if (type == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER) {
+        get_info.data.pStorageBuffer = &descriptor_address;
+        descriptor_size = storage_buffer_descriptor_size;
+    } else {
+        get_info.data.pUniformBuffer = &descriptor_address;
+        descriptor_size = uniform_buffer_descriptor_size;
+    }
+
+    std::vector<uint8_t> descriptor(descriptor_size);
+    get_descriptor(device, &get_info, descriptor.size(), descriptor.data());
+    return descriptor;
+}
+
+void DescriptorBufferRing::beginFrame(uint32_t frameIndex) {
+    region_begin = set_size * sets_per_frame * frameIndex;
+    region_used = 0;
+}
+
+VkDeviceSize DescriptorBufferRing::allocateSet() {
+    if (region_used == sets_per_frame) {
+        throw std::runtime_error("descriptor buffer frame region exhausted!");
+    }
+    return region_begin + set_size * region_used++;
+}
+
+void DescriptorBufferRing::write(VkDeviceSize setOffset, uint32_t binding,
+                                 const std::vector<uint8_t>& descriptor) {
+    if (binding >= binding_offsets.size()) {
+        binding_offsets.resize(binding + 1, UNQUERIED_OFFSET);
+    }
+    if (binding_offsets[binding] == UNQUERIED_OFFSET) {
+        get_binding_offset(device, set_layout, binding,
+                           &binding_offsets[binding]);
+    }
+    std::memcpy(mapped + setOffset + binding_offsets[binding],
+                descriptor.data(), descriptor.size());
+}
+
+void DescriptorBufferRing::bind(VkCommandBuffer commandBuffer,
+                                VkPipelineLayout layout, uint32_t firstSet,
+                                VkDeviceSize setOffset) const {
+    VkDescriptorBufferBindingInfoEXT binding_info{};
+    binding_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_BUFFER_BINDING_INFO_EXT;
+    binding_info.address = buffer_address;
+    binding_info.usage = VK_BUFFER_USAGE_RESOURCE_DESCRIPTOR_BUFFER_BIT_EXT;
+    cmd_bind_descriptor_buffers(commandBuffer, 1, &binding_info);
+
+    uint32_t buffer_index = 0;
+    cmd_set_buffer_offsets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                           layout, firstSet, 1, &buffer_index, &setOffset);
+}
@@ -0,0 +1,81 @@
+/*
+ * @author: Avidel
+ * @LastEditors: Avidel
+ */
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+class VulkanContextManager;
+
+// --- Descriptor Buffer Ring (VK_EXT_descriptor_buffer) ---
+// Descriptors live in a persistently mapped, host-visible buffer instead of a
+// descriptor pool. The buffer is split into one region per frame in flight;
+// each region holds setsPerFrame copies of one set layout. Updating a set is a
+// memcpy of descriptor bytes fetched once with vkGetDescriptorEXT.
+class DescriptorBufferRing {
+public:
+    // setLayout must be created with
+    // VK_DESCRIPTOR_SET_LAYOUT_CREATE_DESCRIPTOR_BUFFER_BIT_EXT
+    DescriptorBufferRing(VulkanContextManager* context,
+                         VkDescriptorSetLayout setLayout,
+                         uint32_t framesInFlight, uint32_t setsPerFrame);
+    ~DescriptorBufferRing();
+
+    DescriptorBufferRing(const DescriptorBufferRing&) = delete;
+    DescriptorBufferRing& operator=(const DescriptorBufferRing&) = delete;
+
+    // Descriptor bytes for a uniform buffer; cache them, they stay valid for
+    // the lifetime of the buffer
+    std::vector<uint8_t> getUniformBufferDescriptor(VkBuffer buffer,
+                                                    VkDeviceSize range) const;
+    std::vector<uint8_t> getStorageBufferDescriptor(VkBuffer buffer,
+                                                    VkDeviceSize range) const;
+
+    // Start writing into the region of this frame. Its fence must have been
+    // waited on, the GPU may still read the other regions.
+    void beginFrame(uint32_t frameIndex);
+
+    // Reserve one set in the current frame region; returns its buffer offset
+    VkDeviceSize allocateSet();
+
+    // Copy descriptor bytes into binding of the set at setOffset
+    void write(VkDeviceSize setOffset, uint32_t binding,
+               const std::vector<uint8_t>& descriptor);
+
+    // Bind the ring buffer and point set firstSet of layout at setOffset
+    void bind(VkCommandBuffer commandBuffer, VkPipelineLayout layout,
+              uint32_t firstSet, VkDeviceSize setOffset) const;
+
+    VkDeviceSize getSetSize() const { return set_size; }
+
+private:
+    std::vector<uint8_t> getBufferDescriptor(VkDescriptorType type,
+                                             VkBuffer buffer,
+                                             VkDeviceSize range) const;
+
+    VulkanContextManager* context;
+    VkDevice device;
+    VkDescriptorSetLayout set_layout;
+    uint32_t sets_per_frame;
+
+    VkBuffer buffer{VK_NULL_HANDLE};
+    VkDeviceMemory buffer_memory{VK_NULL_HANDLE};
+    VkDeviceAddress buffer_address = 0;
+    uint8_t* mapped = nullptr;
+
+    VkDeviceSize set_size = 0;  // Layout size, aligned for binding offsets
+    std::vector<VkDeviceSize> binding_offsets;  // Queried on first write
+    size_t uniform_buffer_descriptor_size = 0;
+    size_t storage_buffer_descriptor_size = 0;
+
+    VkDeviceSize region_begin = 0;  // Current frame region
+    uint32_t region_used = 0;       // Sets allocated in it
+
+    PFN_vkGetDescriptorSetLayoutSizeEXT get_layout_size = nullptr;
+    PFN_vkGetDescriptorSetLayoutBindingOffsetEXT get_binding_offset = nullptr;
+    PFN_vkGetDescriptorEXT get_descriptor = nullptr;
+    PFN_vkCmdBindDescriptorBuffersEXT cmd_bind_descriptor_buffers = nullptr;
+    PFN_vkCmdSetDescriptorBufferOffsetsEXT cmd_set_buffer_offsets = nullptr;
+};
@@ -0,0 +1,144 @@
+/*
+ * @author: Avidel
+ * @LastEditors: Avidel
+ */
+#include "dynamic_state.hpp"
+
+#include <stdexcept>
+#include <string>
+
+namespace {
+template <typename T>
+T loadDeviceFunction(VkDevice device, const char* name) {
+    auto function = reinterpret_cast<T>(vkGetDeviceProcAddr(device, name));
+    if (!function) {
+        throw std::runtime_error(std::string("Failed to get function pointer "
+                                             "for ") +
+                                 name + "!");
+    }
+    return function;
+}
+}  // namespace
+
+DynamicStateTracker::DynamicStateTracker(VkDevice device, Support support)
+    : support(support) {
+    cmd_set_primitive_topology = loadDeviceFunction<
+        PFN_vkCmdSetPrimitiveTopologyEXT>(device,
+                                          "vkCmdSetPrimitiveTopologyEXT");
+    cmd_set_cull_mode =
+        loadDeviceFunction<PFN_vkCmdSetCullModeEXT>(device,
+                                                    "vkCmdSetCullModeEXT");
+    cmd_set_front_face =
+        loadDeviceFunction<PFN_vkCmdSetFrontFaceEXT>(device,
+                                                     "vkCmdSetFrontFaceEXT");
+    cmd_set_depth_test_enable = loadDeviceFunction<
+        PFN_vkCmdSetDepthTestEnableEXT>(device, "vkCmdSetDepthTestEnableEXT");
+    cmd_set_depth_write_enable = loadDeviceFunction<
+        PFN_vkCmdSetDepthWriteEnableEXT>(device, "vkCmdSetDepthWriteEnableEXT");
+    cmd_set_depth_compare_op = loadDeviceFunction<
+        PFN_vkCmdSetDepthCompareOpEXT>(device, "vkCmdSetDepthCompareOpEXT");
+    if (support.extended_dynamic_state2) {
+        cmd_set_primitive_restart =
+            loadDeviceFunction<PFN_vkCmdSetPrimitiveRestartEnableEXT>(
+                device, "vkCmdSetPrimitiveRestartEnableEXT");
+    }
+    if (support.eds3_polygon_mode) {
+        cmd_set_polygon_mode = loadDeviceFunction<PFN_vkCmdSetPolygonModeEXT>(
+            device, "vkCmdSetPolygonModeEXT");
+    }
+    if (support.eds3_color_blend_enable) {
+        cmd_set_color_blend_enable =
+            loadDeviceFunction<PFN_vkCmdSetColorBlendEnableEXT>(
+                device, "vkCmdSetColorBlendEnableEXT");
+    }
+}
+
+std::vector<VkDynamicState> DynamicStateTracker::dynamicStates() const {
+    std::vector<VkDynamicState> states = {
+        VK_DYNAMIC_STATE_VIEWPORT,
+        VK_DYNAMIC_STATE_SCISSOR,
+        VK_DYNAMIC_STATE_PRIMITIVE_TOPOLOGY_EXT,
+        VK_DYNAMIC_STATE_CULL_MODE_EXT,
+        VK_DYNAMIC_STATE_FRONT_FACE_EXT,
+        VK_DYNAMIC_STATE_DEPTH_TEST_ENABLE_EXT,
+        VK_DYNAMIC_STATE_DEPTH_WRITE_ENABLE_EXT,
+        VK_DYNAMIC_STATE_DEPTH_COMPARE_OP_EXT,
+    };
+    if (support.extended_dynamic_state2) {
+        states.push_back(VK_DYNAMIC_STATE_PRIMITIVE_RESTART_ENABLE_EXT);
+    }
+    if (support.eds3_polygon_mode) {
+        states.push_back(VK_DYNAMIC_STATE_POLYGON_MODE_EXT);
+    }
+    if (support.eds3_color_blend_enable) {
+        states.push_back(VK_DYNAMIC_STATE_COLOR_BLEND_ENABLE_EXT);
+    }
+    return states;
+}
+
+void DynamicStateTracker::normalize(PipelineDesc& desc) const {
+    desc.dynamic_states = dynamicStates();
+    // Topology stays: it still selects the topology class
+    desc.cull_mode = VK_CULL_MODE_NONE;
+    desc.front_face = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+    desc.depth_test = false;
+    desc.depth_write = false;
+    if (support.eds3_polygon_mode) {
+        desc.polygon_mode = VK_POLYGON_MODE_FILL;
+    }
+    if (support.eds3_color_blend_enable) {
+        desc.blend_enable = false;
+    }
+}
+
+void DynamicStateTracker::reset() { valid = false; }
+
+template <typename T>
+bool DynamicStateTracker::changed(T& cached, const T& value) {
+    if (valid && cached == value) {
+        ++stats.skipped;
+        return false;
+    }
+    cached = value;
+    ++stats.set_calls;
+    return true;
+}
+
+void DynamicStateTracker::apply(VkCommandBuffer commandBuffer,
+                                const DynamicDrawState& state) {
+    if (changed(current.topology, state.topology)) {
+        cmd_set_primitive_topology(commandBuffer, state.topology);
+    }
+    if (changed(current.cull_mode, state.cull_mode)) {
+        cmd_set_cull_mode(commandBuffer, state.cull_mode);
+    }
+    if (changed(current.front_face, state.front_face)) {
+        cmd_set_front_face(commandBuffer, state.front_face);
+    }
+    if (changed(current.depth_test, state.depth_test)) {
+        cmd_set_depth_test_enable(commandBuffer,
+                                  state.depth_test ? VK_TRUE : VK_FALSE);
+    }
+    if (changed(current.depth_write, state.depth_write)) {
+        cmd_set_depth_write_enable(commandBuffer,
+                                   state.depth_write ? VK_TRUE : VK_FALSE);
+    }
+    if (changed(current.depth_compare_op, state.depth_compare_op)) {
+        cmd_set_depth_compare_op(commandBuffer, state.depth_compare_op);
+    }
+    if (support.extended_dynamic_state2 &&
+        changed(current.primitive_restart, state.primitive_restart)) {
+        cmd_set_primitive_restart(commandBuffer,
+                                  state.primitive_restart ? VK_TRUE : VK_FALSE);
+    }
+    if (support.eds3_polygon_mode &&
+        changed(current.polygon_mode, state.polygon_mode)) {
+        cmd_set_polygon_mode(commandBuffer, state.polygon_mode);
+    }
+    if (support.eds3_color_blend_enable &&
+        changed(current.blend_enable, state.blend_enable)) {
+        VkBool32 enable = state.blend_enable ? VK_TRUE : VK_FALSE;
+        cmd_set_color_blend_enable(commandBuffer, 0, 1, &enable);
+    }
+    valid = true;
+}
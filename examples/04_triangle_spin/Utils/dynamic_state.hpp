@@ -0,0 +1,81 @@
+/*
+ * @author: Avidel
+ * @LastEditors: Avidel
+ */
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+#include "pipeline_manager.hpp"
+
+// --- Per-Draw Dynamic State ---
+// The states that VK_EXT_extended_dynamic_state/2/3 let us set while recording
+// instead of baking them into the pipeline.
+struct DynamicDrawState {
+    VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+    VkCullModeFlags cull_mode = VK_CULL_MODE_NONE;
+    VkFrontFace front_face = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+    bool depth_test = false;
+    bool depth_write = false;
+    VkCompareOp depth_compare_op = VK_COMPARE_OP_LESS_OR_EQUAL;
+    bool primitive_restart = false;  // extended_dynamic_state2
+    VkPolygonMode polygon_mode = VK_POLYGON_MODE_FILL;  // eds3
+    bool blend_enable = false;                          // eds3
+};
+
+// --- Dynamic State Tracker ---
+// Remembers what was last set on the command buffer and skips vkCmdSet* calls
+// that would not change anything. States the device cannot set dynamically
+// stay in the PipelineDesc and are ignored by apply().
+class DynamicStateTracker {
+public:
+    struct Support {
+        bool extended_dynamic_state2 = false;  // Primitive restart
+        bool eds3_polygon_mode = false;
+        bool eds3_color_blend_enable = false;
+    };
+
+    struct Stats {
+        uint64_t set_calls = 0;  // vkCmdSet* calls issued
+        uint64_t skipped = 0;    // Redundant calls filtered out
+    };
+
+    // extended_dynamic_state (1) is required by the renderer and always used
+    DynamicStateTracker(VkDevice device, Support support);
+
+    // Dynamic states every pipeline must be created with
+    std::vector<VkDynamicState> dynamicStates() const;
+
+    // Reset the fields that become dynamic to fixed values, so permutations
+    // that differ only there hash to the same pipeline
+    void normalize(PipelineDesc& desc) const;
+
+    // Forget cached values. Call at vkBeginCommandBuffer: dynamic state does
+    // not carry over between command buffers.
+    void reset();
+
+    // Set every supported field that differs from the last applied state
+    void apply(VkCommandBuffer commandBuffer, const DynamicDrawState& state);
+
+    const Stats& getStats() const { return stats; }
+
+private:
+    template <typename T>
+    bool changed(T& cached, const T& value);
+
+    Support support;
+    bool valid = false;  // False until the first apply() after reset()
+    DynamicDrawState current;
+    Stats stats;
+
+    PFN_vkCmdSetPrimitiveTopologyEXT cmd_set_primitive_topology = nullptr;
+    PFN_vkCmdSetCullModeEXT cmd_set_cull_mode = nullptr;
+    PFN_vkCmdSetFrontFaceEXT cmd_set_front_face = nullptr;
+    PFN_vkCmdSetDepthTestEnableEXT cmd_set_depth_test_enable = nullptr;
+    PFN_vkCmdSetDepthWriteEnableEXT cmd_set_depth_write_enable = nullptr;
+    PFN_vkCmdSetDepthCompareOpEXT cmd_set_depth_compare_op = nullptr;
+    PFN_vkCmdSetPrimitiveRestartEnableEXT cmd_set_primitive_restart = nullptr;
+    PFN_vkCmdSetPolygonModeEXT cmd_set_polygon_mode = nullptr;
+    PFN_vkCmdSetColorBlendEnableEXT cmd_set_color_blend_enable = nullptr;
+};
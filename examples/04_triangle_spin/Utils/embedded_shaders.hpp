@@ -0,0 +1,35 @@
+/*
+ * @author: Avidel
+ * @LastEditors: Avidel
+ */
+#pragma once
+#include <cstdint>
+#include <span>
+
+// SPIR-V compiled by glslc at build time (see embed_shader() in
+// CMakeLists.txt). Storing the words as uint32_t keeps every blob 4-byte
+// aligned, which vkCreateShaderModule requires for pCode.
+namespace embedded_shaders {
+
+inline constexpr uint32_t vert_spv[] = {
+#include "vert.spv.inc"
+};
+
+inline constexpr uint32_t frag_spv[] = {
+#include "frag.spv.inc"
+};
+
+inline constexpr uint32_t hiz_reduce_spv[] = {
+#include "hiz_reduce.spv.inc"
+};
+
+inline constexpr uint32_t hiz_cull_spv[] = {
+#include "hiz_cull.spv.inc"
+};
+
+inline constexpr std::span<const uint32_t> vert{vert_spv};
+inline constexpr std::span<const uint32_t> frag{frag_spv};
+inline constexpr std::span<const uint32_t> hiz_reduce{hiz_reduce_spv};
+inline constexpr std::span<const uint32_t> hiz_cull{hiz_cull_spv};
+
+}  // namespace embedded_shaders
@@ -0,0 +1,55 @@
+/*
+ * @author: Avidel
+ * @LastEditors: Avidel
+ */
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+// --- Fixed Timestep ---
+// Decouples the simulation rate from the frame rate with an accumulator:
+//
+//   uint32_t steps = timestep.accumulate(elapsedSeconds);
+//   for (uint32_t i = 0; i < steps; i++) step(timestep.getStep());
+//   draw(interpolate(previous, latest, timestep.getAlpha()));
+//
+// Every step advances by exactly getStep() seconds however long frames take,
+// and drawing blends the last two steps so motion stays smooth between them.
+// After a long stall at most maxSteps run in one frame and the rest of the
+// time is dropped, so the simulation cannot fall further and further behind.
+class FixedTimestep {
+public:
+    explicit FixedTimestep(double stepSeconds, uint32_t maxSteps = 8)
+        : step(stepSeconds), max_steps(std::max(1u, maxSteps)) {}
+
+    // Adds real time since the last call; returns the steps now due
+    uint32_t accumulate(double elapsedSeconds) {
+        accumulator += std::max(elapsedSeconds, 0.0);
+        uint32_t steps = 0;
+        while (accumulator >= step && steps < max_steps) {
+            accumulator -= step;
+            steps++;
+        }
+        if (accumulator >= step) {  // Hit max_steps
+            double kept = std::fmod(accumulator, step);
+            dropped += accumulator - kept;
+            accumulator = kept;
+        }
+        return steps;
+    }
+
+    // How far the frame lies from the previous towards the latest step, 0..1
+    float getAlpha() const { return static_cast<float>(accumulator / step); }
+
+    double getStep() const { return step; }
+
+    // Real time skipped after stalls, in seconds
+    double getDroppedSeconds() const { return dropped; }
+
+private:
+    double step;
+    uint32_t max_steps;
+    double accumulator = 0.0;
+    double dropped = 0.0;
+};
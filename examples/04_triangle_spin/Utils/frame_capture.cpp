@@ -0,0 +1,325 @@
+/*
+ * @author: Avidel
+ * @LastEditors: Avidel
+ */
+#include "frame_capture.hpp"
+
+#include "stb_image_write.h"
+#include "vulkan_util.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <stdexcept>
+#include <system_error>
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+// 8-bit RGBA and BGRA swapchains; anything else (10-bit, HDR) is not
+// captured. sRGB images already hold the encoded bytes a PNG expects.
+bool isCapturable(VkFormat format, bool& swapRedBlue) {
+    switch (format) {
+    case VK_FORMAT_R8G8B8A8_UNORM:
+    case VK_FORMAT_R8G8B8A8_SRGB:
+        swapRedBlue = false;
+        return true;
+    case VK_FORMAT_B8G8R8A8_UNORM:
+    case VK_FORMAT_B8G8R8A8_SRGB:
+        swapRedBlue = true;
+        return true;
+    default:
+        return false;
+    }
+}
+}  // namespace
+
+FrameCapture::FrameCapture(VulkanContextManager* context,
+                           uint32_t framesInFlight, uint32_t encodeThreads)
+    : vulkan_context(context) {
+    if (!vulkan_context || vulkan_context->getDevice() == VK_NULL_HANDLE) {
+        throw std::runtime_error("Frame capture needs a Vulkan device !");
+    }
+    device = vulkan_context->getDevice();
+
+    // Every pixel is read by the CPU once: cached memory is much faster to
+    // copy out of where the device has it
+    VkPhysicalDeviceMemoryProperties memory_properties;
+    vkGetPhysicalDeviceMemoryProperties(vulkan_context->getPhysicalDevice(),
+                                        &memory_properties);
+    const VkMemoryPropertyFlags cached = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                         VK_MEMORY_PROPERTY_HOST_COHERENT_BIT |
+                                         VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+    for (uint32_t i = 0; i < memory_properties.memoryTypeCount; i++) {
+        if ((memory_properties.memoryTypes[i].propertyFlags & cached) ==
+            cached) {
+            readback_cached = true;
+        }
+    }
+
+    // Buffers are created on first use, sized for the swapchain then
+    slots.resize(framesInFlight + EXTRA_SLOTS);
+    for (uint32_t i = 0; i < slots.size(); i++) {
+        free_slots.push_back(i);
+    }
+    if (encodeThreads == 0) {
+        encodeThreads = std::max(1u, std::thread::hardware_concurrency() / 2);
+    }
+    for (uint32_t i = 0; i < encodeThreads; i++) {
+        encode_threads.emplace_back(&FrameCapture::encodeLoop, this);
+    }
+    spdlog::debug("Frame capture: {} readback slots, {} encode threads.",
+                  slots.size(), encodeThreads);
+}
+
+FrameCapture::~FrameCapture() {
+    // The device is idle: whatever was copied is complete, write it out
+    // before the threads go
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        to_encode.insert(to_encode.end(), recorded.begin(), recorded.end());
+        recorded.clear();
+        stopping = true;
+    }
+    encode_cv.notify_all();
+    for (auto& thread : encode_threads) {
+        thread.join();
+    }
+
+    for (Slot& slot : slots) {
+        if (slot.buffer != VK_NULL_HANDLE) {
+            vkDestroyBuffer(device, slot.buffer, nullptr);
+            vkUnmapMemory(device, slot.memory);
+            vkFreeMemory(device, slot.memory, nullptr);
+        }
+    }
+    if (frames_written > 0 || frames_failed > 0) {
+        spdlog::info("Frame capture: {} frames written, {} failed, {:.2f} ms "
+                     "average encode.",
+                     frames_written, frames_failed,
+                     encode_ms / double(frames_written + frames_failed));
+    }
+}
+
+bool FrameCapture::start(const std::filesystem::path& path,
+                         uint32_t frameCount) {
+    std::error_code error;
+    std::filesystem::create_directories(path, error);
+    if (error) {
+        spdlog::error("Cannot create capture directory {}: {}", path.string(),
+                      error.message());
+        return false;
+    }
+    if (active) {
+        finishSequence();
+    }
+    active = true;
+    directory = path;
+    frames_left = frameCount;
+    sequence_recorded = 0;
+    sequence_skipped = 0;
+    if (frameCount == 0) {
+        spdlog::info("Capturing frames to {} until stopped.", path.string());
+    } else {
+        spdlog::info("Capturing {} frame(s) to {}.", frameCount,
+                     path.string());
+    }
+    return true;
+}
+
+void FrameCapture::stop() {
+    if (active) {
+        finishSequence();
+    }
+}
+
+void FrameCapture::finishSequence() {
+    active = false;
+    frames_left = 0;
+    spdlog::info("Frame capture finished: {} frames copied, {} skipped "
+                 "without a free slot.",
+                 sequence_recorded, sequence_skipped);
+}
+
+bool FrameCapture::recordCopy(VkCommandBuffer commandBuffer, uint32_t frame,
+                              uint64_t frameNumber, VkImage image) {
+    if (!active) {
+        return false;
+    }
+    bool swap_red_blue = false;
+    if (!(vulkan_context->getSwapChainImageUsage() &
+          VK_IMAGE_USAGE_TRANSFER_SRC_BIT) ||
+        !isCapturable(vulkan_context->getSwapChainImageFormat(),
+                      swap_red_blue)) {
+        spdlog::warn("Frame capture: swapchain images cannot be copied out "
+                     "as 8-bit color, stopping.");
+        finishSequence();
+        return false;
+    }
+
+    uint32_t index;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (free_slots.empty()) {
+            ++sequence_skipped;  // Encoding fell behind; try the next frame
+            return false;
+        }
+        index = free_slots.back();
+        free_slots.pop_back();
+    }
+    Slot& slot = slots[index];
+    VkExtent2D extent = vulkan_context->getSwapChainExtent();
+    ensureBuffer(slot, VkDeviceSize(extent.width) * extent.height * 4);
+    slot.extent = extent;
+    slot.swap_red_blue = swap_red_blue;
+    slot.frame = frame;
+    char name[32];
+    std::snprintf(name, sizeof(name), "frame_%06llu.png",
+                  static_cast<unsigned long long>(frameNumber));
+    slot.path = directory / name;
+
+    // The render pass's external dependency already waits for the color
+    // writes and orders its final transition before transfers
+    VkImageMemoryBarrier to_transfer{};
+    to_transfer.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    to_transfer.srcAccessMask = 0;
+    to_transfer.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    to_transfer.oldLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    to_transfer.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    to_transfer.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    to_transfer.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    to_transfer.image = image;
+    to_transfer.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                         nullptr, 1, &to_transfer);
+
+    VkBufferImageCopy region{};
+    region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+    region.imageExtent = {extent.width, extent.height, 1};
+    vkCmdCopyImageToBuffer(commandBuffer, image,
+                           VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, slot.buffer,
+                           1, &region);
+
+    // Back for presenting, and the copy made visible to the host. The
+    // present waits on the semaphore signalled after this.
+    VkImageMemoryBarrier to_present = to_transfer;
+    to_present.srcAccessMask = 0;
+    to_present.dstAccessMask = 0;
+    to_present.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    to_present.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    VkBufferMemoryBarrier to_host{};
+    to_host.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    to_host.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    to_host.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    to_host.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    to_host.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    to_host.buffer = slot.buffer;
+    to_host.size = VK_WHOLE_SIZE;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT |
+                             VK_PIPELINE_STAGE_HOST_BIT,
+                         0, 0, nullptr, 1, &to_host, 1, &to_present);
+
+    recorded.push_back(index);
+    ++sequence_recorded;
+    if (frames_left > 0 && --frames_left == 0) {
+        finishSequence();
+    }
+    return true;
+}
+
+void FrameCapture::collect(uint32_t frame) {
+    if (recorded.empty()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto done = std::stable_partition(
+            recorded.begin(), recorded.end(),
+            [&](uint32_t index) { return slots[index].frame != frame; });
+        to_encode.insert(to_encode.end(), done, recorded.end());
+        recorded.erase(done, recorded.end());
+    }
+    encode_cv.notify_all();
+}
+
+void FrameCapture::ensureBuffer(Slot& slot, VkDeviceSize size) {
+    // Only grows: a smaller window after a resize reuses the buffer
+    if (size <= slot.size) {
+        return;
+    }
+    if (slot.buffer != VK_NULL_HANDLE) {
+        vkDestroyBuffer(device, slot.buffer, nullptr);
+        vkUnmapMemory(device, slot.memory);
+        vkFreeMemory(device, slot.memory, nullptr);
+    }
+    VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                       VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    if (readback_cached) {
+        properties |= VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+    }
+    vulkan_context->createBuffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                 properties, slot.buffer, slot.memory);
+    vkMapMemory(device, slot.memory, 0, size, 0, &slot.mapped);
+    slot.size = size;
+}
+
+void FrameCapture::encodeLoop() {
+    std::vector<uint8_t> pixels;
+    for (;;) {
+        uint32_t index;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            encode_cv.wait(lock, [this] {
+                return stopping || !to_encode.empty();
+            });
+            if (to_encode.empty()) {
+                return;  // Stopping, and everything is written
+            }
+            index = to_encode.front();
+            to_encode.pop_front();
+        }
+        Clock::time_point start = Clock::now();
+
+        // One pass over the mapping, then the slot is free for the next
+        // frame while the PNG is written
+        Slot& slot = slots[index];
+        const VkExtent2D extent = slot.extent;
+        const std::filesystem::path path = std::move(slot.path);
+        const size_t count = size_t(extent.width) * extent.height;
+        pixels.resize(count * 4);
+        const auto* source = static_cast<const uint8_t*>(slot.mapped);
+        const size_t red = slot.swap_red_blue ? 2 : 0;
+        for (size_t i = 0; i < count * 4; i += 4) {
+            pixels[i] = source[i + red];
+            pixels[i + 1] = source[i + 1];
+            pixels[i + 2] = source[i + 2 - red];
+            pixels[i + 3] = 255;  // Swapchain alpha is not meaningful
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            free_slots.push_back(index);
+        }
+
+        int width = static_cast<int>(extent.width);
+        bool written = stbi_write_png(path.string().c_str(), width,
+                                      static_cast<int>(extent.height), 4,
+                                      pixels.data(), width * 4) != 0;
+        if (!written) {
+            spdlog::error("Failed to write capture {} !", path.string());
+        }
+        double ms = std::chrono::duration<double, std::milli>(Clock::now() -
+                                                              start)
+                        .count();
+        std::lock_guard<std::mutex> lock(mutex);
+        if (written) {
+            ++frames_written;
+        } else {
+            ++frames_failed;
+        }
+        encode_ms += ms;
+    }
+}
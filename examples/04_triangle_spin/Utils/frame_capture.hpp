@@ -0,0 +1,97 @@
+/*
+ * @author: Avidel
+ * @LastEditors: Avidel
+ */
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+class VulkanContextManager;
+
+// --- Frame Capture ---
+// Screenshots and image sequences of the presented frames, written as PNGs
+// without stalling the frame loop:
+//   1. recordCopy(): at the end of the frame's command buffer, copy the
+//      swapchain image into a free slot of a ring of host-visible buffers
+//   2. collect(): once drawFrame has waited on that frame's fence, a few
+//      frames later, its slots are complete and go to the encode threads
+//   3. encode threads: convert the mapped pixels to RGBA, hand the slot
+//      back, then write the PNG
+// The ring has a few more slots than frames in flight, so encoding can lag
+// behind briefly. A frame that finds no free slot is skipped and counted,
+// never waited for.
+class FrameCapture {
+public:
+    static constexpr uint32_t EXTRA_SLOTS = 2;  // Beyond frames in flight
+
+    // encodeThreads 0 picks half the hardware threads (at least one)
+    FrameCapture(VulkanContextManager* context, uint32_t framesInFlight,
+                 uint32_t encodeThreads = 0);
+    // Writes out the frames already copied; the device must be idle
+    ~FrameCapture();
+
+    FrameCapture(const FrameCapture&) = delete;
+    FrameCapture& operator=(const FrameCapture&) = delete;
+
+    // Capture the next frameCount frames into directory as
+    // frame_<number>.png, or every frame until stop() with 0. False when the
+    // directory cannot be created.
+    bool start(const std::filesystem::path& directory, uint32_t frameCount);
+    void stop();
+    bool isActive() const { return active; }
+
+    // After the last render pass: image is the swapchain image this frame
+    // presents, in PRESENT_SRC_KHR, and is left that way. False when the
+    // frame was skipped.
+    bool recordCopy(VkCommandBuffer commandBuffer, uint32_t frame,
+                    uint64_t frameNumber, VkImage image);
+    // The fence of this frame in flight has been waited on
+    void collect(uint32_t frame);
+
+private:
+    struct Slot {
+        VkBuffer buffer{VK_NULL_HANDLE};
+        VkDeviceMemory memory{VK_NULL_HANDLE};
+        void* mapped = nullptr;  // Persistently, host coherent
+        VkDeviceSize size = 0;   // Grown on demand
+        VkExtent2D extent{0, 0};
+        bool swap_red_blue = false;  // BGRA swapchain
+        uint32_t frame = 0;          // Frame in flight that copied into it
+        std::filesystem::path path;
+    };
+
+    void ensureBuffer(Slot& slot, VkDeviceSize size);
+    void encodeLoop();
+    void finishSequence();  // Logs what the sequence recorded
+
+    VulkanContextManager* vulkan_context;
+    VkDevice device;
+    bool readback_cached = false;  // Host cached memory for readback
+
+    std::vector<Slot> slots;
+    std::vector<uint32_t> recorded;  // Main thread only, waiting on fences
+
+    // --- Sequence State (main thread) ---
+    bool active = false;
+    std::filesystem::path directory;
+    uint32_t frames_left = 0;  // 0 while active: until stop()
+    uint32_t sequence_recorded = 0;
+    uint32_t sequence_skipped = 0;
+
+    // --- Encode Threads ---
+    std::mutex mutex;
+    std::condition_variable encode_cv;  // Slots to encode or stopping
+    std::vector<uint32_t> free_slots;
+    std::deque<uint32_t> to_encode;
+    bool stopping = false;
+    uint64_t frames_written = 0;  // Totals, for the final log
+    uint64_t frames_failed = 0;
+    double encode_ms = 0.0;
+    std::vector<std::thread> encode_threads;
+};
@@ -0,0 +1,123 @@
+/*
+ * @author: Avidel
+ * @LastEditors: Avidel
+ */
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+
+// --- Frame Queue ---
+// Bounded single-producer single-consumer ring of frame snapshots, e.g. render
+// packets from the game thread to the render thread. Slots are preallocated
+// and filled in place, so a packet's vectors keep their capacity and the
+// steady state allocates nothing:
+//
+//   producer                          consumer
+//   T* slot = queue.tryBeginPush();   T* slot = queue.beginPop();
+//   ...fill *slot...                  ...use *slot...
+//   queue.endPush();                  queue.endPop();
+//
+// Both sides only touch their own index plus an acquire load of the other's;
+// a full or empty queue waits with std::atomic::wait instead of a lock. The
+// depth is how many frames the producer may run ahead: more hides spikes on
+// either side, fewer keeps input latency down.
+template <typename T>
+class FrameQueue {
+public:
+    explicit FrameQueue(size_t depth)
+        : depth(depth), slots(std::make_unique<T[]>(depth)) {
+        if (depth == 0) {
+            throw std::runtime_error("frame queue depth must be at least 1!");
+        }
+    }
+
+    FrameQueue(const FrameQueue&) = delete;
+    FrameQueue& operator=(const FrameQueue&) = delete;
+
+    size_t getDepth() const { return depth; }
+
+    // --- Producer ---
+    // The next free slot, or nullptr while all of them are queued. Returns
+    // the same slot until endPush().
+    T* tryBeginPush() {
+        uint64_t count = head.load(std::memory_order_relaxed) >> 1;
+        if (count - cached_tail == depth) {
+            cached_tail = tail.load(std::memory_order_acquire);
+            if (count - cached_tail == depth) {
+                return nullptr;
+            }
+        }
+        return &slots[count % depth];
+    }
+
+    // Blocks until a slot is free
+    T* beginPush() {
+        T* slot = tryBeginPush();
+        while (slot == nullptr) {
+            tail.wait(cached_tail, std::memory_order_acquire);
+            slot = tryBeginPush();
+        }
+        return slot;
+    }
+
+    // Publishes the slot from tryBeginPush() or beginPush()
+    void endPush() {
+        head.fetch_add(2, std::memory_order_release);
+        head.notify_one();
+    }
+
+    // No more pushes: beginPop() returns what is left, then nullptr
+    void close() {
+        head.fetch_or(CLOSED, std::memory_order_release);
+        head.notify_one();
+    }
+
+    // --- Consumer ---
+    // The oldest queued slot, or nullptr when empty
+    T* tryBeginPop() {
+        uint64_t count = tail.load(std::memory_order_relaxed);
+        if (count == cached_head >> 1) {
+            cached_head = head.load(std::memory_order_acquire);
+            if (count == cached_head >> 1) {
+                return nullptr;
+            }
+        }
+        return &slots[count % depth];
+    }
+
+    // Blocks until a slot is queued; nullptr once closed and drained
+    T* beginPop() {
+        T* slot = tryBeginPop();
+        while (slot == nullptr && (cached_head & CLOSED) == 0) {
+            head.wait(cached_head, std::memory_order_acquire);
+            slot = tryBeginPop();
+        }
+        return slot;
+    }
+
+    // Hands the slot from tryBeginPop() or beginPop() back to the producer
+    void endPop() {
+        tail.fetch_add(1, std::memory_order_release);
+        tail.notify_one();
+    }
+
+private:
+    // Keeps the two indices from false sharing
+    static constexpr size_t CACHE_LINE = 64;
+    // Low bit of head; the push count sits above it, so closing wakes a
+    // consumer waiting on head just like a push does
+    static constexpr uint64_t CLOSED = 1;
+
+    const size_t depth;
+    std::unique_ptr<T[]> slots;
+
+    // Written by the producer: pushes << 1 | CLOSED
+    alignas(CACHE_LINE) std::atomic<uint64_t> head{0};
+    uint64_t cached_tail = 0;  // Producer's last look at tail
+    // Written by the consumer: pops
+    alignas(CACHE_LINE) std::atomic<uint64_t> tail{0};
+    uint64_t cached_head = 0;  // Consumer's last look at head
+};
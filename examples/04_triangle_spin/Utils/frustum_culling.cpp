@@ -0,0 +1,496 @@
+/*
+ * @author: Avidel
+ * @LastEditors: Avidel
+ */
+#include "frustum_culling.hpp"
+
+#include "job_system.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define CULL_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define CULL_NEON 1
+#include <arm_neon.h>
+#endif
+
+// AVX2 is compiled per function so the rest of the build keeps the baseline
+// ISA; it is only called after the runtime CPU check
+#if defined(CULL_X86) && (defined(__GNUC__) || defined(__clang__))
+#define CULL_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define CULL_TARGET_AVX2
+#endif
+
+namespace {
+// Objects per job, a multiple of every SIMD width
+constexpr size_t CULL_GRAIN = 16384;
+
+struct SphereArrays {
+    const float* x;
+    const float* y;
+    const float* z;
+    const float* r;
+};
+
+// For a box only the corner furthest along the plane normal matters. The
+// normal is constant per call, so the min/max array for each axis is picked
+// once per plane instead of per box.
+struct BoxPlane {
+    const float* x;
+    const float* y;
+    const float* z;
+};
+
+struct BoxArrays {
+    BoxPlane corners[6];
+};
+
+using SphereKernel = size_t (*)(const Frustum&, const SphereArrays&, size_t,
+                                size_t, uint32_t*);
+using BoxKernel = size_t (*)(const Frustum&, const BoxArrays&, size_t, size_t,
+                             uint32_t*);
+
+// Append base + lane for every set bit of mask
+inline size_t writeVisible(uint32_t mask, uint32_t base, uint32_t* out) {
+    size_t count = 0;
+    while (mask) {
+        out[count++] = base + static_cast<uint32_t>(std::countr_zero(mask));
+        mask &= mask - 1;
+    }
+    return count;
+}
+
+// --- Scalar ---
+size_t cullSpheresScalar(const Frustum& frustum, const SphereArrays& s,
+                         size_t begin, size_t end, uint32_t* out) {
+    size_t count = 0;
+    for (size_t i = begin; i < end; ++i) {
+        bool inside = true;
+        for (const glm::vec4& plane : frustum.planes) {
+            float d = plane.x * s.x[i] + plane.y * s.y[i] + plane.z * s.z[i] +
+                      plane.w;
+            inside = inside && d >= -s.r[i];
+        }
+        out[count] = static_cast<uint32_t>(i);
+        count += inside;  // Branchless compaction
+    }
+    return count;
+}
+
+size_t cullBoxesScalar(const Frustum& frustum, const BoxArrays& b,
+                       size_t begin, size_t end, uint32_t* out) {
+    size_t count = 0;
+    for (size_t i = begin; i < end; ++i) {
+        bool inside = true;
+        for (int p = 0; p < 6; ++p) {
+            const glm::vec4& plane = frustum.planes[p];
+            const BoxPlane& c = b.corners[p];
+            float d = plane.x * c.x[i] + plane.y * c.y[i] + plane.z * c.z[i] +
+                      plane.w;
+            inside = inside && d >= 0.0f;
+        }
+        out[count] = static_cast<uint32_t>(i);
+        count += inside;
+    }
+    return count;
+}
+
+#if defined(CULL_X86)
+// --- SSE2 (x86-64 baseline) ---
+size_t cullSpheresSse2(const Frustum& frustum, const SphereArrays& s,
+                       size_t begin, size_t end, uint32_t* out) {
+    __m128 px[6], py[6], pz[6], pw[6];
+    for (int p = 0; p < 6; ++p) {
+        px[p] = _mm_set1_ps(frustum.planes[p].x);
+        py[p] = _mm_set1_ps(frustum.planes[p].y);
+        pz[p] = _mm_set1_ps(frustum.planes[p].z);
+        pw[p] = _mm_set1_ps(frustum.planes[p].w);
+    }
+    size_t count = 0;
+    size_t i = begin;
+    for (; i + 4 <= end; i += 4) {
+        __m128 x = _mm_loadu_ps(s.x + i);
+        __m128 y = _mm_loadu_ps(s.y + i);
+        __m128 z = _mm_loadu_ps(s.z + i);
+        __m128 neg_r = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(s.r + i));
+        __m128 inside = _mm_cmpeq_ps(x, x);  // All ones (NaN centers fail)
+        for (int p = 0; p < 6; ++p) {
+            // Same summation order as the scalar kernel
+            __m128 d = _mm_add_ps(_mm_mul_ps(px[p], x), _mm_mul_ps(py[p], y));
+            d = _mm_add_ps(_mm_add_ps(d, _mm_mul_ps(pz[p], z)), pw[p]);
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(d, neg_r));
+        }
+        count += writeVisible(_mm_movemask_ps(inside),
+                              static_cast<uint32_t>(i), out + count);
+    }
+    return count + cullSpheresScalar(frustum, s, i, end, out + count);
+}
+
+size_t cullBoxesSse2(const Frustum& frustum, const BoxArrays& b, size_t begin,
+                     size_t end, uint32_t* out) {
+    __m128 px[6], py[6], pz[6], pw[6];
+    for (int p = 0; p < 6; ++p) {
+        px[p] = _mm_set1_ps(frustum.planes[p].x);
+        py[p] = _mm_set1_ps(frustum.planes[p].y);
+        pz[p] = _mm_set1_ps(frustum.planes[p].z);
+        pw[p] = _mm_set1_ps(frustum.planes[p].w);
+    }
+    const __m128 zero = _mm_setzero_ps();
+    size_t count = 0;
+    size_t i = begin;
+    for (; i + 4 <= end; i += 4) {
+        __m128 inside = _mm_cmpeq_ps(zero, zero);
+        for (int p = 0; p < 6; ++p) {
+            const BoxPlane& c = b.corners[p];
+            __m128 d =
+                _mm_add_ps(_mm_mul_ps(px[p], _mm_loadu_ps(c.x + i)),
+                           _mm_mul_ps(py[p], _mm_loadu_ps(c.y + i)));
+            d = _mm_add_ps(
+                _mm_add_ps(d, _mm_mul_ps(pz[p], _mm_loadu_ps(c.z + i))),
+                pw[p]);
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(d, zero));
+        }
+        count += writeVisible(_mm_movemask_ps(inside),
+                              static_cast<uint32_t>(i), out + count);
+    }
+    return count + cullBoxesScalar(frustum, b, i, end, out + count);
+}
+
+// --- AVX2 ---
+CULL_TARGET_AVX2 size_t cullSpheresAvx2(const Frustum& frustum,
+                                        const SphereArrays& s, size_t begin,
+                                        size_t end, uint32_t* out) {
+    __m256 px[6], py[6], pz[6], pw[6];
+    for (int p = 0; p < 6; ++p) {
+        px[p] = _mm256_set1_ps(frustum.planes[p].x);
+        py[p] = _mm256_set1_ps(frustum.planes[p].y);
+        pz[p] = _mm256_set1_ps(frustum.planes[p].z);
+        pw[p] = _mm256_set1_ps(frustum.planes[p].w);
+    }
+    size_t count = 0;
+    size_t i = begin;
+    for (; i + 8 <= end; i += 8) {
+        __m256 x = _mm256_loadu_ps(s.x + i);
+        __m256 y = _mm256_loadu_ps(s.y + i);
+        __m256 z = _mm256_loadu_ps(s.z + i);
+        __m256 neg_r =
+            _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(s.r + i));
+        __m256 inside = _mm256_cmp_ps(x, x, _CMP_EQ_OQ);
+        for (int p = 0; p < 6; ++p) {
+            __m256 d =
+                _mm256_add_ps(_mm256_mul_ps(px[p], x), _mm256_mul_ps(py[p], y));
+            d = _mm256_add_ps(_mm256_add_ps(d, _mm256_mul_ps(pz[p], z)), pw[p]);
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(d, neg_r, _CMP_GE_OQ));
+        }
+        count += writeVisible(_mm256_movemask_ps(inside),
+                              static_cast<uint32_t>(i), out + count);
+    }
+    return count + cullSpheresScalar(frustum, s, i, end, out + count);
+}
+
+CULL_TARGET_AVX2 size_t cullBoxesAvx2(const Frustum& frustum,
+                                      const BoxArrays& b, size_t begin,
+                                      size_t end, uint32_t* out) {
+    __m256 px[6], py[6], pz[6], pw[6];
+    for (int p = 0; p < 6; ++p) {
+        px[p] = _mm256_set1_ps(frustum.planes[p].x);
+        py[p] = _mm256_set1_ps(frustum.planes[p].y);
+        pz[p] = _mm256_set1_ps(frustum.planes[p].z);
+        pw[p] = _mm256_set1_ps(frustum.planes[p].w);
+    }
+    const __m256 zero = _mm256_setzero_ps();
+    size_t count = 0;
+    size_t i = begin;
+    for (; i + 8 <= end; i += 8) {
+        __m256 inside = _mm256_cmp_ps(zero, zero, _CMP_EQ_OQ);
+        for (int p = 0; p < 6; ++p) {
+            const BoxPlane& c = b.corners[p];
+            __m256 d =
+                _mm256_add_ps(_mm256_mul_ps(px[p], _mm256_loadu_ps(c.x + i)),
+                              _mm256_mul_ps(py[p], _mm256_loadu_ps(c.y + i)));
+            __m256 z = _mm256_mul_ps(pz[p], _mm256_loadu_ps(c.z + i));
+            d = _mm256_add_ps(_mm256_add_ps(d, z), pw[p]);
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(d, zero, _CMP_GE_OQ));
+        }
+        count += writeVisible(_mm256_movemask_ps(inside),
+                              static_cast<uint32_t>(i), out + count);
+    }
+    return count + cullBoxesScalar(frustum, b, i, end, out + count);
+}
+
+bool cpuHasAvx2() {
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif  // CULL_X86
+
+#if defined(CULL_NEON)
+// --- NEON (AArch64 baseline) ---
+inline uint32_t neonMovemask(uint32x4_t mask) {
+    const uint32_t lane_bits[4] = {1, 2, 4, 8};
+    return vaddvq_u32(vandq_u32(mask, vld1q_u32(lane_bits)));
+}
+
+size_t cullSpheresNeon(const Frustum& frustum, const SphereArrays& s,
+                       size_t begin, size_t end, uint32_t* out) {
+    float32x4_t px[6], py[6], pz[6], pw[6];
+    for (int p = 0; p < 6; ++p) {
+        px[p] = vdupq_n_f32(frustum.planes[p].x);
+        py[p] = vdupq_n_f32(frustum.planes[p].y);
+        pz[p] = vdupq_n_f32(frustum.planes[p].z);
+        pw[p] = vdupq_n_f32(frustum.planes[p].w);
+    }
+    size_t count = 0;
+    size_t i = begin;
+    for (; i + 4 <= end; i += 4) {
+        float32x4_t x = vld1q_f32(s.x + i);
+        float32x4_t y = vld1q_f32(s.y + i);
+        float32x4_t z = vld1q_f32(s.z + i);
+        float32x4_t neg_r = vnegq_f32(vld1q_f32(s.r + i));
+        uint32x4_t inside = vceqq_f32(x, x);
+        for (int p = 0; p < 6; ++p) {
+            float32x4_t d = vfmaq_f32(pw[p], px[p], x);
+            d = vfmaq_f32(d, py[p], y);
+            d = vfmaq_f32(d, pz[p], z);
+            inside = vandq_u32(inside, vcgeq_f32(d, neg_r));
+        }
+        count += writeVisible(neonMovemask(inside), static_cast<uint32_t>(i),
+                              out + count);
+    }
+    return count + cullSpheresScalar(frustum, s, i, end, out + count);
+}
+
+size_t cullBoxesNeon(const Frustum& frustum, const BoxArrays& b, size_t begin,
+                     size_t end, uint32_t* out) {
+    float32x4_t px[6], py[6], pz[6], pw[6];
+    for (int p = 0; p < 6; ++p) {
+        px[p] = vdupq_n_f32(frustum.planes[p].x);
+        py[p] = vdupq_n_f32(frustum.planes[p].y);
+        pz[p] = vdupq_n_f32(frustum.planes[p].z);
+        pw[p] = vdupq_n_f32(frustum.planes[p].w);
+    }
+    const float32x4_t zero = vdupq_n_f32(0.0f);
+    size_t count = 0;
+    size_t i = begin;
+    for (; i + 4 <= end; i += 4) {
+        uint32x4_t inside = vceqq_f32(zero, zero);
+        for (int p = 0; p < 6; ++p) {
+            const BoxPlane& c = b.corners[p];
+            float32x4_t d = vfmaq_f32(pw[p], px[p], vld1q_f32(c.x + i));
+            d = vfmaq_f32(d, py[p], vld1q_f32(c.y + i));
+            d = vfmaq_f32(d, pz[p], vld1q_f32(c.z + i));
+            inside = vandq_u32(inside, vcgeq_f32(d, zero));
+        }
+        count += writeVisible(neonMovemask(inside), static_cast<uint32_t>(i),
+                              out + count);
+    }
+    return count + cullBoxesScalar(frustum, b, i, end, out + count);
+}
+#endif  // CULL_NEON
+
+SphereKernel getSphereKernel(FrustumCuller::Kernel kernel) {
+    switch (kernel) {
+#if defined(CULL_X86)
+        case FrustumCuller::Kernel::AVX2:
+            return cullSpheresAvx2;
+        case FrustumCuller::Kernel::SSE2:
+            return cullSpheresSse2;
+#endif
+#if defined(CULL_NEON)
+        case FrustumCuller::Kernel::NEON:
+            return cullSpheresNeon;
+#endif
+        default:
+            return cullSpheresScalar;
+    }
+}
+
+BoxKernel getBoxKernel(FrustumCuller::Kernel kernel) {
+    switch (kernel) {
+#if defined(CULL_X86)
+        case FrustumCuller::Kernel::AVX2:
+            return cullBoxesAvx2;
+        case FrustumCuller::Kernel::SSE2:
+            return cullBoxesSse2;
+#endif
+#if defined(CULL_NEON)
+        case FrustumCuller::Kernel::NEON:
+            return cullBoxesNeon;
+#endif
+        default:
+            return cullBoxesScalar;
+    }
+}
+
+// Run kernel over [0, count) in parallel. Every chunk writes its visible
+// indices at its own offset in out; afterwards the chunks are slid together.
+template <typename Kernel, typename Arrays>
+size_t cullParallel(JobSystem& jobs, std::vector<uint32_t>& chunkCounts,
+                    Kernel kernel, const Frustum& frustum,
+                    const Arrays& arrays, size_t count,
+                    std::vector<uint32_t>& out) {
+    out.resize(count);
+    chunkCounts.assign((count + CULL_GRAIN - 1) / CULL_GRAIN, 0);
+    uint32_t* indices = out.data();
+    jobs.parallelFor(count, CULL_GRAIN, [&](size_t begin, size_t end) {
+        chunkCounts[begin / CULL_GRAIN] = static_cast<uint32_t>(
+            kernel(frustum, arrays, begin, end, indices + begin));
+    });
+
+    size_t visible = chunkCounts.empty() ? 0 : chunkCounts[0];
+    for (size_t chunk = 1; chunk < chunkCounts.size(); ++chunk) {
+        // Destination is never past the source, so memmove is safe
+        std::memmove(indices + visible, indices + chunk * CULL_GRAIN,
+                     chunkCounts[chunk] * sizeof(uint32_t));
+        visible += chunkCounts[chunk];
+    }
+    out.resize(visible);
+    return visible;
+}
+}  // namespace
+
+void SphereBounds::add(const glm::vec3& center, float r) {
+    center_x.push_back(center.x);
+    center_y.push_back(center.y);
+    center_z.push_back(center.z);
+    radius.push_back(r);
+}
+
+void SphereBounds::clear() {
+    center_x.clear();
+    center_y.clear();
+    center_z.clear();
+    radius.clear();
+}
+
+void BoxBounds::add(const glm::vec3& boxMin, const glm::vec3& boxMax) {
+    min_x.push_back(boxMin.x);
+    min_y.push_back(boxMin.y);
+    min_z.push_back(boxMin.z);
+    max_x.push_back(boxMax.x);
+    max_y.push_back(boxMax.y);
+    max_z.push_back(boxMax.z);
+}
+
+void BoxBounds::clear() {
+    min_x.clear();
+    min_y.clear();
+    min_z.clear();
+    max_x.clear();
+    max_y.clear();
+    max_z.clear();
+}
+
+Frustum Frustum::fromMatrix(const glm::mat4& viewProj) {
+    // glm is column-major: row i is (m[0][i], m[1][i], m[2][i], m[3][i])
+    auto row = [&viewProj](int i) {
+        return glm::vec4(viewProj[0][i], viewProj[1][i], viewProj[2][i],
+                         viewProj[3][i]);
+    };
+    glm::vec4 r0 = row(0), r1 = row(1), r2 = row(2), r3 = row(3);
+
+    Frustum frustum;
+    frustum.planes[0] = r3 + r0;  // Left
+    frustum.planes[1] = r3 - r0;  // Right
+    frustum.planes[2] = r3 + r1;  // Bottom
+    frustum.planes[3] = r3 - r1;  // Top
+    frustum.planes[4] = r2;       // Near, clip z >= 0
+    frustum.planes[5] = r3 - r2;  // Far
+    for (glm::vec4& plane : frustum.planes) {
+        plane = plane / glm::length(glm::vec3(plane));
+    }
+    return frustum;
+}
+
+FrustumCuller::FrustumCuller(JobSystem& jobs) : jobs(jobs) {
+    for (Kernel candidate : {Kernel::AVX2, Kernel::NEON, Kernel::SSE2}) {
+        if (isKernelSupported(candidate)) {
+            kernel = candidate;
+            break;
+        }
+    }
+}
+
+void FrustumCuller::setKernel(Kernel newKernel) {
+    if (!isKernelSupported(newKernel)) {
+        throw std::runtime_error(std::string("culling kernel ") +
+                                 getKernelName(newKernel) +
+                                 " is not supported on this CPU!");
+    }
+    kernel = newKernel;
+}
+
+const char* FrustumCuller::getKernelName(Kernel kernel) {
+    switch (kernel) {
+        case Kernel::SSE2:
+            return "SSE2";
+        case Kernel::AVX2:
+            return "AVX2";
+        case Kernel::NEON:
+            return "NEON";
+        default:
+            return "scalar";
+    }
+}
+
+bool FrustumCuller::isKernelSupported(Kernel kernel) {
+    switch (kernel) {
+#if defined(CULL_X86)
+        case Kernel::AVX2: {
+            static const bool has_avx2 = cpuHasAvx2();
+            return has_avx2;
+        }
+        case Kernel::SSE2:
+            return true;
+#endif
+#if defined(CULL_NEON)
+        case Kernel::NEON:
+            return true;
+#endif
+        case Kernel::Scalar:
+            return true;
+        default:
+            return false;
+    }
+}
+
+size_t FrustumCuller::cullSpheres(const Frustum& frustum,
+                                  const SphereBounds& bounds,
+                                  std::vector<uint32_t>& visibleOut) {
+    SphereArrays arrays{bounds.center_x.data(), bounds.center_y.data(),
+                        bounds.center_z.data(), bounds.radius.data()};
+    return cullParallel(jobs, chunk_counts, getSphereKernel(kernel), frustum,
+                        arrays, bounds.size(), visibleOut);
+}
+
+size_t FrustumCuller::cullBoxes(const Frustum& frustum,
+                                const BoxBounds& bounds,
+                                std::vector<uint32_t>& visibleOut) {
+    BoxArrays arrays;
+    for (int p = 0; p < 6; ++p) {
+        const glm::vec4& plane = frustum.planes[p];
+        arrays.corners[p].x =
+            plane.x >= 0.0f ? bounds.max_x.data() : bounds.min_x.data();
+        arrays.corners[p].y =
+            plane.y >= 0.0f ? bounds.max_y.data() : bounds.min_y.data();
+        arrays.corners[p].z =
+            plane.z >= 0.0f ? bounds.max_z.data() : bounds.min_z.data();
+    }
+    return cullParallel(jobs, chunk_counts, getBoxKernel(kernel), frustum,
+                        arrays, bounds.size(), visibleOut);
+}
@@ -0,0 +1,73 @@
+/*
+ * @author: Avidel
+ * @LastEditors: Avidel
+ */
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+class JobSystem;
+
+// --- Bounding Volumes (SoA) ---
+// One array per component so the culling kernels load 4/8 objects per
+// instruction without shuffles.
+struct SphereBounds {
+    std::vector<float> center_x, center_y, center_z, radius;
+
+    void add(const glm::vec3& center, float r);
+    void clear();
+    size_t size() const { return radius.size(); }
+};
+
+struct BoxBounds {
+    std::vector<float> min_x, min_y, min_z;
+    std::vector<float> max_x, max_y, max_z;
+
+    void add(const glm::vec3& boxMin, const glm::vec3& boxMax);
+    void clear();
+    size_t size() const { return min_x.size(); }
+};
+
+// --- Frustum ---
+// Six inward-facing planes (xyz normal, w distance), normalized so plane
+// distances are in world units. Order: left, right, bottom, top, near, far.
+struct Frustum {
+    glm::vec4 planes[6];
+
+    // Gribb/Hartmann extraction from a Vulkan (depth 0..1) view-projection
+    static Frustum fromMatrix(const glm::mat4& viewProj);
+};
+
+// --- SIMD Frustum Culling ---
+// Tests SoA bounds against a frustum and writes the indices of the visible
+// ones, in ascending order, to a compacted list. Runs in parallel over the
+// job system; the kernel (AVX2, SSE2, NEON or scalar) is picked once at
+// construction from what the CPU supports.
+class FrustumCuller {
+public:
+    enum class Kernel { Scalar, SSE2, AVX2, NEON };
+
+    explicit FrustumCuller(JobSystem& jobs);
+
+    // Returns the number of visible objects; visibleOut is resized to it.
+    // Spheres straddling a plane count as visible.
+    size_t cullSpheres(const Frustum& frustum, const SphereBounds& bounds,
+                       std::vector<uint32_t>& visibleOut);
+    // Conservative: a box is culled only if it is fully outside one plane
+    size_t cullBoxes(const Frustum& frustum, const BoxBounds& bounds,
+                     std::vector<uint32_t>& visibleOut);
+
+    // Force a kernel, e.g. to compare them; throws if the CPU lacks it
+    void setKernel(Kernel kernel);
+    Kernel getKernel() const { return kernel; }
+    static const char* getKernelName(Kernel kernel);
+    static bool isKernelSupported(Kernel kernel);
+
+private:
+    JobSystem& jobs;
+    Kernel kernel = Kernel::Scalar;
+    std::vector<uint32_t> chunk_counts;  // Visible per parallelFor chunk
+};
@@ -0,0 +1,44 @@
+/*
+ * @author: Avidel
+ * @LastEditors: Avidel
+ */
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// --- 64-bit FNV-1a Helpers ---
+// Shared by the pipeline and layout caches, which key Vulkan objects by state
+// hashes.
+namespace hash_util {
+inline constexpr uint64_t FNV_OFFSET = 0xcbf29ce484222325ull;
+inline constexpr uint64_t FNV_PRIME = 0x100000001b3ull;
+
+inline void hashBytes(uint64_t& hash, const void* data, size_t size) {
+    const auto* bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ bytes[i]) * FNV_PRIME;
+    }
+}
+
+template <typename T>
+void hashValue(uint64_t& hash, const T& value) {
+    hashBytes(hash, &value, sizeof(T));
+}
+
+// Only for element types without padding (SPIR-V words, vertex descriptions)
+template <typename T>
+void hashRange(uint64_t& hash, const std::vector<T>& values) {
+    hashValue(hash, values.size());
+    hashBytes(hash, values.data(), values.size() * sizeof(T));
+}
+
+// Byte equality matching hashRange(), to tell hash collisions apart
+template <typename T>
+bool equalRange(const std::vector<T>& a, const std::vector<T>& b) {
+    return a.size() == b.size() &&
+           (a.empty() ||
+            std::memcmp(a.data(), b.data(), a.size() * sizeof(T)) == 0);
+}
+}  // namespace hash_util
@@ -0,0 +1,615 @@
+/*
+ * @author: Avidel
+ * @LastEditors: Avidel
+ */
+#include "hiz_culling.hpp"
+
+#include "embedded_shaders.hpp"
+#include "frustum_culling.hpp"
+#include "layout_cache.hpp"
+#include "spirv_reflect.hpp"
+#include "vulkan_util.hpp"
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+// Workgroup sizes and footprints of the compute shaders
+constexpr uint32_t CULL_GROUP_SIZE = 64;
+constexpr uint32_t REDUCE_BLOCK = 64;  // Depth pixels per group and axis
+// Mips 0..5 come from each group, 6..11 from a single group reducing all
+// of mip 5, which fits when mip 5 has at most this many texels per axis
+constexpr uint32_t FIRST_STAGE_MIPS = 6;
+constexpr uint32_t SECOND_STAGE_SOURCE = 64;
+
+// Mirrors CullUniforms in hiz_cull.comp (std140)
+struct CullUniforms {
+    glm::mat4 view_proj;
+    glm::vec4 planes[6];
+    glm::vec4 bounds_min;
+    glm::vec4 bounds_max;
+    int32_t depth_size[2];
+    uint32_t object_count;
+    uint32_t vertex_count;
+    uint32_t mip_count;
+};
+static_assert(offsetof(CullUniforms, planes) == 64);
+static_assert(offsetof(CullUniforms, depth_size) == 192);
+static_assert(offsetof(CullUniforms, mip_count) == 208);
+
+struct ReducePushConstants {
+    int32_t depth_size[2];
+    uint32_t mip_count;
+    uint32_t group_count;
+};
+
+struct CullPushConstants {
+    uint32_t phase;  // 0 early, 1 late
+};
+
+void bufferBarrier(VkCommandBuffer commandBuffer,
+                   VkPipelineStageFlags srcStage, VkAccessFlags srcAccess,
+                   VkPipelineStageFlags dstStage, VkAccessFlags dstAccess) {
+    VkMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = srcAccess;
+    barrier.dstAccessMask = dstAccess;
+    vkCmdPipelineBarrier(commandBuffer, srcStage, dstStage, 0, 1, &barrier, 0,
+                         nullptr, 0, nullptr);
+}
+}  // namespace
+
+HiZCuller::HiZCuller(VulkanContextManager* context, LayoutCache& layoutCache,
+                     uint32_t framesInFlight, uint32_t maxObjects,
+                     bool multiDrawIndirect)
+    : context(context),
+      device(context->getDevice()),
+      layout_cache(layoutCache),
+      max_objects(maxObjects),
+      multi_draw_indirect(multiDrawIndirect),
+      frames(framesInFlight) {
+    createRenderPasses();
+    createPipelines();
+    createBuffers();
+    createDescriptorPool();
+
+    VkSamplerCreateInfo sampler_info{};
+    sampler_info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    sampler_info.magFilter = VK_FILTER_NEAREST;
+    sampler_info.minFilter = VK_FILTER_NEAREST;
+    sampler_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    sampler_info.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    sampler_info.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    sampler_info.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    sampler_info.maxLod = VK_LOD_CLAMP_NONE;
+    if (vkCreateSampler(device, &sampler_info, nullptr, &sampler) !=
+        VK_SUCCESS) {
+        throw std::runtime_error("failed to create Hi-Z sampler!");
+    }
+    spdlog::debug("Hi-Z culler created for {} objects (multi draw: {}).",
+                  max_objects, multi_draw_indirect);
+}
+
+HiZCuller::~HiZCuller() {
+    destroyTargets();
+    vkDestroySampler(device, sampler, nullptr);
+    vkDestroyDescriptorPool(device, descriptor_pool, nullptr);
+    vkDestroyPipeline(device, reduce_pipeline, nullptr);
+    vkDestroyPipeline(device, cull_pipeline, nullptr);
+    vkDestroyRenderPass(device, clear_pass, nullptr);
+    vkDestroyRenderPass(device, load_pass, nullptr);
+
+    auto destroy_buffer = [this](VkBuffer buffer, VkDeviceMemory memory) {
+        vkDestroyBuffer(device, buffer, nullptr);
+        vkFreeMemory(device, memory, nullptr);
+    };
+    destroy_buffer(visibility, visibility_memory);
+    destroy_buffer(counter, counter_memory);
+    for (FrameResources& frame : frames) {
+        vkUnmapMemory(device, frame.uniform_memory);
+        destroy_buffer(frame.uniform_buffer, frame.uniform_memory);
+        destroy_buffer(frame.early_draws, frame.early_memory);
+        destroy_buffer(frame.late_draws, frame.late_memory);
+    }
+}
+
+VkRenderPass HiZCuller::createDepthPass(VkAttachmentLoadOp loadOp,
+                                        VkImageLayout initialLayout) {
+    VkAttachmentDescription depth_attachment{};
+    depth_attachment.format = DEPTH_FORMAT;
+    depth_attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+    depth_attachment.loadOp = loadOp;
+    depth_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    depth_attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    depth_attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depth_attachment.initialLayout = initialLayout;
+    // Sampled by the reduce pass and tested by the color pass afterwards
+    depth_attachment.finalLayout =
+        VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+
+    VkAttachmentReference depth_ref{};
+    depth_ref.attachment = 0;
+    depth_ref.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+    VkSubpassDescription subpass{};
+    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpass.colorAttachmentCount = 0;
+    subpass.pDepthStencilAttachment = &depth_ref;
+
+    const VkPipelineStageFlags fragment_tests =
+        VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+        VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    VkSubpassDependency dependencies[2]{};
+    // Earlier depth writes, the reduce pass and last frame's color pass
+    // are done with the image before it is written
+    dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+    dependencies[0].dstSubpass = 0;
+    dependencies[0].srcStageMask =
+        fragment_tests | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    dependencies[0].srcAccessMask =
+        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    dependencies[0].dstStageMask = fragment_tests;
+    dependencies[0].dstAccessMask =
+        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    // Depth writes are visible to the reduce pass and later depth tests
+    dependencies[1].srcSubpass = 0;
+    dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+    dependencies[1].srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    dependencies[1].srcAccessMask =
+        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    dependencies[1].dstStageMask =
+        fragment_tests | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    dependencies[1].dstAccessMask =
+        VK_ACCESS_SHADER_READ_BIT |
+        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+    VkRenderPassCreateInfo render_pass_info{};
+    render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+    render_pass_info.attachmentCount = 1;
+    render_pass_info.pAttachments = &depth_attachment;
+    render_pass_info.subpassCount = 1;
+    render_pass_info.pSubpasses = &subpass;
+    render_pass_info.dependencyCount = 2;
+    render_pass_info.pDependencies = dependencies;
+
+    VkRenderPass render_pass = VK_NULL_HANDLE;
+    if (vkCreateRenderPass(device, &render_pass_info, nullptr, &render_pass) !=
+        VK_SUCCESS) {
+        throw std::runtime_error("failed to create depth prepass!");
+    }
+    return render_pass;
+}
+
+void HiZCuller::createRenderPasses() {
+    clear_pass = createDepthPass(VK_ATTACHMENT_LOAD_OP_CLEAR,
+                                 VK_IMAGE_LAYOUT_UNDEFINED);
+    load_pass =
+        createDepthPass(VK_ATTACHMENT_LOAD_OP_LOAD,
+                        VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL);
+}
+
+VkPipeline HiZCuller::createComputePipeline(std::span<const uint32_t> code,
+                                            VkDescriptorSetLayout& setLayout,
+                                            VkPipelineLayout& pipelineLayout) {
+    // Layouts come from reflection like the graphics ones
+    LayoutCache::PipelineLayoutInfo layouts =
+        layout_cache.getLayouts(reflectSpirv(code));
+    setLayout = layouts.set_layouts[0];
+    pipelineLayout = layouts.pipeline_layout;
+
+    VkShaderModule module = createShaderModule(device, code);
+    VkComputePipelineCreateInfo pipeline_info{};
+    pipeline_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipeline_info.stage.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipeline_info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipeline_info.stage.module = module;
+    pipeline_info.stage.pName = "main";
+    pipeline_info.layout = pipelineLayout;
+
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    VkResult result = vkCreateComputePipelines(device, VK_NULL_HANDLE, 1,
+                                               &pipeline_info, nullptr,
+                                               &pipeline);
+    vkDestroyShaderModule(device, module, nullptr);
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("failed to create compute pipeline!");
+    }
+    return pipeline;
+}
+
+void HiZCuller::createPipelines() {
+    reduce_pipeline = createComputePipeline(embedded_shaders::hiz_reduce,
+                                            reduce_set_layout, reduce_layout);
+    cull_pipeline = createComputePipeline(embedded_shaders::hiz_cull,
+                                          cull_set_layout, cull_layout);
+}
+
+void HiZCuller::createBuffers() {
+    const VkMemoryPropertyFlags device_local =
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    // Filled with vkCmdFillBuffer before the first cull
+    context->createBuffer(
+        sizeof(uint32_t) * max_objects,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        device_local, visibility, visibility_memory);
+    context->createBuffer(
+        sizeof(uint32_t),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        device_local, counter, counter_memory);
+
+    const VkDeviceSize draws_size =
+        sizeof(VkDrawIndirectCommand) * max_objects;
+    const VkBufferUsageFlags draws_usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                           VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
+    for (FrameResources& frame : frames) {
+        context->createBuffer(sizeof(CullUniforms),
+                              VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+                              VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                  VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                              frame.uniform_buffer, frame.uniform_memory);
+        vkMapMemory(device, frame.uniform_memory, 0, sizeof(CullUniforms), 0,
+                    &frame.uniform_mapped);
+        context->createBuffer(draws_size, draws_usage, device_local,
+                              frame.early_draws, frame.early_memory);
+        context->createBuffer(draws_size, draws_usage, device_local,
+                              frame.late_draws, frame.late_memory);
+    }
+}
+
+void HiZCuller::createDescriptorPool() {
+    const uint32_t frame_count = static_cast<uint32_t>(frames.size());
+    VkDescriptorPoolSize pool_sizes[] = {
+        {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1 + frame_count},
+        {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, MAX_MIPS},
+        // Counter; instances, visibility and two draw lists per frame
+        {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 + 4 * frame_count},
+        {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, frame_count},
+    };
+
+    VkDescriptorPoolCreateInfo pool_info{};
+    pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    pool_info.poolSizeCount = 4;
+    pool_info.pPoolSizes = pool_sizes;
+    pool_info.maxSets = 1 + frame_count;  // Reduce set plus one cull set each
+    if (vkCreateDescriptorPool(device, &pool_info, nullptr,
+                               &descriptor_pool) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create Hi-Z descriptor pool!");
+    }
+}
+
+void HiZCuller::createTargets(VkImageView depthView, VkExtent2D extent,
+                              std::span<const VkBuffer> instanceBuffers) {
+    if (instanceBuffers.size() != frames.size()) {
+        throw std::runtime_error("Hi-Z culler needs one instance buffer per "
+                                 "frame in flight!");
+    }
+    depth_extent = extent;
+
+    VkFramebufferCreateInfo framebuffer_info{};
+    framebuffer_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+    framebuffer_info.renderPass = clear_pass;
+    framebuffer_info.attachmentCount = 1;
+    framebuffer_info.pAttachments = &depthView;
+    framebuffer_info.width = extent.width;
+    framebuffer_info.height = extent.height;
+    framebuffer_info.layers = 1;
+    if (vkCreateFramebuffer(device, &framebuffer_info, nullptr,
+                            &depth_framebuffer) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create depth framebuffer!");
+    }
+
+    // --- Depth Pyramid ---
+    // Mip 0 is half resolution, rounded up so it covers every pixel
+    pyramid_extent.width = std::max(1u, (extent.width + 1) / 2);
+    pyramid_extent.height = std::max(1u, (extent.height + 1) / 2);
+    uint32_t largest = std::max(pyramid_extent.width, pyramid_extent.height);
+    mip_count = std::min<uint32_t>(std::bit_width(largest), MAX_MIPS);
+    reduce_groups_x = (extent.width + REDUCE_BLOCK - 1) / REDUCE_BLOCK;
+    reduce_groups_y = (extent.height + REDUCE_BLOCK - 1) / REDUCE_BLOCK;
+    if (std::max(reduce_groups_x, reduce_groups_y) > SECOND_STAGE_SOURCE) {
+        // Mip 5 no longer fits one group: stop after the first stage. The
+        // cull shader treats larger boxes as visible.
+        mip_count = std::min(mip_count, FIRST_STAGE_MIPS);
+    }
+
+    VkImageCreateInfo image_info{};
+    image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    image_info.imageType = VK_IMAGE_TYPE_2D;
+    image_info.format = VK_FORMAT_R32_SFLOAT;
+    image_info.extent = {pyramid_extent.width, pyramid_extent.height, 1};
+    image_info.mipLevels = mip_count;
+    image_info.arrayLayers = 1;
+    image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+    image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+    image_info.usage =
+        VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    context->createImage(image_info, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                         pyramid, pyramid_memory);
+
+    VkImageViewCreateInfo view_info{};
+    view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    view_info.image = pyramid;
+    view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    view_info.format = VK_FORMAT_R32_SFLOAT;
+    view_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    view_info.subresourceRange.levelCount = mip_count;
+    view_info.subresourceRange.layerCount = 1;
+    if (vkCreateImageView(device, &view_info, nullptr, &pyramid_view) !=
+        VK_SUCCESS) {
+        throw std::runtime_error("failed to create Hi-Z pyramid view!");
+    }
+    mip_views.resize(mip_count);
+    for (uint32_t mip = 0; mip < mip_count; mip++) {
+        view_info.subresourceRange.baseMipLevel = mip;
+        view_info.subresourceRange.levelCount = 1;
+        if (vkCreateImageView(device, &view_info, nullptr, &mip_views[mip]) !=
+            VK_SUCCESS) {
+            throw std::runtime_error("failed to create Hi-Z mip view!");
+        }
+    }
+
+    writeDescriptorSets(depthView, instanceBuffers);
+    reset_pending = true;
+    spdlog::debug("Hi-Z pyramid {}x{} with {} mips.", pyramid_extent.width,
+                  pyramid_extent.height, mip_count);
+}
+
+void HiZCuller::writeDescriptorSets(VkImageView depthView,
+                                    std::span<const VkBuffer> instanceBuffers) {
+    std::vector<VkDescriptorSetLayout> layouts(frames.size() + 1,
+                                               cull_set_layout);
+    layouts[0] = reduce_set_layout;
+    std::vector<VkDescriptorSet> sets(layouts.size());
+
+    VkDescriptorSetAllocateInfo alloc_info{};
+    alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    alloc_info.descriptorPool = descriptor_pool;
+    alloc_info.descriptorSetCount = static_cast<uint32_t>(sets.size());
+    alloc_info.pSetLayouts = layouts.data();
+    if (vkAllocateDescriptorSets(device, &alloc_info, sets.data()) !=
+        VK_SUCCESS) {
+        throw std::runtime_error("failed to allocate Hi-Z descriptor sets!");
+    }
+    reduce_set = sets[0];
+
+    // --- Reduce Set ---
+    VkDescriptorImageInfo depth_info{};
+    depth_info.sampler = sampler;
+    depth_info.imageView = depthView;
+    depth_info.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+
+    // Every array element must be valid; mips past the chain repeat the
+    // last one and are never written
+    VkDescriptorImageInfo mip_infos[MAX_MIPS]{};
+    for (uint32_t i = 0; i < MAX_MIPS; i++) {
+        mip_infos[i].imageView = mip_views[std::min(i, mip_count - 1)];
+        mip_infos[i].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    }
+    VkDescriptorBufferInfo counter_info{counter, 0, VK_WHOLE_SIZE};
+
+    std::vector<VkWriteDescriptorSet> writes;
+    auto add_write = [&writes](VkDescriptorSet set, uint32_t binding,
+                               VkDescriptorType type, uint32_t count) {
+        VkWriteDescriptorSet write{};
+        write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        write.dstSet = set;
+        write.dstBinding = binding;
+        write.descriptorCount = count;
+        write.descriptorType = type;
+        return &writes.emplace_back(write);
+    };
+    add_write(reduce_set, 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1)
+        ->pImageInfo = &depth_info;
+    add_write(reduce_set, 1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, MAX_MIPS)
+        ->pImageInfo = mip_infos;
+    add_write(reduce_set, 2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1)
+        ->pBufferInfo = &counter_info;
+
+    // --- Cull Sets ---
+    VkDescriptorImageInfo pyramid_info{};
+    pyramid_info.sampler = sampler;
+    pyramid_info.imageView = pyramid_view;
+    pyramid_info.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    VkDescriptorBufferInfo visibility_info{visibility, 0, VK_WHOLE_SIZE};
+    std::vector<VkDescriptorBufferInfo> buffer_infos;
+    buffer_infos.reserve(4 * frames.size());  // Writes point into it
+    for (size_t i = 0; i < frames.size(); i++) {
+        FrameResources& frame = frames[i];
+        frame.cull_set = sets[i + 1];
+        VkDescriptorBufferInfo* infos = &buffer_infos.emplace_back(
+            VkDescriptorBufferInfo{frame.uniform_buffer, 0, VK_WHOLE_SIZE});
+        buffer_infos.push_back({instanceBuffers[i], 0, VK_WHOLE_SIZE});
+        buffer_infos.push_back({frame.early_draws, 0, VK_WHOLE_SIZE});
+        buffer_infos.push_back({frame.late_draws, 0, VK_WHOLE_SIZE});
+
+        add_write(frame.cull_set, 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1)
+            ->pBufferInfo = &infos[0];
+        add_write(frame.cull_set, 1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1)
+            ->pBufferInfo = &infos[1];
+        add_write(frame.cull_set, 2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1)
+            ->pBufferInfo = &visibility_info;
+        add_write(frame.cull_set, 3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1)
+            ->pBufferInfo = &infos[2];
+        add_write(frame.cull_set, 4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1)
+            ->pBufferInfo = &infos[3];
+        add_write(frame.cull_set, 5,
+                  VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1)
+            ->pImageInfo = &pyramid_info;
+    }
+    vkUpdateDescriptorSets(device, static_cast<uint32_t>(writes.size()),
+                           writes.data(), 0, nullptr);
+}
+
+void HiZCuller::destroyTargets() {
+    if (descriptor_pool != VK_NULL_HANDLE) {
+        vkResetDescriptorPool(device, descriptor_pool, 0);
+    }
+    reduce_set = VK_NULL_HANDLE;
+    for (FrameResources& frame : frames) {
+        frame.cull_set = VK_NULL_HANDLE;
+    }
+    for (VkImageView view : mip_views) {
+        vkDestroyImageView(device, view, nullptr);
+    }
+    mip_views.clear();
+    vkDestroyImageView(device, pyramid_view, nullptr);
+    vkDestroyImage(device, pyramid, nullptr);
+    vkFreeMemory(device, pyramid_memory, nullptr);
+    vkDestroyFramebuffer(device, depth_framebuffer, nullptr);
+    pyramid_view = VK_NULL_HANDLE;
+    pyramid = VK_NULL_HANDLE;
+    pyramid_memory = VK_NULL_HANDLE;
+    depth_framebuffer = VK_NULL_HANDLE;
+    mip_count = 0;
+}
+
+void HiZCuller::update(uint32_t frame, const glm::mat4& viewProj,
+                       const Aabb& meshBounds, uint32_t objectCount,
+                       uint32_t vertexCount) {
+    if (objectCount > max_objects) {
+        throw std::runtime_error("too many objects for the Hi-Z culler!");
+    }
+    CullUniforms uniforms{};
+    uniforms.view_proj = viewProj;
+    Frustum frustum = Frustum::fromMatrix(viewProj);
+    std::copy(std::begin(frustum.planes), std::end(frustum.planes),
+              uniforms.planes);
+    uniforms.bounds_min = glm::vec4(meshBounds.min, 1.0f);
+    uniforms.bounds_max = glm::vec4(meshBounds.max, 1.0f);
+    uniforms.depth_size[0] = static_cast<int32_t>(depth_extent.width);
+    uniforms.depth_size[1] = static_cast<int32_t>(depth_extent.height);
+    uniforms.object_count = objectCount;
+    uniforms.vertex_count = vertexCount;
+    uniforms.mip_count = mip_count;
+    memcpy(frames[frame].uniform_mapped, &uniforms, sizeof(uniforms));
+    frames[frame].object_count = objectCount;
+}
+
+void HiZCuller::recordCull(VkCommandBuffer commandBuffer, uint32_t frame,
+                           Phase phase) {
+    if (phase == Phase::Early) {
+        if (reset_pending) {
+            // Draw everything early on the first frame after a reset, and
+            // start the reduce pass' group counter at zero
+            vkCmdFillBuffer(commandBuffer, visibility, 0, VK_WHOLE_SIZE, 1);
+            vkCmdFillBuffer(commandBuffer, counter, 0, VK_WHOLE_SIZE, 0);
+            reset_pending = false;
+        }
+        // Last frame's late pass wrote the visibility this pass reads
+        bufferBarrier(commandBuffer,
+                      VK_PIPELINE_STAGE_TRANSFER_BIT |
+                          VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                      VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+                      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                      VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+    }
+    // The late pass runs after recordPyramid(), whose barrier covers it
+
+    const FrameResources& resources = frames[frame];
+    CullPushConstants push{phase == Phase::Early ? 0u : 1u};
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                      cull_pipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            cull_layout, 0, 1, &resources.cull_set, 0,
+                            nullptr);
+    vkCmdPushConstants(commandBuffer, cull_layout, VK_SHADER_STAGE_COMPUTE_BIT,
+                       0, sizeof(push), &push);
+    uint32_t groups =
+        (resources.object_count + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE;
+    if (groups > 0) {
+        vkCmdDispatch(commandBuffer, groups, 1, 1);
+    }
+
+    bufferBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                  VK_ACCESS_SHADER_WRITE_BIT,
+                  VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+                  VK_ACCESS_INDIRECT_COMMAND_READ_BIT);
+}
+
+void HiZCuller::beginDepthPass(VkCommandBuffer commandBuffer, Phase phase) {
+    VkClearValue clear_depth{};
+    clear_depth.depthStencil = {1.0f, 0};  // Far plane
+
+    VkRenderPassBeginInfo render_pass_info{};
+    render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    render_pass_info.renderPass =
+        phase == Phase::Early ? clear_pass : load_pass;
+    render_pass_info.framebuffer = depth_framebuffer;
+    render_pass_info.renderArea.extent = depth_extent;
+    render_pass_info.clearValueCount = phase == Phase::Early ? 1 : 0;
+    render_pass_info.pClearValues = &clear_depth;
+    vkCmdBeginRenderPass(commandBuffer, &render_pass_info,
+                         VK_SUBPASS_CONTENTS_INLINE);
+}
+
+void HiZCuller::recordPyramid(VkCommandBuffer commandBuffer) {
+    // Last frame's late cull is done sampling the old contents
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask =
+        VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = pyramid;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.levelCount = mip_count;
+    barrier.subresourceRange.layerCount = 1;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr,
+                         0, nullptr, 1, &barrier);
+
+    ReducePushConstants push{};
+    push.depth_size[0] = static_cast<int32_t>(depth_extent.width);
+    push.depth_size[1] = static_cast<int32_t>(depth_extent.height);
+    push.mip_count = mip_count;
+    push.group_count = reduce_groups_x * reduce_groups_y;
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                      reduce_pipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            reduce_layout, 0, 1, &reduce_set, 0, nullptr);
+    vkCmdPushConstants(commandBuffer, reduce_layout,
+                       VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push), &push);
+    vkCmdDispatch(commandBuffer, reduce_groups_x, reduce_groups_y, 1);
+
+    // The whole chain is written before the late cull samples it
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+    VkMemoryBarrier memory_barrier{};
+    memory_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    memory_barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    memory_barrier.dstAccessMask =
+        VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+                         &memory_barrier, 0, nullptr, 1, &barrier);
+}
+
+void HiZCuller::recordDraws(VkCommandBuffer commandBuffer, uint32_t frame,
+                            Phase phase) const {
+    const FrameResources& resources = frames[frame];
+    VkBuffer draws =
+        phase == Phase::Early ? resources.early_draws : resources.late_draws;
+    const uint32_t stride = sizeof(VkDrawIndirectCommand);
+    if (multi_draw_indirect) {
+        vkCmdDrawIndirect(commandBuffer, draws, 0, resources.object_count,
+                          stride);
+        return;
+    }
+    for (uint32_t i = 0; i < resources.object_count; i++) {
+        vkCmdDrawIndirect(commandBuffer, draws, VkDeviceSize{i} * stride, 1,
+                          stride);
+    }
+}
@@ -0,0 +1,143 @@
+/*
+ * @author: Avidel
+ * @LastEditors: Avidel
+ */
+#pragma once
+#include <cstdint>
+#include <span>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+#include <glm/glm.hpp>
+
+#include "bvh.hpp"
+
+class VulkanContextManager;
+class LayoutCache;
+
+// --- Hi-Z GPU Occlusion Culling ---
+// Two-phase occlusion culling that stays on the GPU: no readback, the cull
+// shaders write indirect draw commands that the prepass and the color pass
+// consume in the same command buffer.
+//
+// Per frame, outside any render pass:
+//   1. recordCull(Early): objects visible last frame and in the frustum
+//   2. beginDepthPass(Early), draw them with recordDraws(Early): clears depth
+//   3. recordPyramid(): one dispatch builds the max-depth mip chain
+//   4. recordCull(Late): every object against the pyramid; the newly
+//      visible ones form the late list, the result is next frame's input
+//   5. beginDepthPass(Late), recordDraws(Late): adds them to the depth
+// The color pass then draws both lists against the finished depth buffer.
+// Every object draws the same mesh; one indirect command per object with an
+// instance count of 0 or 1, and firstInstance selecting its world matrix.
+class HiZCuller {
+public:
+    enum class Phase { Early, Late };
+
+    static constexpr uint32_t MAX_MIPS = 12;  // Matches hiz_reduce.comp
+    static constexpr VkFormat DEPTH_FORMAT = VK_FORMAT_D32_SFLOAT;
+
+    // multiDrawIndirect: one vkCmdDrawIndirect per list instead of per object
+    HiZCuller(VulkanContextManager* context, LayoutCache& layoutCache,
+              uint32_t framesInFlight, uint32_t maxObjects,
+              bool multiDrawIndirect);
+    ~HiZCuller();
+
+    HiZCuller(const HiZCuller&) = delete;
+    HiZCuller& operator=(const HiZCuller&) = delete;
+
+    // Depth-only pass the prepass pipeline is created against. The clearing
+    // and the loading variant are compatible, either works.
+    VkRenderPass getDepthRenderPass() const { return clear_pass; }
+
+    // Swapchain dependent: the depth framebuffer, the pyramid and the sets
+    // that reference them. The depth view must be DEPTH_FORMAT, sampled and
+    // a depth attachment; instanceBuffers holds the world matrices of each
+    // frame in flight. Every object starts out visible again.
+    void createTargets(VkImageView depthView, VkExtent2D extent,
+                       std::span<const VkBuffer> instanceBuffers);
+    void destroyTargets();
+
+    // Cull inputs of this frame in flight; its fence must have been waited on
+    void update(uint32_t frame, const glm::mat4& viewProj,
+                const Aabb& meshBounds, uint32_t objectCount,
+                uint32_t vertexCount);
+
+    void recordCull(VkCommandBuffer commandBuffer, uint32_t frame,
+                    Phase phase);
+    // Early clears the depth buffer, late keeps it; end with
+    // vkCmdEndRenderPass. Leaves depth ready for sampling and testing.
+    void beginDepthPass(VkCommandBuffer commandBuffer, Phase phase);
+    void recordPyramid(VkCommandBuffer commandBuffer);
+    // Inside a render pass, with the pipeline, vertex buffer and scene set
+    // bound. Culled objects are draws with an instance count of 0.
+    void recordDraws(VkCommandBuffer commandBuffer, uint32_t frame,
+                     Phase phase) const;
+
+    uint32_t getMipCount() const { return mip_count; }
+
+private:
+    struct FrameResources {
+        VkBuffer uniform_buffer{VK_NULL_HANDLE};
+        VkDeviceMemory uniform_memory{VK_NULL_HANDLE};
+        void* uniform_mapped = nullptr;
+        VkBuffer early_draws{VK_NULL_HANDLE};
+        VkDeviceMemory early_memory{VK_NULL_HANDLE};
+        VkBuffer late_draws{VK_NULL_HANDLE};
+        VkDeviceMemory late_memory{VK_NULL_HANDLE};
+        VkDescriptorSet cull_set{VK_NULL_HANDLE};
+        uint32_t object_count = 0;
+    };
+
+    void createRenderPasses();
+    void createPipelines();
+    void createBuffers();
+    void createDescriptorPool();
+    VkRenderPass createDepthPass(VkAttachmentLoadOp loadOp,
+                                 VkImageLayout initialLayout);
+    VkPipeline createComputePipeline(std::span<const uint32_t> code,
+                                     VkDescriptorSetLayout& setLayout,
+                                     VkPipelineLayout& pipelineLayout);
+    void writeDescriptorSets(VkImageView depthView,
+                             std::span<const VkBuffer> instanceBuffers);
+
+    VulkanContextManager* context;
+    VkDevice device;
+    LayoutCache& layout_cache;
+    uint32_t max_objects;
+    bool multi_draw_indirect;
+
+    VkRenderPass clear_pass{VK_NULL_HANDLE};  // Early phase
+    VkRenderPass load_pass{VK_NULL_HANDLE};   // Late phase
+    VkFramebuffer depth_framebuffer{VK_NULL_HANDLE};
+    VkExtent2D depth_extent{0, 0};
+
+    // Layouts are owned by layout_cache
+    VkDescriptorSetLayout reduce_set_layout{VK_NULL_HANDLE};
+    VkPipelineLayout reduce_layout{VK_NULL_HANDLE};
+    VkPipeline reduce_pipeline{VK_NULL_HANDLE};
+    VkDescriptorSetLayout cull_set_layout{VK_NULL_HANDLE};
+    VkPipelineLayout cull_layout{VK_NULL_HANDLE};
+    VkPipeline cull_pipeline{VK_NULL_HANDLE};
+    VkDescriptorPool descriptor_pool{VK_NULL_HANDLE};
+    VkDescriptorSet reduce_set{VK_NULL_HANDLE};
+
+    // --- Depth Pyramid ---
+    VkImage pyramid{VK_NULL_HANDLE};
+    VkDeviceMemory pyramid_memory{VK_NULL_HANDLE};
+    VkImageView pyramid_view{VK_NULL_HANDLE};  // All mips, for sampling
+    std::vector<VkImageView> mip_views;        // One per mip, for storage
+    VkSampler sampler{VK_NULL_HANDLE};         // Nearest, clamped
+    VkExtent2D pyramid_extent{0, 0};           // Mip 0
+    uint32_t mip_count = 0;
+    uint32_t reduce_groups_x = 0;
+    uint32_t reduce_groups_y = 0;
+
+    // --- Buffers ---
+    VkBuffer visibility{VK_NULL_HANDLE};  // Last frame's result, per object
+    VkDeviceMemory visibility_memory{VK_NULL_HANDLE};
+    VkBuffer counter{VK_NULL_HANDLE};  // Finished groups of the reduce pass
+    VkDeviceMemory counter_memory{VK_NULL_HANDLE};
+    std::vector<FrameResources> frames;
+    bool reset_pending = true;  // Fill visibility and counter before use
+};
@@ -0,0 +1,240 @@
+/*
+ * @author: Avidel
+ * @LastEditors: Avidel
+ */
+#include "image_compare.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define COMPARE_X86 1
+#include <immintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define COMPARE_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace {
+constexpr uint32_t WINDOW = 8;
+constexpr uint32_t WINDOW_STRIDE = 4;
+// Wang et al. stabilizers, K1 = 0.01 and K2 = 0.03 of a luma range of 1
+constexpr double SSIM_C1 = 0.01 * 0.01;
+constexpr double SSIM_C2 = 0.03 * 0.03;
+
+struct WindowSums {
+    double x = 0.0;
+    double y = 0.0;
+    double xx = 0.0;
+    double yy = 0.0;
+    double xy = 0.0;
+};
+
+// Any window size, and images smaller than one window
+WindowSums sumWindowScalar(const float* x, const float* y, size_t pitch,
+                           uint32_t width, uint32_t height) {
+    WindowSums sums;
+    for (uint32_t row = 0; row < height; ++row) {
+        for (uint32_t i = 0; i < width; ++i) {
+            double a = x[row * pitch + i];
+            double b = y[row * pitch + i];
+            sums.x += a;
+            sums.y += b;
+            sums.xx += a * a;
+            sums.yy += b * b;
+            sums.xy += a * b;
+        }
+    }
+    return sums;
+}
+
+#if defined(COMPARE_X86)
+// --- SSE2 (x86-64 baseline) ---
+float horizontalSum(__m128 v) {
+    __m128 pairs = _mm_add_ps(v, _mm_movehl_ps(v, v));
+    return _mm_cvtss_f32(_mm_add_ss(pairs, _mm_shuffle_ps(pairs, pairs, 1)));
+}
+
+// WINDOW x WINDOW, two vectors per row
+WindowSums sumWindow(const float* x, const float* y, size_t pitch) {
+    __m128 sx = _mm_setzero_ps();
+    __m128 sy = _mm_setzero_ps();
+    __m128 sxx = _mm_setzero_ps();
+    __m128 syy = _mm_setzero_ps();
+    __m128 sxy = _mm_setzero_ps();
+    for (uint32_t row = 0; row < WINDOW; ++row) {
+        for (uint32_t i = 0; i < WINDOW; i += 4) {
+            __m128 a = _mm_loadu_ps(x + row * pitch + i);
+            __m128 b = _mm_loadu_ps(y + row * pitch + i);
+            sx = _mm_add_ps(sx, a);
+            sy = _mm_add_ps(sy, b);
+            sxx = _mm_add_ps(sxx, _mm_mul_ps(a, a));
+            syy = _mm_add_ps(syy, _mm_mul_ps(b, b));
+            sxy = _mm_add_ps(sxy, _mm_mul_ps(a, b));
+        }
+    }
+    return {horizontalSum(sx), horizontalSum(sy), horizontalSum(sxx),
+            horizontalSum(syy), horizontalSum(sxy)};
+}
+#elif defined(COMPARE_NEON)
+// --- NEON (AArch64 baseline) ---
+WindowSums sumWindow(const float* x, const float* y, size_t pitch) {
+    float32x4_t sx = vdupq_n_f32(0.0f);
+    float32x4_t sy = sx;
+    float32x4_t sxx = sx;
+    float32x4_t syy = sx;
+    float32x4_t sxy = sx;
+    for (uint32_t row = 0; row < WINDOW; ++row) {
+        for (uint32_t i = 0; i < WINDOW; i += 4) {
+            float32x4_t a = vld1q_f32(x + row * pitch + i);
+            float32x4_t b = vld1q_f32(y + row * pitch + i);
+            sx = vaddq_f32(sx, a);
+            sy = vaddq_f32(sy, b);
+            sxx = vfmaq_f32(sxx, a, a);
+            syy = vfmaq_f32(syy, b, b);
+            sxy = vfmaq_f32(sxy, a, b);
+        }
+    }
+    return {vaddvq_f32(sx), vaddvq_f32(sy), vaddvq_f32(sxx), vaddvq_f32(syy),
+            vaddvq_f32(sxy)};
+}
+#else
+WindowSums sumWindow(const float* x, const float* y, size_t pitch) {
+    return sumWindowScalar(x, y, pitch, WINDOW, WINDOW);
+}
+#endif
+
+double windowSsim(const WindowSums& sums, double count) {
+    double mean_x = sums.x / count;
+    double mean_y = sums.y / count;
+    double var_x = std::max(0.0, sums.xx / count - mean_x * mean_x);
+    double var_y = std::max(0.0, sums.yy / count - mean_y * mean_y);
+    double covariance = sums.xy / count - mean_x * mean_y;
+    return ((2.0 * mean_x * mean_y + SSIM_C1) * (2.0 * covariance + SSIM_C2)) /
+           ((mean_x * mean_x + mean_y * mean_y + SSIM_C1) *
+            (var_x + var_y + SSIM_C2));
+}
+
+// Rec. 601 weights on the encoded values, as SSIM is usually computed
+void toLuma(const uint8_t* rgba, size_t count, float* luma) {
+    for (size_t i = 0; i < count; ++i) {
+        const uint8_t* p = rgba + i * 4;
+        luma[i] = (0.299f * p[0] + 0.587f * p[1] + 0.114f * p[2]) / 255.0f;
+    }
+}
+
+struct Lab {
+    float l, a, b;
+};
+
+const std::array<float, 256>& srgbToLinear() {
+    static const std::array<float, 256> table = [] {
+        std::array<float, 256> values{};
+        for (int i = 0; i < 256; ++i) {
+            float c = i / 255.0f;
+            values[i] = c <= 0.04045f ? c / 12.92f
+                                      : std::pow((c + 0.055f) / 1.055f, 2.4f);
+        }
+        return values;
+    }();
+    return table;
+}
+
+float labCurve(float t) {
+    constexpr float EPSILON = 216.0f / 24389.0f;
+    constexpr float KAPPA = 24389.0f / 27.0f;
+    return t > EPSILON ? std::cbrt(t) : (KAPPA * t + 16.0f) / 116.0f;
+}
+
+// Linear sRGB to CIELAB, D65 white
+Lab toLab(float r, float g, float b) {
+    float x = (0.4124f * r + 0.3576f * g + 0.1805f * b) / 0.95047f;
+    float y = 0.2126f * r + 0.7152f * g + 0.0722f * b;
+    float z = (0.0193f * r + 0.1192f * g + 0.9505f * b) / 1.08883f;
+    float fx = labCurve(x);
+    float fy = labCurve(y);
+    float fz = labCurve(z);
+    return {116.0f * fy - 16.0f, 500.0f * (fx - fy), 200.0f * (fy - fz)};
+}
+
+Lab toLab(const uint8_t* rgba) {
+    const auto& linear = srgbToLinear();
+    return toLab(linear[rgba[0]], linear[rgba[1]], linear[rgba[2]]);
+}
+
+// Lightness and chroma differences added, which suits large differences
+// better than Euclidean distance does
+float hyab(const Lab& p, const Lab& q) {
+    float da = p.a - q.a;
+    float db = p.b - q.b;
+    return std::abs(p.l - q.l) + std::sqrt(da * da + db * db);
+}
+}  // namespace
+
+ImageDifference compareImages(const uint8_t* reference, const uint8_t* test,
+                              uint32_t width, uint32_t height,
+                              float errorThreshold,
+                              std::vector<uint8_t>* errorMap) {
+    ImageDifference difference;
+    const size_t count = size_t(width) * height;
+    if (count == 0) {
+        return difference;
+    }
+
+    // --- SSIM ---
+    std::vector<float> luma_x(count);
+    std::vector<float> luma_y(count);
+    toLuma(reference, count, luma_x.data());
+    toLuma(test, count, luma_y.data());
+    if (width < WINDOW || height < WINDOW) {
+        difference.ssim = windowSsim(
+            sumWindowScalar(luma_x.data(), luma_y.data(), width, width, height),
+            double(count));
+    } else {
+        double total = 0.0;
+        size_t windows = 0;
+        for (uint32_t y = 0; y + WINDOW <= height; y += WINDOW_STRIDE) {
+            for (uint32_t x = 0; x + WINDOW <= width; x += WINDOW_STRIDE) {
+                size_t offset = size_t(y) * width + x;
+                total += windowSsim(sumWindow(luma_x.data() + offset,
+                                              luma_y.data() + offset, width),
+                                    WINDOW * WINDOW);
+                ++windows;
+            }
+        }
+        difference.ssim = total / double(windows);
+    }
+
+    // --- Color Error ---
+    const float scale = 1.0f / hyab(toLab(0.0f, 1.0f, 0.0f),
+                                    toLab(0.0f, 0.0f, 1.0f));
+    if (errorMap) {
+        errorMap->resize(count * 4);
+    }
+    double total_error = 0.0;
+    size_t above = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const uint8_t* p = reference + i * 4;
+        const uint8_t* q = test + i * 4;
+        float error = 0.0f;
+        if (p[0] != q[0] || p[1] != q[1] || p[2] != q[2]) {
+            error = std::min(1.0f, hyab(toLab(p), toLab(q)) * scale);
+        }
+        total_error += error;
+        difference.max_error = std::max(difference.max_error, double(error));
+        above += error > errorThreshold;
+        if (errorMap) {
+            uint8_t* out = errorMap->data() + i * 4;
+            uint8_t level = static_cast<uint8_t>(error * 255.0f + 0.5f);
+            bool over = error > errorThreshold;
+            out[0] = over ? 255 : level;
+            out[1] = over ? 0 : level;
+            out[2] = over ? 0 : level;
+            out[3] = 255;
+        }
+    }
+    difference.mean_error = total_error / double(count);
+    difference.error_fraction = double(above) / double(count);
+    return difference;
+}
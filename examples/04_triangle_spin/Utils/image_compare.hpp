@@ -0,0 +1,31 @@
+/*
+ * @author: Avidel
+ * @LastEditors: Avidel
+ */
+#pragma once
+#include <cstdint>
+#include <vector>
+
+// --- Image Comparison ---
+// Metrics of a rendered image against a reference, for golden-image tests:
+//   ssim: mean structural similarity of the luma over 8x8 windows at a
+//     stride of 4, 1 for identical images. The window statistics are
+//     4-wide SIMD (SSE2 or NEON), scalar elsewhere.
+//   color error: FLIP-style per pixel difference, the HyAB distance in
+//     CIELAB scaled so that pure green against pure blue is 1. Unlike FLIP
+//     there is no contrast sensitivity filter and no edge term, so it
+//     over-reports noise-like differences slightly.
+struct ImageDifference {
+    double ssim = 1.0;
+    double mean_error = 0.0;     // Color error, 0..1
+    double max_error = 0.0;
+    double error_fraction = 0.0;  // Pixels with an error above the threshold
+};
+
+// Both images RGBA8 sRGB, tightly packed and of the same size; alpha is
+// ignored. errorMap, when given, receives the color error as an RGBA8 heat
+// map, black for none and red above the threshold.
+ImageDifference compareImages(const uint8_t* reference, const uint8_t* test,
+                              uint32_t width, uint32_t height,
+                              float errorThreshold,
+                              std::vector<uint8_t>* errorMap = nullptr);
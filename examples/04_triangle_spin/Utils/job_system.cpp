@@ -0,0 +1,120 @@
+/*
+ * @author: Avidel
+ * @LastEditors: Avidel
+ */
+#include "job_system.hpp"
+
+#include <algorithm>
+#include <atomic>
+
+// One parallelFor() call. Queued once per helping worker; whoever pops it
+// claims chunks until none are left. Shared so a worker that pops it late,
+// after the caller has returned, still touches valid memory.
+struct JobSystem::ParallelJob {
+    const RangeFunction* fn = nullptr;  // Only dereferenced for a claimed chunk
+    size_t count = 0;
+    size_t grain_size = 1;
+    size_t chunk_count = 0;
+    std::atomic<size_t> next_chunk{0};
+    std::atomic<size_t> done_chunks{0};
+    std::mutex done_mutex;
+    std::condition_variable done_cv;  // Signals the caller: last chunk done
+};
+
+JobSystem::JobSystem(uint32_t threadCount) {
+    if (threadCount == 0) {
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (uint32_t i = 1; i < threadCount; ++i) {
+        workers.emplace_back(&JobSystem::workerLoop, this);
+    }
+}
+
+JobSystem::~JobSystem() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        queue.clear();
+    }
+    work_cv.notify_all();
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+void JobSystem::parallelFor(size_t count, size_t grainSize,
+                            const RangeFunction& fn) {
+    if (count == 0) {
+        return;
+    }
+    grainSize = std::max<size_t>(grainSize, 1);
+    size_t chunk_count = (count + grainSize - 1) / grainSize;
+    if (chunk_count == 1 || workers.empty()) {
+        fn(0, count);
+        return;
+    }
+
+    auto job = std::make_shared<ParallelJob>();
+    job->fn = &fn;
+    job->count = count;
+    job->grain_size = grainSize;
+    job->chunk_count = chunk_count;
+
+    // The caller takes a share as well, so one helper fewer is enough
+    size_t helpers = std::min(workers.size(), chunk_count - 1);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = 0; i < helpers; ++i) {
+            queue.push_back(job);
+        }
+    }
+    if (helpers == 1) {
+        work_cv.notify_one();
+    } else {
+        work_cv.notify_all();
+    }
+
+    runChunks(*job);
+
+    std::unique_lock<std::mutex> lock(job->done_mutex);
+    job->done_cv.wait(lock, [&job] {
+        return job->done_chunks.load(std::memory_order_acquire) ==
+               job->chunk_count;
+    });
+}
+
+void JobSystem::runChunks(ParallelJob& job) {
+    while (true) {
+        size_t chunk = job.next_chunk.fetch_add(1, std::memory_order_relaxed);
+        if (chunk >= job.chunk_count) {
+            return;
+        }
+        size_t begin = chunk * job.grain_size;
+        size_t end = std::min(begin + job.grain_size, job.count);
+        (*job.fn)(begin, end);
+
+        if (job.done_chunks.fetch_add(1, std::memory_order_acq_rel) + 1 ==
+            job.chunk_count) {
+            // Lock so the caller cannot miss the wakeup between its predicate
+            // check and going to sleep
+            std::lock_guard<std::mutex> lock(job.done_mutex);
+            job.done_cv.notify_all();
+        }
+    }
+}
+
+void JobSystem::workerLoop() {
+    while (true) {
+        std::shared_ptr<ParallelJob> job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            work_cv.wait(lock, [this] { return stopping || !queue.empty(); });
+            if (stopping) {
+                return;
+            }
+            job = std::move(queue.front());
+            queue.pop_front();
+        }
+        runChunks(*job);
+    }
+}
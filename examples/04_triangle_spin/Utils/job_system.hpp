@@ -0,0 +1,55 @@
+/*
+ * @author: Avidel
+ * @LastEditors: Avidel
+ */
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// --- Job System ---
+// A fixed pool of worker threads for data-parallel CPU work (scene updates,
+// culling). The thread calling parallelFor() works on the range too, so nested
+// calls from inside a job cannot deadlock, they just get less help.
+class JobSystem {
+public:
+    // fn(begin, end) processes the half-open index range [begin, end)
+    using RangeFunction = std::function<void(size_t begin, size_t end)>;
+
+    // threadCount includes the calling thread; 0 picks the hardware thread
+    // count and 1 runs everything inline
+    explicit JobSystem(uint32_t threadCount = 0);
+    ~JobSystem();  // Joins the workers; queued jobs are dropped
+
+    JobSystem(const JobSystem&) = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
+
+    // Split [0, count) into chunks of grainSize indices and run fn on them in
+    // parallel. Returns once every chunk is done. fn must not throw. Ranges
+    // of a single chunk run inline on the calling thread.
+    void parallelFor(size_t count, size_t grainSize, const RangeFunction& fn);
+
+    // Workers plus the calling thread
+    uint32_t getThreadCount() const {
+        return static_cast<uint32_t>(workers.size()) + 1;
+    }
+
+private:
+    struct ParallelJob;
+
+    void workerLoop();
+    static void runChunks(ParallelJob& job);
+
+    std::mutex mutex;
+    std::condition_variable work_cv;  // Signals workers: new job or stop
+    std::deque<std::shared_ptr<ParallelJob>> queue;
+    bool stopping = false;
+
+    std::vector<std::thread> workers;
+};
@@ -0,0 +1,148 @@
+/*
+ * @author: Avidel
+ * @LastEditors: Avidel
+ */
+#include "layout_cache.hpp"
+
+#include "hash_util.hpp"
+#include <spdlog/spdlog.h>
+
+#include <stdexcept>
+
+namespace {
+using hash_util::equalRange;
+using hash_util::FNV_OFFSET;
+using hash_util::hashRange;
+using hash_util::hashValue;
+
+// The fields getSetLayout() hashes, compared one by one for the same reason
+bool sameBindings(const std::vector<VkDescriptorSetLayoutBinding>& a,
+                  const std::vector<VkDescriptorSetLayoutBinding>& b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (a[i].binding != b[i].binding ||
+            a[i].descriptorType != b[i].descriptorType ||
+            a[i].descriptorCount != b[i].descriptorCount ||
+            a[i].stageFlags != b[i].stageFlags ||
+            a[i].pImmutableSamplers != b[i].pImmutableSamplers) {
+            return false;
+        }
+    }
+    return true;
+}
+}  // namespace
+
+LayoutCache::LayoutCache(VkDevice device) : device(device) {}
+
+LayoutCache::~LayoutCache() {
+    for (const auto& [hash, cached] : pipeline_layouts) {
+        vkDestroyPipelineLayout(device, cached.layout, nullptr);
+    }
+    for (const auto& [hash, cached] : set_layouts) {
+        vkDestroyDescriptorSetLayout(device, cached.layout, nullptr);
+    }
+}
+
+VkDescriptorSetLayout LayoutCache::getSetLayout(
+    const std::vector<VkDescriptorSetLayoutBinding>& bindings,
+    VkDescriptorSetLayoutCreateFlags flags) {
+    // Field by field: the struct has padding before pImmutableSamplers
+    uint64_t hash = FNV_OFFSET;
+    hashValue(hash, flags);
+    for (const auto& binding : bindings) {
+        hashValue(hash, binding.binding);
+        hashValue(hash, binding.descriptorType);
+        hashValue(hash, binding.descriptorCount);
+        hashValue(hash, binding.stageFlags);
+        hashValue(hash, binding.pImmutableSamplers);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto [first, last] = set_layouts.equal_range(hash);
+    for (auto it = first; it != last; ++it) {
+        if (it->second.flags == flags &&
+            sameBindings(it->second.bindings, bindings)) {
+            return it->second.layout;
+        }
+    }
+
+    VkDescriptorSetLayoutCreateInfo layout_info{};
+    layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layout_info.flags = flags;
+    layout_info.bindingCount = static_cast<uint32_t>(bindings.size());
+    layout_info.pBindings = bindings.data();
+
+    VkDescriptorSetLayout layout;
+    if (vkCreateDescriptorSetLayout(device, &layout_info, nullptr, &layout) !=
+        VK_SUCCESS) {
+        throw std::runtime_error("failed to create descriptor set layout!");
+    }
+    set_layouts.emplace(hash, CachedSetLayout{flags, bindings, layout});
+    spdlog::debug("Layout cache: new descriptor set layout ({} bindings).",
+                  bindings.size());
+    return layout;
+}
+
+VkPipelineLayout LayoutCache::getPipelineLayout(
+    const std::vector<VkDescriptorSetLayout>& setLayouts,
+    const std::vector<VkPushConstantRange>& pushConstants) {
+    // Set layouts are deduplicated above, so their handles identify them
+    uint64_t hash = FNV_OFFSET;
+    hashRange(hash, setLayouts);
+    hashRange(hash, pushConstants);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto [first, last] = pipeline_layouts.equal_range(hash);
+    for (auto it = first; it != last; ++it) {
+        if (equalRange(it->second.set_layouts, setLayouts) &&
+            equalRange(it->second.push_constants, pushConstants)) {
+            return it->second.layout;
+        }
+    }
+
+    VkPipelineLayoutCreateInfo pipeline_layout_info{};
+    pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipeline_layout_info.setLayoutCount =
+        static_cast<uint32_t>(setLayouts.size());
+    pipeline_layout_info.pSetLayouts = setLayouts.data();
+    pipeline_layout_info.pushConstantRangeCount =
+        static_cast<uint32_t>(pushConstants.size());
+    pipeline_layout_info.pPushConstantRanges = pushConstants.data();
+
+    VkPipelineLayout layout;
+    if (vkCreatePipelineLayout(device, &pipeline_layout_info, nullptr,
+                               &layout) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create pipeline layout!");
+    }
+    pipeline_layouts.emplace(
+        hash, CachedPipelineLayout{setLayouts, pushConstants, layout});
+    spdlog::debug("Layout cache: new pipeline layout ({} sets, {} ranges).",
+                  setLayouts.size(), pushConstants.size());
+    return layout;
+}
+
+LayoutCache::PipelineLayoutInfo LayoutCache::getLayouts(
+    const ShaderReflection& reflection,
+    VkDescriptorSetLayoutCreateFlags flags) {
+    PipelineLayoutInfo info;
+    // Sets the shaders skip still need a (possibly empty) layout
+    for (uint32_t set = 0; set < reflection.getSetCount(); ++set) {
+        info.set_layouts.push_back(
+            getSetLayout(reflection.getSetBindings(set), flags));
+    }
+    info.pipeline_layout =
+        getPipelineLayout(info.set_layouts, reflection.push_constants);
+    return info;
+}
+
+size_t LayoutCache::getSetLayoutCount() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return set_layouts.size();
+}
+
+size_t LayoutCache::getPipelineLayoutCount() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return pipeline_layouts.size();
+}
@@ -0,0 +1,63 @@
+/*
+ * @author: Avidel
+ * @LastEditors: Avidel
+ */
+#pragma once
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+#include "spirv_reflect.hpp"
+
+// --- Layout Cache ---
+// Owns descriptor set layouts and pipeline layouts, keyed by a hash of their
+// create info and compared in full on a hit. Pipelines with identical interfaces share the same objects, and
+// recreating a layout with the same bindings just returns the cached handle.
+class LayoutCache {
+public:
+    struct PipelineLayoutInfo {
+        std::vector<VkDescriptorSetLayout> set_layouts;  // Indexed by set
+        VkPipelineLayout pipeline_layout = VK_NULL_HANDLE;
+    };
+
+    explicit LayoutCache(VkDevice device);
+    ~LayoutCache();  // Destroys every cached layout
+
+    LayoutCache(const LayoutCache&) = delete;
+    LayoutCache& operator=(const LayoutCache&) = delete;
+
+    VkDescriptorSetLayout getSetLayout(
+        const std::vector<VkDescriptorSetLayoutBinding>& bindings,
+        VkDescriptorSetLayoutCreateFlags flags = 0);
+    VkPipelineLayout getPipelineLayout(
+        const std::vector<VkDescriptorSetLayout>& setLayouts,
+        const std::vector<VkPushConstantRange>& pushConstants);
+
+    // Set layouts for every set the shaders use plus the pipeline layout
+    PipelineLayoutInfo getLayouts(const ShaderReflection& reflection,
+                                  VkDescriptorSetLayoutCreateFlags flags = 0);
+
+    size_t getSetLayoutCount() const;
+    size_t getPipelineLayoutCount() const;
+
+private:
+    VkDevice device;
+
+    // Create info kept next to each layout, so a hash collision is a miss
+    struct CachedSetLayout {
+        VkDescriptorSetLayoutCreateFlags flags;
+        std::vector<VkDescriptorSetLayoutBinding> bindings;
+        VkDescriptorSetLayout layout;
+    };
+    struct CachedPipelineLayout {
+        std::vector<VkDescriptorSetLayout> set_layouts;
+        std::vector<VkPushConstantRange> push_constants;
+        VkPipelineLayout layout;
+    };
+
+    mutable std::mutex mutex;  // Reflection may run on the hot reload thread
+    std::unordered_multimap<uint64_t, CachedSetLayout> set_layouts;
+    std::unordered_multimap<uint64_t, CachedPipelineLayout> pipeline_layouts;
+};
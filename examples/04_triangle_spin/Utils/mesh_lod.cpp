@@ -0,0 +1,626 @@
+/*
+ * @author: Avidel
+ * @LastEditors: Avidel
+ */
+#include "mesh_lod.hpp"
+
+#include "job_system.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+
+namespace {
+// Border planes outweigh the surface so open edges stay in place
+constexpr float BORDER_WEIGHT = 10.0f;
+// A level that keeps more than this fraction of its source ends the chain
+constexpr float STALL_RATIO = 0.9f;
+// Closer than this to the bounding sphere counts as inside it
+constexpr float MIN_DISTANCE = 1e-3f;
+constexpr size_t SELECT_GRAIN = 4096;
+
+// Sum of weighted squared plane distances, Q(p) = p'Ap + 2b'p + c, with the
+// symmetric A kept as its upper triangle. Doubles, since the terms cancel.
+struct Quadric {
+    double a00 = 0.0, a01 = 0.0, a02 = 0.0, a11 = 0.0, a12 = 0.0, a22 = 0.0;
+    double b0 = 0.0, b1 = 0.0, b2 = 0.0;
+    double c = 0.0;
+    double weight = 0.0;  // Turns the sum into a mean squared distance
+
+    // Plane dot(normal, p) + distance = 0 with a unit normal
+    void addPlane(const glm::vec3& normal, float distance, float w) {
+        double x = normal.x, y = normal.y, z = normal.z, d = distance;
+        a00 += w * x * x;
+        a01 += w * x * y;
+        a02 += w * x * z;
+        a11 += w * y * y;
+        a12 += w * y * z;
+        a22 += w * z * z;
+        b0 += w * x * d;
+        b1 += w * y * d;
+        b2 += w * z * d;
+        c += w * d * d;
+        weight += w;
+    }
+
+    void add(const Quadric& other) {
+        a00 += other.a00;
+        a01 += other.a01;
+        a02 += other.a02;
+        a11 += other.a11;
+        a12 += other.a12;
+        a22 += other.a22;
+        b0 += other.b0;
+        b1 += other.b1;
+        b2 += other.b2;
+        c += other.c;
+        weight += other.weight;
+    }
+
+    double evaluate(const glm::vec3& p) const {
+        double x = p.x, y = p.y, z = p.z;
+        double value = a00 * x * x + a11 * y * y + a22 * z * z +
+                       2.0 * (a01 * x * y + a02 * x * z + a12 * y * z) +
+                       2.0 * (b0 * x + b1 * y + b2 * z) + c;
+        return std::max(value, 0.0);  // Rounding can go slightly negative
+    }
+};
+
+struct EdgeRef {
+    uint64_t key;  // Lower vertex in the high half
+    uint32_t triangle;
+};
+
+struct Collapse {
+    uint32_t from;
+    uint32_t to;
+    double cost;  // Mean squared distance after the collapse
+};
+
+struct PositionKey {
+    uint32_t bits[3];
+    bool operator==(const PositionKey& other) const {
+        return bits[0] == other.bits[0] && bits[1] == other.bits[1] &&
+               bits[2] == other.bits[2];
+    }
+};
+
+struct PositionKeyHash {
+    size_t operator()(const PositionKey& key) const {
+        uint64_t h = key.bits[0] * 73856093ull ^ key.bits[1] * 19349663ull ^
+                     key.bits[2] * 83492791ull;
+        return static_cast<size_t>(h);
+    }
+};
+
+// Maps every vertex to the lowest index with the same position
+std::vector<uint32_t> weldPositions(std::span<const glm::vec3> positions) {
+    std::vector<uint32_t> remap(positions.size());
+    std::unordered_map<PositionKey, uint32_t, PositionKeyHash> first;
+    first.reserve(positions.size());
+    for (size_t i = 0; i < positions.size(); ++i) {
+        PositionKey key;
+        std::memcpy(key.bits, &positions[i].x, sizeof(float));
+        std::memcpy(key.bits + 1, &positions[i].y, sizeof(float));
+        std::memcpy(key.bits + 2, &positions[i].z, sizeof(float));
+        remap[i] = first.emplace(key, static_cast<uint32_t>(i)).first->second;
+    }
+    return remap;
+}
+
+uint64_t edgeKey(uint32_t a, uint32_t b) {
+    return a < b ? (uint64_t(a) << 32) | b : (uint64_t(b) << 32) | a;
+}
+
+// Three per triangle, sorted so shared edges are adjacent
+std::vector<EdgeRef> collectEdges(const std::vector<uint32_t>& triangles) {
+    std::vector<EdgeRef> edges;
+    edges.reserve(triangles.size());
+    for (size_t i = 0; i < triangles.size(); i += 3) {
+        auto t = static_cast<uint32_t>(i / 3);
+        edges.push_back({edgeKey(triangles[i], triangles[i + 1]), t});
+        edges.push_back({edgeKey(triangles[i + 1], triangles[i + 2]), t});
+        edges.push_back({edgeKey(triangles[i + 2], triangles[i]), t});
+    }
+    std::sort(edges.begin(), edges.end(),
+              [](const EdgeRef& a, const EdgeRef& b) { return a.key < b.key; });
+    return edges;
+}
+
+glm::vec3 triangleNormal(const glm::vec3& a, const glm::vec3& b,
+                         const glm::vec3& c) {
+    return glm::cross(b - a, c - a);  // Length is twice the area
+}
+
+std::vector<Quadric> computeQuadrics(std::span<const glm::vec3> positions,
+                                     const std::vector<uint32_t>& triangles) {
+    std::vector<Quadric> quadrics(positions.size());
+    for (size_t i = 0; i < triangles.size(); i += 3) {
+        const glm::vec3& p0 = positions[triangles[i]];
+        glm::vec3 normal = triangleNormal(p0, positions[triangles[i + 1]],
+                                          positions[triangles[i + 2]]);
+        float length = glm::length(normal);
+        if (length <= 0.0f) {
+            continue;
+        }
+        normal = normal / length;
+        float distance = -glm::dot(normal, p0);
+        for (size_t k = 0; k < 3; ++k) {
+            quadrics[triangles[i + k]].addPlane(normal, distance,
+                                                length * 0.5f);
+        }
+    }
+
+    // An edge used by one triangle only is on a border: add the plane through
+    // it perpendicular to the triangle, so sliding off the border costs
+    std::vector<EdgeRef> edges = collectEdges(triangles);
+    for (size_t i = 0; i < edges.size(); ++i) {
+        uint64_t key = edges[i].key;
+        bool shared = (i > 0 && edges[i - 1].key == key) ||
+                      (i + 1 < edges.size() && edges[i + 1].key == key);
+        if (shared) {
+            continue;
+        }
+        auto a = static_cast<uint32_t>(key >> 32);
+        auto b = static_cast<uint32_t>(key & 0xffffffffu);
+        const uint32_t* t = &triangles[size_t(edges[i].triangle) * 3];
+        glm::vec3 face = triangleNormal(positions[t[0]], positions[t[1]],
+                                        positions[t[2]]);
+        glm::vec3 edge = positions[b] - positions[a];
+        glm::vec3 normal = glm::cross(edge, face);
+        float length = glm::length(normal);
+        if (length <= 0.0f) {
+            continue;
+        }
+        normal = normal / length;
+        float distance = -glm::dot(normal, positions[a]);
+        float weight = glm::dot(edge, edge) * BORDER_WEIGHT;
+        quadrics[a].addPlane(normal, distance, weight);
+        quadrics[b].addPlane(normal, distance, weight);
+    }
+    return quadrics;
+}
+
+double collapseCost(const Quadric& from, const Quadric& to,
+                    const glm::vec3& position) {
+    Quadric sum = from;
+    sum.add(to);
+    return sum.weight > 0.0 ? sum.evaluate(position) / sum.weight : 0.0;
+}
+
+// True if moving from onto to turns any surviving triangle around from over
+// or collapses it to a line
+bool flipsTriangle(std::span<const glm::vec3> positions,
+                   const std::vector<uint32_t>& triangles,
+                   std::span<const uint32_t> around, uint32_t from,
+                   uint32_t to) {
+    for (uint32_t t : around) {
+        const uint32_t* v = &triangles[size_t(t) * 3];
+        if (v[0] == to || v[1] == to || v[2] == to) {
+            continue;  // Removed by the collapse
+        }
+        glm::vec3 p[3];
+        glm::vec3 q[3];
+        for (int k = 0; k < 3; ++k) {
+            p[k] = positions[v[k]];
+            q[k] = v[k] == from ? positions[to] : p[k];
+        }
+        glm::vec3 before = triangleNormal(p[0], p[1], p[2]);
+        glm::vec3 after = triangleNormal(q[0], q[1], q[2]);
+        if (glm::dot(before, after) <= 0.0f) {
+            return true;
+        }
+    }
+    return false;
+}
+}  // namespace
+
+SimplifyResult simplifyMesh(std::span<const glm::vec3> positions,
+                            std::span<const uint32_t> indices,
+                            size_t targetIndexCount, float maxError) {
+    SimplifyResult result;
+    std::vector<uint32_t> remap = weldPositions(positions);
+    std::vector<uint32_t>& triangles = result.indices;
+    triangles.reserve(indices.size());
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+        uint32_t a = remap[indices[i]];
+        uint32_t b = remap[indices[i + 1]];
+        uint32_t c = remap[indices[i + 2]];
+        if (a != b && b != c && c != a) {
+            triangles.insert(triangles.end(), {a, b, c});
+        }
+    }
+
+    const size_t vertex_count = positions.size();
+    std::vector<Quadric> quadrics = computeQuadrics(positions, triangles);
+    const double max_cost = double(maxError) * double(maxError);
+    double applied_cost = 0.0;
+
+    std::vector<uint32_t> collapsed(vertex_count);
+    std::vector<uint8_t> locked(vertex_count);
+    std::vector<uint32_t> around_offsets(vertex_count + 1);
+    std::vector<uint32_t> around;
+    std::vector<Collapse> collapses;
+
+    // Each pass collapses the cheapest edges that do not touch each other,
+    // then rebuilds the triangle list; passes repeat until the target
+    while (triangles.size() > targetIndexCount) {
+        // Triangles around each vertex, as offsets into around
+        std::fill(around_offsets.begin(), around_offsets.end(), 0);
+        for (uint32_t v : triangles) {
+            ++around_offsets[v + 1];
+        }
+        for (size_t v = 0; v < vertex_count; ++v) {
+            around_offsets[v + 1] += around_offsets[v];
+        }
+        around.resize(triangles.size());
+        std::vector<uint32_t> fill(around_offsets.begin(),
+                                   around_offsets.end() - 1);
+        for (size_t i = 0; i < triangles.size(); ++i) {
+            around[fill[triangles[i]]++] = static_cast<uint32_t>(i / 3);
+        }
+
+        // Cheaper direction of every edge
+        std::vector<EdgeRef> edges = collectEdges(triangles);
+        collapses.clear();
+        for (size_t i = 0; i < edges.size(); ++i) {
+            if (i > 0 && edges[i - 1].key == edges[i].key) {
+                continue;
+            }
+            auto a = static_cast<uint32_t>(edges[i].key >> 32);
+            auto b = static_cast<uint32_t>(edges[i].key & 0xffffffffu);
+            double onto_b =
+                collapseCost(quadrics[a], quadrics[b], positions[b]);
+            double onto_a =
+                collapseCost(quadrics[b], quadrics[a], positions[a]);
+            collapses.push_back(onto_b <= onto_a ? Collapse{a, b, onto_b}
+                                                 : Collapse{b, a, onto_a});
+        }
+        std::sort(collapses.begin(), collapses.end(),
+                  [](const Collapse& x, const Collapse& y) {
+                      return x.cost < y.cost;
+                  });
+
+        std::fill(locked.begin(), locked.end(), 0);
+        for (size_t v = 0; v < vertex_count; ++v) {
+            collapsed[v] = static_cast<uint32_t>(v);
+        }
+        const size_t target_triangles = targetIndexCount / 3;
+        size_t triangle_count = triangles.size() / 3;
+        bool progress = false;
+        for (const Collapse& collapse : collapses) {
+            if (collapse.cost > max_cost ||
+                triangle_count <= target_triangles) {
+                break;
+            }
+            if (locked[collapse.from] || locked[collapse.to]) {
+                continue;
+            }
+            std::span<const uint32_t> from_around(
+                around.data() + around_offsets[collapse.from],
+                around_offsets[collapse.from + 1] -
+                    around_offsets[collapse.from]);
+            if (flipsTriangle(positions, triangles, from_around,
+                              collapse.from, collapse.to)) {
+                continue;
+            }
+
+            collapsed[collapse.from] = collapse.to;
+            quadrics[collapse.to].add(quadrics[collapse.from]);
+            applied_cost = std::max(applied_cost, collapse.cost);
+            progress = true;
+            // Neighbours keep their positions for the flip tests of this pass
+            for (uint32_t t : from_around) {
+                const uint32_t* v = &triangles[size_t(t) * 3];
+                locked[v[0]] = locked[v[1]] = locked[v[2]] = 1;
+                if (v[0] == collapse.to || v[1] == collapse.to ||
+                    v[2] == collapse.to) {
+                    --triangle_count;
+                }
+            }
+        }
+        if (!progress) {
+            break;
+        }
+
+        // A collapsed vertex's target was locked, so one lookup suffices
+        size_t write = 0;
+        for (size_t i = 0; i < triangles.size(); i += 3) {
+            uint32_t a = collapsed[triangles[i]];
+            uint32_t b = collapsed[triangles[i + 1]];
+            uint32_t c = collapsed[triangles[i + 2]];
+            if (a != b && b != c && c != a) {
+                triangles[write++] = a;
+                triangles[write++] = b;
+                triangles[write++] = c;
+            }
+        }
+        triangles.resize(write);
+    }
+
+    result.error = static_cast<float>(std::sqrt(applied_cost));
+    return result;
+}
+
+LodChain buildLodChain(std::span<const glm::vec3> positions,
+                       std::span<const uint32_t> indices, uint32_t maxLevels) {
+    LodChain chain;
+    for (uint32_t index : indices) {
+        chain.bounds.expand(positions[index]);
+    }
+    glm::vec3 center = chain.bounds.center();
+    for (uint32_t index : indices) {
+        chain.radius =
+            std::max(chain.radius, glm::length(positions[index] - center));
+    }
+
+    chain.indices.assign(indices.begin(), indices.end());
+    chain.levels.push_back(
+        {0, static_cast<uint32_t>(indices.size()), 0.0f});
+
+    std::vector<uint32_t> source(indices.begin(), indices.end());
+    float error = 0.0f;
+    maxLevels = std::min(maxLevels, MAX_LOD_LEVELS);
+    while (chain.levels.size() < maxLevels) {
+        size_t target = source.size() / 6 * 3;  // Half the triangles
+        if (target < MIN_LOD_TRIANGLES * 3) {
+            break;
+        }
+        SimplifyResult level = simplifyMesh(
+            positions, source, target, std::numeric_limits<float>::max());
+        if (level.indices.size() > source.size() * STALL_RATIO) {
+            break;
+        }
+        error += level.error;
+        chain.levels.push_back({static_cast<uint32_t>(chain.indices.size()),
+                                static_cast<uint32_t>(level.indices.size()),
+                                error});
+        chain.indices.insert(chain.indices.end(), level.indices.begin(),
+                             level.indices.end());
+        source = std::move(level.indices);
+    }
+    return chain;
+}
+
+void LodSelector::setCamera(const glm::vec3& eye, float fovY,
+                            float viewportHeight) {
+    this->eye = eye;
+    projection_scale = viewportHeight / (2.0f * std::tan(fovY * 0.5f));
+}
+
+float LodSelector::getScreenError(const LodChain& chain, uint32_t level,
+                                  const LodInstance& instance) const {
+    float error = chain.levels[level].error * instance.scale;
+    if (error <= 0.0f) {
+        return 0.0f;
+    }
+    float distance = glm::length(instance.center - eye) - instance.radius;
+    if (distance < MIN_DISTANCE) {
+        return std::numeric_limits<float>::max();
+    }
+    return error * projection_scale / distance;
+}
+
+void LodSelector::select(std::span<const LodChain> chains,
+                         std::span<const LodInstance> instances,
+                         std::vector<uint8_t>& levels) {
+    last_stats = {};
+    levels.resize(instances.size(), 0);
+    previous.assign(levels.begin(), levels.end());
+
+    const float refine_threshold = settings.max_pixel_error;
+    const float coarsen_threshold =
+        settings.max_pixel_error * (1.0f - settings.hysteresis);
+    jobs.parallelFor(
+        instances.size(), SELECT_GRAIN, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                const LodInstance& instance = instances[i];
+                const LodChain& chain = chains[instance.chain];
+                uint32_t last = chain.getLevelCount() - 1;
+                uint32_t current = std::min<uint32_t>(levels[i], last);
+                bool refine =
+                    getScreenError(chain, current, instance) > refine_threshold;
+                float limit = refine ? refine_threshold : coarsen_threshold;
+                // Errors grow with the level, so stop at the first too large
+                uint32_t level = 0;
+                while (level < last &&
+                       getScreenError(chain, level + 1, instance) <= limit) {
+                    ++level;
+                }
+                if (!refine) {
+                    level = std::max(level, current);
+                }
+                levels[i] = static_cast<uint8_t>(level);
+            }
+        });
+
+    uint64_t triangles = 0;
+    for (size_t i = 0; i < instances.size(); ++i) {
+        const LodChain& chain = chains[instances[i].chain];
+        triangles += chain.levels[levels[i]].index_count / 3;
+    }
+    last_stats.error_triangles = triangles;
+
+    if (settings.triangle_budget != 0 && triangles > settings.triangle_budget) {
+        // Min-heap on the pixel error of each instance's next coarser level
+        struct Step {
+            float error;
+            uint32_t instance;
+        };
+        auto later = [](const Step& a, const Step& b) {
+            return a.error > b.error;
+        };
+        std::vector<Step> heap;
+        for (size_t i = 0; i < instances.size(); ++i) {
+            const LodChain& chain = chains[instances[i].chain];
+            if (levels[i] + 1u < chain.getLevelCount()) {
+                heap.push_back(
+                    {getScreenError(chain, levels[i] + 1u, instances[i]),
+                     static_cast<uint32_t>(i)});
+            }
+        }
+        std::make_heap(heap.begin(), heap.end(), later);
+        while (triangles > settings.triangle_budget && !heap.empty()) {
+            std::pop_heap(heap.begin(), heap.end(), later);
+            uint32_t i = heap.back().instance;
+            heap.pop_back();
+
+            const LodChain& chain = chains[instances[i].chain];
+            uint32_t level = levels[i];
+            triangles -= (chain.levels[level].index_count -
+                          chain.levels[level + 1].index_count) /
+                         3;
+            levels[i] = static_cast<uint8_t>(++level);
+            ++last_stats.budget_coarsened;
+            if (level + 1 < chain.getLevelCount()) {
+                heap.push_back(
+                    {getScreenError(chain, level + 1, instances[i]), i});
+                std::push_heap(heap.begin(), heap.end(), later);
+            }
+        }
+    }
+    last_stats.triangles = triangles;
+
+    for (size_t i = 0; i < levels.size(); ++i) {
+        last_stats.level_changes += levels[i] != previous[i] ? 1 : 0;
+    }
+}
+
+LodStreamer::LodStreamer(LoadFunction load, size_t budgetBytes)
+    : load(std::move(load)), budget_bytes(budgetBytes) {
+    loader = std::thread(&LodStreamer::loaderLoop, this);
+}
+
+LodStreamer::~LodStreamer() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    work_cv.notify_all();
+    loader.join();
+}
+
+uint32_t LodStreamer::addMesh(uint32_t levelCount) {
+    if (levelCount == 0) {
+        throw std::runtime_error("LOD mesh needs at least one level !");
+    }
+    auto mesh = static_cast<uint32_t>(meshes.size());
+    meshes.emplace_back(levelCount);
+    makeResident(meshes.back().back(), load(mesh, levelCount - 1));
+    ++loads;
+    return mesh;
+}
+
+uint32_t LodStreamer::request(uint32_t mesh, uint32_t level) {
+    std::vector<Slot>& slots = meshes[mesh];
+    Slot& slot = slots[level];
+    slot.last_used = frame;
+    if (!slot.resident && !slot.pending) {
+        slot.pending = true;
+        ++pending;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back({mesh, level});
+        }
+        work_cv.notify_one();
+    }
+
+    // The coarsest level is always resident
+    uint32_t drawn = level;
+    while (!slots[drawn].resident) {
+        ++drawn;
+    }
+    slots[drawn].last_used = frame;
+    return drawn;
+}
+
+bool LodStreamer::isResident(uint32_t mesh, uint32_t level) const {
+    return meshes[mesh][level].resident;
+}
+
+std::span<const uint32_t> LodStreamer::getIndices(uint32_t mesh,
+                                                  uint32_t level) const {
+    return meshes[mesh][level].indices;
+}
+
+void LodStreamer::update() {
+    std::vector<LoadResult> done;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        done.swap(finished);
+    }
+    for (LoadResult& result : done) {
+        Slot& slot = meshes[result.mesh][result.level];
+        slot.pending = false;
+        --pending;
+        makeResident(slot, std::move(result.indices));
+        ++loads;
+    }
+
+    if (resident_bytes > budget_bytes) {
+        // Oldest first among the levels nobody asked for this frame
+        struct Candidate {
+            uint64_t last_used;
+            uint32_t mesh;
+            uint32_t level;
+        };
+        std::vector<Candidate> candidates;
+        for (size_t m = 0; m < meshes.size(); ++m) {
+            for (size_t l = 0; l + 1 < meshes[m].size(); ++l) {
+                const Slot& slot = meshes[m][l];
+                if (slot.resident && slot.last_used < frame) {
+                    candidates.push_back({slot.last_used,
+                                          static_cast<uint32_t>(m),
+                                          static_cast<uint32_t>(l)});
+                }
+            }
+        }
+        std::sort(candidates.begin(), candidates.end(),
+                  [](const Candidate& a, const Candidate& b) {
+                      return a.last_used < b.last_used;
+                  });
+        for (const Candidate& candidate : candidates) {
+            if (resident_bytes <= budget_bytes) {
+                break;
+            }
+            Slot& slot = meshes[candidate.mesh][candidate.level];
+            resident_bytes -= slot.indices.size() * sizeof(uint32_t);
+            std::vector<uint32_t>().swap(slot.indices);
+            slot.resident = false;
+            ++evictions;
+        }
+    }
+    ++frame;
+}
+
+LodStreamer::Stats LodStreamer::getStats() const {
+    return {resident_bytes, pending, loads, evictions};
+}
+
+void LodStreamer::loaderLoop() {
+    for (;;) {
+        LoadRequest request;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            work_cv.wait(lock, [this] { return stopping || !queue.empty(); });
+            if (stopping) {
+                return;
+            }
+            request = queue.front();
+            queue.pop_front();
+        }
+        std::vector<uint32_t> indices = load(request.mesh, request.level);
+        std::lock_guard<std::mutex> lock(mutex);
+        finished.push_back({request.mesh, request.level, std::move(indices)});
+    }
+}
+
+void LodStreamer::makeResident(Slot& slot, std::vector<uint32_t>&& indices) {
+    resident_bytes += indices.size() * sizeof(uint32_t);
+    slot.indices = std::move(indices);
+    slot.resident = true;
+}
@@ -0,0 +1,227 @@
+/*
+ * @author: Avidel
+ * @LastEditors: Avidel
+ */
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "bvh.hpp"
+
+class JobSystem;
+
+// --- Mesh Simplification ---
+struct SimplifyResult {
+    std::vector<uint32_t> indices;
+    // Object space RMS distance to the planes merged into the worst collapse
+    // (the square root of its area weighted quadric cost). An error metric,
+    // not a bound on the distance to the input surface.
+    float error = 0.0f;
+};
+
+// Quadric error metric edge collapse (Garland and Heckbert 1997). Vertices
+// collapse onto one of their neighbours rather than an optimal position, so
+// the result indexes the same vertex buffer as the input and every LOD can
+// share it. Vertices with bit-identical positions (attribute seams) are
+// welded first; the result uses the lowest index of each group. Open borders
+// get an extra constraint plane and collapses that would flip a triangle are
+// rejected. Stops once the index count is at most targetIndexCount or the
+// next collapse would exceed maxError, in the same metric as the result.
+SimplifyResult simplifyMesh(std::span<const glm::vec3> positions,
+                            std::span<const uint32_t> indices,
+                            size_t targetIndexCount, float maxError);
+
+// --- LOD Chains ---
+// Every level of a mesh back to back in one index list, finest first. Level
+// errors grow monotonically.
+struct LodChain {
+    struct Level {
+        uint32_t first_index = 0;
+        uint32_t index_count = 0;
+        float error = 0.0f;  // Object space, 0 for the source mesh
+    };
+
+    std::vector<uint32_t> indices;
+    std::vector<Level> levels;
+    Aabb bounds;
+    float radius = 0.0f;  // Of the bounding sphere around bounds.center()
+
+    uint32_t getLevelCount() const {
+        return static_cast<uint32_t>(levels.size());
+    }
+    std::span<const uint32_t> getIndices(uint32_t level) const {
+        const Level& l = levels[level];
+        return {indices.data() + l.first_index, l.index_count};
+    }
+};
+
+// Halves the triangle count per level until maxLevels, MIN_LOD_TRIANGLES or
+// until simplification stalls (e.g. on a mesh made of disconnected pieces).
+// Each level is simplified from the previous one; its error is the sum of
+// the quadric errors along the way. That keeps errors monotonic and tends to
+// overestimate, but is not a guaranteed distance bound against the source.
+constexpr uint32_t MIN_LOD_TRIANGLES = 32;
+constexpr uint32_t MAX_LOD_LEVELS = 16;  // Selection stores levels as bytes
+LodChain buildLodChain(std::span<const glm::vec3> positions,
+                       std::span<const uint32_t> indices,
+                       uint32_t maxLevels = 8);
+
+// --- LOD Selection ---
+// One drawn copy of a chain; center and radius are the world bounding
+// sphere, scale the largest axis scale of its world matrix
+struct LodInstance {
+    uint32_t chain = 0;
+    glm::vec3 center{0.0f};
+    float radius = 0.0f;
+    float scale = 1.0f;
+};
+
+// Picks the coarsest level whose error projects to at most max_pixel_error
+// pixels. Switching to a coarser level additionally needs the error to fall
+// below max_pixel_error * (1 - hysteresis), so an object sitting at the
+// threshold does not flip between levels every frame; refining is immediate.
+// A triangle budget then caps the total regardless of scene density: while
+// over it, the object whose next coarser level costs the fewest pixels of
+// error is coarsened, so the error spreads evenly over the screen.
+class LodSelector {
+public:
+    struct Settings {
+        float max_pixel_error = 1.0f;
+        float hysteresis = 0.25f;      // Fraction of max_pixel_error
+        uint64_t triangle_budget = 0;  // 0 for no budget
+    };
+
+    struct Stats {
+        uint64_t triangles = 0;        // Selected
+        uint64_t error_triangles = 0;  // Before the budget was applied
+        size_t budget_coarsened = 0;   // Level steps the budget forced
+        size_t level_changes = 0;      // Instances whose level changed
+    };
+
+    explicit LodSelector(JobSystem& jobs) : jobs(jobs) {}
+
+    void setSettings(const Settings& settings) { this->settings = settings; }
+    const Settings& getSettings() const { return settings; }
+
+    // fovY in radians, viewportHeight in pixels
+    void setCamera(const glm::vec3& eye, float fovY, float viewportHeight);
+
+    // Error of the level in pixels; instances around the eye get the finest
+    float getScreenError(const LodChain& chain, uint32_t level,
+                         const LodInstance& instance) const;
+
+    // Pass the instances that will be drawn, culled ones would still count
+    // against the budget. levels holds each instance's level from the last
+    // call and receives the new ones; it is resized to the instance count,
+    // new instances start at the finest level.
+    void select(std::span<const LodChain> chains,
+                std::span<const LodInstance> instances,
+                std::vector<uint8_t>& levels);
+
+    const Stats& getLastStats() const { return last_stats; }
+
+private:
+    JobSystem& jobs;
+    Settings settings;
+    glm::vec3 eye{0.0f};
+    float projection_scale = 1.0f;  // Pixels per unit at distance 1
+
+    std::vector<uint8_t> previous;  // Scratch for change counting
+    Stats last_stats;
+};
+
+// --- LOD Streaming ---
+// Residency of the levels of each mesh. Only levels that selection asks for
+// are loaded, on a background thread, so a mesh seen from afar never brings
+// in its fine levels. The coarsest level is loaded when the mesh is added and
+// never evicted; until a requested level arrives the next coarser resident
+// one is drawn. Levels not requested for a frame are evicted, least recently
+// used first, while the resident size is over budget.
+//
+// All calls come from one thread; only the load function runs on the loader.
+class LodStreamer {
+public:
+    // Produces the indices of one level, e.g. read from disk. Runs on the
+    // loader thread and must not throw.
+    using LoadFunction =
+        std::function<std::vector<uint32_t>(uint32_t mesh, uint32_t level)>;
+
+    struct Stats {
+        size_t resident_bytes = 0;
+        size_t pending = 0;  // Queued or loading
+        uint64_t loads = 0;
+        uint64_t evictions = 0;
+    };
+
+    LodStreamer(LoadFunction load, size_t budgetBytes);
+    ~LodStreamer();  // Joins the loader; queued loads are dropped
+
+    LodStreamer(const LodStreamer&) = delete;
+    LodStreamer& operator=(const LodStreamer&) = delete;
+
+    // Loads the coarsest level inline; returns the mesh id
+    uint32_t addMesh(uint32_t levelCount);
+
+    // Mark the level as needed this frame, queueing its load if absent.
+    // Returns the level to draw now: it, or the next coarser resident one.
+    uint32_t request(uint32_t mesh, uint32_t level);
+    bool isResident(uint32_t mesh, uint32_t level) const;
+    // Resident levels only
+    std::span<const uint32_t> getIndices(uint32_t mesh, uint32_t level) const;
+
+    // Once per frame: take in finished loads, then evict over budget
+    void update();
+
+    Stats getStats() const;
+
+private:
+    struct Slot {
+        std::vector<uint32_t> indices;
+        uint64_t last_used = 0;  // Frame of the last request
+        bool resident = false;
+        bool pending = false;
+    };
+
+    struct LoadRequest {
+        uint32_t mesh;
+        uint32_t level;
+    };
+
+    struct LoadResult {
+        uint32_t mesh;
+        uint32_t level;
+        std::vector<uint32_t> indices;
+    };
+
+    void loaderLoop();
+    void makeResident(Slot& slot, std::vector<uint32_t>&& indices);
+
+    LoadFunction load;
+    size_t budget_bytes;
+
+    // Owning thread only
+    std::vector<std::vector<Slot>> meshes;  // [mesh][level]
+    uint64_t frame = 1;
+    size_t resident_bytes = 0;
+    size_t pending = 0;
+    uint64_t loads = 0;
+    uint64_t evictions = 0;
+
+    // Shared with the loader
+    std::mutex mutex;
+    std::condition_variable work_cv;  // Signals the loader: request or stop
+    std::deque<LoadRequest> queue;
+    std::vector<LoadResult> finished;
+    bool stopping = false;
+
+    std::thread loader;
+};
@@ -0,0 +1,413 @@
+/*
+ * @author: Avidel
+ * @LastEditors: Avidel
+ */
+#include "occlusion_culling.hpp"
+
+#include "job_system.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <utility>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define OCCLUSION_SSE 1
+#include <immintrin.h>
+#endif
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+constexpr float FAR_DEPTH = std::numeric_limits<float>::max();
+constexpr float INF = std::numeric_limits<float>::infinity();
+// Vertices closer to the eye than this (clip w) count as crossing the near
+// plane
+constexpr float MIN_CLIP_W = 1e-5f;
+// Triangles smaller than this (pixels, doubled area) cover nothing
+constexpr float MIN_TRIANGLE_AREA = 1e-4f;
+// Pull occluder spans in a little, so rounding never grows them
+constexpr float SPAN_EPSILON = 1.0f / 256.0f;
+constexpr size_t TEST_GRAIN = 256;  // Occludees per parallelFor chunk
+
+double elapsedMs(Clock::time_point since) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - since)
+        .count();
+}
+
+// Bits first..last of a 32 pixel tile row, empty if first > last
+uint32_t spanMask(int first, int last) {
+    first = std::max(first, 0);
+    last = std::min(last, static_cast<int>(OcclusionCuller::TILE_WIDTH) - 1);
+    if (first > last) {
+        return 0;
+    }
+    return (~0u >> (31 - last)) & (~0u << first);
+}
+}  // namespace
+
+OcclusionCuller::OcclusionCuller(JobSystem& jobs, uint32_t width,
+                                 uint32_t height)
+    : jobs(jobs) {
+    setResolution(width, height);
+}
+
+void OcclusionCuller::setResolution(uint32_t width, uint32_t height) {
+    uint32_t new_tiles_x = std::max(1u, (width + TILE_WIDTH - 1) / TILE_WIDTH);
+    uint32_t new_tiles_y =
+        std::max(1u, (height + TILE_HEIGHT - 1) / TILE_HEIGHT);
+    if (new_tiles_x == tiles_x && new_tiles_y == tiles_y) {
+        return;
+    }
+    tiles_x = new_tiles_x;
+    tiles_y = new_tiles_y;
+    this->width = tiles_x * TILE_WIDTH;
+    this->height = tiles_y * TILE_HEIGHT;
+    tiles.clear();
+    triangles.clear();
+}
+
+void OcclusionCuller::beginFrame(const glm::mat4& viewProj) {
+    view_proj = viewProj;
+    Tile empty_tile{};
+    empty_tile.z_max0 = FAR_DEPTH;
+    tiles.assign(static_cast<size_t>(tiles_x) * tiles_y, empty_tile);
+    triangles.clear();
+    last_stats = Stats();
+}
+
+// --- Occluders ---
+
+void OcclusionCuller::addOccluder(std::span<const glm::vec3> vertices,
+                                  const glm::mat4& model) {
+    auto start = Clock::now();
+    const glm::mat4 transform = view_proj * model;
+    for (size_t i = 0; i + 2 < vertices.size(); i += 3) {
+        glm::vec3 screen[3];
+        bool crosses_near = false;
+        for (int k = 0; k < 3; ++k) {
+            glm::vec4 clip = transform * glm::vec4(vertices[i + k], 1.0f);
+            if (clip.w <= MIN_CLIP_W || clip.z < 0.0f) {
+                crosses_near = true;
+                break;
+            }
+            float inv_w = 1.0f / clip.w;
+            screen[k] = glm::vec3((clip.x * inv_w * 0.5f + 0.5f) * width,
+                                  (clip.y * inv_w * 0.5f + 0.5f) * height,
+                                  clip.z * inv_w);
+        }
+        // Clipping would only add work for a rare case; skipping an occluder
+        // is always safe
+        if (crosses_near) {
+            continue;
+        }
+        float area = (screen[1].x - screen[0].x) * (screen[2].y - screen[0].y) -
+                     (screen[1].y - screen[0].y) * (screen[2].x - screen[0].x);
+        if (std::abs(area) < MIN_TRIANGLE_AREA) {
+            continue;
+        }
+        if (area < 0.0f) {
+            std::swap(screen[1], screen[2]);  // Double-sided: fix the winding
+        }
+
+        ScreenTriangle triangle;
+        float min_x = INF, min_y = INF, max_x = -INF, max_y = -INF;
+        triangle.z_max = 0.0f;
+        for (int k = 0; k < 3; ++k) {
+            const glm::vec3& p = screen[k];
+            const glm::vec3& q = screen[(k + 1) % 3];
+            triangle.a[k] = p.y - q.y;
+            triangle.b[k] = q.x - p.x;
+            triangle.c[k] = -(triangle.a[k] * p.x + triangle.b[k] * p.y);
+            min_x = std::min(min_x, p.x);
+            min_y = std::min(min_y, p.y);
+            max_x = std::max(max_x, p.x);
+            max_y = std::max(max_y, p.y);
+            triangle.z_max = std::max(triangle.z_max, p.z);
+        }
+        float last_x = static_cast<float>(width - 1);
+        float last_y = static_cast<float>(height - 1);
+        triangle.min_x = static_cast<int>(std::clamp(min_x, 0.0f, last_x + 1));
+        triangle.min_y = static_cast<int>(std::clamp(min_y, 0.0f, last_y + 1));
+        triangle.max_x =
+            static_cast<int>(std::floor(std::clamp(max_x, -1.0f, last_x)));
+        triangle.max_y =
+            static_cast<int>(std::floor(std::clamp(max_y, -1.0f, last_y)));
+        if (triangle.min_x > triangle.max_x ||
+            triangle.min_y > triangle.max_y) {
+            continue;  // Off screen
+        }
+        triangles.push_back(triangle);
+    }
+    last_stats.raster_ms += elapsedMs(start);
+}
+
+void OcclusionCuller::rasterize() {
+    auto start = Clock::now();
+    // Tile rows are independent, so the jobs need no synchronization
+    jobs.parallelFor(tiles_y, 1, [this](size_t begin, size_t end) {
+        for (size_t tile_row = begin; tile_row < end; ++tile_row) {
+            rasterizeTileRow(static_cast<uint32_t>(tile_row));
+        }
+    });
+    last_stats.occluder_triangles = triangles.size();
+    last_stats.raster_ms += elapsedMs(start);
+}
+
+void OcclusionCuller::rasterizeTileRow(uint32_t tileRow) {
+    const int y0 = static_cast<int>(tileRow * TILE_HEIGHT);
+    const int y1 = y0 + static_cast<int>(TILE_HEIGHT) - 1;
+    Tile* row_tiles = tiles.data() + static_cast<size_t>(tileRow) * tiles_x;
+
+    for (const ScreenTriangle& triangle : triangles) {
+        if (triangle.max_y < y0 || triangle.min_y > y1) {
+            continue;
+        }
+        int first[TILE_HEIGHT];
+        int last[TILE_HEIGHT];
+        computeRowSpans(triangle, y0, first, last);
+
+        const int tile_begin = triangle.min_x / static_cast<int>(TILE_WIDTH);
+        const int tile_end = triangle.max_x / static_cast<int>(TILE_WIDTH);
+        for (int tx = tile_begin; tx <= tile_end; ++tx) {
+            const int base = tx * static_cast<int>(TILE_WIDTH);
+            uint32_t mask[TILE_HEIGHT];
+            uint32_t any = 0;
+            for (uint32_t row = 0; row < TILE_HEIGHT; ++row) {
+                mask[row] = spanMask(first[row] - base, last[row] - base);
+                any |= mask[row];
+            }
+            if (any != 0) {
+                updateTile(row_tiles[tx], mask, triangle.z_max);
+            }
+        }
+    }
+}
+
+void OcclusionCuller::computeRowSpans(const ScreenTriangle& triangle, int y0,
+                                      int first[], int last[]) const {
+    // Covered x range per row, sampled at pixel centers: each edge bounds it
+    // from the left (a > 0) or the right (a < 0)
+    alignas(16) float left[TILE_HEIGHT];
+    alignas(16) float right[TILE_HEIGHT];
+    std::fill(left, left + TILE_HEIGHT, -INF);
+    std::fill(right, right + TILE_HEIGHT, INF);
+    for (int e = 0; e < 3; ++e) {
+        const float a = triangle.a[e];
+        const float b = triangle.b[e];
+        const float c = triangle.c[e];
+        if (a == 0.0f) {
+            // Horizontal edge: a row is entirely inside or outside
+            for (uint32_t row = 0; row < TILE_HEIGHT; ++row) {
+                if (b * (static_cast<float>(y0 + row) + 0.5f) + c < 0.0f) {
+                    left[row] = INF;
+                }
+            }
+            continue;
+        }
+        const float inv_a = -1.0f / a;
+        float* bound = a > 0.0f ? left : right;
+#if defined(OCCLUSION_SSE)
+        // Four rows per instruction
+        const __m128 b4 = _mm_set1_ps(b);
+        const __m128 c4 = _mm_set1_ps(c);
+        const __m128 inv_a4 = _mm_set1_ps(inv_a);
+        const __m128 centers = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+        for (uint32_t row = 0; row < TILE_HEIGHT; row += 4) {
+            __m128 y = _mm_add_ps(_mm_set1_ps(static_cast<float>(y0 + row)),
+                                  centers);
+            __m128 x = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(b4, y), c4), inv_a4);
+            __m128 current = _mm_load_ps(bound + row);
+            _mm_store_ps(bound + row, a > 0.0f ? _mm_max_ps(current, x)
+                                               : _mm_min_ps(current, x));
+        }
+#else
+        for (uint32_t row = 0; row < TILE_HEIGHT; ++row) {
+            float x = (b * (static_cast<float>(y0 + row) + 0.5f) + c) * inv_a;
+            bound[row] = a > 0.0f ? std::max(bound[row], x)
+                                  : std::min(bound[row], x);
+        }
+#endif
+    }
+
+    // Pixel px is covered if its center px + 0.5 is inside the span
+    for (uint32_t row = 0; row < TILE_HEIGHT; ++row) {
+        const int y = y0 + static_cast<int>(row);
+        float lo = std::max(left[row] - 0.5f + SPAN_EPSILON,
+                            static_cast<float>(triangle.min_x));
+        float hi = std::min(right[row] - 0.5f - SPAN_EPSILON,
+                            static_cast<float>(triangle.max_x));
+        if (y < triangle.min_y || y > triangle.max_y || lo > hi) {
+            first[row] = 1;
+            last[row] = 0;
+            continue;
+        }
+        first[row] = static_cast<int>(std::ceil(lo));
+        last[row] = static_cast<int>(std::floor(hi));
+    }
+}
+
+void OcclusionCuller::updateTile(Tile& tile, const uint32_t triangleMask[],
+                                 float triangleZMax) {
+    if (triangleZMax >= tile.z_max0) {
+        return;  // Behind everything already in the tile
+    }
+#if defined(OCCLUSION_SSE)
+    // The 256 bit coverage mask as two SSE registers
+    const __m128i zero = _mm_setzero_si128();
+    __m128i mask_lo = _mm_loadu_si128(reinterpret_cast<__m128i*>(tile.mask));
+    __m128i mask_hi =
+        _mm_loadu_si128(reinterpret_cast<__m128i*>(tile.mask + 4));
+    bool empty = _mm_movemask_epi8(_mm_cmpeq_epi32(
+                     _mm_or_si128(mask_lo, mask_hi), zero)) == 0xFFFF;
+#else
+    bool empty = true;
+    for (uint32_t row = 0; row < TILE_HEIGHT; ++row) {
+        empty = empty && tile.mask[row] == 0;
+    }
+#endif
+    // Merge heuristic from the paper: a triangle much closer than the working
+    // layer starts a new one rather than dragging the old one forward
+    if (!empty &&
+        tile.z_max1 - triangleZMax > tile.z_max0 - tile.z_max1) {
+        empty = true;
+#if defined(OCCLUSION_SSE)
+        mask_lo = mask_hi = zero;
+#endif
+    }
+    tile.z_max1 = empty ? triangleZMax : std::max(tile.z_max1, triangleZMax);
+
+#if defined(OCCLUSION_SSE)
+    const __m128i* triangle_rows =
+        reinterpret_cast<const __m128i*>(triangleMask);
+    mask_lo = _mm_or_si128(mask_lo, _mm_loadu_si128(triangle_rows));
+    mask_hi = _mm_or_si128(mask_hi, _mm_loadu_si128(triangle_rows + 1));
+    const __m128i all = _mm_set1_epi32(-1);
+    bool full = _mm_movemask_epi8(_mm_cmpeq_epi32(
+                    _mm_and_si128(mask_lo, mask_hi), all)) == 0xFFFF;
+    if (full) {
+        mask_lo = mask_hi = zero;
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(tile.mask), mask_lo);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(tile.mask + 4), mask_hi);
+#else
+    bool full = true;
+    for (uint32_t row = 0; row < TILE_HEIGHT; ++row) {
+        tile.mask[row] = (empty ? 0u : tile.mask[row]) | triangleMask[row];
+        full = full && tile.mask[row] == ~0u;
+    }
+    if (full) {
+        std::fill(tile.mask, tile.mask + TILE_HEIGHT, 0u);
+    }
+#endif
+    // A fully covered working layer becomes the new reference layer
+    if (full) {
+        tile.z_max0 = tile.z_max1;
+        tile.z_max1 = 0.0f;
+    }
+}
+
+// --- Occludees ---
+
+bool OcclusionCuller::projectBounds(const Aabb& bounds,
+                                    ScreenRect& rect) const {
+    float min_x = INF, min_y = INF, max_x = -INF, max_y = -INF;
+    rect.z_min = INF;
+    for (int corner = 0; corner < 8; ++corner) {
+        glm::vec4 point((corner & 1) ? bounds.max.x : bounds.min.x,
+                        (corner & 2) ? bounds.max.y : bounds.min.y,
+                        (corner & 4) ? bounds.max.z : bounds.min.z, 1.0f);
+        glm::vec4 clip = view_proj * point;
+        if (clip.w <= MIN_CLIP_W || clip.z < 0.0f) {
+            return false;
+        }
+        float inv_w = 1.0f / clip.w;
+        float x = (clip.x * inv_w * 0.5f + 0.5f) * width;
+        float y = (clip.y * inv_w * 0.5f + 0.5f) * height;
+        min_x = std::min(min_x, x);
+        min_y = std::min(min_y, y);
+        max_x = std::max(max_x, x);
+        max_y = std::max(max_y, y);
+        rect.z_min = std::min(rect.z_min, clip.z * inv_w);
+    }
+    // Every pixel the box touches, not just the ones whose center it covers
+    float w = static_cast<float>(width);
+    float h = static_cast<float>(height);
+    rect.min_x = static_cast<int>(std::floor(std::clamp(min_x, -1.0f, w)));
+    rect.min_y = static_cast<int>(std::floor(std::clamp(min_y, -1.0f, h)));
+    rect.max_x = static_cast<int>(std::floor(std::clamp(max_x, -1.0f, w)));
+    rect.max_y = static_cast<int>(std::floor(std::clamp(max_y, -1.0f, h)));
+    rect.min_x = std::max(rect.min_x, 0);
+    rect.min_y = std::max(rect.min_y, 0);
+    rect.max_x = std::min(rect.max_x, static_cast<int>(width) - 1);
+    rect.max_y = std::min(rect.max_y, static_cast<int>(height) - 1);
+    return rect.min_x <= rect.max_x && rect.min_y <= rect.max_y;
+}
+
+bool OcclusionCuller::isOccluded(const Aabb& bounds) const {
+    ScreenRect rect;
+    if (tiles.empty() || !projectBounds(bounds, rect)) {
+        return false;
+    }
+    const int tile_w = static_cast<int>(TILE_WIDTH);
+    const int tile_h = static_cast<int>(TILE_HEIGHT);
+    for (int ty = rect.min_y / tile_h; ty <= rect.max_y / tile_h; ++ty) {
+        for (int tx = rect.min_x / tile_w; tx <= rect.max_x / tile_w; ++tx) {
+            const Tile& tile = tiles[static_cast<size_t>(ty) * tiles_x + tx];
+            // Coarse level: the box is behind the whole tile
+            if (rect.z_min > tile.z_max0) {
+                continue;
+            }
+            // Fine level: only pixels in the working layer can still hide it
+            uint32_t row_mask = spanMask(rect.min_x - tx * tile_w,
+                                         rect.max_x - tx * tile_w);
+            uint32_t uncovered = 0;
+            for (int row = 0; row < tile_h; ++row) {
+                int y = ty * tile_h + row;
+                if (y >= rect.min_y && y <= rect.max_y) {
+                    uncovered |= row_mask & ~tile.mask[row];
+                }
+            }
+            if (uncovered != 0 || rect.z_min <= tile.z_max1) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+size_t OcclusionCuller::cullBoxes(std::span<const Aabb> bounds,
+                                  std::vector<uint32_t>& indices) {
+    auto start = Clock::now();
+    occluded_flags.assign(indices.size(), 0);
+    jobs.parallelFor(indices.size(), TEST_GRAIN,
+                     [&](size_t begin, size_t end) {
+                         for (size_t i = begin; i < end; ++i) {
+                             occluded_flags[i] = isOccluded(bounds[indices[i]]);
+                         }
+                     });
+
+    size_t kept = 0;
+    for (size_t i = 0; i < indices.size(); ++i) {
+        if (!occluded_flags[i]) {
+            indices[kept++] = indices[i];
+        }
+    }
+    size_t removed = indices.size() - kept;
+    indices.resize(kept);
+
+    last_stats.tested += kept + removed;
+    last_stats.occluded += removed;
+    last_stats.test_ms += elapsedMs(start);
+    return removed;
+}
+
+float OcclusionCuller::getScreenArea(const Aabb& bounds) const {
+    ScreenRect rect;
+    if (!projectBounds(bounds, rect)) {
+        return 0.0f;
+    }
+    return static_cast<float>(rect.max_x - rect.min_x + 1) *
+           static_cast<float>(rect.max_y - rect.min_y + 1);
+}
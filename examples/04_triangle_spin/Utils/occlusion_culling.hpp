@@ -0,0 +1,110 @@
+/*
+ * @author: Avidel
+ * @LastEditors: Avidel
+ */
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "bvh.hpp"
+
+class JobSystem;
+
+// --- Masked Software Occlusion Culling ---
+// A low resolution CPU depth buffer in the style of Masked Occlusion Culling
+// (Hasselgren et al. 2016). Instead of a depth per pixel, each 32x8 pixel
+// tile keeps a coverage bitmask and two conservative max depths: a reference
+// layer bounding the whole tile and a working layer bounding the masked
+// pixels. Occluder updates and occludee tests are then a few mask operations
+// per tile, and the per-tile max depth rejects whole tiles first.
+//
+// Per frame: beginFrame(), addOccluder() for a few large occluders,
+// rasterize(), then cullBoxes(). Everything errs on the visible side: a box
+// is only culled when it is provably behind the occluders.
+// Depth follows Vulkan clip space (0 near, 1 far).
+class OcclusionCuller {
+public:
+    static constexpr uint32_t TILE_WIDTH = 32;  // One bit per pixel in a row
+    static constexpr uint32_t TILE_HEIGHT = 8;
+
+    struct Stats {
+        size_t occluder_triangles = 0;  // Rasterized, after near rejection
+        size_t tested = 0;
+        size_t occluded = 0;
+        double raster_ms = 0.0;  // Triangle setup plus rasterization
+        double test_ms = 0.0;
+    };
+
+    // Resolution in depth buffer pixels, rounded up to whole tiles. It only
+    // needs to resolve large occluders, so a few hundred pixels wide is plenty.
+    explicit OcclusionCuller(JobSystem& jobs, uint32_t width = 256,
+                             uint32_t height = 128);
+
+    // Takes effect at the next beginFrame(); cheap if nothing changes
+    void setResolution(uint32_t width, uint32_t height);
+    uint32_t getWidth() const { return width; }
+    uint32_t getHeight() const { return height; }
+
+    // Clears the depth buffer, the queued occluders and the stats
+    void beginFrame(const glm::mat4& viewProj);
+    // Queue a triangle list (three vertices per triangle) in model space.
+    // Triangles are double-sided; ones crossing the near plane are skipped.
+    void addOccluder(std::span<const glm::vec3> vertices,
+                     const glm::mat4& model);
+    // Rasterize the queued occluders, one row of tiles per job
+    void rasterize();
+
+    // Remove the indices whose world bounds are hidden, keeping the order of
+    // the rest. Returns how many were removed.
+    size_t cullBoxes(std::span<const Aabb> bounds,
+                     std::vector<uint32_t>& indices);
+    bool isOccluded(const Aabb& bounds) const;
+    // Projected size in depth buffer pixels, to rank occluder candidates.
+    // 0 for boxes crossing the near plane, which cannot be occluders.
+    float getScreenArea(const Aabb& bounds) const;
+
+    const Stats& getLastStats() const { return last_stats; }
+
+private:
+    struct Tile {
+        uint32_t mask[TILE_HEIGHT];  // Working layer coverage per pixel row
+        float z_max0;                // Reference layer, whole tile
+        float z_max1;                // Working layer, pixels in mask
+    };
+
+    // Edge functions a * x + b * y + c >= 0 inside, in pixel coordinates
+    struct ScreenTriangle {
+        float a[3], b[3], c[3];
+        int min_x, min_y, max_x, max_y;  // Pixel bounds, clamped to screen
+        float z_max;
+    };
+
+    struct ScreenRect {
+        int min_x, min_y, max_x, max_y;
+        float z_min;
+    };
+
+    void rasterizeTileRow(uint32_t tileRow);
+    // Pixel spans [first, last] covered in the eight rows from y0
+    void computeRowSpans(const ScreenTriangle& triangle, int y0,
+                         int first[TILE_HEIGHT], int last[TILE_HEIGHT]) const;
+    static void updateTile(Tile& tile, const uint32_t triangleMask[],
+                           float triangleZMax);
+    // False if the box crosses the near plane or misses the screen
+    bool projectBounds(const Aabb& bounds, ScreenRect& rect) const;
+
+    JobSystem& jobs;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t tiles_x = 0;
+    uint32_t tiles_y = 0;
+    glm::mat4 view_proj{1.0f};
+    std::vector<Tile> tiles;
+    std::vector<ScreenTriangle> triangles;
+    std::vector<uint8_t> occluded_flags;  // Scratch for cullBoxes()
+    Stats last_stats;
+};
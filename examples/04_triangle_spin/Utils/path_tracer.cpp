@@ -0,0 +1,668 @@
+/*
+ * @author: Avidel
+ * @LastEditors: Avidel
+ */
+#include "path_tracer.hpp"
+
+#include "job_system.hpp"
+#include "stb_image_write.h"
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define PATH_TRACER_SSE 1
+#include <immintrin.h>
+#endif
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+constexpr uint32_t MAX_SIZE = 8192;  // Per axis
+constexpr size_t SETUP_GRAIN = 4096;  // Triangles per job in setScene()
+constexpr uint32_t NO_HIT = UINT32_MAX;
+constexpr float INF = std::numeric_limits<float>::max();
+constexpr float PI = 3.14159265f;
+// Along the normal, so bounces don't hit the surface they leave
+constexpr float RAY_OFFSET = 1e-4f;
+constexpr uint32_t ROULETTE_BOUNCE = 2;  // Russian roulette from here on
+
+double elapsedMs(Clock::time_point since) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - since)
+        .count();
+}
+
+// --- Four Lanes ---
+// One ray of a packet per lane. Comparisons give lane masks; min4/max4
+// return the second operand on NaN like minps/maxps on every path, which
+// keeps the slab test robust to 0 * inf.
+#if defined(PATH_TRACER_SSE)
+struct Float4 {
+    __m128 v;
+};
+struct Mask4 {
+    __m128 v;
+};
+
+inline Float4 splat(float x) { return {_mm_set1_ps(x)}; }
+inline Float4 load4(const float* p) { return {_mm_loadu_ps(p)}; }
+inline void store4(float* p, Float4 a) { _mm_storeu_ps(p, a.v); }
+inline Float4 operator+(Float4 a, Float4 b) { return {_mm_add_ps(a.v, b.v)}; }
+inline Float4 operator-(Float4 a, Float4 b) { return {_mm_sub_ps(a.v, b.v)}; }
+inline Float4 operator*(Float4 a, Float4 b) { return {_mm_mul_ps(a.v, b.v)}; }
+inline Float4 operator/(Float4 a, Float4 b) { return {_mm_div_ps(a.v, b.v)}; }
+inline Float4 min4(Float4 a, Float4 b) { return {_mm_min_ps(a.v, b.v)}; }
+inline Float4 max4(Float4 a, Float4 b) { return {_mm_max_ps(a.v, b.v)}; }
+inline Mask4 operator<(Float4 a, Float4 b) { return {_mm_cmplt_ps(a.v, b.v)}; }
+inline Mask4 operator<=(Float4 a, Float4 b) {
+    return {_mm_cmple_ps(a.v, b.v)};
+}
+inline Mask4 operator>(Float4 a, Float4 b) { return {_mm_cmpgt_ps(a.v, b.v)}; }
+inline Mask4 operator>=(Float4 a, Float4 b) {
+    return {_mm_cmpge_ps(a.v, b.v)};
+}
+inline Mask4 operator&(Mask4 a, Mask4 b) { return {_mm_and_ps(a.v, b.v)}; }
+inline int laneBits(Mask4 m) { return _mm_movemask_ps(m.v); }
+inline Mask4 bitsMask(int bits) {
+    const __m128i lane_bits = _mm_setr_epi32(1, 2, 4, 8);
+    return {_mm_castsi128_ps(_mm_cmpeq_epi32(
+        _mm_and_si128(_mm_set1_epi32(bits), lane_bits), lane_bits))};
+}
+inline Float4 select(Mask4 m, Float4 a, Float4 b) {
+    return {_mm_or_ps(_mm_and_ps(m.v, a.v), _mm_andnot_ps(m.v, b.v))};
+}
+#else
+struct Float4 {
+    float v[4];
+};
+struct Mask4 {
+    int bits;
+};
+
+template <typename Op>
+Float4 map4(Float4 a, Float4 b, Op op) {
+    Float4 result;
+    for (int i = 0; i < 4; ++i) {
+        result.v[i] = op(a.v[i], b.v[i]);
+    }
+    return result;
+}
+template <typename Op>
+Mask4 compare4(Float4 a, Float4 b, Op op) {
+    int bits = 0;
+    for (int i = 0; i < 4; ++i) {
+        bits |= op(a.v[i], b.v[i]) ? 1 << i : 0;
+    }
+    return {bits};
+}
+
+inline Float4 splat(float x) { return {{x, x, x, x}}; }
+inline Float4 load4(const float* p) { return {{p[0], p[1], p[2], p[3]}}; }
+inline void store4(float* p, Float4 a) { std::copy(a.v, a.v + 4, p); }
+inline Float4 operator+(Float4 a, Float4 b) {
+    return map4(a, b, [](float x, float y) { return x + y; });
+}
+inline Float4 operator-(Float4 a, Float4 b) {
+    return map4(a, b, [](float x, float y) { return x - y; });
+}
+inline Float4 operator*(Float4 a, Float4 b) {
+    return map4(a, b, [](float x, float y) { return x * y; });
+}
+inline Float4 operator/(Float4 a, Float4 b) {
+    return map4(a, b, [](float x, float y) { return x / y; });
+}
+inline Float4 min4(Float4 a, Float4 b) {
+    return map4(a, b, [](float x, float y) { return x < y ? x : y; });
+}
+inline Float4 max4(Float4 a, Float4 b) {
+    return map4(a, b, [](float x, float y) { return x > y ? x : y; });
+}
+inline Mask4 operator<(Float4 a, Float4 b) {
+    return compare4(a, b, [](float x, float y) { return x < y; });
+}
+inline Mask4 operator<=(Float4 a, Float4 b) {
+    return compare4(a, b, [](float x, float y) { return x <= y; });
+}
+inline Mask4 operator>(Float4 a, Float4 b) {
+    return compare4(a, b, [](float x, float y) { return x > y; });
+}
+inline Mask4 operator>=(Float4 a, Float4 b) {
+    return compare4(a, b, [](float x, float y) { return x >= y; });
+}
+inline Mask4 operator&(Mask4 a, Mask4 b) { return {a.bits & b.bits}; }
+inline int laneBits(Mask4 m) { return m.bits; }
+inline Mask4 bitsMask(int bits) { return {bits}; }
+inline Float4 select(Mask4 m, Float4 a, Float4 b) {
+    Float4 result;
+    for (int i = 0; i < 4; ++i) {
+        result.v[i] = (m.bits >> i & 1) != 0 ? a.v[i] : b.v[i];
+    }
+    return result;
+}
+#endif
+
+// PCG-RXS-M-XS: an LCG step and an output permutation. The permutation
+// alone hashes pixel and sample indices into seeds.
+uint32_t pcgPermute(uint32_t state) {
+    uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return (word >> 22u) ^ word;
+}
+
+struct Rng {
+    uint32_t state;
+
+    // Uniform in [0, 1)
+    float next() {
+        state = state * 747796405u + 2891336453u;
+        return float(pcgPermute(state) >> 8) * (1.0f / 16777216.0f);
+    }
+};
+
+// Cosine-weighted direction around the unit normal n, with the branchless
+// orthonormal basis of Duff et al.
+glm::vec3 sampleCosine(const glm::vec3& n, Rng& rng) {
+    float sign = std::copysign(1.0f, n.z);
+    float a = -1.0f / (sign + n.z);
+    float b = n.x * n.y * a;
+    glm::vec3 tangent(1.0f + sign * n.x * n.x * a, sign * b, -sign * n.x);
+    glm::vec3 bitangent(b, sign + n.y * n.y * a, -n.y);
+    float r = std::sqrt(rng.next());
+    float phi = 2.0f * PI * rng.next();
+    return tangent * (r * std::cos(phi)) + bitangent * (r * std::sin(phi)) +
+           n * std::sqrt(std::max(0.0f, 1.0f - r * r));
+}
+
+uint8_t encodeSrgb(float linear) {
+    if (!(linear > 0.0f)) {
+        return 0;  // Also NaN
+    }
+    linear = std::min(linear, 1.0f);
+    float srgb = linear <= 0.0031308f
+                     ? linear * 12.92f
+                     : 1.055f * std::pow(linear, 1.0f / 2.4f) - 0.055f;
+    return static_cast<uint8_t>(srgb * 255.0f + 0.5f);
+}
+}  // namespace
+
+struct PathTracer::Packet {
+    Float4 origin[3];
+    Float4 direction[3];
+    Float4 inverse_direction[3];
+    Float4 t_max;           // Closest hit so far
+    Float4 u, v;            // Barycentrics of that hit
+    uint32_t primitive[4];  // Its leaf slot, NO_HIT
+    int active;             // Lanes that trace
+};
+
+struct PathTracer::StackEntry {
+    uint32_t node;
+    float t_near;  // Nearest entry over the lanes that hit it
+};
+
+PathTracer::PathTracer(JobSystem& jobs, uint32_t width, uint32_t height)
+    : jobs(jobs) {
+    resize(width, height);
+}
+
+void PathTracer::resize(uint32_t width, uint32_t height) {
+    if (width == 0 || height == 0 || width > MAX_SIZE || height > MAX_SIZE) {
+        throw std::runtime_error("Invalid path tracer image size !");
+    }
+    this->width = width;
+    this->height = height;
+    tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+    tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+    reset();
+}
+
+void PathTracer::setSettings(const Settings& settings) {
+    this->settings = settings;
+    reset();
+}
+
+void PathTracer::setScene(std::span<const Vertex> vertices,
+                          std::span<const glm::mat4> models) {
+    const size_t per_instance = vertices.size() / 3;
+    const size_t total = per_instance * models.size();
+    std::vector<Triangle> world(total);
+    std::vector<Shading> world_shading(total);
+    std::vector<Aabb> bounds(total);
+    jobs.parallelFor(total, SETUP_GRAIN, [&](size_t begin, size_t end) {
+        for (size_t t = begin; t < end; ++t) {
+            const glm::mat4& model = models[t / per_instance];
+            const Vertex* v = &vertices[(t % per_instance) * 3];
+            glm::vec3 p[3];
+            for (int k = 0; k < 3; ++k) {
+                p[k] = glm::vec3(model * glm::vec4(v[k].pos, 0.0f, 1.0f));
+                bounds[t].expand(p[k]);
+            }
+            world[t] = {p[0], p[1] - p[0], p[2] - p[0]};
+            // Degenerate triangles keep any normal; they are never hit
+            glm::vec3 normal = glm::cross(world[t].edge1, world[t].edge2);
+            float length = glm::length(normal);
+            world_shading[t] = {
+                {v[0].color, v[1].color, v[2].color},
+                length > 0.0f ? normal / length : glm::vec3(0.0f, 0.0f, 1.0f)};
+        }
+    });
+    bvh.build(bounds);
+
+    std::span<const uint32_t> order = bvh.getPrimitiveIndices();
+    triangles.resize(total);
+    shading.resize(total);
+    for (size_t slot = 0; slot < total; ++slot) {
+        triangles[slot] = world[order[slot]];
+        shading[slot] = world_shading[order[slot]];
+    }
+    reset();
+}
+
+void PathTracer::setCamera(const FrameUniforms& frame) {
+    inverse_view_proj = glm::inverse(frame.view_proj);
+    reset();
+}
+
+void PathTracer::reset() {
+    accumulation.assign(size_t(width) * height, glm::vec3(0.0f));
+    pixels.assign(size_t(width) * height, 0);
+    sample_count = 0;
+}
+
+void PathTracer::renderPass() {
+    auto start = Clock::now();
+    const size_t tile_count = size_t(tiles_x) * tiles_y;
+    std::vector<uint64_t> tile_rays(tile_count, 0);
+    jobs.parallelFor(tile_count, 1, [&](size_t begin, size_t end) {
+        for (size_t tile = begin; tile < end; ++tile) {
+            renderTile(static_cast<uint32_t>(tile), tile_rays[tile]);
+        }
+    });
+    ++sample_count;
+
+    last_stats = {};
+    last_stats.samples = uint64_t(width) * height;
+    for (uint64_t rays : tile_rays) {
+        last_stats.rays += rays;
+    }
+    last_stats.render_ms = elapsedMs(start);
+}
+
+bool PathTracer::writePng(const std::string& path) const {
+    return stbi_write_png(path.c_str(), int(width), int(height), 4,
+                          pixels.data(), int(getPitch())) != 0;
+}
+
+void PathTracer::renderTile(uint32_t tile, uint64_t& rays) {
+    const uint32_t x0 = (tile % tiles_x) * TILE_SIZE;
+    const uint32_t y0 = (tile / tiles_x) * TILE_SIZE;
+    const uint32_t x1 = std::min(x0 + TILE_SIZE, width);
+    const uint32_t y1 = std::min(y0 + TILE_SIZE, height);
+    std::vector<StackEntry> stack;
+    stack.reserve(64);
+
+    for (uint32_t y = y0; y < y1; y += 2) {
+        for (uint32_t x = x0; x < x1; x += 2) {
+            // Lanes of a 2x2 quad; the ones past the image edge stay off
+            float origin[3][4] = {};
+            float direction[3][4] = {};
+            uint32_t pixel[4] = {};
+            Rng rng[4] = {};
+            glm::vec3 throughput[4];
+            glm::vec3 radiance[4];
+            int alive = 0;
+            for (int lane = 0; lane < 4; ++lane) {
+                uint32_t px = x + (lane & 1);
+                uint32_t py = y + (lane >> 1);
+                direction[2][lane] = 1.0f;
+                if (px >= x1 || py >= y1) {
+                    continue;
+                }
+                alive |= 1 << lane;
+                pixel[lane] = py * width + px;
+                rng[lane].state = pcgPermute(
+                    pixel[lane] ^
+                    pcgPermute(sample_count ^ pcgPermute(settings.seed)));
+                throughput[lane] = glm::vec3(1.0f);
+                radiance[lane] = glm::vec3(0.0f);
+
+                // Jittered point in the pixel, from the near plane (clip z
+                // 0) to the far plane (clip z 1) like the rasterizers
+                float ndc_x = (px + rng[lane].next()) / width * 2.0f - 1.0f;
+                float ndc_y = (py + rng[lane].next()) / height * 2.0f - 1.0f;
+                glm::vec4 near =
+                    inverse_view_proj * glm::vec4(ndc_x, ndc_y, 0.0f, 1.0f);
+                glm::vec4 far =
+                    inverse_view_proj * glm::vec4(ndc_x, ndc_y, 1.0f, 1.0f);
+                glm::vec3 start = glm::vec3(near) / near.w;
+                glm::vec3 end = glm::vec3(far) / far.w;
+                for (int i = 0; i < 3; ++i) {
+                    origin[i][lane] = start[i];
+                    direction[i][lane] = end[i] - start[i];
+                }
+            }
+
+            for (uint32_t bounce = 0; alive != 0; ++bounce) {
+                float t[4], u[4], v[4];
+                uint32_t primitive[4];
+                if (bounce == 0) {
+                    // The camera rays of a quad are coherent: one packet
+                    Packet packet;
+                    for (int i = 0; i < 3; ++i) {
+                        packet.origin[i] = load4(origin[i]);
+                        packet.direction[i] = load4(direction[i]);
+                        packet.inverse_direction[i] =
+                            splat(1.0f) / packet.direction[i];
+                    }
+                    packet.t_max = splat(1.0f);  // The far plane
+                    packet.u = packet.v = splat(0.0f);
+                    std::fill(packet.primitive, packet.primitive + 4, NO_HIT);
+                    packet.active = alive;
+                    intersect(packet, stack);
+                    store4(t, packet.t_max);
+                    store4(u, packet.u);
+                    store4(v, packet.v);
+                    std::copy(packet.primitive, packet.primitive + 4,
+                              primitive);
+                } else {
+                    // Bounces scatter, and a packet would visit the union
+                    // of their paths: one ray at a time instead
+                    for (int lane = 0; lane < 4; ++lane) {
+                        if ((alive >> lane & 1) == 0) {
+                            continue;
+                        }
+                        t[lane] = INF;
+                        primitive[lane] = intersectRay(
+                            glm::vec3(origin[0][lane], origin[1][lane],
+                                      origin[2][lane]),
+                            glm::vec3(direction[0][lane], direction[1][lane],
+                                      direction[2][lane]),
+                            stack, t[lane], u[lane], v[lane]);
+                    }
+                }
+                rays += std::popcount(static_cast<unsigned>(alive));
+
+                for (int lane = 0; lane < 4; ++lane) {
+                    if ((alive >> lane & 1) == 0) {
+                        continue;
+                    }
+                    uint32_t slot = primitive[lane];
+                    if (slot == NO_HIT) {
+                        radiance[lane] +=
+                            throughput[lane] * (bounce == 0
+                                                    ? settings.background
+                                                    : settings.environment);
+                        alive &= ~(1 << lane);
+                        continue;
+                    }
+                    if (bounce == settings.max_bounces) {
+                        alive &= ~(1 << lane);
+                        continue;
+                    }
+
+                    const Shading& surface = shading[slot];
+                    glm::vec3 ray_origin(origin[0][lane], origin[1][lane],
+                                         origin[2][lane]);
+                    glm::vec3 ray_direction(direction[0][lane],
+                                            direction[1][lane],
+                                            direction[2][lane]);
+                    throughput[lane] *=
+                        surface.colors[0] * (1.0f - u[lane] - v[lane]) +
+                        surface.colors[1] * u[lane] +
+                        surface.colors[2] * v[lane];
+                    if (bounce >= ROULETTE_BOUNCE) {
+                        const glm::vec3& weight = throughput[lane];
+                        float survival = std::min(
+                            std::max(std::max(weight.x, weight.y), weight.z),
+                            1.0f);
+                        if (rng[lane].next() >= survival) {
+                            alive &= ~(1 << lane);
+                            continue;
+                        }
+                        throughput[lane] /= survival;
+                    }
+
+                    // Double-sided: bounce off the side the ray came from
+                    glm::vec3 normal =
+                        glm::dot(surface.normal, ray_direction) > 0.0f
+                            ? -surface.normal
+                            : surface.normal;
+                    glm::vec3 position = ray_origin + ray_direction * t[lane] +
+                                         normal * RAY_OFFSET;
+                    glm::vec3 next = sampleCosine(normal, rng[lane]);
+                    for (int i = 0; i < 3; ++i) {
+                        origin[i][lane] = position[i];
+                        direction[i][lane] = next[i];
+                    }
+                }
+            }
+
+            for (int lane = 0; lane < 4; ++lane) {
+                uint32_t px = x + (lane & 1);
+                uint32_t py = y + (lane >> 1);
+                if (px < x1 && py < y1) {
+                    accumulation[pixel[lane]] += radiance[lane];
+                }
+            }
+        }
+    }
+
+    // Resolve the running mean, so every pass leaves a complete preview
+    const float scale = 1.0f / float(sample_count + 1);
+    for (uint32_t y = y0; y < y1; ++y) {
+        for (uint32_t x = x0; x < x1; ++x) {
+            size_t i = size_t(y) * width + x;
+            glm::vec3 mean = accumulation[i] * scale;
+            pixels[i] = uint32_t(encodeSrgb(mean.x)) |
+                        uint32_t(encodeSrgb(mean.y)) << 8 |
+                        uint32_t(encodeSrgb(mean.z)) << 16 | 0xff000000u;
+        }
+    }
+}
+
+void PathTracer::intersect(Packet& packet,
+                           std::vector<StackEntry>& stack) const {
+    std::span<const Bvh4::Node> nodes = bvh.getNodes();
+    if (nodes.empty() || packet.active == 0) {
+        return;
+    }
+    const Float4 zero = splat(0.0f);
+    stack.clear();
+    stack.push_back({0, 0.0f});
+    while (!stack.empty()) {
+        StackEntry entry = stack.back();
+        stack.pop_back();
+        if ((laneBits(splat(entry.t_near) <= packet.t_max) & packet.active) ==
+            0) {
+            continue;  // Every lane found a closer hit since the push
+        }
+        const Bvh4::Node& node = nodes[entry.node];
+
+        // Slab test of each child against all four rays at once
+        float t_near[4];
+        int order[4];
+        int hit_count = 0;
+        for (int c = 0; c < node.child_count; ++c) {
+            const Float4* o = packet.origin;
+            const Float4* inv = packet.inverse_direction;
+            Float4 tx0 = (splat(node.min_x[c]) - o[0]) * inv[0];
+            Float4 tx1 = (splat(node.max_x[c]) - o[0]) * inv[0];
+            Float4 ty0 = (splat(node.min_y[c]) - o[1]) * inv[1];
+            Float4 ty1 = (splat(node.max_y[c]) - o[1]) * inv[1];
+            Float4 tz0 = (splat(node.min_z[c]) - o[2]) * inv[2];
+            Float4 tz1 = (splat(node.max_z[c]) - o[2]) * inv[2];
+            Float4 enter =
+                max4(max4(min4(tx0, tx1), min4(ty0, ty1)),
+                     max4(min4(tz0, tz1), zero));
+            Float4 exit =
+                min4(min4(max4(tx0, tx1), max4(ty0, ty1)),
+                     min4(max4(tz0, tz1), packet.t_max));
+            int hit = laneBits(enter <= exit) & packet.active;
+            if (hit == 0) {
+                continue;
+            }
+            float enters[4];
+            store4(enters, enter);
+            float nearest = INF;
+            for (int lane = 0; lane < 4; ++lane) {
+                if ((hit >> lane & 1) != 0) {
+                    nearest = std::min(nearest, enters[lane]);
+                }
+            }
+            t_near[c] = nearest;
+            order[hit_count++] = c;
+        }
+
+        // Leaves near to far right away, so their hits shorten the rays;
+        // internal children pushed far to near, so the near one pops first
+        for (int k = 1; k < hit_count; ++k) {
+            for (int j = k; j > 0 && t_near[order[j]] < t_near[order[j - 1]];
+                 --j) {
+                std::swap(order[j], order[j - 1]);
+            }
+        }
+        for (int k = 0; k < hit_count; ++k) {
+            int c = order[k];
+            for (uint32_t i = 0; i < node.count[c]; ++i) {
+                intersectTriangle(packet, node.child[c] + i);
+            }
+        }
+        for (int k = hit_count - 1; k >= 0; --k) {
+            int c = order[k];
+            if (node.count[c] == 0) {
+                stack.push_back({node.child[c], t_near[c]});
+            }
+        }
+    }
+}
+
+// Moller-Trumbore for four rays against one triangle
+void PathTracer::intersectTriangle(Packet& packet, uint32_t slot) const {
+    const Triangle& triangle = triangles[slot];
+    const Float4 e1[3] = {splat(triangle.edge1.x), splat(triangle.edge1.y),
+                          splat(triangle.edge1.z)};
+    const Float4 e2[3] = {splat(triangle.edge2.x), splat(triangle.edge2.y),
+                          splat(triangle.edge2.z)};
+    const Float4* d = packet.direction;
+
+    Float4 p[3] = {d[1] * e2[2] - d[2] * e2[1], d[2] * e2[0] - d[0] * e2[2],
+                   d[0] * e2[1] - d[1] * e2[0]};
+    Float4 det = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+    // A zero determinant gives inf or NaN, which fails the tests below
+    Float4 inverse_det = splat(1.0f) / det;
+    Float4 s[3] = {packet.origin[0] - splat(triangle.v0.x),
+                   packet.origin[1] - splat(triangle.v0.y),
+                   packet.origin[2] - splat(triangle.v0.z)};
+    Float4 u = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) * inverse_det;
+    Float4 q[3] = {s[1] * e1[2] - s[2] * e1[1], s[2] * e1[0] - s[0] * e1[2],
+                   s[0] * e1[1] - s[1] * e1[0]};
+    Float4 v = (d[0] * q[0] + d[1] * q[1] + d[2] * q[2]) * inverse_det;
+    Float4 t = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) * inverse_det;
+
+    const Float4 zero = splat(0.0f);
+    int hit = laneBits((u >= zero) & (v >= zero) & (u + v <= splat(1.0f)) &
+                       (t > zero) & (t < packet.t_max)) &
+              packet.active;
+    if (hit == 0) {
+        return;
+    }
+    Mask4 mask = bitsMask(hit);
+    packet.t_max = select(mask, t, packet.t_max);
+    packet.u = select(mask, u, packet.u);
+    packet.v = select(mask, v, packet.v);
+    for (int lane = 0; lane < 4; ++lane) {
+        if ((hit >> lane & 1) != 0) {
+            packet.primitive[lane] = slot;
+        }
+    }
+}
+
+uint32_t PathTracer::intersectRay(const glm::vec3& origin,
+                                  const glm::vec3& direction,
+                                  std::vector<StackEntry>& stack, float& t,
+                                  float& u, float& v) const {
+    std::span<const Bvh4::Node> nodes = bvh.getNodes();
+    uint32_t closest = NO_HIT;
+    if (nodes.empty()) {
+        return closest;
+    }
+    const Float4 o[3] = {splat(origin.x), splat(origin.y), splat(origin.z)};
+    const Float4 inv[3] = {splat(1.0f / direction.x),
+                           splat(1.0f / direction.y),
+                           splat(1.0f / direction.z)};
+    const Float4 zero = splat(0.0f);
+    stack.clear();
+    stack.push_back({0, 0.0f});
+    while (!stack.empty()) {
+        StackEntry entry = stack.back();
+        stack.pop_back();
+        if (entry.t_near > t) {
+            continue;
+        }
+        const Bvh4::Node& node = nodes[entry.node];
+
+        // Slab test of the four children at once, one per lane
+        Float4 tx0 = (load4(node.min_x) - o[0]) * inv[0];
+        Float4 tx1 = (load4(node.max_x) - o[0]) * inv[0];
+        Float4 ty0 = (load4(node.min_y) - o[1]) * inv[1];
+        Float4 ty1 = (load4(node.max_y) - o[1]) * inv[1];
+        Float4 tz0 = (load4(node.min_z) - o[2]) * inv[2];
+        Float4 tz1 = (load4(node.max_z) - o[2]) * inv[2];
+        Float4 enter = max4(max4(min4(tx0, tx1), min4(ty0, ty1)),
+                            max4(min4(tz0, tz1), zero));
+        Float4 exit = min4(min4(max4(tx0, tx1), max4(ty0, ty1)),
+                           min4(max4(tz0, tz1), splat(t)));
+        int hit = laneBits(enter <= exit) & ((1 << node.child_count) - 1);
+        if (hit == 0) {
+            continue;
+        }
+        float t_near[4];
+        store4(t_near, enter);
+        int order[4];
+        int hit_count = 0;
+        for (int c = 0; c < node.child_count; ++c) {
+            if ((hit >> c & 1) != 0) {
+                order[hit_count++] = c;
+            }
+        }
+        for (int k = 1; k < hit_count; ++k) {
+            for (int j = k; j > 0 && t_near[order[j]] < t_near[order[j - 1]];
+                 --j) {
+                std::swap(order[j], order[j - 1]);
+            }
+        }
+
+        for (int k = 0; k < hit_count; ++k) {
+            int c = order[k];
+            for (uint32_t i = 0; i < node.count[c]; ++i) {
+                uint32_t slot = node.child[c] + i;
+                const Triangle& triangle = triangles[slot];
+                glm::vec3 p = glm::cross(direction, triangle.edge2);
+                float inverse_det = 1.0f / glm::dot(triangle.edge1, p);
+                glm::vec3 s = origin - triangle.v0;
+                float hit_u = glm::dot(s, p) * inverse_det;
+                glm::vec3 q = glm::cross(s, triangle.edge1);
+                float hit_v = glm::dot(direction, q) * inverse_det;
+                float hit_t = glm::dot(triangle.edge2, q) * inverse_det;
+                // Written to fail on the NaN of a zero determinant
+                if (hit_u >= 0.0f && hit_v >= 0.0f && hit_u + hit_v <= 1.0f &&
+                    hit_t > 0.0f && hit_t < t) {
+                    t = hit_t;
+                    u = hit_u;
+                    v = hit_v;
+                    closest = slot;
+                }
+            }
+        }
+        for (int k = hit_count - 1; k >= 0; --k) {
+            int c = order[k];
+            if (node.count[c] == 0) {
+                stack.push_back({node.child[c], t_near[c]});
+            }
+        }
+    }
+    return closest;
+}
@@ -0,0 +1,117 @@
+/*
+ * @author: Avidel
+ * @LastEditors: Avidel
+ */
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "bvh.hpp"
+#include "render_types.hpp"
+
+class JobSystem;
+
+// --- Path Tracer ---
+// CPU reference renderer for the scene the rasterizers draw: the same
+// triangle lists of Vertex, one world matrix per instance and the camera of
+// FrameUniforms::view_proj. Surfaces are double-sided diffuse reflectors of
+// their interpolated vertex color, lit by a uniform environment, so an
+// unoccluded triangle converges to the rasterized color and occlusion adds
+// soft shadows and color bleeding.
+//
+// Traversal of the Bvh4 over the world-space triangles is 4-wide SIMD both
+// ways: camera rays go as packets of a 2x2 pixel quad, one ray per lane;
+// bounces, which diverge, go one at a time testing four children per lane.
+// Each renderPass() adds one jittered sample to every pixel, one TILE_SIZE
+// tile per job, and resolves the running mean, so the image can be
+// previewed after any pass.
+class PathTracer {
+public:
+    static constexpr uint32_t TILE_SIZE = 16;  // Pixels, a multiple of 2
+
+    struct Settings {
+        uint32_t max_bounces = 4;
+        glm::vec3 environment{1.0f};  // Radiance of escaping paths
+        glm::vec3 background{0.0f};   // Camera rays that hit nothing
+        uint32_t seed = 0;  // Decorrelates the noise of separate images
+    };
+
+    struct Stats {
+        uint64_t samples = 0;   // Camera paths, one per pixel
+        uint64_t rays = 0;      // Path segments traced
+        double render_ms = 0.0;
+    };
+
+    PathTracer(JobSystem& jobs, uint32_t width, uint32_t height);
+
+    // The following restart the accumulation
+    void resize(uint32_t width, uint32_t height);
+    void setSettings(const Settings& settings);
+    // Every world matrix instances the whole vertex list, like a draw of
+    // SoftwareRasterizer
+    void setScene(std::span<const Vertex> vertices,
+                  std::span<const glm::mat4> models);
+    void setCamera(const FrameUniforms& frame);
+    void reset();
+
+    void renderPass();
+    uint32_t getSampleCount() const { return sample_count; }  // Per pixel
+
+    uint32_t getWidth() const { return width; }
+    uint32_t getHeight() const { return height; }
+    size_t getTriangleCount() const { return triangles.size(); }
+    // sRGB encoded RGBA8 rows of getPitch() bytes, the mean of all passes
+    const uint8_t* getPixels() const {
+        return reinterpret_cast<const uint8_t*>(pixels.data());
+    }
+    size_t getPitch() const { return size_t(width) * sizeof(uint32_t); }
+    bool writePng(const std::string& path) const;
+
+    const Stats& getLastStats() const { return last_stats; }
+
+private:
+    // World space, in BVH leaf order so a leaf slot indexes it directly
+    struct Triangle {
+        glm::vec3 v0, edge1, edge2;
+    };
+    struct Shading {
+        glm::vec3 colors[3];
+        glm::vec3 normal;  // Unit length, either side
+    };
+
+    struct Packet;
+    struct StackEntry;
+
+    void renderTile(uint32_t tile, uint64_t& rays);
+    // Closest hit of every active lane
+    void intersect(Packet& packet, std::vector<StackEntry>& stack) const;
+    void intersectTriangle(Packet& packet, uint32_t slot) const;
+    // Closest hit closer than t of a single ray; returns its leaf slot and
+    // sets t and the barycentrics, or returns UINT32_MAX
+    uint32_t intersectRay(const glm::vec3& origin, const glm::vec3& direction,
+                          std::vector<StackEntry>& stack, float& t, float& u,
+                          float& v) const;
+
+    JobSystem& jobs;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t tiles_x = 0;
+    uint32_t tiles_y = 0;
+    Settings settings;
+    glm::mat4 inverse_view_proj{1.0f};
+
+    Bvh4 bvh;
+    std::vector<Triangle> triangles;
+    std::vector<Shading> shading;
+
+    std::vector<glm::vec3> accumulation;  // Linear radiance sums
+    std::vector<uint32_t> pixels;         // sRGB RGBA8
+    uint32_t sample_count = 0;
+
+    Stats last_stats;
+};
@@ -0,0 +1,187 @@
+/*
+ * @author: Avidel
+ * @LastEditors: Avidel
+ */
+#include "pipeline_library.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <stdexcept>
+
+namespace {
+uint64_t partHash(PipelineLibraryCache::Part part, const PipelineDesc& desc) {
+    switch (part) {
+        case PipelineLibraryCache::Part::VertexInput:
+            return desc.hashVertexInput();
+        case PipelineLibraryCache::Part::PreRasterization:
+            return desc.hashPreRasterization();
+        case PipelineLibraryCache::Part::FragmentShader:
+            return desc.hashFragmentShader();
+        case PipelineLibraryCache::Part::FragmentOutput:
+            return desc.hashFragmentOutput();
+    }
+    return 0;
+}
+
+VkGraphicsPipelineLibraryFlagsEXT partFlags(PipelineLibraryCache::Part part) {
+    switch (part) {
+        case PipelineLibraryCache::Part::VertexInput:
+            return VK_GRAPHICS_PIPELINE_LIBRARY_VERTEX_INPUT_INTERFACE_BIT_EXT;
+        case PipelineLibraryCache::Part::PreRasterization:
+            return VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT;
+        case PipelineLibraryCache::Part::FragmentShader:
+            return VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT;
+        case PipelineLibraryCache::Part::FragmentOutput:
+            return VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_OUTPUT_INTERFACE_BIT_EXT;
+    }
+    return 0;
+}
+}  // namespace
+
+PipelineLibraryCache::PipelineLibraryCache(VkDevice device,
+                                           VkPipelineCache pipelineCache)
+    : device(device), pipeline_cache(pipelineCache) {}
+
+PipelineLibraryCache::~PipelineLibraryCache() { clear(); }
+
+VkPipeline PipelineLibraryCache::getPart(Part part, const PipelineDesc& desc) {
+    uint64_t key = partHash(part, desc);
+    auto& map = parts[static_cast<size_t>(part)];
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = map.find(key);
+        if (it != map.end()) {
+            return it->second;
+        }
+    }
+
+    // Build outside the lock; parts are small but shader compiles are not
+    VkPipeline library = createPart(part, desc);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto [it, inserted] = map.emplace(key, library);
+    if (!inserted) {
+        // Another worker built the same part meanwhile, keep theirs
+        vkDestroyPipeline(device, library, nullptr);
+    }
+    return it->second;
+}
+
+VkPipeline PipelineLibraryCache::createPart(Part part,
+                                            const PipelineDesc& desc) {
+    PipelineFixedState state(desc);
+
+    VkGraphicsPipelineLibraryCreateInfoEXT library_info{};
+    library_info.sType =
+        VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_LIBRARY_CREATE_INFO_EXT;
+    library_info.flags = partFlags(part);
+
+    VkGraphicsPipelineCreateInfo pipeline_info{};
+    pipeline_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    pipeline_info.pNext = &library_info;
+    pipeline_info.flags =
+        VK_PIPELINE_CREATE_LIBRARY_BIT_KHR | desc.create_flags;
+    pipeline_info.pDynamicState = &state.dynamic_state;
+
+    VkShaderModule shader_module = VK_NULL_HANDLE;
+    VkPipelineShaderStageCreateInfo stage_info{};
+    stage_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    stage_info.pName = "main";
+
+    // Each part only reads the state that belongs to its subset
+    switch (part) {
+        case Part::VertexInput:
+            pipeline_info.pVertexInputState = &state.vertex_input;
+            pipeline_info.pInputAssemblyState = &state.input_assembly;
+            break;
+        case Part::PreRasterization:
+            shader_module = createShaderModule(device, desc.vert_spirv);
+            stage_info.stage = VK_SHADER_STAGE_VERTEX_BIT;
+            stage_info.module = shader_module;
+            pipeline_info.stageCount = 1;
+            pipeline_info.pStages = &stage_info;
+            pipeline_info.pViewportState = &state.viewport_state;
+            pipeline_info.pRasterizationState = &state.rasterizer;
+            pipeline_info.layout = desc.layout;
+            pipeline_info.renderPass = desc.render_pass;
+            pipeline_info.subpass = desc.subpass;
+            break;
+        case Part::FragmentShader:
+            shader_module = createShaderModule(device, desc.frag_spirv);
+            stage_info.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+            stage_info.module = shader_module;
+            pipeline_info.stageCount = 1;
+            pipeline_info.pStages = &stage_info;
+            pipeline_info.pMultisampleState = &state.multisampling;
+            pipeline_info.pDepthStencilState = state.depthStencil();
+            pipeline_info.layout = desc.layout;
+            pipeline_info.renderPass = desc.render_pass;
+            pipeline_info.subpass = desc.subpass;
+            break;
+        case Part::FragmentOutput:
+            pipeline_info.pMultisampleState = &state.multisampling;
+            pipeline_info.pColorBlendState = &state.color_blending;
+            pipeline_info.renderPass = desc.render_pass;
+            pipeline_info.subpass = desc.subpass;
+            break;
+    }
+
+    VkPipeline library = VK_NULL_HANDLE;
+    VkResult result = vkCreateGraphicsPipelines(
+        device, pipeline_cache, 1, &pipeline_info, nullptr, &library);
+    if (shader_module != VK_NULL_HANDLE) {
+        vkDestroyShaderModule(device, shader_module, nullptr);
+    }
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("failed to create pipeline library!");
+    }
+    return library;
+}
+
+VkPipeline PipelineLibraryCache::link(const PipelineDesc& desc) {
+    VkPipeline libraries[] = {
+        getPart(Part::VertexInput, desc),
+        getPart(Part::PreRasterization, desc),
+        getPart(Part::FragmentShader, desc),
+        getPart(Part::FragmentOutput, desc),
+    };
+
+    VkPipelineLibraryCreateInfoKHR link_info{};
+    link_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LIBRARY_CREATE_INFO_KHR;
+    link_info.libraryCount = 4;
+    link_info.pLibraries = libraries;
+
+    // No VK_PIPELINE_CREATE_LINK_TIME_OPTIMIZATION_BIT_EXT: this is the fast
+    // path, the driver only stitches the precompiled parts together
+    VkGraphicsPipelineCreateInfo pipeline_info{};
+    pipeline_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    pipeline_info.pNext = &link_info;
+    pipeline_info.flags = desc.create_flags;  // Must match the parts
+    pipeline_info.layout = desc.layout;
+
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    if (vkCreateGraphicsPipelines(device, pipeline_cache, 1, &pipeline_info,
+                                  nullptr, &pipeline) != VK_SUCCESS) {
+        throw std::runtime_error("failed to link graphics pipeline!");
+    }
+    return pipeline;
+}
+
+void PipelineLibraryCache::clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& map : parts) {
+        for (const auto& [key, library] : map) {
+            vkDestroyPipeline(device, library, nullptr);
+        }
+        map.clear();
+    }
+}
+
+size_t PipelineLibraryCache::getPartCount() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t count = 0;
+    for (const auto& map : parts) {
+        count += map.size();
+    }
+    return count;
+}
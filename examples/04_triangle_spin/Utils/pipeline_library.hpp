@@ -0,0 +1,55 @@
+/*
+ * @author: Avidel
+ * @LastEditors: Avidel
+ */
+#pragma once
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vulkan/vulkan.h>
+
+#include "pipeline_manager.hpp"
+
+// --- Graphics Pipeline Library Cache ---
+// Builds the four VK_EXT_graphics_pipeline_library parts (vertex input,
+// pre-rasterization, fragment shader, fragment output) once per unique subset
+// of a PipelineDesc and fast-links them into complete pipelines. A new blend
+// or cull mode then only compiles the one part that changed.
+class PipelineLibraryCache {
+public:
+    enum class Part {
+        VertexInput,
+        PreRasterization,
+        FragmentShader,
+        FragmentOutput,
+    };
+
+    PipelineLibraryCache(VkDevice device, VkPipelineCache pipelineCache);
+    ~PipelineLibraryCache();  // Calls clear()
+
+    PipelineLibraryCache(const PipelineLibraryCache&) = delete;
+    PipelineLibraryCache& operator=(const PipelineLibraryCache&) = delete;
+
+    // Fetch or build the parts for desc and link them without link-time
+    // optimization. Thread safe; the caller owns the returned pipeline.
+    VkPipeline link(const PipelineDesc& desc);
+
+    // Build (or look up) a single part; exposed for benchmarking
+    VkPipeline getPart(Part part, const PipelineDesc& desc);
+
+    // Destroy all parts. Linked pipelines stay valid, but the device must be
+    // idle if the render pass or layout they reference is going away.
+    void clear();
+
+    size_t getPartCount() const;
+
+private:
+    VkPipeline createPart(Part part, const PipelineDesc& desc);
+
+    VkDevice device;
+    VkPipelineCache pipeline_cache;
+
+    mutable std::mutex mutex;
+    // One map per part, keyed by the matching PipelineDesc sub-hash
+    std::unordered_map<uint64_t, VkPipeline> parts[4];
+};
@@ -0,0 +1,480 @@
+/*
+ * @author: Avidel
+ * @LastEditors: Avidel
+ */
+#include "pipeline_manager.hpp"
+
+#include "hash_util.hpp"
+#include "pipeline_library.hpp"
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+using hash_util::equalRange;
+using hash_util::FNV_OFFSET;
+using hash_util::hashRange;
+using hash_util::hashValue;
+
+double elapsedMs(std::chrono::steady_clock::time_point since) {
+    return std::chrono::duration<double, std::milli>(
+               std::chrono::steady_clock::now() - since)
+        .count();
+}
+}  // namespace
+
+uint64_t PipelineDesc::hash() const {
+    uint64_t hash = FNV_OFFSET;
+    hashValue(hash, hashVertexInput());
+    hashValue(hash, hashPreRasterization());
+    hashValue(hash, hashFragmentShader());
+    hashValue(hash, hashFragmentOutput());
+    return hash != 0 ? hash : 1;  // 0 is reserved for "no pipeline"
+}
+
+bool PipelineDesc::operator==(const PipelineDesc& other) const {
+    return equalRange(vert_spirv, other.vert_spirv) &&
+           equalRange(frag_spirv, other.frag_spirv) &&
+           equalRange(bindings, other.bindings) &&
+           equalRange(attributes, other.attributes) &&
+           topology == other.topology &&
+           polygon_mode == other.polygon_mode &&
+           cull_mode == other.cull_mode && front_face == other.front_face &&
+           depth_test == other.depth_test &&
+           depth_write == other.depth_write &&
+           blend_enable == other.blend_enable &&
+           depth_attachment == other.depth_attachment &&
+           color_attachment_count == other.color_attachment_count &&
+           layout == other.layout && render_pass == other.render_pass &&
+           subpass == other.subpass && create_flags == other.create_flags &&
+           dynamic_states == other.dynamic_states;
+}
+
+uint64_t PipelineDesc::hashVertexInput() const {
+    uint64_t hash = FNV_OFFSET;
+    hashRange(hash, dynamic_states);
+    hashValue(hash, create_flags);
+    hashRange(hash, bindings);
+    hashRange(hash, attributes);
+    hashValue(hash, topology);
+    return hash;
+}
+
+uint64_t PipelineDesc::hashPreRasterization() const {
+    uint64_t hash = FNV_OFFSET;
+    hashRange(hash, dynamic_states);
+    hashValue(hash, create_flags);
+    hashRange(hash, vert_spirv);
+    hashValue(hash, polygon_mode);
+    hashValue(hash, cull_mode);
+    hashValue(hash, front_face);
+    hashValue(hash, layout);
+    hashValue(hash, render_pass);
+    hashValue(hash, subpass);
+    return hash;
+}
+
+uint64_t PipelineDesc::hashFragmentShader() const {
+    uint64_t hash = FNV_OFFSET;
+    hashRange(hash, dynamic_states);
+    hashValue(hash, create_flags);
+    hashRange(hash, frag_spirv);
+    hashValue(hash, depth_test);
+    hashValue(hash, depth_write);
+    hashValue(hash, depth_attachment);
+    hashValue(hash, layout);
+    hashValue(hash, render_pass);
+    hashValue(hash, subpass);
+    return hash;
+}
+
+uint64_t PipelineDesc::hashFragmentOutput() const {
+    uint64_t hash = FNV_OFFSET;
+    hashRange(hash, dynamic_states);
+    hashValue(hash, create_flags);
+    hashValue(hash, blend_enable);
+    hashValue(hash, color_attachment_count);
+    hashValue(hash, render_pass);
+    hashValue(hash, subpass);
+    return hash;
+}
+
+PipelineFixedState::PipelineFixedState(const PipelineDesc& desc) {
+    // --- Vertex Input State ---
+    vertex_input.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+    vertex_input.vertexBindingDescriptionCount =
+        static_cast<uint32_t>(desc.bindings.size());
+    vertex_input.pVertexBindingDescriptions = desc.bindings.data();
+    vertex_input.vertexAttributeDescriptionCount =
+        static_cast<uint32_t>(desc.attributes.size());
+    vertex_input.pVertexAttributeDescriptions = desc.attributes.data();
+
+    // --- Input Assembly State ---
+    input_assembly.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+    // Topology is dynamic, this only picks the topology class
+    input_assembly.topology = desc.topology;
+    input_assembly.primitiveRestartEnable = VK_FALSE;
+
+    // --- Viewport and Scissor --- (Dynamic state, but need placeholder here)
+    viewport_state.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+    viewport_state.viewportCount = 1;  // One viewport
+    viewport_state.scissorCount = 1;   // One scissor rectangle
+
+    // --- Rasterization State ---
+    rasterizer.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+    rasterizer.depthClampEnable = VK_FALSE;
+    rasterizer.rasterizerDiscardEnable = VK_FALSE;
+    rasterizer.polygonMode = desc.polygon_mode;
+    rasterizer.lineWidth = 1.0f;  // 点的大小通过 gl_PointSize 控制
+    rasterizer.cullMode = desc.cull_mode;
+    rasterizer.frontFace = desc.front_face;
+    rasterizer.depthBiasEnable = VK_FALSE;
+
+    // --- Multisampling State ---
+    multisampling.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+    multisampling.sampleShadingEnable = VK_FALSE;
+    multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+    // --- Depth/Stencil State ---
+    depth_stencil.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+    depth_stencil.depthTestEnable = desc.depth_test ? VK_TRUE : VK_FALSE;
+    depth_stencil.depthWriteEnable = desc.depth_write ? VK_TRUE : VK_FALSE;
+    depth_stencil.depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+    depth_attachment = desc.depth_attachment;
+
+    // --- Color Blend State ---
+    color_blend_attachment.colorWriteMask =
+        VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+        VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+    color_blend_attachment.blendEnable =
+        desc.blend_enable ? VK_TRUE : VK_FALSE;
+    color_blend_attachment.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+    color_blend_attachment.dstColorBlendFactor =
+        VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+    color_blend_attachment.colorBlendOp = VK_BLEND_OP_ADD;
+    color_blend_attachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+    color_blend_attachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+    color_blend_attachment.alphaBlendOp = VK_BLEND_OP_ADD;
+
+    color_blending.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+    color_blending.logicOpEnable = VK_FALSE;
+    color_blending.attachmentCount = desc.color_attachment_count;
+    color_blending.pAttachments =
+        desc.color_attachment_count > 0 ? &color_blend_attachment : nullptr;
+
+    // --- Dynamic State ---
+    dynamic_states = desc.dynamic_states;
+    dynamic_state.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+    dynamic_state.dynamicStateCount =
+        static_cast<uint32_t>(dynamic_states.size());
+    dynamic_state.pDynamicStates = dynamic_states.data();
+}
+
+const VkPipelineDepthStencilStateCreateInfo* PipelineFixedState::depthStencil()
+    const {
+    bool uses_depth = depth_attachment ||
+                      depth_stencil.depthTestEnable == VK_TRUE ||
+                      depth_stencil.depthWriteEnable == VK_TRUE;
+    return uses_depth ? &depth_stencil : nullptr;
+}
+
+VkShaderModule createShaderModule(VkDevice device,
+                                  std::span<const uint32_t> code) {
+    VkShaderModuleCreateInfo create_info{};
+    create_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    create_info.codeSize = code.size_bytes();  // Size in bytes, not words
+    create_info.pCode = code.data();
+
+    VkShaderModule shader_module;
+    if (vkCreateShaderModule(device, &create_info, nullptr, &shader_module) !=
+        VK_SUCCESS) {
+        throw std::runtime_error("failed to create shader module!");
+    }
+    return shader_module;
+}
+
+PipelineManager::PipelineManager(VkDevice device, uint32_t framesInFlight,
+                                 uint32_t workerCount)
+    : device(device), frames_in_flight(framesInFlight) {
+    VkPipelineCacheCreateInfo cache_info{};
+    cache_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    if (vkCreatePipelineCache(device, &cache_info, nullptr, &pipeline_cache) !=
+        VK_SUCCESS) {
+        throw std::runtime_error("failed to create pipeline cache!");
+    }
+
+    if (workerCount == 0) {
+        workerCount = std::max(1u, std::thread::hardware_concurrency() / 4);
+    }
+    for (uint32_t i = 0; i < workerCount; ++i) {
+        workers.emplace_back(&PipelineManager::workerLoop, this);
+    }
+    spdlog::debug("Pipeline manager started with {} compile workers.",
+                  workerCount);
+}
+
+PipelineManager::~PipelineManager() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        queue.clear();
+    }
+    work_cv.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    clear();
+    libraries.reset();
+    vkDestroyPipelineCache(device, pipeline_cache, nullptr);
+}
+
+void PipelineManager::enableLibraries() {
+    libraries = std::make_unique<PipelineLibraryCache>(device, pipeline_cache);
+    spdlog::info("Pipeline manager links pipelines from library parts.");
+}
+
+VkPipeline PipelineManager::createPipeline(const PipelineDesc& desc) {
+    if (libraries) {
+        return libraries->link(desc);
+    }
+    return createMonolithicPipeline(desc);
+}
+
+VkPipeline PipelineManager::createMonolithicPipeline(const PipelineDesc& desc) {
+    VkShaderModule vert_shader_module =
+        createShaderModule(device, desc.vert_spirv);
+    VkShaderModule frag_shader_module =
+        createShaderModule(device, desc.frag_spirv);
+
+    // --- Shader Stage Creation ---
+    VkPipelineShaderStageCreateInfo vert_shader_stage_info{};
+    vert_shader_stage_info.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    vert_shader_stage_info.stage = VK_SHADER_STAGE_VERTEX_BIT;
+    vert_shader_stage_info.module = vert_shader_module;
+    vert_shader_stage_info.pName = "main";  // Entry point function name
+
+    VkPipelineShaderStageCreateInfo frag_shader_stage_info{};
+    frag_shader_stage_info.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    frag_shader_stage_info.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+    frag_shader_stage_info.module = frag_shader_module;
+    frag_shader_stage_info.pName = "main";
+
+    VkPipelineShaderStageCreateInfo shader_stages[] = {vert_shader_stage_info,
+                                                       frag_shader_stage_info};
+
+    PipelineFixedState state(desc);
+
+    // --- Graphics Pipeline Creation ---
+    VkGraphicsPipelineCreateInfo pipeline_info{};
+    pipeline_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    pipeline_info.flags = desc.create_flags;
+    pipeline_info.stageCount = 2;
+    pipeline_info.pStages = shader_stages;
+    pipeline_info.pVertexInputState = &state.vertex_input;
+    pipeline_info.pInputAssemblyState = &state.input_assembly;
+    pipeline_info.pViewportState = &state.viewport_state;
+    pipeline_info.pRasterizationState = &state.rasterizer;
+    pipeline_info.pMultisampleState = &state.multisampling;
+    pipeline_info.pDepthStencilState = state.depthStencil();
+    pipeline_info.pColorBlendState = &state.color_blending;
+    pipeline_info.pDynamicState = &state.dynamic_state;
+    pipeline_info.layout = desc.layout;
+    pipeline_info.renderPass = desc.render_pass;
+    pipeline_info.subpass = desc.subpass;
+
+    // The cache is internally synchronized, so workers share it freely
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    VkResult result = vkCreateGraphicsPipelines(
+        device, pipeline_cache, 1, &pipeline_info, nullptr, &pipeline);
+
+    // --- Cleanup Shader Modules ---
+    vkDestroyShaderModule(device, frag_shader_module, nullptr);
+    vkDestroyShaderModule(device, vert_shader_module, nullptr);
+
+    if (result != VK_SUCCESS) {
+        throw std::runtime_error("failed to create graphics pipeline!");
+    }
+    return pipeline;
+}
+
+PipelineManager::PipelineKey PipelineManager::request(const PipelineDesc& desc,
+                                                      Fallback fallback) {
+    PipelineKey key = desc.hash();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        // A different description under the same hash moves on to the next
+        // key, so get() never answers with another description's pipeline
+        for (auto it = entries.find(key); it != entries.end();
+             it = entries.find(key)) {
+            if (it->second->desc == desc) {
+                return key;  // Already compiled or on its way
+            }
+            key = key + 1 != 0 ? key + 1 : 1;
+        }
+        auto entry = std::make_shared<Entry>();
+        entry->desc = desc;
+        entry->fallback = fallback;
+        entry->requested = std::chrono::steady_clock::now();
+        entries.emplace(key, entry);
+        queue.push_back(std::move(entry));
+    }
+    work_cv.notify_one();
+    return key;
+}
+
+VkPipeline PipelineManager::get(PipelineKey key) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(key);
+    if (it != entries.end()) {
+        if (VkPipeline pipeline = it->second->pipeline.load()) {
+            return pipeline;
+        }
+        if (it->second->fallback == Fallback::Skip) {
+            ++stats.skipped_binds;
+            return VK_NULL_HANDLE;
+        }
+    }
+    ++stats.fallback_binds;
+    return fallback_pipeline;
+}
+
+PipelineManager::Status PipelineManager::getStatus(PipelineKey key) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(key);
+    if (it == entries.end()) {
+        return Status::Unknown;
+    }
+    if (it->second->pipeline.load() != VK_NULL_HANDLE) {
+        return Status::Ready;
+    }
+    return it->second->failed ? Status::Failed : Status::Pending;
+}
+
+void PipelineManager::retire(PipelineKey key, uint64_t retireFrame) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(key);
+    if (it == entries.end()) {
+        return;
+    }
+    std::shared_ptr<Entry> entry = std::move(it->second);
+    entries.erase(it);
+
+    if (VkPipeline pipeline = entry->pipeline.exchange(VK_NULL_HANDLE)) {
+        retired.push_back({pipeline, retireFrame});
+        return;
+    }
+    // Still queued: just drop it. Compiling: the worker destroys the result.
+    auto queued = std::find(queue.begin(), queue.end(), entry);
+    if (queued != queue.end()) {
+        queue.erase(queued);
+    } else {
+        entry->discarded = true;
+    }
+}
+
+void PipelineManager::collectGarbage(uint64_t currentFrame) {
+    std::lock_guard<std::mutex> lock(mutex);
+    // A pipeline retired at frame R was last recorded in frame R - 1; after
+    // frames_in_flight more frames waited on their fences it is no longer used
+    std::erase_if(retired, [&](const RetiredPipeline& entry) {
+        if (currentFrame < entry.retire_frame + frames_in_flight) {
+            return false;
+        }
+        vkDestroyPipeline(device, entry.pipeline, nullptr);
+        return true;
+    });
+}
+
+void PipelineManager::clear() {
+    std::unique_lock<std::mutex> lock(mutex);
+    queue.clear();
+    for (auto& [key, entry] : entries) {
+        entry->discarded = true;
+    }
+    idle_cv.wait(lock, [this] { return compiling == 0; });
+
+    for (auto& [key, entry] : entries) {
+        if (VkPipeline pipeline = entry->pipeline.exchange(VK_NULL_HANDLE)) {
+            vkDestroyPipeline(device, pipeline, nullptr);
+        }
+    }
+    entries.clear();
+    for (const auto& entry : retired) {
+        vkDestroyPipeline(device, entry.pipeline, nullptr);
+    }
+    retired.clear();
+    // Library parts reference the render pass and layout as well
+    if (libraries) {
+        libraries->clear();
+    }
+}
+
+PipelineManager::Stats PipelineManager::getStats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    Stats result = stats;
+    result.queue_depth = queue.size();
+    result.compiling = compiling;
+    result.ready = static_cast<size_t>(
+        std::count_if(entries.begin(), entries.end(), [](const auto& entry) {
+            return entry.second->pipeline.load() != VK_NULL_HANDLE;
+        }));
+    return result;
+}
+
+void PipelineManager::workerLoop() {
+    while (true) {
+        std::shared_ptr<Entry> entry;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            work_cv.wait(lock, [this] { return stopping || !queue.empty(); });
+            if (stopping) {
+                return;
+            }
+            entry = std::move(queue.front());
+            queue.pop_front();
+            ++compiling;
+        }
+
+        auto compile_start = std::chrono::steady_clock::now();
+        VkPipeline pipeline = VK_NULL_HANDLE;
+        try {
+            pipeline = createPipeline(entry->desc);
+        } catch (const std::exception& e) {
+            spdlog::error("Async pipeline compile failed: {}", e.what());
+        }
+        double compile_ms = elapsedMs(compile_start);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            --compiling;
+            if (entry->discarded) {
+                if (pipeline != VK_NULL_HANDLE) {
+                    vkDestroyPipeline(device, pipeline, nullptr);
+                }
+            } else if (pipeline == VK_NULL_HANDLE) {
+                entry->failed = true;
+            } else {
+                double latency_ms = elapsedMs(entry->requested);
+                ++stats.compiled;
+                double n = static_cast<double>(stats.compiled);
+                stats.last_latency_ms = latency_ms;
+                stats.avg_latency_ms += (latency_ms - stats.avg_latency_ms) / n;
+                stats.max_latency_ms =
+                    std::max(stats.max_latency_ms, latency_ms);
+                stats.avg_compile_ms += (compile_ms - stats.avg_compile_ms) / n;
+                entry->pipeline = pipeline;
+            }
+        }
+        idle_cv.notify_all();
+    }
+}
@@ -0,0 +1,198 @@
+/*
+ * @author: Avidel
+ * @LastEditors: Avidel
+ */
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+// --- Pipeline Description ---
+// Everything that ends up baked into a VkPipeline. Equal descriptions are the
+// same pipeline; hash() is only a key and may collide.
+struct PipelineDesc {
+    std::vector<uint32_t> vert_spirv;
+    std::vector<uint32_t> frag_spirv;
+    std::vector<VkVertexInputBindingDescription> bindings;
+    std::vector<VkVertexInputAttributeDescription> attributes;
+    VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+    VkPolygonMode polygon_mode = VK_POLYGON_MODE_FILL;
+    VkCullModeFlags cull_mode = VK_CULL_MODE_NONE;
+    VkFrontFace front_face = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+    bool depth_test = false;
+    bool depth_write = false;
+    bool blend_enable = false;
+    // The subpass has a depth attachment: depth state is then always given,
+    // even when depth test and write are dynamic
+    bool depth_attachment = false;
+    uint32_t color_attachment_count = 1;  // 0 for depth-only passes
+    VkPipelineLayout layout = VK_NULL_HANDLE;
+    VkRenderPass render_pass = VK_NULL_HANDLE;
+    uint32_t subpass = 0;
+    // E.g. VK_PIPELINE_CREATE_DESCRIPTOR_BUFFER_BIT_EXT; never the library bit
+    VkPipelineCreateFlags create_flags = 0;
+    // States set while recording; see DynamicStateTracker::normalize()
+    std::vector<VkDynamicState> dynamic_states = {
+        VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR,
+        VK_DYNAMIC_STATE_PRIMITIVE_TOPOLOGY_EXT};
+
+    // 64-bit FNV-1a over the full state; never returns 0
+    uint64_t hash() const;
+    // Every field hash() covers
+    bool operator==(const PipelineDesc& other) const;
+
+    // Hashes of the four graphics pipeline library subsets. hash() combines
+    // them, so the subsets together cover the full state. The dynamic state
+    // list is part of every subset.
+    uint64_t hashVertexInput() const;       // Bindings, attributes, topology
+    uint64_t hashPreRasterization() const;  // Vertex shader, raster state
+    uint64_t hashFragmentShader() const;    // Fragment shader, depth state
+    uint64_t hashFragmentOutput() const;    // Blend state, render pass
+};
+
+// Fixed-function create infos filled from a PipelineDesc, shared by the
+// monolithic and the pipeline library paths. The pointers inside reference the
+// desc and this object, so neither may move while it is in use.
+struct PipelineFixedState {
+    explicit PipelineFixedState(const PipelineDesc& desc);
+    PipelineFixedState(const PipelineFixedState&) = delete;
+    PipelineFixedState& operator=(const PipelineFixedState&) = delete;
+
+    // Null when the desc neither tests nor writes depth and has no depth
+    // attachment, so render passes without one stay valid
+    const VkPipelineDepthStencilStateCreateInfo* depthStencil() const;
+
+    VkPipelineVertexInputStateCreateInfo vertex_input{};
+    VkPipelineInputAssemblyStateCreateInfo input_assembly{};
+    VkPipelineViewportStateCreateInfo viewport_state{};
+    VkPipelineRasterizationStateCreateInfo rasterizer{};
+    VkPipelineMultisampleStateCreateInfo multisampling{};
+    VkPipelineDepthStencilStateCreateInfo depth_stencil{};
+    VkPipelineColorBlendAttachmentState color_blend_attachment{};
+    VkPipelineColorBlendStateCreateInfo color_blending{};
+    std::vector<VkDynamicState> dynamic_states;
+    VkPipelineDynamicStateCreateInfo dynamic_state{};
+    bool depth_attachment = false;
+};
+
+VkShaderModule createShaderModule(VkDevice device,
+                                  std::span<const uint32_t> code);
+
+class PipelineLibraryCache;
+
+// --- Asynchronous Pipeline Compilation ---
+// Compiles pipelines on dedicated worker threads so the render thread never
+// blocks in vkCreateGraphicsPipelines. Until a pipeline is ready, get()
+// returns the fallback pipeline or VK_NULL_HANDLE (skip the draw).
+class PipelineManager {
+public:
+    // PipelineDesc::hash(), or the next free value if another description
+    // already has it; 0 means "none"
+    using PipelineKey = uint64_t;
+
+    enum class Fallback {
+        UseFallback,  // Draw with the generic fallback pipeline meanwhile
+        Skip,         // get() returns VK_NULL_HANDLE until ready
+    };
+
+    enum class Status { Unknown, Pending, Ready, Failed };
+
+    struct Stats {
+        size_t queue_depth = 0;       // Requests waiting for a worker
+        size_t compiling = 0;         // Requests being compiled right now
+        size_t ready = 0;             // Pipelines available to get()
+        uint64_t compiled = 0;        // Total successful compiles
+        uint64_t fallback_binds = 0;  // get() answered with the fallback
+        uint64_t skipped_binds = 0;   // get() answered VK_NULL_HANDLE
+        double last_latency_ms = 0.0;  // Request -> ready, incl. queueing
+        double avg_latency_ms = 0.0;
+        double max_latency_ms = 0.0;
+        double avg_compile_ms = 0.0;  // vkCreateGraphicsPipelines only
+    };
+
+    // workerCount 0 picks a quarter of the hardware threads (at least one)
+    PipelineManager(VkDevice device, uint32_t framesInFlight,
+                    uint32_t workerCount = 0);
+    ~PipelineManager();  // Stops workers and destroys owned pipelines
+
+    PipelineManager(const PipelineManager&) = delete;
+    PipelineManager& operator=(const PipelineManager&) = delete;
+
+    // Use VK_EXT_graphics_pipeline_library: new state combinations link from
+    // cached parts instead of compiling a whole pipeline
+    void enableLibraries();
+    bool librariesEnabled() const { return libraries != nullptr; }
+
+    // Compile on the calling thread (linked from library parts when enabled).
+    // The caller owns the returned pipeline.
+    VkPipeline createPipeline(const PipelineDesc& desc);
+    VkPipeline createMonolithicPipeline(const PipelineDesc& desc);
+
+    // Queue a compile unless an equal description is already known
+    PipelineKey request(const PipelineDesc& desc,
+                        Fallback fallback = Fallback::UseFallback);
+
+    // Per-draw lookup: the real pipeline, the fallback, or VK_NULL_HANDLE
+    VkPipeline get(PipelineKey key);
+    Status getStatus(PipelineKey key) const;
+
+    // Not owned; typically a generic pipeline compiled synchronously at init
+    void setFallback(VkPipeline pipeline) { fallback_pipeline = pipeline; }
+
+    // Drop a pipeline. It is destroyed by collectGarbage() once the frame it
+    // was retired in has completed (retireFrame 0: it was never bound).
+    void retire(PipelineKey key, uint64_t retireFrame);
+    void collectGarbage(uint64_t currentFrame);
+
+    // Cancel queued work, wait for running compiles and destroy everything.
+    // The device must be idle. Used when the render pass is recreated.
+    void clear();
+
+    Stats getStats() const;
+
+    VkPipelineCache getCache() const { return pipeline_cache; }
+
+private:
+    struct Entry {
+        PipelineDesc desc;
+        Fallback fallback = Fallback::UseFallback;
+        std::atomic<VkPipeline> pipeline{VK_NULL_HANDLE};
+        std::atomic<bool> failed{false};
+        bool discarded = false;  // Retired while compiling (guarded by mutex)
+        std::chrono::steady_clock::time_point requested;
+    };
+
+    struct RetiredPipeline {
+        VkPipeline pipeline;
+        uint64_t retire_frame;
+    };
+
+    void workerLoop();
+
+    VkDevice device;
+    uint32_t frames_in_flight;
+    VkPipelineCache pipeline_cache{VK_NULL_HANDLE};
+    std::unique_ptr<PipelineLibraryCache> libraries;
+    VkPipeline fallback_pipeline{VK_NULL_HANDLE};
+
+    mutable std::mutex mutex;
+    std::condition_variable work_cv;  // Signals workers: new request or stop
+    std::condition_variable idle_cv;  // Signals clear(): a compile finished
+    std::unordered_map<PipelineKey, std::shared_ptr<Entry>> entries;
+    std::deque<std::shared_ptr<Entry>> queue;
+    std::vector<RetiredPipeline> retired;
+    size_t compiling = 0;
+    bool stopping = false;
+    Stats stats;
+
+    std::vector<std::thread> workers;
+};
@@ -0,0 +1,1294 @@
+/*
+ * @author: Avidel
+ * @LastEditors: Avidel
+ */
+#include "render_service.hpp"
+
+#include "embedded_shaders.hpp"
+#include "spirv_reflect.hpp"
+#include "stb_image_write.h"
+#include "vulkan_util.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#if defined(__linux__)
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#endif
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+constexpr float NEAR_PLANE = 0.1f;
+constexpr float FAR_PLANE = 100.0f;
+constexpr size_t MAX_SCENE_VERTICES = 1 << 20;
+constexpr size_t MAX_SCENE_INSTANCES = 1 << 20;
+constexpr size_t MAX_CACHED_SCENES = 64;  // All dropped once exceeded
+constexpr size_t MIN_BUFFER_ELEMENTS = 1024;
+constexpr size_t READ_CHUNK = 64 * 1024;
+
+// The example's triangle, for scene files without a mesh
+const Vertex DEFAULT_MESH[] = {
+    {{0.0f, -0.5f}, {1.0f, 0.0f, 0.0f}},
+    {{0.5f, 0.5f}, {0.0f, 1.0f, 0.0f}},
+    {{-0.5f, 0.5f}, {0.0f, 0.0f, 1.0f}},
+};
+
+float elapsedMs(Clock::time_point from, Clock::time_point to) {
+    return std::chrono::duration<float, std::milli>(to - from).count();
+}
+
+// stbi_write_png_to_func callback
+void appendBytes(void* context, void* data, int size) {
+    auto* bytes = static_cast<std::vector<uint8_t>*>(context);
+    auto* begin = static_cast<const uint8_t*>(data);
+    bytes->insert(bytes->end(), begin, begin + size);
+}
+
+bool isFinite(const float* values, size_t count) {
+    return std::all_of(values, values + count,
+                       [](float value) { return std::isfinite(value); });
+}
+
+#if defined(__linux__)
+// A socket file nobody accepts connections on, left behind by a run that
+// did not get to remove it. Anything else at the path is not ours to delete.
+bool isStaleSocket(const sockaddr_un& address) {
+    struct stat info;
+    if (lstat(address.sun_path, &info) != 0 || !S_ISSOCK(info.st_mode)) {
+        return false;
+    }
+    int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (probe < 0) {
+        return false;
+    }
+    bool refused = connect(probe, reinterpret_cast<const sockaddr*>(&address),
+                           sizeof(address)) != 0 &&
+                   errno == ECONNREFUSED;
+    close(probe);
+    return refused;
+}
+#endif
+}  // namespace
+
+RenderService::RenderService(VulkanContextManager* context,
+                             uint32_t encodeThreads)
+    : vulkan_context(context) {
+    if (!vulkan_context || vulkan_context->getDevice() == VK_NULL_HANDLE) {
+        throw std::runtime_error("Render service needs a Vulkan device !");
+    }
+    device = vulkan_context->getDevice();
+    VkPhysicalDevice physical_device = vulkan_context->getPhysicalDevice();
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physical_device, &properties);
+    if (properties.limits.timestampComputeAndGraphics) {
+        timestamp_period = properties.limits.timestampPeriod;
+    }
+    // Readback is read by the CPU once per pixel: cached memory is much
+    // faster to copy out of where the device has it
+    VkPhysicalDeviceMemoryProperties memory_properties;
+    vkGetPhysicalDeviceMemoryProperties(physical_device, &memory_properties);
+    const VkMemoryPropertyFlags cached = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                         VK_MEMORY_PROPERTY_HOST_COHERENT_BIT |
+                                         VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+    for (uint32_t i = 0; i < memory_properties.memoryTypeCount; i++) {
+        if ((memory_properties.memoryTypes[i].propertyFlags & cached) ==
+            cached) {
+            readback_cached = true;
+        }
+    }
+
+    VkCommandPoolCreateInfo pool_info{};
+    pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    pool_info.queueFamilyIndex =
+        vulkan_context->findQueueFamilies(physical_device)
+            .graphics_family.value();
+    if (vkCreateCommandPool(device, &pool_info, nullptr, &command_pool) !=
+        VK_SUCCESS) {
+        throw std::runtime_error("failed to create service command pool!");
+    }
+
+    createRenderPass();
+    createPipeline();
+    createSlots();
+
+#if defined(__linux__)
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd < 0) {
+        throw std::runtime_error("Failed to create render service eventfd !");
+    }
+#endif
+    if (encodeThreads == 0) {
+        encodeThreads = std::max(1u, std::thread::hardware_concurrency() / 2);
+    }
+    readback_thread = std::thread(&RenderService::readbackLoop, this);
+    for (uint32_t i = 0; i < encodeThreads; i++) {
+        encode_threads.emplace_back(&RenderService::encodeLoop, this);
+    }
+    spdlog::info("Render service ready: {} jobs in flight, {} encode "
+                 "threads, GPU timestamps {}.",
+                 JOBS_IN_FLIGHT, encodeThreads,
+                 timestamp_period > 0.0f ? "on" : "off");
+}
+
+RenderService::~RenderService() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        threads_stopping = true;
+    }
+    readback_cv.notify_all();
+    encode_cv.notify_all();
+    if (readback_thread.joinable()) {
+        readback_thread.join();
+    }
+    for (std::thread& thread : encode_threads) {
+        thread.join();
+    }
+    vkDeviceWaitIdle(device);  // Jobs the readback thread left behind
+
+    for (Slot& slot : slots) {
+        destroySlot(slot);
+    }
+    if (descriptor_pool != VK_NULL_HANDLE) {
+        vkDestroyDescriptorPool(device, descriptor_pool, nullptr);
+    }
+    if (pipeline != VK_NULL_HANDLE) {
+        vkDestroyPipeline(device, pipeline, nullptr);
+    }
+    pipeline_manager.reset();
+    layout_cache.reset();  // Owns the set and pipeline layouts
+    if (render_pass != VK_NULL_HANDLE) {
+        vkDestroyRenderPass(device, render_pass, nullptr);
+    }
+    if (command_pool != VK_NULL_HANDLE) {
+        vkDestroyCommandPool(device, command_pool, nullptr);
+    }
+#if defined(__linux__)
+    if (wake_fd >= 0) {
+        close(wake_fd);
+    }
+#endif
+    spdlog::info("Render service destroyed.");
+}
+
+// --- Setup ---
+
+void RenderService::createRenderPass() {
+    VkPhysicalDevice physical_device = vulkan_context->getPhysicalDevice();
+    VkFormatProperties color_properties;
+    vkGetPhysicalDeviceFormatProperties(physical_device, COLOR_FORMAT,
+                                        &color_properties);
+    VkFormatFeatureFlags color_required =
+        VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT |
+        VK_FORMAT_FEATURE_TRANSFER_SRC_BIT;
+    VkFormatProperties depth_properties;
+    vkGetPhysicalDeviceFormatProperties(physical_device, DEPTH_FORMAT,
+                                        &depth_properties);
+    if ((color_properties.optimalTilingFeatures & color_required) !=
+            color_required ||
+        !(depth_properties.optimalTilingFeatures &
+          VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT)) {
+        throw std::runtime_error("offscreen target formats not supported!");
+    }
+
+    // Color ends up as the source of the readback copy
+    VkAttachmentDescription color_attachment{};
+    color_attachment.format = COLOR_FORMAT;
+    color_attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+    color_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    color_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    color_attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    color_attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    color_attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    color_attachment.finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    VkAttachmentReference color_attachment_ref{};
+    color_attachment_ref.attachment = 0;
+    color_attachment_ref.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+    VkAttachmentDescription depth_attachment{};
+    depth_attachment.format = DEPTH_FORMAT;
+    depth_attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+    depth_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    depth_attachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depth_attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    depth_attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depth_attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    depth_attachment.finalLayout =
+        VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    VkAttachmentReference depth_attachment_ref{};
+    depth_attachment_ref.attachment = 1;
+    depth_attachment_ref.layout =
+        VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+    VkSubpassDescription subpass{};
+    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpass.colorAttachmentCount = 1;
+    subpass.pColorAttachments = &color_attachment_ref;
+    subpass.pDepthStencilAttachment = &depth_attachment_ref;
+
+    // In: the previous job's copy read the color image and its depth tests
+    // wrote depth. Out: the readback copy waits for the color writes.
+    const VkPipelineStageFlags fragment_tests =
+        VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+        VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    VkSubpassDependency dependencies[2]{};
+    dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+    dependencies[0].dstSubpass = 0;
+    dependencies[0].srcStageMask =
+        VK_PIPELINE_STAGE_TRANSFER_BIT | fragment_tests;
+    dependencies[0].srcAccessMask =
+        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    dependencies[0].dstStageMask =
+        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | fragment_tests;
+    dependencies[0].dstAccessMask =
+        VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    dependencies[1].srcSubpass = 0;
+    dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+    dependencies[1].srcStageMask =
+        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    dependencies[1].dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    dependencies[1].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+    VkAttachmentDescription attachments[] = {color_attachment,
+                                             depth_attachment};
+    VkRenderPassCreateInfo render_pass_info{};
+    render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+    render_pass_info.attachmentCount = 2;
+    render_pass_info.pAttachments = attachments;
+    render_pass_info.subpassCount = 1;
+    render_pass_info.pSubpasses = &subpass;
+    render_pass_info.dependencyCount = 2;
+    render_pass_info.pDependencies = dependencies;
+    if (vkCreateRenderPass(device, &render_pass_info, nullptr,
+                           &render_pass) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create service render pass!");
+    }
+}
+
+void RenderService::createPipeline() {
+    // The window's shaders and layouts; only the render pass differs
+    ShaderReflection reflection = reflectSpirv(embedded_shaders::vert);
+    reflection.merge(reflectSpirv(embedded_shaders::frag));
+    PipelineDesc desc;
+    desc.vert_spirv.assign(embedded_shaders::vert.begin(),
+                           embedded_shaders::vert.end());
+    desc.frag_spirv.assign(embedded_shaders::frag.begin(),
+                           embedded_shaders::frag.end());
+    if (reflection.getVertexInput(desc.bindings, desc.attributes) !=
+        sizeof(Vertex)) {
+        throw std::runtime_error("vertex shader inputs do not match Vertex!");
+    }
+    layout_cache = std::make_unique<LayoutCache>(device);
+    LayoutCache::PipelineLayoutInfo layouts =
+        layout_cache->getLayouts(reflection);
+    descriptor_set_layout = layouts.set_layouts[0];
+    pipeline_layout = layouts.pipeline_layout;
+
+    const auto& features = vulkan_context->getOptionalFeatures();
+    DynamicStateTracker::Support dynamic_support;
+    dynamic_support.extended_dynamic_state2 = features.extended_dynamic_state2;
+    dynamic_support.eds3_polygon_mode = features.eds3_polygon_mode;
+    dynamic_support.eds3_color_blend_enable = features.eds3_color_blend_enable;
+    dynamic_state_tracker =
+        std::make_unique<DynamicStateTracker>(device, dynamic_support);
+    draw_state.depth_test = true;
+    draw_state.depth_write = true;
+
+    desc.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+    desc.depth_attachment = true;
+    desc.layout = pipeline_layout;
+    desc.render_pass = render_pass;
+    dynamic_state_tracker->normalize(desc);
+    // One pipeline, compiled up front: the cache keeps later starts cheap
+    pipeline_manager =
+        std::make_unique<PipelineManager>(device, JOBS_IN_FLIGHT, 1);
+    pipeline = pipeline_manager->createPipeline(desc);
+}
+
+void RenderService::createSlots() {
+    slots.resize(JOBS_IN_FLIGHT);
+
+    VkDescriptorPoolSize pool_sizes[2]{};
+    pool_sizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    pool_sizes[0].descriptorCount = JOBS_IN_FLIGHT;
+    pool_sizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    pool_sizes[1].descriptorCount = JOBS_IN_FLIGHT;
+    VkDescriptorPoolCreateInfo pool_info{};
+    pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    pool_info.poolSizeCount = 2;
+    pool_info.pPoolSizes = pool_sizes;
+    pool_info.maxSets = JOBS_IN_FLIGHT;
+    if (vkCreateDescriptorPool(device, &pool_info, nullptr,
+                               &descriptor_pool) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create service descriptor pool!");
+    }
+
+    for (uint32_t i = 0; i < JOBS_IN_FLIGHT; i++) {
+        Slot& slot = slots[i];
+        VkDescriptorSetAllocateInfo set_info{};
+        set_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        set_info.descriptorPool = descriptor_pool;
+        set_info.descriptorSetCount = 1;
+        set_info.pSetLayouts = &descriptor_set_layout;
+        VkCommandBufferAllocateInfo command_info{};
+        command_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        command_info.commandPool = command_pool;
+        command_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        command_info.commandBufferCount = 1;
+        VkFenceCreateInfo fence_info{};
+        fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        if (vkAllocateDescriptorSets(device, &set_info,
+                                     &slot.descriptor_set) != VK_SUCCESS ||
+            vkAllocateCommandBuffers(device, &command_info,
+                                     &slot.command_buffer) != VK_SUCCESS ||
+            vkCreateFence(device, &fence_info, nullptr, &slot.fence) !=
+                VK_SUCCESS) {
+            throw std::runtime_error("failed to create service job slot!");
+        }
+        if (timestamp_period > 0.0f) {
+            // Start, render pass done, readback copy done
+            VkQueryPoolCreateInfo query_info{};
+            query_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+            query_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+            query_info.queryCount = 3;
+            if (vkCreateQueryPool(device, &query_info, nullptr,
+                                  &slot.timestamps) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create query pool!");
+            }
+        }
+        vulkan_context->createBuffer(
+            sizeof(FrameUniforms), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            slot.uniform_buffer, slot.uniform_buffer_memory);
+        vkMapMemory(device, slot.uniform_buffer_memory, 0,
+                    sizeof(FrameUniforms), 0, &slot.uniforms_mapped);
+        free_slots.push_back(i);
+    }
+}
+
+void RenderService::destroyTargets(Slot& slot) {
+    if (slot.framebuffer != VK_NULL_HANDLE) {
+        vkDestroyFramebuffer(device, slot.framebuffer, nullptr);
+        vkDestroyImageView(device, slot.color_image_view, nullptr);
+        vkDestroyImage(device, slot.color_image, nullptr);
+        vkFreeMemory(device, slot.color_image_memory, nullptr);
+        vkDestroyImageView(device, slot.depth_image_view, nullptr);
+        vkDestroyImage(device, slot.depth_image, nullptr);
+        vkFreeMemory(device, slot.depth_image_memory, nullptr);
+    }
+    slot.framebuffer = VK_NULL_HANDLE;
+    slot.extent = {0, 0};
+}
+
+void RenderService::destroySlot(Slot& slot) {
+    destroyTargets(slot);
+    auto destroy_buffer = [&](VkBuffer& buffer, VkDeviceMemory& memory) {
+        if (buffer != VK_NULL_HANDLE) {
+            vkDestroyBuffer(device, buffer, nullptr);
+            vkFreeMemory(device, memory, nullptr);  // Unmaps
+        }
+        buffer = VK_NULL_HANDLE;
+        memory = VK_NULL_HANDLE;
+    };
+    destroy_buffer(slot.vertex_buffer, slot.vertex_buffer_memory);
+    destroy_buffer(slot.instance_buffer, slot.instance_buffer_memory);
+    destroy_buffer(slot.uniform_buffer, slot.uniform_buffer_memory);
+    destroy_buffer(slot.readback_buffer, slot.readback_buffer_memory);
+    if (slot.fence != VK_NULL_HANDLE) {
+        vkDestroyFence(device, slot.fence, nullptr);
+    }
+    if (slot.timestamps != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(device, slot.timestamps, nullptr);
+    }
+    // Command buffers and sets go with their pools
+}
+
+void RenderService::ensureTargets(Slot& slot, VkExtent2D extent) {
+    if (slot.extent.width == extent.width &&
+        slot.extent.height == extent.height) {
+        return;
+    }
+    destroyTargets(slot);
+
+    VkImageCreateInfo image_info{};
+    image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    image_info.imageType = VK_IMAGE_TYPE_2D;
+    image_info.format = COLOR_FORMAT;
+    image_info.extent = {extent.width, extent.height, 1};
+    image_info.mipLevels = 1;
+    image_info.arrayLayers = 1;
+    image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+    image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+    image_info.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                       VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    vulkan_context->createImage(image_info,
+                                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                                slot.color_image, slot.color_image_memory);
+    image_info.format = DEPTH_FORMAT;
+    image_info.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+    vulkan_context->createImage(image_info,
+                                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                                slot.depth_image, slot.depth_image_memory);
+
+    VkImageViewCreateInfo view_info{};
+    view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    view_info.image = slot.color_image;
+    view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    view_info.format = COLOR_FORMAT;
+    view_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    view_info.subresourceRange.levelCount = 1;
+    view_info.subresourceRange.layerCount = 1;
+    VkImageViewCreateInfo depth_view_info = view_info;
+    depth_view_info.image = slot.depth_image;
+    depth_view_info.format = DEPTH_FORMAT;
+    depth_view_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+    if (vkCreateImageView(device, &view_info, nullptr,
+                          &slot.color_image_view) != VK_SUCCESS ||
+        vkCreateImageView(device, &depth_view_info, nullptr,
+                          &slot.depth_image_view) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create offscreen image views!");
+    }
+
+    VkImageView attachments[] = {slot.color_image_view,
+                                 slot.depth_image_view};
+    VkFramebufferCreateInfo framebuffer_info{};
+    framebuffer_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+    framebuffer_info.renderPass = render_pass;
+    framebuffer_info.attachmentCount = 2;
+    framebuffer_info.pAttachments = attachments;
+    framebuffer_info.width = extent.width;
+    framebuffer_info.height = extent.height;
+    framebuffer_info.layers = 1;
+    if (vkCreateFramebuffer(device, &framebuffer_info, nullptr,
+                            &slot.framebuffer) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create offscreen framebuffer!");
+    }
+    slot.extent = extent;
+
+    // The readback buffer only grows: alternating sizes don't reallocate it
+    VkDeviceSize readback_size = VkDeviceSize(extent.width) * extent.height * 4;
+    if (readback_size > slot.readback_size) {
+        if (slot.readback_buffer != VK_NULL_HANDLE) {
+            vkDestroyBuffer(device, slot.readback_buffer, nullptr);
+            vkFreeMemory(device, slot.readback_buffer_memory, nullptr);
+        }
+        VkMemoryPropertyFlags properties =
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+        if (readback_cached) {
+            properties |= VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+        }
+        vulkan_context->createBuffer(readback_size,
+                                     VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                     properties, slot.readback_buffer,
+                                     slot.readback_buffer_memory);
+        vkMapMemory(device, slot.readback_buffer_memory, 0, readback_size, 0,
+                    &slot.readback_mapped);
+        slot.readback_size = readback_size;
+    }
+}
+
+void RenderService::ensureBuffers(Slot& slot, size_t vertexCount,
+                                  size_t instanceCount) {
+    const VkMemoryPropertyFlags host_visible =
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    auto grow = [&](size_t count, size_t& capacity, size_t elementSize,
+                    VkBufferUsageFlags usage, VkBuffer& buffer,
+                    VkDeviceMemory& memory, void*& mapped) {
+        if (count <= capacity) {
+            return false;
+        }
+        if (buffer != VK_NULL_HANDLE) {
+            vkDestroyBuffer(device, buffer, nullptr);
+            vkFreeMemory(device, memory, nullptr);
+        }
+        capacity = std::bit_ceil(std::max(count, MIN_BUFFER_ELEMENTS));
+        vulkan_context->createBuffer(capacity * elementSize, usage,
+                                     host_visible, buffer, memory);
+        vkMapMemory(device, memory, 0, capacity * elementSize, 0, &mapped);
+        return true;
+    };
+    bool vertices_grown =
+        grow(vertexCount, slot.vertex_capacity, sizeof(Vertex),
+             VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, slot.vertex_buffer,
+             slot.vertex_buffer_memory, slot.vertices_mapped);
+    bool instances_grown =
+        grow(instanceCount, slot.instance_capacity, sizeof(glm::mat4),
+             VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, slot.instance_buffer,
+             slot.instance_buffer_memory, slot.instances_mapped);
+    if (vertices_grown || instances_grown) {
+        slot.scene_version = 0;  // New buffers hold nothing yet
+    }
+    if (!instances_grown) {
+        return;
+    }
+
+    // Binding 0: frame uniforms, binding 1: world matrices
+    VkDescriptorBufferInfo buffer_info{};
+    buffer_info.buffer = slot.uniform_buffer;
+    buffer_info.range = sizeof(FrameUniforms);
+    VkWriteDescriptorSet uniform_write{};
+    uniform_write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    uniform_write.dstSet = slot.descriptor_set;
+    uniform_write.dstBinding = 0;
+    uniform_write.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    uniform_write.descriptorCount = 1;
+    uniform_write.pBufferInfo = &buffer_info;
+    VkDescriptorBufferInfo instance_info{};
+    instance_info.buffer = slot.instance_buffer;
+    instance_info.range = sizeof(glm::mat4) * slot.instance_capacity;
+    VkWriteDescriptorSet instance_write = uniform_write;
+    instance_write.dstBinding = 1;
+    instance_write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    instance_write.pBufferInfo = &instance_info;
+    VkWriteDescriptorSet writes[] = {uniform_write, instance_write};
+    vkUpdateDescriptorSets(device, 2, writes, 0, nullptr);
+}
+
+// --- Pipeline Stages ---
+
+const RenderService::CachedScene* RenderService::loadScene(
+    const std::string& path, std::string& error) {
+    // A stat per job; the file is only parsed again once it changed
+    std::error_code code;
+    auto write_time = std::filesystem::last_write_time(path, code);
+    if (code) {
+        error = "Cannot open scene " + path + ": " + code.message();
+        return nullptr;
+    }
+    auto cached = scenes.find(path);
+    if (cached != scenes.end() && cached->second.write_time == write_time) {
+        return &cached->second;
+    }
+
+    std::ifstream file(path);
+    if (!file) {
+        error = "Cannot open scene " + path;
+        return nullptr;
+    }
+    CachedScene scene;
+    scene.write_time = write_time;
+    std::string line;
+    for (size_t line_number = 1; std::getline(file, line); line_number++) {
+        line = line.substr(0, line.find('#'));
+        std::istringstream stream(line);
+        std::string tag;
+        if (!(stream >> tag)) {
+            continue;  // Blank or comment
+        }
+        bool valid = false;
+        if (tag == "v" && scene.vertices.size() < MAX_SCENE_VERTICES) {
+            Vertex vertex;
+            valid = bool(stream >> vertex.pos.x >> vertex.pos.y >>
+                         vertex.color.r >> vertex.color.g >> vertex.color.b);
+            scene.vertices.push_back(vertex);
+        } else if (tag == "i" && scene.models.size() < MAX_SCENE_INSTANCES) {
+            glm::vec3 position;
+            float yaw = 0.0f;
+            float scale = 1.0f;
+            valid = bool(stream >> position.x >> position.y >> position.z);
+            if (valid && stream >> yaw) {
+                stream >> scale;
+            }
+            glm::mat4 model = glm::translate(glm::mat4(1.0f), position);
+            model = glm::rotate(model, glm::radians(yaw),
+                                glm::vec3(0.0f, 1.0f, 0.0f));
+            scene.models.push_back(glm::scale(model, glm::vec3(scale)));
+        }
+        if (!valid) {
+            error = path + ":" + std::to_string(line_number) +
+                    ": invalid or too many entries";
+            return nullptr;
+        }
+    }
+    if (scene.vertices.size() % 3 != 0) {
+        error = path + ": vertex count is not a multiple of 3";
+        return nullptr;
+    }
+    if (scene.models.empty()) {
+        error = path + ": no instances";
+        return nullptr;
+    }
+    if (scene.vertices.empty()) {
+        scene.vertices.assign(std::begin(DEFAULT_MESH),
+                              std::end(DEFAULT_MESH));
+    }
+
+    if (scenes.size() >= MAX_CACHED_SCENES && cached == scenes.end()) {
+        scenes.clear();
+    }
+    scene.version = ++scene_versions;
+    spdlog::debug("Loaded scene {}: {} vertices, {} instances.", path,
+                  scene.vertices.size(), scene.models.size());
+    CachedScene& entry = scenes[path];
+    entry = std::move(scene);
+    return &entry;
+}
+
+RenderService::Status RenderService::render(
+    const RequestHeader& request, const std::string& scenePath,
+    std::vector<uint8_t>& pixels, JobMetrics& metrics, std::string& error) {
+    if (free_slots.size() != slots.size()) {
+        throw std::runtime_error("Render service is busy serving !");
+    }
+    Job job;
+    job.request = request;
+    job.scene_path = scenePath;
+    job.received = Clock::now();
+    error = validateRequest(request, scenePath);
+    if (!error.empty()) {
+        return Status::BadRequest;
+    }
+    if (submitJob(job, free_slots.back())) {
+        readbackJob(job);
+    }
+    if (job.status == Status::Ok) {
+        pixels = std::move(job.pixels);
+    } else {
+        error.assign(job.payload.begin(), job.payload.end());
+    }
+    metrics = job.metrics;
+    return job.status;
+}
+
+std::string RenderService::validateRequest(const RequestHeader& request,
+                                           const std::string& scenePath) {
+    if (request.width == 0 || request.height == 0 ||
+        request.width > MAX_IMAGE_SIZE || request.height > MAX_IMAGE_SIZE) {
+        return "Image size must be 1.." + std::to_string(MAX_IMAGE_SIZE) +
+               " per side";
+    }
+    if (!isFinite(request.eye, 3) || !isFinite(request.target, 3) ||
+        !(request.fov_degrees > 0.0f && request.fov_degrees < 180.0f)) {
+        return "Invalid camera";
+    }
+    if (scenePath.empty()) {
+        return "No scene path";
+    }
+    return {};
+}
+
+void RenderService::startJob(const std::shared_ptr<Job>& job,
+                             uint32_t slotIndex) {
+    if (!submitJob(*job, slotIndex)) {
+        free_slots.push_back(slotIndex);
+        finishJob(job);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        submitted.push_back(job);
+    }
+    readback_cv.notify_one();
+}
+
+bool RenderService::submitJob(Job& job, uint32_t slotIndex) {
+    Clock::time_point start = Clock::now();
+    job.slot = slotIndex;
+    job.metrics.queue_ms = elapsedMs(job.received, start);
+    const RequestHeader& request = job.request;
+
+    std::string error;
+    const CachedScene* scene = loadScene(job.scene_path, error);
+    if (!scene) {
+        job.status = Status::SceneError;
+        job.payload.assign(error.begin(), error.end());
+        return false;
+    }
+    Slot& slot = slots[slotIndex];
+    ensureTargets(slot, {request.width, request.height});
+    ensureBuffers(slot, scene->vertices.size(), scene->models.size());
+    if (slot.scene_version != scene->version) {
+        // Consecutive jobs usually share the scene; then only the camera
+        // changes
+        std::memcpy(slot.vertices_mapped, scene->vertices.data(),
+                    scene->vertices.size() * sizeof(Vertex));
+        std::memcpy(slot.instances_mapped, scene->models.data(),
+                    scene->models.size() * sizeof(glm::mat4));
+        slot.scene_version = scene->version;
+    }
+
+    glm::vec3 eye(request.eye[0], request.eye[1], request.eye[2]);
+    glm::vec3 target(request.target[0], request.target[1], request.target[2]);
+    glm::mat4 view = glm::lookAt(eye, target, glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::mat4 proj = glm::perspective(glm::radians(request.fov_degrees),
+                                      float(request.width) / request.height,
+                                      NEAR_PLANE, FAR_PLANE);
+    proj[1][1] *= -1;  // Vulkan clip space points Y down
+    FrameUniforms frame{};
+    frame.view_proj = proj * view;
+    frame.light_color = glm::vec4(1.0f);
+    std::memcpy(slot.uniforms_mapped, &frame, sizeof(frame));
+
+    recordJob(slot, static_cast<uint32_t>(scene->vertices.size()),
+              static_cast<uint32_t>(scene->models.size()));
+    VkSubmitInfo submit_info{};
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &slot.command_buffer;
+    vkResetFences(device, 1, &slot.fence);
+    if (vkQueueSubmit(vulkan_context->getGraphicsQueue(), 1, &submit_info,
+                      slot.fence) != VK_SUCCESS) {
+        throw std::runtime_error("failed to submit render job!");
+    }
+    job.submitted = Clock::now();
+    job.metrics.prepare_ms = elapsedMs(start, job.submitted);
+    return true;
+}
+
+void RenderService::recordJob(Slot& slot, uint32_t vertexCount,
+                              uint32_t instanceCount) {
+    VkCommandBuffer command_buffer = slot.command_buffer;
+    vkResetCommandBuffer(command_buffer, 0);
+    VkCommandBufferBeginInfo begin_info{};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    if (vkBeginCommandBuffer(command_buffer, &begin_info) != VK_SUCCESS) {
+        throw std::runtime_error("failed to begin recording render job!");
+    }
+    dynamic_state_tracker->reset();
+    if (slot.timestamps) {
+        vkCmdResetQueryPool(command_buffer, slot.timestamps, 0, 3);
+        vkCmdWriteTimestamp(command_buffer,
+                            VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                            slot.timestamps, 0);
+    }
+
+    VkRenderPassBeginInfo render_pass_info{};
+    render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    render_pass_info.renderPass = render_pass;
+    render_pass_info.framebuffer = slot.framebuffer;
+    render_pass_info.renderArea.extent = slot.extent;
+    VkClearValue clear_values[2]{};
+    clear_values[0].color = {{0.0f, 0.0f, 0.0f, 1.0f}};
+    clear_values[1].depthStencil = {1.0f, 0};
+    render_pass_info.clearValueCount = 2;
+    render_pass_info.pClearValues = clear_values;
+    vkCmdBeginRenderPass(command_buffer, &render_pass_info,
+                         VK_SUBPASS_CONTENTS_INLINE);
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                      pipeline);
+    VkDeviceSize offset = 0;
+    vkCmdBindVertexBuffers(command_buffer, 0, 1, &slot.vertex_buffer,
+                           &offset);
+    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                            pipeline_layout, 0, 1, &slot.descriptor_set, 0,
+                            nullptr);
+    VkViewport viewport{};
+    viewport.width = static_cast<float>(slot.extent.width);
+    viewport.height = static_cast<float>(slot.extent.height);
+    viewport.maxDepth = 1.0f;
+    vkCmdSetViewport(command_buffer, 0, 1, &viewport);
+    VkRect2D scissor{};
+    scissor.extent = slot.extent;
+    vkCmdSetScissor(command_buffer, 0, 1, &scissor);
+    dynamic_state_tracker->apply(command_buffer, draw_state);
+    vkCmdDraw(command_buffer, vertexCount, instanceCount, 0, 0);
+    vkCmdEndRenderPass(command_buffer);
+    if (slot.timestamps) {
+        vkCmdWriteTimestamp(command_buffer,
+                            VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                            slot.timestamps, 1);
+    }
+
+    // Tightly packed rows, then make them visible to the readback thread
+    VkBufferImageCopy region{};
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.layerCount = 1;
+    region.imageExtent = {slot.extent.width, slot.extent.height, 1};
+    vkCmdCopyImageToBuffer(command_buffer, slot.color_image,
+                           VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                           slot.readback_buffer, 1, &region);
+    if (slot.timestamps) {
+        vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                            slot.timestamps, 2);
+    }
+    VkBufferMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = slot.readback_buffer;
+    barrier.size = VK_WHOLE_SIZE;
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1,
+                         &barrier, 0, nullptr);
+
+    if (vkEndCommandBuffer(command_buffer) != VK_SUCCESS) {
+        throw std::runtime_error("failed to record render job!");
+    }
+}
+
+void RenderService::readbackLoop() {
+    for (;;) {
+        std::shared_ptr<Job> job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            readback_cv.wait(lock, [this] {
+                return threads_stopping || !submitted.empty();
+            });
+            if (threads_stopping) {
+                return;
+            }
+            job = submitted.front();
+            submitted.pop_front();
+        }
+        // The main thread leaves the slot alone until it is released below
+        readbackJob(*job);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            released_slots.push_back(job->slot);
+            if (job->status == Status::Ok) {
+                to_encode.push_back(job);
+            } else {
+                finished.push_back(job);
+            }
+        }
+        encode_cv.notify_one();
+        wake();
+    }
+}
+
+void RenderService::readbackJob(Job& job) {
+    Slot& slot = slots[job.slot];
+    if (vkWaitForFences(device, 1, &slot.fence, VK_TRUE, UINT64_MAX) !=
+        VK_SUCCESS) {
+        static const char message[] = "Device lost while rendering";
+        job.status = Status::RenderError;
+        job.payload.assign(message, message + sizeof(message) - 1);
+    } else {
+        uint64_t ticks[3];
+        if (slot.timestamps &&
+            vkGetQueryPoolResults(device, slot.timestamps, 0, 3,
+                                  sizeof(ticks), ticks, sizeof(uint64_t),
+                                  VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+            float ms_per_tick = timestamp_period * 1e-6f;
+            job.metrics.gpu_render_ms = (ticks[1] - ticks[0]) * ms_per_tick;
+            job.metrics.gpu_readback_ms = (ticks[2] - ticks[1]) * ms_per_tick;
+        }
+        // One pass over the mapping: the slot is free again right after
+        const auto* pixels = static_cast<const uint8_t*>(slot.readback_mapped);
+        job.pixels.assign(pixels, pixels + size_t(job.request.width) *
+                                               job.request.height * 4);
+    }
+    job.metrics.execute_ms = elapsedMs(job.submitted, Clock::now());
+}
+
+void RenderService::encodeLoop() {
+    for (;;) {
+        std::shared_ptr<Job> job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            encode_cv.wait(lock, [this] {
+                return threads_stopping || !to_encode.empty();
+            });
+            if (threads_stopping) {
+                return;
+            }
+            job = to_encode.front();
+            to_encode.pop_front();
+        }
+        Clock::time_point start = Clock::now();
+        int width = static_cast<int>(job->request.width);
+        int height = static_cast<int>(job->request.height);
+        if (!stbi_write_png_to_func(appendBytes, &job->payload, width, height,
+                                    4, job->pixels.data(), width * 4)) {
+            static const char message[] = "PNG encoding failed";
+            job->status = Status::RenderError;
+            job->payload.assign(message, message + sizeof(message) - 1);
+        }
+        job->pixels = {};  // Responses can queue up; keep only the PNG
+        job->metrics.encode_ms = elapsedMs(start, Clock::now());
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            finished.push_back(job);
+        }
+        wake();
+    }
+}
+
+void RenderService::finishJob(const std::shared_ptr<Job>& job) {
+    job->metrics.total_ms = elapsedMs(job->received, Clock::now());
+    job->done = true;
+    const JobMetrics& metrics = job->metrics;
+    if (job->status != Status::Ok) {
+        spdlog::warn("Render job {}.{} failed: {}", job->client, job->id,
+                     std::string(job->payload.begin(), job->payload.end()));
+        return;
+    }
+    spdlog::debug("Render job {}.{}: {}x{}, {} bytes, {:.2f} ms total "
+                  "(queue {:.2f}, prepare {:.2f}, gpu {:.2f} + {:.2f}, "
+                  "execute {:.2f}, encode {:.2f}).",
+                  job->client, job->id, job->request.width,
+                  job->request.height, job->payload.size(), metrics.total_ms,
+                  metrics.queue_ms, metrics.prepare_ms, metrics.gpu_render_ms,
+                  metrics.gpu_readback_ms, metrics.execute_ms,
+                  metrics.encode_ms);
+
+    report_jobs++;
+    report_pixels += uint64_t(job->request.width) * job->request.height;
+    report_totals.queue_ms += metrics.queue_ms;
+    report_totals.prepare_ms += metrics.prepare_ms;
+    report_totals.gpu_render_ms += metrics.gpu_render_ms;
+    report_totals.gpu_readback_ms += metrics.gpu_readback_ms;
+    report_totals.execute_ms += metrics.execute_ms;
+    report_totals.encode_ms += metrics.encode_ms;
+    report_totals.total_ms += metrics.total_ms;
+    report_max_ms = std::max(report_max_ms, metrics.total_ms);
+    if (report_jobs < REPORT_JOBS) {
+        return;
+    }
+    Clock::time_point now = Clock::now();
+    float seconds = elapsedMs(report_start, now) * 1e-3f;
+    float jobs = float(report_jobs);
+    spdlog::info("Render service: {:.1f} jobs/s, {:.2f} Mpx/s; avg ms queue "
+                 "{:.2f} prepare {:.2f} gpu {:.2f} + {:.2f} execute {:.2f} "
+                 "encode {:.2f} total {:.2f} (max {:.2f}).",
+                 jobs / seconds, report_pixels * 1e-6f / seconds,
+                 report_totals.queue_ms / jobs,
+                 report_totals.prepare_ms / jobs,
+                 report_totals.gpu_render_ms / jobs,
+                 report_totals.gpu_readback_ms / jobs,
+                 report_totals.execute_ms / jobs,
+                 report_totals.encode_ms / jobs,
+                 report_totals.total_ms / jobs, report_max_ms);
+    report_start = now;
+    report_jobs = 0;
+    report_pixels = 0;
+    report_totals = {};
+    report_max_ms = 0.0f;
+}
+
+// --- Connections ---
+
+#if defined(__linux__)
+void RenderService::run(const std::string& socketPath) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (socketPath.empty() || socketPath.size() >= sizeof(address.sun_path)) {
+        throw std::runtime_error("Invalid render service socket path !");
+    }
+    std::memcpy(address.sun_path, socketPath.c_str(), socketPath.size());
+    int listener =
+        socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listener < 0) {
+        throw std::runtime_error("Failed to create render service socket !");
+    }
+    if (isStaleSocket(address)) {
+        unlink(socketPath.c_str());
+    }
+    if (bind(listener, reinterpret_cast<sockaddr*>(&address),
+             sizeof(address)) != 0) {
+        std::string reason = std::strerror(errno);  // EADDRINUSE: not stale
+        close(listener);
+        throw std::runtime_error("Failed to bind " + socketPath + ": " +
+                                 reason + " !");
+    }
+    // The path is ours from here on and goes however run() ends
+    struct Binding {
+        int listener;
+        const std::string& path;
+        ~Binding() {
+            close(listener);
+            unlink(path.c_str());
+        }
+    } binding{listener, socketPath};
+    if (listen(listener, SOMAXCONN) != 0) {
+        throw std::runtime_error("Failed to listen on " + socketPath + " !");
+    }
+    spdlog::info("Render service listening on {}.", socketPath);
+    report_start = Clock::now();
+
+    std::vector<pollfd> fds;
+    while (!stopping.load()) {
+        fds.clear();
+        fds.push_back({wake_fd, POLLIN, 0});
+        fds.push_back({listener, POLLIN, 0});
+        bool runnable = !pending.empty() && !free_slots.empty();
+        for (const auto& client : clients) {
+            short events = 0;
+            if (!client->hung_up && client->jobs.size() < MAX_QUEUED_JOBS) {
+                events |= POLLIN;
+            }
+            if (client->output_offset < client->output.size()) {
+                events |= POLLOUT;
+            }
+            fds.push_back({client->socket, events, 0});
+            // Requests already read, waiting for room in the client's queue
+            runnable = runnable ||
+                       (client->jobs.size() < MAX_QUEUED_JOBS &&
+                        hasRequest(*client));
+        }
+        if (poll(fds.data(), fds.size(), runnable ? 0 : -1) < 0) {
+            if (errno == EINTR) {
+                continue;  // stop() from a signal handler wrote wake_fd
+            }
+            throw std::runtime_error("Render service poll failed !");
+        }
+        uint64_t wakes;
+        while (read(wake_fd, &wakes, sizeof(wakes)) > 0) {
+        }
+
+        // Results from the worker threads
+        std::deque<std::shared_ptr<Job>> done;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            free_slots.insert(free_slots.end(), released_slots.begin(),
+                              released_slots.end());
+            released_slots.clear();
+            done.swap(finished);
+        }
+        for (const auto& job : done) {
+            finishJob(job);
+        }
+
+        if (fds[1].revents & POLLIN) {
+            acceptClients(listener);
+        }
+        // Clients accepted just now have no pollfd yet
+        for (size_t i = 2; i < fds.size(); i++) {
+            Client& client = *clients[i - 2];
+            bool keep = !(fds[i].revents & (POLLHUP | POLLERR));
+            if (keep && (fds[i].revents & POLLIN)) {
+                keep = readRequests(client);
+            }
+            if (keep) {
+                keep = writeResponses(client) && parseRequests(client);
+            }
+            if (!keep) {
+                dropClient(client);
+            }
+        }
+
+        // Keep every slot busy, oldest requests first
+        while (!pending.empty() && !free_slots.empty()) {
+            std::shared_ptr<Job> job = pending.front();
+            pending.pop_front();
+            uint32_t slot = free_slots.back();
+            free_slots.pop_back();
+            startJob(job, slot);
+        }
+
+        for (auto& client : clients) {
+            if (client->socket < 0) {
+                continue;
+            }
+            if (!writeResponses(*client)) {
+                dropClient(*client);
+            } else if (client->hung_up && client->jobs.empty() &&
+                       client->output.empty()) {
+                dropClient(*client);  // Everything it asked for was sent
+            }
+        }
+        std::erase_if(clients,
+                      [](const auto& client) { return client->socket < 0; });
+    }
+
+    for (auto& client : clients) {
+        close(client->socket);
+    }
+    clients.clear();
+    pending.clear();
+    // In-flight jobs finish on the GPU; the destructor waits for them
+    spdlog::info("Render service stopped.");
+}
+
+void RenderService::stop() {
+    stopping.store(true);
+    wake();
+}
+
+void RenderService::wake() {
+    uint64_t one = 1;
+    ssize_t written = write(wake_fd, &one, sizeof(one));
+    (void)written;  // Full counter: a wake is pending anyway
+}
+
+void RenderService::dropClient(Client& client) {
+    spdlog::info("Render service client {} disconnected.", client.id);
+    close(client.socket);
+    client.socket = -1;
+    // Jobs already submitted finish and are discarded
+    std::erase_if(pending, [&](const std::shared_ptr<Job>& job) {
+        return job->client == client.id;
+    });
+}
+
+void RenderService::acceptClients(int listener) {
+    for (;;) {
+        int socket = accept4(listener, nullptr, nullptr,
+                             SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (socket < 0) {
+            return;  // EAGAIN: no more waiting
+        }
+        auto client = std::make_unique<Client>();
+        client->id = next_client++;
+        client->socket = socket;
+        spdlog::info("Render service client {} connected.", client->id);
+        clients.push_back(std::move(client));
+    }
+}
+
+bool RenderService::readRequests(Client& client) {
+    uint8_t buffer[READ_CHUNK];
+    for (;;) {
+        ssize_t received = recv(client.socket, buffer, sizeof(buffer), 0);
+        if (received > 0) {
+            client.input.insert(client.input.end(), buffer,
+                                buffer + received);
+            if (client.input.size() >=
+                MAX_QUEUED_JOBS * (sizeof(RequestHeader) + MAX_PATH_LENGTH)) {
+                break;  // Parsed below once responses went out
+            }
+            continue;
+        }
+        if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received < 0) {
+            return false;
+        }
+        client.hung_up = true;  // Done sending; still gets its responses
+        break;
+    }
+    return parseRequests(client);
+}
+
+bool RenderService::parseRequests(Client& client) {
+    size_t offset = 0;
+    while (client.jobs.size() < MAX_QUEUED_JOBS &&
+           client.input.size() - offset >= sizeof(RequestHeader)) {
+        RequestHeader request;
+        std::memcpy(&request, client.input.data() + offset, sizeof(request));
+        if (request.magic != REQUEST_MAGIC ||
+            request.path_length > MAX_PATH_LENGTH) {
+            return false;  // Can't find the next request after this one
+        }
+        size_t size = sizeof(RequestHeader) + request.path_length;
+        if (client.input.size() - offset < size) {
+            break;
+        }
+        auto job = std::make_shared<Job>();
+        job->client = client.id;
+        job->id = client.next_job++;
+        job->request = request;
+        const auto* path = client.input.data() + offset + sizeof(request);
+        job->scene_path.assign(path, path + request.path_length);
+        job->received = Clock::now();
+        offset += size;
+
+        std::string error = validateRequest(request, job->scene_path);
+        client.jobs.push_back(job);
+        if (error.empty()) {
+            pending.push_back(job);
+        } else {
+            job->status = Status::BadRequest;
+            job->payload.assign(error.begin(), error.end());
+            finishJob(job);
+        }
+    }
+    client.input.erase(client.input.begin(), client.input.begin() + offset);
+    return true;
+}
+
+bool RenderService::hasRequest(const Client& client) {
+    if (client.input.size() < sizeof(RequestHeader)) {
+        return false;
+    }
+    RequestHeader request;
+    std::memcpy(&request, client.input.data(), sizeof(request));
+    if (request.magic != REQUEST_MAGIC ||
+        request.path_length > MAX_PATH_LENGTH) {
+        return true;  // parseRequests() drops the client
+    }
+    return client.input.size() >= sizeof(RequestHeader) + request.path_length;
+}
+
+bool RenderService::writeResponses(Client& client) {
+    // Responses go out in request order, each once its job is done
+    while (!client.jobs.empty() && client.jobs.front()->done) {
+        const Job& job = *client.jobs.front();
+        ResponseHeader header;
+        header.status = job.status;
+        header.job = job.id;
+        header.width = job.request.width;
+        header.height = job.request.height;
+        header.metrics = job.metrics;
+        header.payload_size = static_cast<uint32_t>(job.payload.size());
+        const auto* bytes = reinterpret_cast<const uint8_t*>(&header);
+        client.output.insert(client.output.end(), bytes,
+                             bytes + sizeof(header));
+        client.output.insert(client.output.end(), job.payload.begin(),
+                             job.payload.end());
+        client.jobs.pop_front();
+    }
+    while (client.output_offset < client.output.size()) {
+        ssize_t sent = send(client.socket,
+                            client.output.data() + client.output_offset,
+                            client.output.size() - client.output_offset,
+                            MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return true;  // POLLOUT continues
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        client.output_offset += static_cast<size_t>(sent);
+    }
+    client.output.clear();
+    client.output_offset = 0;
+    return true;
+}
+#else
+void RenderService::run(const std::string&) {
+    throw std::runtime_error("Render service requires Linux !");
+}
+
+void RenderService::stop() { stopping.store(true); }
+
+void RenderService::wake() {}
+
+void RenderService::acceptClients(int) {}
+
+void RenderService::dropClient(Client&) {}
+
+bool RenderService::readRequests(Client&) { return false; }
+
+bool RenderService::parseRequests(Client&) { return false; }
+
+bool RenderService::hasRequest(const Client&) { return false; }
+
+bool RenderService::writeResponses(Client&) { return false; }
+#endif
@@ -0,0 +1,282 @@
+/*
+ * @author: Avidel
+ * @LastEditors: Avidel
+ */
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+#include <glm/glm.hpp>
+
+#include "dynamic_state.hpp"
+#include "layout_cache.hpp"
+#include "pipeline_manager.hpp"
+#include "render_types.hpp"
+
+class VulkanContextManager;
+
+// --- Render Service ---
+// Headless render server for thumbnails and previews (Linux only). It
+// renders jobs sent to a Unix domain socket offscreen on a device that stays
+// up between jobs and sends each image back PNG encoded.
+//
+// Jobs flow through a pipeline, so consecutive jobs overlap:
+//   1. main thread: load the scene (cached), write it into the mapped
+//      buffers of a free slot, record and submit
+//   2. GPU: render pass, then copy the image into the slot's readback buffer
+//   3. readback thread: wait for the slot's fence, copy the pixels out and
+//      hand the slot back
+//   4. encode threads: PNG encode, then the main thread sends the response
+// JOBS_IN_FLIGHT slots keep the GPU fed while earlier jobs are encoded.
+//
+// Scene files are text, one entry per line, '#' starts a comment:
+//   v <x> <y> <r> <g> <b>            Mesh vertex, three per triangle
+//   i <x> <y> <z> [<yaw> [<scale>]]  Instance of the mesh; yaw in degrees
+// Without v lines the mesh is the example's triangle.
+class RenderService {
+public:
+    static constexpr uint32_t JOBS_IN_FLIGHT = 3;
+    static constexpr uint32_t MAX_IMAGE_SIZE = 4096;  // Per side
+    static constexpr uint32_t MAX_PATH_LENGTH = 4096;
+    // Per client; further requests stay unread until responses went out
+    static constexpr size_t MAX_QUEUED_JOBS = 64;
+    static constexpr uint32_t REPORT_JOBS = 100;  // Throughput log interval
+    static constexpr VkFormat COLOR_FORMAT = VK_FORMAT_R8G8B8A8_SRGB;
+    static constexpr VkFormat DEPTH_FORMAT = VK_FORMAT_D32_SFLOAT;
+
+    // --- Wire Format ---
+    // Native byte order, for local clients. A client may send any number of
+    // requests without waiting; responses come back in request order.
+    static constexpr uint32_t REQUEST_MAGIC = 0x424A524D;   // "MRJB"
+    static constexpr uint32_t RESPONSE_MAGIC = 0x4D49524D;  // "MRIM"
+
+    // Followed by path_length bytes of scene path, not terminated
+    struct RequestHeader {
+        uint32_t magic = REQUEST_MAGIC;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        float eye[3] = {0.0f, 0.0f, 2.0f};  // Camera, looking at target
+        float target[3] = {0.0f, 0.0f, 0.0f};
+        float fov_degrees = 45.0f;  // Vertical
+        uint32_t path_length = 0;
+    };
+
+    enum class Status : uint32_t {
+        Ok = 0,        // Payload is the PNG
+        BadRequest,    // Payload is an error message, as for the rest
+        SceneError,
+        RenderError,
+    };
+
+    // Per job, in milliseconds. The GPU times are 0 when the queue has no
+    // timestamps.
+    struct JobMetrics {
+        float queue_ms = 0.0f;     // Received until a slot was free
+        float prepare_ms = 0.0f;   // Scene, buffer writes, record, submit
+        float gpu_render_ms = 0.0f;
+        float gpu_readback_ms = 0.0f;  // Image to buffer copy
+        float execute_ms = 0.0f;   // Submit until the pixels were copied out
+        float encode_ms = 0.0f;
+        float total_ms = 0.0f;     // Received until the response was queued
+    };
+
+    // Followed by payload_size bytes
+    struct ResponseHeader {
+        uint32_t magic = RESPONSE_MAGIC;
+        Status status = Status::Ok;
+        uint64_t job = 0;  // Per connection, counting from 0
+        uint32_t width = 0;
+        uint32_t height = 0;
+        JobMetrics metrics;
+        uint32_t payload_size = 0;
+    };
+
+    // encodeThreads 0 picks half the hardware threads (at least one)
+    explicit RenderService(VulkanContextManager* context,
+                           uint32_t encodeThreads = 0);
+    ~RenderService();  // Waits for the GPU and destroys everything
+
+    RenderService(const RenderService&) = delete;
+    RenderService& operator=(const RenderService&) = delete;
+
+    // Listen on socketPath and serve until stop(). Replaces a socket file
+    // nobody listens on any more, fails on anything else already there, and
+    // removes the socket file it created however it returns.
+    void run(const std::string& socketPath);
+    // Safe from other threads and from signal handlers
+    void stop();
+
+    // Renders one job on the calling thread and waits for it, without the
+    // PNG: pixels are RGBA8, tightly packed. For in-process callers such as
+    // tests, never while run() is serving. Anything but Ok sets error.
+    Status render(const RequestHeader& request, const std::string& scenePath,
+                  std::vector<uint8_t>& pixels, JobMetrics& metrics,
+                  std::string& error);
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Job {
+        uint64_t client = 0;  // Client::id, which may be gone by the end
+        uint64_t id = 0;
+        RequestHeader request;
+        std::string scene_path;
+        Status status = Status::Ok;
+        std::vector<uint8_t> pixels;   // RGBA8, tightly packed
+        std::vector<uint8_t> payload;  // PNG or error message
+        JobMetrics metrics;
+        uint32_t slot = 0;
+        bool done = false;
+        Clock::time_point received;
+        Clock::time_point submitted;
+    };
+
+    struct Client {
+        uint64_t id = 0;
+        int socket = -1;
+        std::vector<uint8_t> input;  // Requests not parsed yet
+        bool hung_up = false;        // Sent EOF, waits for its responses
+        std::vector<uint8_t> output;
+        size_t output_offset = 0;
+        uint64_t next_job = 0;
+        std::deque<std::shared_ptr<Job>> jobs;  // Request order
+    };
+
+    struct CachedScene {
+        std::filesystem::file_time_type write_time;
+        uint64_t version = 0;  // Unique per load
+        std::vector<Vertex> vertices;
+        std::vector<glm::mat4> models;
+    };
+
+    // Everything one job in flight uses
+    struct Slot {
+        VkExtent2D extent{0, 0};
+        VkImage color_image{VK_NULL_HANDLE};
+        VkDeviceMemory color_image_memory{VK_NULL_HANDLE};
+        VkImageView color_image_view{VK_NULL_HANDLE};
+        VkImage depth_image{VK_NULL_HANDLE};
+        VkDeviceMemory depth_image_memory{VK_NULL_HANDLE};
+        VkImageView depth_image_view{VK_NULL_HANDLE};
+        VkFramebuffer framebuffer{VK_NULL_HANDLE};
+
+        // Host visible and persistently mapped, grown on demand
+        VkBuffer vertex_buffer{VK_NULL_HANDLE};
+        VkDeviceMemory vertex_buffer_memory{VK_NULL_HANDLE};
+        void* vertices_mapped = nullptr;
+        size_t vertex_capacity = 0;
+        VkBuffer instance_buffer{VK_NULL_HANDLE};
+        VkDeviceMemory instance_buffer_memory{VK_NULL_HANDLE};
+        void* instances_mapped = nullptr;
+        size_t instance_capacity = 0;
+        uint64_t scene_version = 0;  // Already in the buffers
+        VkBuffer uniform_buffer{VK_NULL_HANDLE};
+        VkDeviceMemory uniform_buffer_memory{VK_NULL_HANDLE};
+        void* uniforms_mapped = nullptr;
+        VkBuffer readback_buffer{VK_NULL_HANDLE};
+        VkDeviceMemory readback_buffer_memory{VK_NULL_HANDLE};
+        void* readback_mapped = nullptr;
+        VkDeviceSize readback_size = 0;
+
+        VkDescriptorSet descriptor_set{VK_NULL_HANDLE};
+        VkCommandBuffer command_buffer{VK_NULL_HANDLE};
+        VkFence fence{VK_NULL_HANDLE};
+        VkQueryPool timestamps{VK_NULL_HANDLE};  // Null without support
+    };
+
+    // --- Setup ---
+    void createRenderPass();
+    void createPipeline();
+    void createSlots();
+    void destroySlot(Slot& slot);
+    void destroyTargets(Slot& slot);
+    // Recreate the targets when the extent changes; the slot must be idle
+    void ensureTargets(Slot& slot, VkExtent2D extent);
+    void ensureBuffers(Slot& slot, size_t vertexCount, size_t instanceCount);
+
+    // --- Pipeline Stages ---
+    // Empty, or the error message for the client
+    static std::string validateRequest(const RequestHeader& request,
+                                       const std::string& scenePath);
+    // Null with an error message for the client on failure
+    const CachedScene* loadScene(const std::string& path, std::string& error);
+    // Main thread: submits and queues for readback, or fails the job
+    void startJob(const std::shared_ptr<Job>& job, uint32_t slot);
+    // Fills the slot and submits; false with the job failed
+    bool submitJob(Job& job, uint32_t slot);
+    void recordJob(Slot& slot, uint32_t vertexCount, uint32_t instanceCount);
+    // Waits for the slot's fence and copies the pixels out
+    void readbackJob(Job& job);
+    void readbackLoop();
+    void encodeLoop();
+    void finishJob(const std::shared_ptr<Job>& job);  // Main thread
+
+    // --- Connections ---
+    void acceptClients(int listener);
+    bool readRequests(Client& client);   // False: drop the client
+    bool parseRequests(Client& client);  // Same
+    // A whole request, or a malformed header, is buffered
+    static bool hasRequest(const Client& client);
+    bool writeResponses(Client& client);  // Same
+    void dropClient(Client& client);  // Closes it; removed after the pass
+    void wake();  // Interrupts the main thread's poll()
+
+    VulkanContextManager* vulkan_context;
+    VkDevice device;
+    float timestamp_period = 0.0f;  // Nanoseconds per tick, 0: unsupported
+
+    VkRenderPass render_pass{VK_NULL_HANDLE};
+    std::unique_ptr<LayoutCache> layout_cache;
+    VkDescriptorSetLayout descriptor_set_layout{VK_NULL_HANDLE};
+    VkPipelineLayout pipeline_layout{VK_NULL_HANDLE};
+    std::unique_ptr<PipelineManager> pipeline_manager;
+    std::unique_ptr<DynamicStateTracker> dynamic_state_tracker;
+    DynamicDrawState draw_state;
+    VkPipeline pipeline{VK_NULL_HANDLE};
+    VkCommandPool command_pool{VK_NULL_HANDLE};
+    VkDescriptorPool descriptor_pool{VK_NULL_HANDLE};
+    bool readback_cached = false;  // Host cached memory for readback
+
+    std::vector<Slot> slots;
+    std::vector<uint32_t> free_slots;  // Main thread only
+    std::unordered_map<std::string, CachedScene> scenes;
+    uint64_t scene_versions = 0;
+
+    // --- Main Thread State ---
+    std::vector<std::unique_ptr<Client>> clients;
+    uint64_t next_client = 0;
+    std::deque<std::shared_ptr<Job>> pending;  // Waiting for a slot
+
+    // --- Throughput ---
+    Clock::time_point report_start;
+    uint32_t report_jobs = 0;
+    uint64_t report_pixels = 0;
+    JobMetrics report_totals;  // Summed over the interval
+    float report_max_ms = 0.0f;
+
+    // --- Worker Threads ---
+    std::mutex mutex;
+    std::condition_variable readback_cv;  // Submitted jobs or stopping
+    std::condition_variable encode_cv;    // Jobs to encode or stopping
+    std::deque<std::shared_ptr<Job>> submitted;  // Submit order
+    std::deque<std::shared_ptr<Job>> to_encode;
+    std::deque<std::shared_ptr<Job>> finished;   // Back to the main thread
+    std::vector<uint32_t> released_slots;        // Back to the main thread
+    bool threads_stopping = false;
+    std::thread readback_thread;
+    std::vector<std::thread> encode_threads;
+
+    std::atomic<bool> stopping{false};
+    int wake_fd = -1;  // eventfd the main thread polls
+};
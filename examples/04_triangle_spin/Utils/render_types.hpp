@@ -0,0 +1,26 @@
+/*
+ * @author: Avidel
+ * @LastEditors: Avidel
+ */
+#pragma once
+#include <glm/glm.hpp>
+
+// Data shared by the Vulkan and the software renderer
+
+// --- Per-Frame Uniforms (set 0, binding 0) ---
+struct FrameUniforms {
+    alignas(16) glm::mat4 view_proj;    // proj * view, once per frame
+    alignas(16) glm::vec4 light_color;  // 用于动态颜色
+};
+
+// --- Per-Object Data (set 0, binding 1) ---
+// World matrices indexed by gl_InstanceIndex, written by Scene::update()
+// straight into the mapped instance buffer of the frame
+
+// --- Vertex Data Structure ---
+// Binding and attribute descriptions are reflected from vert.glsl, so the
+// members must stay tightly packed in input location order
+struct Vertex {
+    glm::vec2 pos;    // layout(location = 0)
+    glm::vec3 color;  // layout(location = 1)
+};
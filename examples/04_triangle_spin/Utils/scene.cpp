@@ -0,0 +1,241 @@
+/*
+ * @author: Avidel
+ * @LastEditors: Avidel
+ */
+#include "scene.hpp"
+
+#include "job_system.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+#include <type_traits>
+
+namespace {
+// Nodes per job; one node is a quat->mat4 and a mat4 multiply at most
+constexpr size_t UPDATE_GRAIN = 512;
+
+glm::mat4 composeTransform(const glm::vec3& translation,
+                           const glm::quat& rotation, const glm::vec3& scale) {
+    // T * R * S without the two full matrix products
+    glm::mat4 m = glm::mat4_cast(rotation);
+    m[0] *= scale.x;
+    m[1] *= scale.y;
+    m[2] *= scale.z;
+    m[3] = glm::vec4(translation, 1.0f);
+    return m;
+}
+}  // namespace
+
+Scene::NodeId Scene::createNode(NodeId parent) {
+    if (parent != NO_PARENT && parent >= positions.size()) {
+        throw std::runtime_error("scene node parent does not exist!");
+    }
+    NodeId node = static_cast<NodeId>(positions.size());
+    uint32_t parent_position =
+        parent == NO_PARENT ? NO_PARENT : positions[parent];
+    uint32_t depth = parent == NO_PARENT ? 0 : depths[parent_position] + 1;
+
+    positions.push_back(static_cast<uint32_t>(parents.size()));
+    translations.emplace_back(0.0f);
+    rotations.emplace_back(1.0f, 0.0f, 0.0f, 0.0f);
+    scales.emplace_back(1.0f);
+    parents.push_back(parent_position);
+    depths.push_back(depth);
+    flags.push_back(LOCAL_DIRTY);
+    local_matrices.emplace_back(1.0f);
+    world_matrices.emplace_back(1.0f);
+    world_versions.push_back(0);
+    node_ids.push_back(node);
+
+    order_dirty = true;
+    any_dirty = true;
+    return node;
+}
+
+void Scene::setTranslation(NodeId node, const glm::vec3& translation) {
+    uint32_t position = positions[node];
+    translations[position] = translation;
+    flags[position] |= LOCAL_DIRTY;
+    any_dirty = true;
+}
+
+void Scene::setRotation(NodeId node, const glm::quat& rotation) {
+    uint32_t position = positions[node];
+    rotations[position] = rotation;
+    flags[position] |= LOCAL_DIRTY;
+    any_dirty = true;
+}
+
+void Scene::setScale(NodeId node, const glm::vec3& scale) {
+    uint32_t position = positions[node];
+    scales[position] = scale;
+    flags[position] |= LOCAL_DIRTY;
+    any_dirty = true;
+}
+
+const glm::vec3& Scene::getTranslation(NodeId node) const {
+    return translations[positions[node]];
+}
+
+const glm::quat& Scene::getRotation(NodeId node) const {
+    return rotations[positions[node]];
+}
+
+const glm::vec3& Scene::getScale(NodeId node) const {
+    return scales[positions[node]];
+}
+
+Scene::NodeId Scene::getParent(NodeId node) const {
+    uint32_t parent = parents[positions[node]];
+    return parent == NO_PARENT ? NO_PARENT : node_ids[parent];
+}
+
+const glm::mat4& Scene::getWorldMatrix(NodeId node) const {
+    return world_matrices[positions[node]];
+}
+
+void Scene::sortByDepth() {
+    order_dirty = false;
+    size_t count = parents.size();
+
+    // Counting sort by depth; stable, so siblings keep creation order
+    uint32_t max_depth = 0;
+    for (uint32_t depth : depths) {
+        max_depth = std::max(max_depth, depth);
+    }
+    level_begins.assign(max_depth + 2, 0);
+    for (uint32_t depth : depths) {
+        ++level_begins[depth + 1];
+    }
+    for (size_t level = 1; level < level_begins.size(); ++level) {
+        level_begins[level] += level_begins[level - 1];
+    }
+
+    std::vector<uint32_t> new_positions(count);
+    std::vector<size_t> cursor(level_begins.begin(), level_begins.end() - 1);
+    bool sorted = true;
+    for (size_t i = 0; i < count; ++i) {
+        new_positions[i] = static_cast<uint32_t>(cursor[depths[i]]++);
+        sorted = sorted && new_positions[i] == i;
+    }
+    if (sorted) {
+        return;  // Nodes were appended in depth order
+    }
+
+    auto permute = [&](auto& array) {
+        std::remove_reference_t<decltype(array)> sorted_array(count);
+        for (size_t i = 0; i < count; ++i) {
+            sorted_array[new_positions[i]] = array[i];
+        }
+        array.swap(sorted_array);
+    };
+    for (uint32_t& parent : parents) {
+        if (parent != NO_PARENT) {
+            parent = new_positions[parent];
+        }
+    }
+    permute(translations);
+    permute(rotations);
+    permute(scales);
+    permute(parents);
+    permute(depths);
+    permute(flags);
+    permute(local_matrices);
+    permute(world_matrices);
+    permute(world_versions);
+    permute(node_ids);
+    for (size_t i = 0; i < count; ++i) {
+        positions[node_ids[i]] = static_cast<uint32_t>(i);
+    }
+}
+
+void Scene::update(JobSystem& jobs, InstanceTarget* target) {
+    if (target && target->capacity < parents.size()) {
+        throw std::runtime_error("scene instance buffer is too small!");
+    }
+    if (order_dirty) {
+        sortByDepth();
+    }
+    last_stats = {};
+    bool target_behind = target && target->synced_version != version;
+    if (!any_dirty && !target_behind) {
+        return;
+    }
+
+    bool propagate = any_dirty;
+    if (propagate) {
+        ++version;
+        any_dirty = false;
+    }
+    uint64_t synced_version = target ? target->synced_version : version;
+    glm::mat4* instance_matrices = target ? target->matrices : nullptr;
+
+    std::atomic<size_t> local_updates{0};
+    std::atomic<size_t> world_updates{0};
+    std::atomic<size_t> instance_writes{0};
+
+    // Levels run one after another: a level reads the world matrices of the
+    // level above, which are final by then
+    for (size_t level = 0; level + 1 < level_begins.size(); ++level) {
+        size_t level_begin = level_begins[level];
+        size_t level_size = level_begins[level + 1] - level_begin;
+        jobs.parallelFor(
+            level_size, UPDATE_GRAIN, [&](size_t begin, size_t end) {
+                size_t locals = 0;
+                size_t worlds = 0;
+                size_t writes = 0;
+                for (size_t i = level_begin + begin; i < level_begin + end;
+                     ++i) {
+                    if (propagate) {
+                        bool local_dirty = flags[i] & LOCAL_DIRTY;
+                        if (local_dirty) {
+                            local_matrices[i] = composeTransform(
+                                translations[i], rotations[i], scales[i]);
+                            flags[i] = 0;
+                            ++locals;
+                        }
+                        uint32_t parent = parents[i];
+                        bool parent_changed =
+                            parent != NO_PARENT &&
+                            world_versions[parent] == version;
+                        if (local_dirty || parent_changed) {
+                            world_matrices[i] =
+                                parent == NO_PARENT
+                                    ? local_matrices[i]
+                                    : world_matrices[parent] *
+                                          local_matrices[i];
+                            world_versions[i] = version;
+                            ++worlds;
+                        }
+                    }
+                    if (instance_matrices &&
+                        world_versions[i] > synced_version) {
+                        instance_matrices[node_ids[i]] = world_matrices[i];
+                        ++writes;
+                    }
+                }
+                local_updates += locals;
+                world_updates += worlds;
+                instance_writes += writes;
+            });
+    }
+
+    if (target) {
+        target->synced_version = version;
+    }
+    last_stats.local_updates = local_updates;
+    last_stats.world_updates = world_updates;
+    last_stats.instance_writes = instance_writes;
+}
+
+void Scene::collectChanges(uint64_t& syncedVersion, std::vector<NodeId>& nodes,
+                           std::vector<glm::mat4>& matrices) const {
+    for (size_t i = 0; i < world_versions.size(); ++i) {
+        if (world_versions[i] > syncedVersion) {
+            nodes.push_back(node_ids[i]);
+            matrices.push_back(world_matrices[i]);
+        }
+    }
+    syncedVersion = version;
+}
@@ -0,0 +1,94 @@
+/*
+ * @author: Avidel
+ * @LastEditors: Avidel
+ */
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+class JobSystem;
+
+// --- Scene Transforms ---
+// Node transforms stored as structure-of-arrays, ordered by hierarchy depth so
+// every parent comes before its children and each depth level is one
+// contiguous range. update() walks the levels in order and runs each level in
+// parallel; only nodes whose local transform or parent changed are recomputed.
+class Scene {
+public:
+    // Stable handle, also the node's slot in the GPU instance buffer
+    using NodeId = uint32_t;
+    static constexpr NodeId NO_PARENT = UINT32_MAX;
+
+    // Destination of world matrices, typically a persistently mapped buffer.
+    // Keep one per buffer copy (e.g. per frame in flight): update() writes
+    // every matrix that changed since that copy was last written.
+    struct InstanceTarget {
+        glm::mat4* matrices = nullptr;  // Indexed by NodeId
+        size_t capacity = 0;            // In matrices
+        uint64_t synced_version = 0;    // Managed by update()
+    };
+
+    struct Stats {
+        size_t local_updates = 0;    // Local matrices recomputed
+        size_t world_updates = 0;    // World matrices recomputed
+        size_t instance_writes = 0;  // Matrices copied into the target
+    };
+
+    // Parents must already exist; the node starts at the identity transform
+    NodeId createNode(NodeId parent = NO_PARENT);
+
+    void setTranslation(NodeId node, const glm::vec3& translation);
+    void setRotation(NodeId node, const glm::quat& rotation);
+    void setScale(NodeId node, const glm::vec3& scale);
+
+    const glm::vec3& getTranslation(NodeId node) const;
+    const glm::quat& getRotation(NodeId node) const;
+    const glm::vec3& getScale(NodeId node) const;
+    NodeId getParent(NodeId node) const;
+
+    // Valid after update()
+    const glm::mat4& getWorldMatrix(NodeId node) const;
+
+    size_t getNodeCount() const { return parents.size(); }
+
+    // Propagate dirty transforms to world matrices and copy the changed ones
+    // into target (if any). Throws if target is too small for all nodes.
+    void update(JobSystem& jobs, InstanceTarget* target = nullptr);
+
+    // Appends every world matrix that changed since syncedVersion, with its
+    // node, and advances syncedVersion. For a copy on another thread that
+    // has no mapped buffer to write into yet; valid after update().
+    void collectChanges(uint64_t& syncedVersion, std::vector<NodeId>& nodes,
+                        std::vector<glm::mat4>& matrices) const;
+
+    const Stats& getLastStats() const { return last_stats; }
+
+private:
+    static constexpr uint8_t LOCAL_DIRTY = 1;
+
+    // Re-sort the arrays by depth after nodes were added
+    void sortByDepth();
+
+    // SoA storage, indexed by sorted position
+    std::vector<glm::vec3> translations;
+    std::vector<glm::quat> rotations;
+    std::vector<glm::vec3> scales;
+    std::vector<uint32_t> parents;  // Sorted position, or NO_PARENT
+    std::vector<uint32_t> depths;
+    std::vector<uint8_t> flags;
+    std::vector<glm::mat4> local_matrices;
+    std::vector<glm::mat4> world_matrices;
+    std::vector<uint64_t> world_versions;  // Update that last changed it
+    std::vector<NodeId> node_ids;          // Sorted position -> NodeId
+
+    std::vector<uint32_t> positions;  // NodeId -> sorted position
+    std::vector<size_t> level_begins;  // Per depth, plus the end
+    bool order_dirty = false;
+    bool any_dirty = false;
+    uint64_t version = 0;
+    Stats last_stats;
+};
@@ -0,0 +1,212 @@
+/*
+ * @author: Avidel
+ * @LastEditors: Avidel
+ */
+#include "shader_watcher.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <set>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/inotify.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char** environ;
+#endif
+
+namespace {
+constexpr uint32_t SPIRV_MAGIC = 0x07230203;
+// Editors usually emit several events per save; collect them for this long
+// before recompiling so one save triggers one rebuild.
+constexpr int DEBOUNCE_MS = 50;
+constexpr int POLL_TIMEOUT_MS = 100;  // How often stop() is noticed
+}  // namespace
+
+ShaderWatcher::ShaderWatcher(std::string shaderDir, std::string glslcPath)
+    : shader_dir(std::move(shaderDir)), glslc_path(std::move(glslcPath)) {}
+
+ShaderWatcher::~ShaderWatcher() { stop(); }
+
+void ShaderWatcher::addShader(const std::string& file,
+                              const std::string& stage) {
+    shaders.push_back({file, stage});
+}
+
+bool ShaderWatcher::start(ReloadCallback callback) {
+#if defined(__linux__)
+    if (isRunning()) {
+        return true;
+    }
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd < 0) {
+        spdlog::error("inotify_init1 failed, shader hot reload disabled.");
+        return false;
+    }
+    // IN_CLOSE_WRITE covers in-place saves, IN_MOVED_TO covers editors that
+    // write a temp file and rename it over the original
+    if (inotify_add_watch(inotify_fd, shader_dir.c_str(),
+                          IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        spdlog::error("Failed to watch shader directory {}", shader_dir);
+        close(inotify_fd);
+        inotify_fd = -1;
+        return false;
+    }
+    on_reload = std::move(callback);
+    stop_requested = false;
+    worker = std::thread(&ShaderWatcher::watchLoop, this);
+    spdlog::info("Watching {} for shader changes.", shader_dir);
+    return true;
+#else
+    (void)callback;
+    spdlog::warn("Shader hot reload requires inotify (Linux only).");
+    return false;
+#endif
+}
+
+void ShaderWatcher::stop() {
+    stop_requested = true;
+    if (worker.joinable()) {
+        worker.join();
+    }
+#if defined(__linux__)
+    if (inotify_fd >= 0) {
+        close(inotify_fd);
+        inotify_fd = -1;
+    }
+#endif
+}
+
+void ShaderWatcher::watchLoop() {
+#if defined(__linux__)
+    alignas(inotify_event) char buffer[4096];
+    pollfd pfd{inotify_fd, POLLIN, 0};
+
+    while (!stop_requested) {
+        if (poll(&pfd, 1, POLL_TIMEOUT_MS) <= 0) {
+            continue;
+        }
+
+        // Drain events until the directory has been quiet for DEBOUNCE_MS
+        std::set<std::string> changed;
+        do {
+            ssize_t length;
+            while ((length = read(inotify_fd, buffer, sizeof(buffer))) > 0) {
+                for (char* ptr = buffer; ptr < buffer + length;) {
+                    auto* event = reinterpret_cast<inotify_event*>(ptr);
+                    if (event->len > 0) {
+                        changed.insert(event->name);
+                    }
+                    ptr += sizeof(inotify_event) + event->len;
+                }
+            }
+        } while (!stop_requested && poll(&pfd, 1, DEBOUNCE_MS) > 0);
+
+        for (const auto& shader : shaders) {
+            if (stop_requested || !changed.contains(shader.file)) {
+                continue;
+            }
+            spdlog::info("Shader {} changed, recompiling...", shader.file);
+            auto start = std::chrono::steady_clock::now();
+            std::vector<uint32_t> spirv = compile(shader);
+            if (spirv.empty()) {
+                continue;  // Keep the last good pipeline
+            }
+            spdlog::info(
+                "Shader {} recompiled in {:.1f} ms.", shader.file,
+                std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - start)
+                    .count());
+            on_reload(std::filesystem::path(shader.file).stem().string(),
+                      std::move(spirv));
+        }
+    }
+#endif
+}
+
+std::vector<uint32_t> ShaderWatcher::compile(
+    const WatchedShader& shader) const {
+#if defined(__linux__)
+    // glslc writes the SPIR-V to stdout ("-o -"), read through a pipe: no
+    // shell to quote the paths for, and no temp file that another instance
+    // or a same-named shader of another stage could overwrite
+    std::string source =
+        (std::filesystem::path(shader_dir) / shader.file).string();
+    std::string stage_arg = "-fshader-stage=" + shader.stage;
+    std::string optimize_arg = "-O";
+    std::string output_arg = "-o";
+    std::string stdout_arg = "-";
+    char* argv[] = {const_cast<char*>(glslc_path.c_str()),
+                    optimize_arg.data(),
+                    stage_arg.data(),
+                    source.data(),
+                    output_arg.data(),
+                    stdout_arg.data(),
+                    nullptr};
+
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0) {
+        spdlog::error("pipe2 failed: {}", std::strerror(errno));
+        return {};
+    }
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+    pid_t pid = -1;
+    int spawn_error = posix_spawnp(&pid, glslc_path.c_str(), &actions,
+                                   nullptr, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(fds[1]);
+    if (spawn_error != 0) {
+        close(fds[0]);
+        spdlog::error("Failed to run {}: {}", glslc_path,
+                      std::strerror(spawn_error));
+        return {};
+    }
+
+    std::vector<char> bytes;
+    char buffer[16384];
+    while (true) {
+        ssize_t count = read(fds[0], buffer, sizeof(buffer));
+        if (count > 0) {
+            bytes.insert(bytes.end(), buffer, buffer + count);
+        } else if (count == 0 || errno != EINTR) {
+            break;
+        }
+    }
+    close(fds[0]);
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        spdlog::error("glslc failed for {}, keeping previous shader.",
+                      shader.file);
+        return {};
+    }
+
+    if (bytes.empty() || bytes.size() % sizeof(uint32_t) != 0) {
+        spdlog::error("Compiled shader {} has invalid size {}", shader.file,
+                      bytes.size());
+        return {};
+    }
+    // Copied into uint32_t storage so the words stay 4-byte aligned
+    std::vector<uint32_t> words(bytes.size() / sizeof(uint32_t));
+    std::memcpy(words.data(), bytes.data(), bytes.size());
+    if (words[0] != SPIRV_MAGIC) {
+        spdlog::error("Compiled shader {} is not SPIR-V", shader.file);
+        return {};
+    }
+    return words;
+#else
+    (void)shader;
+    return {};  // Only watchLoop() compiles, and it needs inotify
+#endif
+}
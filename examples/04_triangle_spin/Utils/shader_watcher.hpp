@@ -0,0 +1,57 @@
+/*
+ * @author: Avidel
+ * @LastEditors: Avidel
+ */
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+// --- Shader Hot Reload ---
+// Watches the GLSL source directory with inotify and recompiles changed
+// shaders with glslc on a background thread. The callback also runs on that
+// thread, so expensive follow-up work (pipeline creation) stays off the render
+// thread.
+class ShaderWatcher {
+public:
+    // name: shader file stem ("vert", "frag"); spirv: freshly compiled words
+    using ReloadCallback =
+        std::function<void(const std::string& name, std::vector<uint32_t>)>;
+
+    ShaderWatcher(std::string shaderDir, std::string glslcPath);
+    ~ShaderWatcher();  // Calls stop()
+
+    ShaderWatcher(const ShaderWatcher&) = delete;
+    ShaderWatcher& operator=(const ShaderWatcher&) = delete;
+
+    // Register a GLSL file (relative to shaderDir) and its glslc stage name
+    void addShader(const std::string& file, const std::string& stage);
+
+    // Start the watcher thread; returns false if watching is unsupported
+    bool start(ReloadCallback callback);
+    void stop();
+
+    bool isRunning() const { return worker.joinable(); }
+
+private:
+    struct WatchedShader {
+        std::string file;   // e.g. "vert.glsl"
+        std::string stage;  // e.g. "vertex"
+    };
+
+    void watchLoop();
+    // Runs glslc -O on the shader; returns empty on compile failure
+    std::vector<uint32_t> compile(const WatchedShader& shader) const;
+
+    std::string shader_dir;
+    std::string glslc_path;
+    std::vector<WatchedShader> shaders;
+    ReloadCallback on_reload;
+
+    int inotify_fd = -1;
+    std::atomic<bool> stop_requested{false};
+    std::thread worker;
+};
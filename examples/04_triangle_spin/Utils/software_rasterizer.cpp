@@ -0,0 +1,529 @@
+/*
+ * @author: Avidel
+ * @LastEditors: Avidel
+ */
+#include "software_rasterizer.hpp"
+
+#include "job_system.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <stdexcept>
+#include <utility>
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define SOFTWARE_RASTER_SSE 1
+#include <immintrin.h>
+#endif
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+constexpr int32_t SUBPIXEL_BITS = 4;
+constexpr int32_t SUBPIXEL = 1 << SUBPIXEL_BITS;
+// Clipping happens only for triangles reaching this far from the viewport
+// center. It bounds the fixed-point coordinates, so an edge function changes
+// by less than 2^28 across one tile row.
+constexpr float GUARD_BAND = 8192.0f;  // Pixels
+// Row start edge values are clamped to this; within a row the step is smaller,
+// so a clamped value still has the right sign at every pixel
+constexpr int64_t EDGE_CLAMP = int64_t(1) << 30;
+constexpr size_t MIN_GRAIN = 256;  // Triangles per binning job
+constexpr int MAX_CLIP_VERTICES = 8;  // Three plus one per clip plane
+constexpr int SRGB_LUT_SIZE = 4096;
+
+double elapsedMs(Clock::time_point since) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - since)
+        .count();
+}
+
+// Linear [0, 1] quantized to 12 bits -> sRGB byte, like an _SRGB attachment
+const std::array<uint8_t, SRGB_LUT_SIZE>& srgbTable() {
+    static const std::array<uint8_t, SRGB_LUT_SIZE> table = [] {
+        std::array<uint8_t, SRGB_LUT_SIZE> values{};
+        for (int i = 0; i < SRGB_LUT_SIZE; ++i) {
+            float linear = float(i) / (SRGB_LUT_SIZE - 1);
+            float encoded = linear <= 0.0031308f
+                                ? linear * 12.92f
+                                : 1.055f * std::pow(linear, 1.0f / 2.4f) -
+                                      0.055f;
+            values[i] = static_cast<uint8_t>(encoded * 255.0f + 0.5f);
+        }
+        return values;
+    }();
+    return table;
+}
+
+uint32_t packColor(float r, float g, float b, float a) {
+    const std::array<uint8_t, SRGB_LUT_SIZE>& table = srgbTable();
+    auto index = [](float c) {
+        c = std::min(std::max(c, 0.0f), 1.0f);
+        return static_cast<int>(c * (SRGB_LUT_SIZE - 1) + 0.5f);
+    };
+    // Alpha stays linear
+    auto alpha = static_cast<uint32_t>(
+        std::min(std::max(a, 0.0f), 1.0f) * 255.0f + 0.5f);
+    return uint32_t(table[index(r)]) | uint32_t(table[index(g)]) << 8 |
+           uint32_t(table[index(b)]) << 16 | alpha << 24;
+}
+
+// Signed distance-like value of a clip space vertex to one clipping plane;
+// inside when >= 0
+float planeDistance(const glm::vec4& p, int plane, float guardX,
+                    float guardY) {
+    switch (plane) {
+        case 0: return p.z;  // Near, Vulkan depth range
+        case 1: return p.x + guardX * p.w;
+        case 2: return guardX * p.w - p.x;
+        case 3: return p.y + guardY * p.w;
+        default: return guardY * p.w - p.y;
+    }
+}
+}  // namespace
+
+SoftwareRasterizer::SoftwareRasterizer(JobSystem& jobs, uint32_t width,
+                                       uint32_t height)
+    : jobs(jobs) {
+    resize(width, height);
+}
+
+void SoftwareRasterizer::resize(uint32_t width, uint32_t height) {
+    if (width == 0 || height == 0 || width > MAX_SIZE || height > MAX_SIZE) {
+        throw std::runtime_error("Invalid software framebuffer size !");
+    }
+    this->width = width;
+    this->height = height;
+    tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+    tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+    stride = tiles_x * TILE_SIZE;
+    // Whole tiles, so tile jobs need no edge cases
+    color.assign(size_t(stride) * tiles_y * TILE_SIZE, 0);
+    depth.assign(color.size(), 1.0f);
+    guard_x = 2.0f * GUARD_BAND / width;
+    guard_y = 2.0f * GUARD_BAND / height;
+}
+
+void SoftwareRasterizer::beginFrame(const glm::vec4& clearColor) {
+    stats = {};
+    bin_count = 0;
+    clear_color =
+        packColor(clearColor.r, clearColor.g, clearColor.b, clearColor.a);
+}
+
+void SoftwareRasterizer::draw(const FrameUniforms& frame,
+                              std::span<const Vertex> vertices,
+                              std::span<const glm::mat4> models) {
+    auto start = Clock::now();
+    const size_t per_instance = vertices.size() / 3;
+    const size_t total = per_instance * models.size();
+    stats.triangles += total;
+    if (total == 0) {
+        return;
+    }
+
+    // A few chunks per thread, each binning into its own lists
+    size_t chunks_wanted = size_t(jobs.getThreadCount()) * 4;
+    size_t grain =
+        std::max(MIN_GRAIN, (total + chunks_wanted - 1) / chunks_wanted);
+    size_t chunk_count = (total + grain - 1) / grain;
+    size_t first_bin = bin_count;
+    bin_count += chunk_count;
+    if (bins.size() < bin_count) {
+        bins.resize(bin_count);
+    }
+
+    const size_t tile_count = size_t(tiles_x) * tiles_y;
+    auto bin_chunk = [&](size_t begin, size_t end) {
+        Bin& bin = bins[first_bin + begin / grain];
+        bin.triangles.clear();
+        bin.tiles.resize(tile_count);
+        for (std::vector<uint32_t>& tile : bin.tiles) {
+            tile.clear();
+        }
+
+        size_t current = SIZE_MAX;
+        glm::mat4 model_view_proj(1.0f);
+        for (size_t t = begin; t < end; ++t) {
+            size_t instance = t / per_instance;
+            if (instance != current) {
+                model_view_proj = frame.view_proj * models[instance];
+                current = instance;
+            }
+            const Vertex* v = &vertices[(t % per_instance) * 3];
+            ClipVertex clip[3];
+            for (int k = 0; k < 3; ++k) {
+                clip[k].position =
+                    model_view_proj * glm::vec4(v[k].pos, 0.0f, 1.0f);
+                clip[k].color = v[k].color;
+            }
+            setupTriangle(clip, bin);
+        }
+    };
+    // A single-threaded job system hands over the whole range at once
+    jobs.parallelFor(total, grain, [&](size_t begin, size_t end) {
+        for (size_t chunk = begin; chunk < end; chunk += grain) {
+            bin_chunk(chunk, std::min(chunk + grain, end));
+        }
+    });
+
+    for (size_t b = first_bin; b < bin_count; ++b) {
+        stats.binned += bins[b].triangles.size();
+        for (const std::vector<uint32_t>& tile : bins[b].tiles) {
+            stats.bin_entries += tile.size();
+        }
+    }
+    stats.geometry_ms += elapsedMs(start);
+}
+
+void SoftwareRasterizer::endFrame() {
+    auto start = Clock::now();
+    const size_t tile_count = size_t(tiles_x) * tiles_y;
+    std::vector<uint64_t> tile_pixels(tile_count, 0);
+    jobs.parallelFor(tile_count, 1, [&](size_t begin, size_t end) {
+        for (size_t tile = begin; tile < end; ++tile) {
+            rasterizeTile(static_cast<uint32_t>(tile), tile_pixels[tile]);
+        }
+    });
+    for (uint64_t pixels : tile_pixels) {
+        stats.pixels += pixels;
+    }
+    stats.raster_ms = elapsedMs(start);
+    last_stats = stats;
+}
+
+bool SoftwareRasterizer::writePng(const std::string& path) const {
+    return stbi_write_png(path.c_str(), int(width), int(height), 4,
+                          color.data(), int(getPitch())) != 0;
+}
+
+void SoftwareRasterizer::setupTriangle(const ClipVertex (&vertices)[3],
+                                       Bin& bin) {
+    // Outside one plane of the view volume: nothing to draw
+    uint32_t outside_all = 0x3f;
+    bool needs_clip = false;
+    for (const ClipVertex& vertex : vertices) {
+        const glm::vec4& p = vertex.position;
+        uint32_t code = (p.x < -p.w ? 1u : 0u) | (p.x > p.w ? 2u : 0u) |
+                        (p.y < -p.w ? 4u : 0u) | (p.y > p.w ? 8u : 0u) |
+                        (p.z < 0.0f ? 16u : 0u) | (p.z > p.w ? 32u : 0u);
+        outside_all &= code;
+        for (int plane = 0; plane < 5; ++plane) {
+            needs_clip = needs_clip ||
+                         planeDistance(p, plane, guard_x, guard_y) < 0.0f;
+        }
+    }
+    if (outside_all != 0) {
+        return;
+    }
+    if (!needs_clip) {
+        emitTriangle(vertices[0], vertices[1], vertices[2], bin);
+        return;
+    }
+
+    // Sutherland-Hodgman against the near plane and the guard band; the far
+    // plane is left to the depth test, which fails beyond 1
+    ClipVertex buffers[2][MAX_CLIP_VERTICES + 1];
+    int count = 3;
+    std::copy(vertices, vertices + 3, buffers[0]);
+    int source = 0;
+    for (int plane = 0; plane < 5 && count > 0; ++plane) {
+        const ClipVertex* in = buffers[source];
+        ClipVertex* out = buffers[source ^ 1];
+        int out_count = 0;
+        for (int i = 0; i < count; ++i) {
+            const ClipVertex& a = in[i];
+            const ClipVertex& b = in[(i + 1) % count];
+            float da = planeDistance(a.position, plane, guard_x, guard_y);
+            float db = planeDistance(b.position, plane, guard_x, guard_y);
+            if (da >= 0.0f) {
+                out[out_count++] = a;
+            }
+            if ((da >= 0.0f) != (db >= 0.0f)) {
+                float t = da / (da - db);
+                out[out_count].position =
+                    a.position + (b.position - a.position) * t;
+                out[out_count].color = glm::mix(a.color, b.color, t);
+                ++out_count;
+            }
+        }
+        count = out_count;
+        source ^= 1;
+    }
+    for (int i = 1; i + 1 < count; ++i) {
+        emitTriangle(buffers[source][0], buffers[source][i],
+                     buffers[source][i + 1], bin);
+    }
+}
+
+void SoftwareRasterizer::emitTriangle(const ClipVertex& a, const ClipVertex& b,
+                                      const ClipVertex& c, Bin& bin) {
+    const ClipVertex* v[3] = {&a, &b, &c};
+    Triangle triangle;
+    float values[3][5];  // z, 1/w, color/w per vertex
+    for (int k = 0; k < 3; ++k) {
+        const glm::vec4& p = v[k]->position;
+        if (!(p.w > 0.0f)) {
+            return;
+        }
+        float inv_w = 1.0f / p.w;
+        float sx = (p.x * inv_w * 0.5f + 0.5f) * width;
+        float sy = (p.y * inv_w * 0.5f + 0.5f) * height;
+        triangle.x[k] = static_cast<int32_t>(std::lrint(sx * SUBPIXEL));
+        triangle.y[k] = static_cast<int32_t>(std::lrint(sy * SUBPIXEL));
+        values[k][0] = p.z * inv_w;
+        values[k][1] = inv_w;
+        values[k][2] = v[k]->color.r * inv_w;
+        values[k][3] = v[k]->color.g * inv_w;
+        values[k][4] = v[k]->color.b * inv_w;
+    }
+
+    // Nothing is culled: mirrored triangles swap two vertices, so every one
+    // rasterizes with positive area and the same fill rule
+    int64_t area = int64_t(triangle.x[1] - triangle.x[0]) *
+                       (triangle.y[2] - triangle.y[0]) -
+                   int64_t(triangle.x[2] - triangle.x[0]) *
+                       (triangle.y[1] - triangle.y[0]);
+    if (area == 0) {
+        return;
+    }
+    if (area < 0) {
+        std::swap(triangle.x[1], triangle.x[2]);
+        std::swap(triangle.y[1], triangle.y[2]);
+        std::swap(values[1], values[2]);
+    }
+
+    // Pixels whose center lies inside the vertex bounds
+    int32_t min_fx = std::min({triangle.x[0], triangle.x[1], triangle.x[2]});
+    int32_t max_fx = std::max({triangle.x[0], triangle.x[1], triangle.x[2]});
+    int32_t min_fy = std::min({triangle.y[0], triangle.y[1], triangle.y[2]});
+    int32_t max_fy = std::max({triangle.y[0], triangle.y[1], triangle.y[2]});
+    const int32_t half = SUBPIXEL / 2;
+    const int32_t round_up = SUBPIXEL - 1;
+    triangle.min_x =
+        std::max(0, (min_fx - half + round_up) >> SUBPIXEL_BITS);
+    triangle.min_y =
+        std::max(0, (min_fy - half + round_up) >> SUBPIXEL_BITS);
+    triangle.max_x =
+        std::min(int32_t(width) - 1, (max_fx - half) >> SUBPIXEL_BITS);
+    triangle.max_y =
+        std::min(int32_t(height) - 1, (max_fy - half) >> SUBPIXEL_BITS);
+    if (triangle.min_x > triangle.max_x || triangle.min_y > triangle.max_y) {
+        return;
+    }
+
+    // Attribute planes from the snapped positions the edges use
+    float fx[3], fy[3];
+    for (int k = 0; k < 3; ++k) {
+        fx[k] = float(triangle.x[k]) / SUBPIXEL;
+        fy[k] = float(triangle.y[k]) / SUBPIXEL;
+    }
+    float dx1 = fx[1] - fx[0], dy1 = fy[1] - fy[0];
+    float dx2 = fx[2] - fx[0], dy2 = fy[2] - fy[0];
+    float inv_det = 1.0f / (dx1 * dy2 - dx2 * dy1);
+    triangle.x0 = fx[0];
+    triangle.y0 = fy[0];
+    for (int i = 0; i < 5; ++i) {
+        float da1 = values[1][i] - values[0][i];
+        float da2 = values[2][i] - values[0][i];
+        triangle.attributes[i][0] = values[0][i];
+        triangle.attributes[i][1] = (da1 * dy2 - da2 * dy1) * inv_det;
+        triangle.attributes[i][2] = (dx1 * da2 - dx2 * da1) * inv_det;
+    }
+
+    auto index = static_cast<uint32_t>(bin.triangles.size());
+    bin.triangles.push_back(triangle);
+    for (int32_t ty = triangle.min_y / int32_t(TILE_SIZE);
+         ty <= triangle.max_y / int32_t(TILE_SIZE); ++ty) {
+        for (int32_t tx = triangle.min_x / int32_t(TILE_SIZE);
+             tx <= triangle.max_x / int32_t(TILE_SIZE); ++tx) {
+            bin.tiles[size_t(ty) * tiles_x + tx].push_back(index);
+        }
+    }
+}
+
+void SoftwareRasterizer::rasterizeTile(uint32_t tile, uint64_t& pixels) {
+    int32_t x0 = int32_t(tile % tiles_x * TILE_SIZE);
+    int32_t y0 = int32_t(tile / tiles_x * TILE_SIZE);
+    for (uint32_t row = 0; row < TILE_SIZE; ++row) {
+        size_t offset = size_t(y0 + row) * stride + x0;
+        std::fill_n(color.begin() + offset, TILE_SIZE, clear_color);
+        std::fill_n(depth.begin() + offset, TILE_SIZE, 1.0f);
+    }
+
+    int32_t x1 = std::min(x0 + int32_t(TILE_SIZE), int32_t(width)) - 1;
+    int32_t y1 = std::min(y0 + int32_t(TILE_SIZE), int32_t(height)) - 1;
+    for (size_t b = 0; b < bin_count; ++b) {
+        const Bin& bin = bins[b];
+        for (uint32_t index : bin.tiles[tile]) {
+            rasterizeTriangle(bin.triangles[index], x0, y0, x1, y1, pixels);
+        }
+    }
+}
+
+void SoftwareRasterizer::rasterizeTriangle(const Triangle& triangle,
+                                           int32_t tileX0, int32_t tileY0,
+                                           int32_t tileX1, int32_t tileY1,
+                                           uint64_t& pixels) {
+    // Groups of four pixels; tiles start at multiples of four
+    int32_t start_x = std::max(triangle.min_x, tileX0) & ~3;
+    int32_t end_x = std::min(triangle.max_x, tileX1);
+    int32_t start_y = std::max(triangle.min_y, tileY0);
+    int32_t end_y = std::min(triangle.max_y, tileY1);
+    if (start_x > end_x || start_y > end_y) {
+        return;
+    }
+
+    // Edge i runs from vertex i to i + 1 and is >= 0 inside. Pixels exactly
+    // on a left or top edge belong to the triangle, others get a -1 bias.
+    int64_t step_x[3];
+    int64_t step_y[3];
+    int64_t edge_origin[3];  // At the center of pixel (start_x, start_y)
+    const int64_t px = int64_t(start_x) * SUBPIXEL + SUBPIXEL / 2;
+    const int64_t py = int64_t(start_y) * SUBPIXEL + SUBPIXEL / 2;
+    for (int i = 0; i < 3; ++i) {
+        int j = (i + 1) % 3;
+        int64_t a = triangle.y[i] - triangle.y[j];
+        int64_t b = triangle.x[j] - triangle.x[i];
+        int64_t bias = (a > 0 || (a == 0 && b > 0)) ? 0 : -1;
+        edge_origin[i] =
+            a * (px - triangle.x[i]) + b * (py - triangle.y[i]) + bias;
+        step_x[i] = a * SUBPIXEL;
+        step_y[i] = b * SUBPIXEL;
+    }
+
+    // Attributes at the same pixel center
+    float attribute_origin[5];
+    const float cx = float(start_x) + 0.5f - triangle.x0;
+    const float cy = float(start_y) + 0.5f - triangle.y0;
+    for (int i = 0; i < 5; ++i) {
+        const float* plane = triangle.attributes[i];
+        attribute_origin[i] = plane[0] + plane[1] * cx + plane[2] * cy;
+    }
+
+#if !defined(SOFTWARE_RASTER_SSE)
+    auto shade = [&](size_t offset, const float (&values)[5]) {
+        float w = 1.0f / values[1];
+        color[offset] =
+            packColor(values[2] * w, values[3] * w, values[4] * w, 1.0f);
+    };
+#endif
+
+    for (int32_t y = start_y; y <= end_y; ++y) {
+        const int64_t dy = y - start_y;
+        int32_t edge[3];
+        for (int i = 0; i < 3; ++i) {
+            int64_t value = edge_origin[i] + step_y[i] * dy;
+            edge[i] = static_cast<int32_t>(
+                std::min(std::max(value, -EDGE_CLAMP), EDGE_CLAMP));
+        }
+        float row[5];
+        for (int i = 0; i < 5; ++i) {
+            row[i] = attribute_origin[i] + triangle.attributes[i][2] * dy;
+        }
+        const size_t row_offset = size_t(y) * stride;
+
+#if defined(SOFTWARE_RASTER_SSE)
+        __m128i e[3];
+        __m128i e_step[3];
+        for (int i = 0; i < 3; ++i) {
+            auto s = static_cast<int32_t>(step_x[i]);
+            e[i] = _mm_add_epi32(_mm_set1_epi32(edge[i]),
+                                 _mm_setr_epi32(0, s, 2 * s, 3 * s));
+            e_step[i] = _mm_set1_epi32(4 * s);
+        }
+        // z, 1/w and color/w for the four lanes, stepped along the row
+        __m128 attribute[5];
+        __m128 attribute_step[5];
+        for (int i = 0; i < 5; ++i) {
+            float d = triangle.attributes[i][1];
+            attribute[i] = _mm_add_ps(_mm_set1_ps(row[i]),
+                                      _mm_setr_ps(0.0f, d, 2.0f * d, 3.0f * d));
+            attribute_step[i] = _mm_set1_ps(4.0f * d);
+        }
+        const __m128i lane_bits = _mm_setr_epi32(1, 2, 4, 8);
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 lut_scale = _mm_set1_ps(float(SRGB_LUT_SIZE - 1));
+        const __m128 half = _mm_set1_ps(0.5f);
+        const std::array<uint8_t, SRGB_LUT_SIZE>& srgb = srgbTable();
+        for (int32_t x = start_x; x <= end_x; x += 4) {
+            __m128i any_negative =
+                _mm_or_si128(_mm_or_si128(e[0], e[1]), e[2]);
+            int outside = _mm_movemask_ps(_mm_castsi128_ps(any_negative));
+            int lanes = end_x - x >= 3 ? 0xf : (1 << (end_x - x + 1)) - 1;
+            int covered = ~outside & lanes;
+            float* depth_row = &depth[row_offset + x];
+            __m128 old_depth = _mm_loadu_ps(depth_row);
+            int passed =
+                covered != 0
+                    ? _mm_movemask_ps(_mm_cmple_ps(attribute[0], old_depth)) &
+                          covered
+                    : 0;
+            if (passed != 0) {
+                __m128 mask = _mm_castsi128_ps(_mm_cmpeq_epi32(
+                    _mm_and_si128(_mm_set1_epi32(passed), lane_bits),
+                    lane_bits));
+                _mm_storeu_ps(depth_row,
+                              _mm_or_ps(_mm_and_ps(mask, attribute[0]),
+                                        _mm_andnot_ps(mask, old_depth)));
+
+                // Perspective divide, clamp and quantize for the sRGB table
+                __m128 w = _mm_div_ps(one, attribute[1]);
+                alignas(16) int32_t index[3][4];
+                for (int c = 0; c < 3; ++c) {
+                    __m128 value = _mm_mul_ps(attribute[2 + c], w);
+                    value = _mm_min_ps(_mm_max_ps(value, _mm_setzero_ps()),
+                                       one);
+                    _mm_store_si128(
+                        reinterpret_cast<__m128i*>(index[c]),
+                        _mm_cvttps_epi32(
+                            _mm_add_ps(_mm_mul_ps(value, lut_scale), half)));
+                }
+                uint32_t* color_row = &color[row_offset + x];
+                for (int lane = 0; lane < 4; ++lane) {
+                    if ((passed & (1 << lane)) != 0) {
+                        color_row[lane] = uint32_t(srgb[index[0][lane]]) |
+                                          uint32_t(srgb[index[1][lane]]) << 8 |
+                                          uint32_t(srgb[index[2][lane]]) << 16 |
+                                          0xff000000u;
+                    }
+                }
+                pixels += std::popcount(static_cast<unsigned>(passed));
+            }
+            for (int i = 0; i < 3; ++i) {
+                e[i] = _mm_add_epi32(e[i], e_step[i]);
+            }
+            for (int i = 0; i < 5; ++i) {
+                attribute[i] = _mm_add_ps(attribute[i], attribute_step[i]);
+            }
+        }
+#else
+        for (int32_t x = start_x; x <= end_x; ++x) {
+            int32_t dx = x - start_x;
+            bool inside = true;
+            for (int i = 0; i < 3; ++i) {
+                inside = inside &&
+                         edge[i] + static_cast<int32_t>(step_x[i]) * dx >= 0;
+            }
+            if (!inside) {
+                continue;
+            }
+            float values[5];
+            for (int i = 0; i < 5; ++i) {
+                values[i] = row[i] + triangle.attributes[i][1] * dx;
+            }
+            float& stored = depth[row_offset + x];
+            if (values[0] <= stored) {
+                stored = values[0];
+                shade(row_offset + x, values);
+                ++pixels;
+            }
+        }
+#endif
+    }
+}
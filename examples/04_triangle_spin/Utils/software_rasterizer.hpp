@@ -0,0 +1,116 @@
+/*
+ * @author: Avidel
+ * @LastEditors: Avidel
+ */
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "render_types.hpp"
+
+class JobSystem;
+
+// --- Software Rasterizer ---
+// A tiled, multithreaded CPU rasterizer for the example's pipeline: triangle
+// lists of Vertex under FrameUniforms::view_proj and one world matrix per
+// instance, color interpolated perspective-correct, depth tested with
+// LESS_OR_EQUAL, no culling. It follows the Vulkan conventions Renderer
+// uses (clip z in [0, 1], pixel centers at .5, a top-left fill rule, an
+// sRGB target) so both produce matching images.
+//
+// Per frame: beginFrame() clears, draw() transforms, clips and bins the
+// triangles into TILE_SIZE tiles in parallel, endFrame() rasterizes each
+// tile as one job, so no two threads ever touch the same pixel.
+class SoftwareRasterizer {
+public:
+    static constexpr uint32_t TILE_SIZE = 64;   // Pixels, a multiple of 4
+    static constexpr uint32_t MAX_SIZE = 8192;  // Per axis
+
+    struct Stats {
+        size_t triangles = 0;      // Submitted
+        size_t binned = 0;         // After clipping, without empty ones
+        size_t bin_entries = 0;    // Triangle and tile pairs
+        uint64_t pixels = 0;       // Passed the depth test
+        double geometry_ms = 0.0;  // draw(): transform, clip and bin
+        double raster_ms = 0.0;    // endFrame()
+    };
+
+    SoftwareRasterizer(JobSystem& jobs, uint32_t width, uint32_t height);
+
+    // Contents are undefined until the next beginFrame()
+    void resize(uint32_t width, uint32_t height);
+    uint32_t getWidth() const { return width; }
+    uint32_t getHeight() const { return height; }
+
+    // Clears color (linear) and depth (to 1)
+    void beginFrame(const glm::vec4& clearColor);
+    // Every world matrix draws the whole vertex list, like an instanced draw.
+    // Draws are rasterized in submission order.
+    void draw(const FrameUniforms& frame, std::span<const Vertex> vertices,
+              std::span<const glm::mat4> models);
+    void endFrame();
+
+    // sRGB encoded RGBA8 rows of getPitch() bytes; complete after endFrame()
+    const uint8_t* getPixels() const {
+        return reinterpret_cast<const uint8_t*>(color.data());
+    }
+    size_t getPitch() const { return size_t(stride) * sizeof(uint32_t); }
+    bool writePng(const std::string& path) const;
+
+    const Stats& getLastStats() const { return last_stats; }
+
+private:
+    // Screen space, ready for the edge functions
+    struct Triangle {
+        int32_t x[3], y[3];  // Fixed point, SUBPIXEL_BITS of fraction
+        // Attribute planes v0 + dx * (x - x0) + dy * (y - y0) in pixels,
+        // for z, 1/w and color/w
+        float x0, y0;
+        float attributes[5][3];  // [attribute][value, d/dx, d/dy]
+        int32_t min_x, min_y, max_x, max_y;  // Pixels, inclusive, clamped
+    };
+
+    // Triangles of one parallel chunk of a draw, with per tile lists into
+    // them. Chunks are rasterized in order, which keeps submission order.
+    struct Bin {
+        std::vector<Triangle> triangles;
+        std::vector<std::vector<uint32_t>> tiles;
+    };
+
+    struct ClipVertex {
+        glm::vec4 position;
+        glm::vec3 color;
+    };
+
+    // Clip, project and bin one triangle
+    void setupTriangle(const ClipVertex (&vertices)[3], Bin& bin);
+    void emitTriangle(const ClipVertex& a, const ClipVertex& b,
+                      const ClipVertex& c, Bin& bin);
+    void rasterizeTile(uint32_t tile, uint64_t& pixels);
+    void rasterizeTriangle(const Triangle& triangle, int32_t tileX0,
+                           int32_t tileY0, int32_t tileX1, int32_t tileY1,
+                           uint64_t& pixels);
+
+    JobSystem& jobs;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t stride = 0;  // In pixels, whole tiles
+    uint32_t tiles_x = 0;
+    uint32_t tiles_y = 0;
+    float guard_x = 1.0f;  // Clip space guard band, in w
+    float guard_y = 1.0f;
+
+    std::vector<uint32_t> color;  // sRGB RGBA8
+    std::vector<float> depth;
+    uint32_t clear_color = 0;  // Packed; tiles clear themselves in endFrame()
+    std::vector<Bin> bins;
+    size_t bin_count = 0;  // In use this frame
+
+    Stats stats;
+    Stats last_stats;
+};
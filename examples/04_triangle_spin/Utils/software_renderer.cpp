@@ -0,0 +1,163 @@
+/*
+ * @author: Avidel
+ * @LastEditors: Avidel
+ */
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include "software_renderer.hpp"
+
+#include <SDL3/SDL_error.h>
+#include <spdlog/spdlog.h>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+SoftwareRenderer::SoftwareRenderer(SDL_Window* window)
+    : window(window), rasterizer(job_system, 1, 1) {
+    if (!window) {
+        throw std::runtime_error("SDL_Window pointer is null !");
+    }
+}
+
+SoftwareRenderer::~SoftwareRenderer() {
+    if (frame_surface) {
+        SDL_DestroySurface(frame_surface);
+    }
+}
+
+void SoftwareRenderer::init() {
+    createScene();
+    models.resize(scene.getNodeCount());
+    instance_target.matrices = models.data();
+    instance_target.capacity = models.size();
+    start_time = std::chrono::steady_clock::now();
+    spdlog::info("Software renderer initialized with {} threads.",
+                 job_system.getThreadCount());
+}
+
+void SoftwareRenderer::createScene() {
+    constexpr int ORBIT_COUNT = 6;
+    scene_root = scene.createNode();
+    for (int i = 0; i < ORBIT_COUNT; i++) {
+        Scene::NodeId orbit = scene.createNode(scene_root);
+        scene.setScale(orbit, glm::vec3(0.3f));
+        orbit_nodes.push_back(orbit);
+
+        Scene::NodeId moon = scene.createNode(orbit);
+        scene.setTranslation(moon, glm::vec3(0.0f, -1.2f, 0.0f));
+        scene.setScale(moon, glm::vec3(0.4f));
+    }
+}
+
+void SoftwareRenderer::updateScene(float time) {
+    const glm::vec3 z_axis(0.0f, 0.0f, 1.0f);
+    scene.setRotation(scene_root,
+                      glm::angleAxis(time * glm::radians(30.0f), z_axis));
+    for (size_t i = 0; i < orbit_nodes.size(); i++) {
+        float angle = glm::radians(360.0f) * i / orbit_nodes.size();
+        scene.setTranslation(orbit_nodes[i],
+                             glm::vec3(cos(angle), sin(angle), 0.0f) * 0.8f);
+        scene.setRotation(orbit_nodes[i],
+                          glm::angleAxis(time * glm::radians(-120.0f), z_axis));
+    }
+    scene.update(job_system, &instance_target);
+}
+
+FrameUniforms SoftwareRenderer::makeFrameUniforms(float time) const {
+    // Same camera as Renderer::updateUniformBuffer()
+    float radius = 2.0f;
+    float camX = sin(time * glm::radians(45.0f)) * radius;
+    float camZ = cos(time * glm::radians(45.0f)) * radius;
+    glm::mat4 view = glm::lookAt(glm::vec3(camX, 0.0f, camZ), glm::vec3(0.0f),
+                                 glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::mat4 proj = glm::perspective(
+        glm::radians(45.0f),
+        rasterizer.getWidth() / (float)rasterizer.getHeight(), 0.1f, 10.0f);
+    proj[1][1] *= -1;
+
+    FrameUniforms frame{};
+    frame.view_proj = proj * view;
+    frame.light_color = glm::vec4(1.0f);
+    return frame;
+}
+
+bool SoftwareRenderer::updateSize() {
+    int width = 0, height = 0;
+    SDL_GetWindowSizeInPixels(window, &width, &height);
+    if (width <= 0 || height <= 0) {
+        return false;  // Minimized
+    }
+    width = std::min(width, int(SoftwareRasterizer::MAX_SIZE));
+    height = std::min(height, int(SoftwareRasterizer::MAX_SIZE));
+    if (!framebuffer_resized && uint32_t(width) == rasterizer.getWidth() &&
+        uint32_t(height) == rasterizer.getHeight()) {
+        return true;
+    }
+    framebuffer_resized = false;
+    rasterizer.resize(uint32_t(width), uint32_t(height));
+
+    // resize() reallocates the pixels, so wrap them again. SDL only reads
+    // them, as the source of the blit.
+    if (frame_surface) {
+        SDL_DestroySurface(frame_surface);
+    }
+    frame_surface = SDL_CreateSurfaceFrom(
+        width, height, SDL_PIXELFORMAT_RGBA32,
+        const_cast<uint8_t*>(rasterizer.getPixels()),
+        int(rasterizer.getPitch()));
+    if (!frame_surface) {
+        spdlog::error("Failed to wrap the software framebuffer: {}",
+                      SDL_GetError());
+        throw std::runtime_error("Failed to create the frame surface !");
+    }
+    spdlog::debug("Software framebuffer resized to {}x{}.", width, height);
+    return true;
+}
+
+void SoftwareRenderer::present() {
+    // Revalidated by SDL after the window resizes
+    SDL_Surface* window_surface = SDL_GetWindowSurface(window);
+    if (!window_surface) {
+        throw std::runtime_error("Failed to get the window surface !");
+    }
+    if (!SDL_BlitSurface(frame_surface, nullptr, window_surface, nullptr) ||
+        !SDL_UpdateWindowSurface(window)) {
+        spdlog::warn("Failed to present the software frame: {}",
+                     SDL_GetError());
+    }
+}
+
+void SoftwareRenderer::drawFrame() {
+    if (!updateSize()) {
+        return;
+    }
+    float time = std::chrono::duration<float, std::chrono::seconds::period>(
+                     std::chrono::steady_clock::now() - start_time)
+                     .count();
+    updateScene(time);
+
+    rasterizer.beginFrame(glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+    rasterizer.draw(makeFrameUniforms(time), vertices, models);
+    rasterizer.endFrame();
+    present();
+
+    const SoftwareRasterizer::Stats& stats = rasterizer.getLastStats();
+    stats_totals.triangles += stats.triangles;
+    stats_totals.pixels += stats.pixels;
+    stats_totals.geometry_ms += stats.geometry_ms;
+    stats_totals.raster_ms += stats.raster_ms;
+    if (++stats_frames == REPORT_FRAMES) {
+        double frames = stats_frames;
+        spdlog::info("Software rasterizer: {:.1f} triangles, {:.0f} pixels "
+                     "per frame, {:.3f} ms geometry + {:.3f} ms raster",
+                     stats_totals.triangles / frames,
+                     stats_totals.pixels / frames,
+                     stats_totals.geometry_ms / frames,
+                     stats_totals.raster_ms / frames);
+        stats_totals = SoftwareRasterizer::Stats();
+        stats_frames = 0;
+    }
+}
@@ -0,0 +1,68 @@
+/*
+ * @author: Avidel
+ * @LastEditors: Avidel
+ */
+#pragma once
+#include <SDL3/SDL_surface.h>
+#include <SDL3/SDL_video.h>
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "job_system.hpp"
+#include "render_types.hpp"
+#include "scene.hpp"
+#include "software_rasterizer.hpp"
+
+// --- Software Renderer ---
+// Draws the same animated scene as Renderer with SoftwareRasterizer and
+// presents through the window's SDL surface, so the example runs without a
+// Vulkan device. The window must not be created with SDL_WINDOW_VULKAN.
+class SoftwareRenderer {
+public:
+    static constexpr uint32_t REPORT_FRAMES = 600;  // Stats log interval
+
+    explicit SoftwareRenderer(SDL_Window* window);
+    ~SoftwareRenderer();
+
+    SoftwareRenderer(const SoftwareRenderer&) = delete;
+    SoftwareRenderer& operator=(const SoftwareRenderer&) = delete;
+
+    void init();
+    void drawFrame();
+    // Called from the application event loop
+    void signalFramebufferResize() { framebuffer_resized = true; }
+
+private:
+    void createScene();  // Same hierarchy as Renderer::createScene()
+    void updateScene(float time);
+    FrameUniforms makeFrameUniforms(float time) const;
+    // Match the rasterizer to the window; false while it has no area
+    bool updateSize();
+    void present();
+
+    SDL_Window* window;
+    JobSystem job_system;
+    SoftwareRasterizer rasterizer;
+    SDL_Surface* frame_surface = nullptr;  // Wraps the rasterizer's pixels
+    bool framebuffer_resized = true;
+
+    Scene scene;
+    Scene::NodeId scene_root = 0;
+    std::vector<Scene::NodeId> orbit_nodes;
+    std::vector<glm::mat4> models;  // Every node's world matrix
+    Scene::InstanceTarget instance_target;
+    std::chrono::steady_clock::time_point start_time;
+
+    const std::vector<Vertex> vertices = {
+        {{0.0f, -0.5f}, {1.0f, 0.0f, 0.0f}},
+        { {0.5f, 0.5f}, {0.0f, 1.0f, 0.0f}},
+        {{-0.5f, 0.5f}, {0.0f, 0.0f, 1.0f}},
+    };
+
+    SoftwareRasterizer::Stats stats_totals;  // Since the last report
+    uint32_t stats_frames = 0;
+};
@@ -0,0 +1,567 @@
+/*
+ * @author: Avidel
+ * @LastEditors: Avidel
+ */
+#include "spirv_reflect.hpp"
+
+#include <algorithm>
+#include <map>
+#include <optional>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace {
+constexpr uint32_t SPIRV_MAGIC = 0x07230203;
+constexpr size_t HEADER_WORDS = 5;
+
+// --- SPIR-V enumerants used here (see the SPIR-V specification) ---
+enum Op : uint16_t {
+    OpEntryPoint = 15,
+    OpTypeInt = 21,
+    OpTypeFloat = 22,
+    OpTypeVector = 23,
+    OpTypeMatrix = 24,
+    OpTypeImage = 25,
+    OpTypeSampler = 26,
+    OpTypeSampledImage = 27,
+    OpTypeArray = 28,
+    OpTypeRuntimeArray = 29,
+    OpTypeStruct = 30,
+    OpTypePointer = 32,
+    OpConstant = 43,
+    OpVariable = 59,
+    OpDecorate = 71,
+    OpMemberDecorate = 72,
+    OpTypeAccelerationStructureKHR = 5341,
+};
+
+enum Decoration : uint32_t {
+    DecorationBlock = 2,
+    DecorationBufferBlock = 3,
+    DecorationArrayStride = 6,
+    DecorationMatrixStride = 7,
+    DecorationBuiltIn = 11,
+    DecorationLocation = 30,
+    DecorationBinding = 33,
+    DecorationDescriptorSet = 34,
+    DecorationOffset = 35,
+};
+
+enum StorageClass : uint32_t {
+    StorageUniformConstant = 0,
+    StorageInput = 1,
+    StorageUniform = 2,
+    StoragePushConstant = 9,
+    StorageStorageBuffer = 12,
+};
+
+constexpr uint32_t DIM_BUFFER = 5;
+constexpr uint32_t DIM_SUBPASS_DATA = 6;
+
+struct TypeInfo {
+    uint16_t op = 0;
+    std::vector<uint32_t> operands;  // Words after the result id
+};
+
+struct Decorations {
+    std::optional<uint32_t> set;
+    std::optional<uint32_t> binding;
+    std::optional<uint32_t> location;
+    std::optional<uint32_t> array_stride;
+    bool block = false;
+    bool buffer_block = false;
+    bool built_in = false;
+};
+
+struct MemberDecorations {
+    uint32_t offset = 0;
+    std::optional<uint32_t> matrix_stride;
+};
+
+struct Variable {
+    uint32_t id;
+    uint32_t type;  // Pointer type
+    uint32_t storage;
+};
+
+class Parser {
+public:
+    explicit Parser(std::span<const uint32_t> code) : code(code) {}
+
+    ShaderReflection parse();
+
+private:
+    void collect();
+    const TypeInfo& type(uint32_t id) const;
+    uint32_t arrayLength(const TypeInfo& array) const;
+    uint32_t typeSize(uint32_t id) const;
+    uint32_t structSize(uint32_t id) const;
+    VkDescriptorType descriptorType(uint32_t typeId, uint32_t storage) const;
+    VkFormat vertexFormat(uint32_t typeId) const;
+    void addVertexInput(ShaderReflection& result, uint32_t typeId,
+                        uint32_t location) const;
+
+    std::span<const uint32_t> code;
+    VkShaderStageFlags stage = 0;
+    std::unordered_map<uint32_t, TypeInfo> types;
+    std::unordered_map<uint32_t, uint32_t> constants;  // 32-bit ints only
+    std::unordered_map<uint32_t, Decorations> decorations;
+    std::unordered_map<uint32_t, std::map<uint32_t, MemberDecorations>>
+        member_decorations;
+    std::vector<Variable> variables;
+};
+
+VkShaderStageFlags stageFromExecutionModel(uint32_t model) {
+    switch (model) {
+        case 0:
+            return VK_SHADER_STAGE_VERTEX_BIT;
+        case 1:
+            return VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT;
+        case 2:
+            return VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT;
+        case 3:
+            return VK_SHADER_STAGE_GEOMETRY_BIT;
+        case 4:
+            return VK_SHADER_STAGE_FRAGMENT_BIT;
+        case 5:
+            return VK_SHADER_STAGE_COMPUTE_BIT;
+        case 5364:
+            return VK_SHADER_STAGE_TASK_BIT_EXT;
+        case 5365:
+            return VK_SHADER_STAGE_MESH_BIT_EXT;
+        default:
+            return 0;
+    }
+}
+
+void ensure(bool condition, const char* message) {
+    if (!condition) {
+        throw std::runtime_error(message);
+    }
+}
+
+void Parser::collect() {
+    ensure(code.size() >= HEADER_WORDS && code[0] == SPIRV_MAGIC,
+           "invalid SPIR-V header!");
+
+    for (size_t i = HEADER_WORDS; i < code.size();) {
+        uint16_t op = static_cast<uint16_t>(code[i] & 0xffff);
+        uint32_t word_count = code[i] >> 16;
+        ensure(word_count > 0 && i + word_count <= code.size(),
+               "truncated SPIR-V instruction!");
+        const uint32_t* words = &code[i];
+
+        switch (op) {
+            case OpEntryPoint:
+                // One stage per module is all the renderer produces
+                if (stage == 0) {
+                    stage = stageFromExecutionModel(words[1]);
+                }
+                break;
+            case OpTypeInt:
+            case OpTypeFloat:
+            case OpTypeVector:
+            case OpTypeMatrix:
+            case OpTypeImage:
+            case OpTypeSampler:
+            case OpTypeSampledImage:
+            case OpTypeArray:
+            case OpTypeRuntimeArray:
+            case OpTypeStruct:
+            case OpTypePointer:
+            case OpTypeAccelerationStructureKHR: {
+                TypeInfo info;
+                info.op = op;
+                info.operands.assign(words + 2, words + word_count);
+                types[words[1]] = std::move(info);
+                break;
+            }
+            case OpConstant:
+                // words: result type, result id, value (low word)
+                constants[words[2]] = words[3];
+                break;
+            case OpVariable:
+                variables.push_back({words[2], words[1], words[3]});
+                break;
+            case OpDecorate: {
+                Decorations& target = decorations[words[1]];
+                switch (words[2]) {
+                    case DecorationBlock:
+                        target.block = true;
+                        break;
+                    case DecorationBufferBlock:
+                        target.buffer_block = true;
+                        break;
+                    case DecorationBuiltIn:
+                        target.built_in = true;
+                        break;
+                    case DecorationDescriptorSet:
+                        target.set = words[3];
+                        break;
+                    case DecorationBinding:
+                        target.binding = words[3];
+                        break;
+                    case DecorationLocation:
+                        target.location = words[3];
+                        break;
+                    case DecorationArrayStride:
+                        target.array_stride = words[3];
+                        break;
+                    default:
+                        break;
+                }
+                break;
+            }
+            case OpMemberDecorate: {
+                MemberDecorations& member =
+                    member_decorations[words[1]][words[2]];
+                if (words[3] == DecorationOffset) {
+                    member.offset = words[4];
+                } else if (words[3] == DecorationMatrixStride) {
+                    member.matrix_stride = words[4];
+                }
+                break;
+            }
+            default:
+                break;
+        }
+        i += word_count;
+    }
+}
+
+const TypeInfo& Parser::type(uint32_t id) const {
+    auto it = types.find(id);
+    ensure(it != types.end(), "SPIR-V references an unknown type!");
+    return it->second;
+}
+
+uint32_t Parser::arrayLength(const TypeInfo& array) const {
+    if (array.op == OpTypeRuntimeArray) {
+        return 1;
+    }
+    auto it = constants.find(array.operands[1]);
+    ensure(it != constants.end(), "SPIR-V array length is not a constant!");
+    return it->second;
+}
+
+// Size in bytes following the explicit layout decorations (Offset,
+// ArrayStride, MatrixStride) that std140/std430/push constant blocks carry
+uint32_t Parser::typeSize(uint32_t id) const {
+    const TypeInfo& info = type(id);
+    switch (info.op) {
+        case OpTypeInt:
+        case OpTypeFloat:
+            return info.operands[0] / 8;
+        case OpTypeVector:
+            return typeSize(info.operands[0]) * info.operands[1];
+        case OpTypeMatrix:
+            return typeSize(info.operands[0]) * info.operands[1];
+        case OpTypeArray:
+        case OpTypeRuntimeArray: {
+            auto it = decorations.find(id);
+            uint32_t stride = it != decorations.end() && it->second.array_stride
+                                  ? *it->second.array_stride
+                                  : typeSize(info.operands[0]);
+            return stride * arrayLength(info);
+        }
+        case OpTypeStruct:
+            return structSize(id);
+        default:
+            return 0;
+    }
+}
+
+uint32_t Parser::structSize(uint32_t id) const {
+    const TypeInfo& info = type(id);
+    auto members = member_decorations.find(id);
+    uint32_t size = 0;
+    for (uint32_t i = 0; i < info.operands.size(); ++i) {
+        MemberDecorations member;
+        if (members != member_decorations.end()) {
+            auto it = members->second.find(i);
+            if (it != members->second.end()) {
+                member = it->second;
+            }
+        }
+        uint32_t member_type = info.operands[i];
+        uint32_t member_size = typeSize(member_type);
+        const TypeInfo& member_info = type(member_type);
+        if (member_info.op == OpTypeMatrix && member.matrix_stride) {
+            member_size = *member.matrix_stride * member_info.operands[1];
+        }
+        size = std::max(size, member.offset + member_size);
+    }
+    return size;
+}
+
+VkDescriptorType Parser::descriptorType(uint32_t typeId,
+                                        uint32_t storage) const {
+    const TypeInfo* info = &type(typeId);
+    uint32_t id = typeId;
+    while (info->op == OpTypeArray || info->op == OpTypeRuntimeArray) {
+        id = info->operands[0];
+        info = &type(id);
+    }
+
+    if (storage == StorageStorageBuffer) {
+        return VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    }
+    if (storage == StorageUniform) {
+        auto it = decorations.find(id);
+        bool buffer_block = it != decorations.end() && it->second.buffer_block;
+        return buffer_block ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER
+                            : VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    }
+
+    switch (info->op) {
+        case OpTypeSampler:
+            return VK_DESCRIPTOR_TYPE_SAMPLER;
+        case OpTypeSampledImage:
+            return VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        case OpTypeAccelerationStructureKHR:
+            return VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR;
+        case OpTypeImage: {
+            // operands: sampled type, dim, depth, arrayed, ms, sampled, format
+            uint32_t dim = info->operands[1];
+            bool storage_image = info->operands[5] == 2;
+            if (dim == DIM_SUBPASS_DATA) {
+                return VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+            }
+            if (dim == DIM_BUFFER) {
+                return storage_image ? VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER
+                                     : VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER;
+            }
+            return storage_image ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE
+                                 : VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+        }
+        default:
+            throw std::runtime_error("unsupported SPIR-V resource type!");
+    }
+}
+
+VkFormat Parser::vertexFormat(uint32_t typeId) const {
+    const TypeInfo& info = type(typeId);
+    uint32_t components = 1;
+    const TypeInfo* scalar = &info;
+    if (info.op == OpTypeVector) {
+        components = info.operands[1];
+        scalar = &type(info.operands[0]);
+    }
+    ensure(scalar->operands[0] == 32, "only 32-bit vertex inputs supported!");
+
+    static constexpr VkFormat FLOAT_FORMATS[] = {
+        VK_FORMAT_R32_SFLOAT, VK_FORMAT_R32G32_SFLOAT,
+        VK_FORMAT_R32G32B32_SFLOAT, VK_FORMAT_R32G32B32A32_SFLOAT};
+    static constexpr VkFormat SINT_FORMATS[] = {
+        VK_FORMAT_R32_SINT, VK_FORMAT_R32G32_SINT, VK_FORMAT_R32G32B32_SINT,
+        VK_FORMAT_R32G32B32A32_SINT};
+    static constexpr VkFormat UINT_FORMATS[] = {
+        VK_FORMAT_R32_UINT, VK_FORMAT_R32G32_UINT, VK_FORMAT_R32G32B32_UINT,
+        VK_FORMAT_R32G32B32A32_UINT};
+
+    if (scalar->op == OpTypeFloat) {
+        return FLOAT_FORMATS[components - 1];
+    }
+    ensure(scalar->op == OpTypeInt, "unsupported vertex input type!");
+    bool is_signed = scalar->operands[1] != 0;
+    return is_signed ? SINT_FORMATS[components - 1]
+                     : UINT_FORMATS[components - 1];
+}
+
+void Parser::addVertexInput(ShaderReflection& result, uint32_t typeId,
+                            uint32_t location) const {
+    const TypeInfo& info = type(typeId);
+    if (info.op == OpTypeMatrix) {
+        // A matN input takes one location per column
+        for (uint32_t column = 0; column < info.operands[1]; ++column) {
+            addVertexInput(result, info.operands[0], location + column);
+        }
+        return;
+    }
+    result.vertex_inputs.push_back(
+        {location, vertexFormat(typeId), typeSize(typeId)});
+}
+
+ShaderReflection Parser::parse() {
+    collect();
+    ensure(stage != 0, "SPIR-V module has no supported entry point!");
+
+    ShaderReflection result;
+    result.stages = stage;
+    for (const auto& variable : variables) {
+        const TypeInfo& pointer = type(variable.type);
+        ensure(pointer.op == OpTypePointer, "SPIR-V variable is no pointer!");
+        uint32_t pointee = pointer.operands[1];
+        auto deco_it = decorations.find(variable.id);
+        Decorations deco =
+            deco_it != decorations.end() ? deco_it->second : Decorations{};
+
+        switch (variable.storage) {
+            case StorageUniformConstant:
+            case StorageUniform:
+            case StorageStorageBuffer: {
+                if (!deco.binding) {
+                    break;
+                }
+                ReflectedBinding binding;
+                binding.set = deco.set.value_or(0);
+                binding.binding = *deco.binding;
+                binding.type = descriptorType(pointee, variable.storage);
+                const TypeInfo& info = type(pointee);
+                if (info.op == OpTypeArray || info.op == OpTypeRuntimeArray) {
+                    binding.count = arrayLength(info);
+                }
+                binding.stages = stage;
+                result.bindings.push_back(binding);
+                break;
+            }
+            case StoragePushConstant: {
+                uint32_t offset = UINT32_MAX;
+                auto members = member_decorations.find(pointee);
+                if (members != member_decorations.end()) {
+                    for (const auto& [index, member] : members->second) {
+                        offset = std::min(offset, member.offset);
+                    }
+                }
+                if (offset == UINT32_MAX) {
+                    offset = 0;
+                }
+                result.push_constants.push_back(
+                    {stage, offset, structSize(pointee) - offset});
+                break;
+            }
+            case StorageInput:
+                if (stage == VK_SHADER_STAGE_VERTEX_BIT && !deco.built_in &&
+                    deco.location) {
+                    addVertexInput(result, pointee, *deco.location);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+
+    std::sort(result.bindings.begin(), result.bindings.end(),
+              [](const ReflectedBinding& a, const ReflectedBinding& b) {
+                  return a.set != b.set ? a.set < b.set
+                                        : a.binding < b.binding;
+              });
+    std::sort(result.vertex_inputs.begin(), result.vertex_inputs.end(),
+              [](const ReflectedVertexInput& a,
+                 const ReflectedVertexInput& b) {
+                  return a.location < b.location;
+              });
+    return result;
+}
+}  // namespace
+
+ShaderReflection reflectSpirv(std::span<const uint32_t> code) {
+    return Parser(code).parse();
+}
+
+void ShaderReflection::merge(const ShaderReflection& other) {
+    stages |= other.stages;
+
+    for (const auto& binding : other.bindings) {
+        auto it = std::find_if(bindings.begin(), bindings.end(),
+                               [&](const ReflectedBinding& existing) {
+                                   return existing.set == binding.set &&
+                                          existing.binding == binding.binding;
+                               });
+        if (it == bindings.end()) {
+            bindings.push_back(binding);
+            continue;
+        }
+        if (it->type != binding.type) {
+            throw std::runtime_error(
+                "shader stages disagree on a descriptor type!");
+        }
+        it->stages |= binding.stages;
+        it->count = std::max(it->count, binding.count);
+    }
+    std::sort(bindings.begin(), bindings.end(),
+              [](const ReflectedBinding& a, const ReflectedBinding& b) {
+                  return a.set != b.set ? a.set < b.set
+                                        : a.binding < b.binding;
+              });
+
+    // One range covering every stage's block keeps each stage in one range
+    for (const auto& range : other.push_constants) {
+        if (push_constants.empty()) {
+            push_constants.push_back(range);
+            continue;
+        }
+        VkPushConstantRange& merged = push_constants.front();
+        uint32_t end = std::max(merged.offset + merged.size,
+                                range.offset + range.size);
+        merged.offset = std::min(merged.offset, range.offset);
+        merged.size = end - merged.offset;
+        merged.stageFlags |= range.stageFlags;
+    }
+
+    if (vertex_inputs.empty()) {
+        vertex_inputs = other.vertex_inputs;
+    }
+}
+
+bool ShaderReflection::sameInterface(const ShaderReflection& other) const {
+    if (bindings != other.bindings || vertex_inputs != other.vertex_inputs ||
+        push_constants.size() != other.push_constants.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < push_constants.size(); ++i) {
+        const VkPushConstantRange& a = push_constants[i];
+        const VkPushConstantRange& b = other.push_constants[i];
+        if (a.stageFlags != b.stageFlags || a.offset != b.offset ||
+            a.size != b.size) {
+            return false;
+        }
+    }
+    return true;
+}
+
+uint32_t ShaderReflection::getSetCount() const {
+    return bindings.empty() ? 0 : bindings.back().set + 1;
+}
+
+std::vector<VkDescriptorSetLayoutBinding> ShaderReflection::getSetBindings(
+    uint32_t set) const {
+    std::vector<VkDescriptorSetLayoutBinding> layout_bindings;
+    for (const auto& binding : bindings) {
+        if (binding.set != set) {
+            continue;
+        }
+        VkDescriptorSetLayoutBinding layout_binding{};
+        layout_binding.binding = binding.binding;
+        layout_binding.descriptorType = binding.type;
+        layout_binding.descriptorCount = binding.count;
+        layout_binding.stageFlags = binding.stages;
+        layout_bindings.push_back(layout_binding);
+    }
+    return layout_bindings;
+}
+
+uint32_t ShaderReflection::getVertexInput(
+    std::vector<VkVertexInputBindingDescription>& bindingsOut,
+    std::vector<VkVertexInputAttributeDescription>& attributesOut) const {
+    bindingsOut.clear();
+    attributesOut.clear();
+    uint32_t offset = 0;
+    for (const auto& input : vertex_inputs) {
+        VkVertexInputAttributeDescription attribute{};
+        attribute.binding = 0;
+        attribute.location = input.location;
+        attribute.format = input.format;
+        attribute.offset = offset;
+        attributesOut.push_back(attribute);
+        offset += input.size;
+    }
+    if (!vertex_inputs.empty()) {
+        VkVertexInputBindingDescription binding{};
+        binding.binding = 0;
+        binding.stride = offset;
+        binding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+        bindingsOut.push_back(binding);
+    }
+    return offset;
+}
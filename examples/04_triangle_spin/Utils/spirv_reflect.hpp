@@ -0,0 +1,61 @@
+/*
+ * @author: Avidel
+ * @LastEditors: Avidel
+ */
+#pragma once
+#include <cstdint>
+#include <span>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+// --- SPIR-V Reflection ---
+// Reads descriptor bindings, push constant blocks and vertex inputs straight
+// from shader binaries, so set layouts and vertex formats never have to be
+// kept in sync with the GLSL by hand.
+
+struct ReflectedBinding {
+    uint32_t set = 0;
+    uint32_t binding = 0;
+    VkDescriptorType type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    uint32_t count = 1;  // Array length; runtime arrays report 1
+    VkShaderStageFlags stages = 0;
+
+    bool operator==(const ReflectedBinding&) const = default;
+};
+
+struct ReflectedVertexInput {
+    uint32_t location = 0;
+    VkFormat format = VK_FORMAT_UNDEFINED;
+    uint32_t size = 0;  // Bytes
+
+    bool operator==(const ReflectedVertexInput&) const = default;
+};
+
+struct ShaderReflection {
+    VkShaderStageFlags stages = 0;
+    std::vector<ReflectedBinding> bindings;  // Sorted by set, then binding
+    // At most one range: each stage may only appear in one range
+    std::vector<VkPushConstantRange> push_constants;
+    std::vector<ReflectedVertexInput> vertex_inputs;  // Sorted by location
+
+    // Combine with another stage of the same pipeline. Throws if both stages
+    // declare the same set/binding with different types.
+    void merge(const ShaderReflection& other);
+
+    // Same descriptors, push constants and vertex inputs: a pipeline built
+    // from other can use the layouts and vertex buffers made for this
+    bool sameInterface(const ShaderReflection& other) const;
+
+    uint32_t getSetCount() const;  // Highest set index + 1
+    std::vector<VkDescriptorSetLayoutBinding> getSetBindings(
+        uint32_t set) const;
+
+    // Vertex inputs as one tightly packed, per-vertex binding 0 in location
+    // order. Returns the stride.
+    uint32_t getVertexInput(
+        std::vector<VkVertexInputBindingDescription>& bindingsOut,
+        std::vector<VkVertexInputAttributeDescription>& attributesOut) const;
+};
+
+// Parse one shader module. Throws std::runtime_error on malformed SPIR-V.
+ShaderReflection reflectSpirv(std::span<const uint32_t> code);
@@ -0,0 +1,377 @@
+/*
+ * @author: Avidel
+ * @LastEditors: Avidel
+ */
+#include "tile_farm.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <thread>
+
+#if defined(__linux__)
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cerrno>
+#endif
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+double elapsedMs(Clock::time_point since) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - since)
+        .count();
+}
+
+// Start of the shared mapping; the pixels follow at PIXEL_OFFSET
+struct SharedHeader {
+    uint64_t parameter_size;
+    alignas(64) std::byte parameters[TileFarm::MAX_PARAMETER_BYTES];
+};
+constexpr size_t PIXEL_OFFSET = (sizeof(SharedHeader) + 63) / 64 * 64;
+
+// Coordinator to worker, one message per packet
+enum class CommandType : uint32_t { Render, Quit };
+struct TileCommand {
+    CommandType type;
+    uint32_t tile;
+};
+
+// Worker to coordinator, once the tile's pixels are written
+struct TileResult {
+    uint32_t tile;
+    double render_ms;
+};
+}  // namespace
+
+glm::mat4 TileFarm::cropViewProj(const glm::mat4& viewProj, const Tile& tile,
+                                 uint32_t width, uint32_t height) {
+    // Scale clip space about the tile's center so it spans [-1, 1]
+    float scale_x = float(width) / tile.width;
+    float scale_y = float(height) / tile.height;
+    float center_x = (tile.x + tile.width * 0.5f) / width * 2.0f - 1.0f;
+    float center_y = (tile.y + tile.height * 0.5f) / height * 2.0f - 1.0f;
+    glm::mat4 crop(1.0f);
+    crop[0][0] = scale_x;
+    crop[1][1] = scale_y;
+    crop[3][0] = -center_x * scale_x;  // Times w, so it holds after division
+    crop[3][1] = -center_y * scale_y;
+    return crop * viewProj;
+}
+
+#if defined(__linux__)
+TileFarm::TileFarm(uint32_t workerCount, uint32_t width, uint32_t height,
+                   uint32_t tileSize, WorkerSetup setup)
+    : width(width), height(height) {
+    if (width == 0 || height == 0 || tileSize == 0) {
+        throw std::runtime_error("Invalid tile farm frame size !");
+    }
+    if (workerCount == 0) {
+        workerCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (uint32_t y = 0; y < height; y += tileSize) {
+        for (uint32_t x = 0; x < width; x += tileSize) {
+            tiles.push_back({x, y, std::min(tileSize, width - x),
+                             std::min(tileSize, height - y)});
+        }
+    }
+
+    // Anonymous and shared: the workers inherit it across fork()
+    shared_size = PIXEL_OFFSET + getPitch() * height;
+    shared = mmap(nullptr, shared_size, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        shared = nullptr;
+        throw std::runtime_error("Failed to map the tile farm framebuffer !");
+    }
+    new (shared) SharedHeader{};
+    pixels = static_cast<uint8_t*>(shared) + PIXEL_OFFSET;
+
+    workers.resize(workerCount);
+    for (uint32_t i = 0; i < workerCount; ++i) {
+        int sockets[2];
+        if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sockets) !=
+            0) {
+            stopWorkers();
+            throw std::runtime_error("Failed to create a worker socket !");
+        }
+        pid_t pid = fork();
+        if (pid < 0) {
+            close(sockets[0]);
+            close(sockets[1]);
+            stopWorkers();
+            throw std::runtime_error("Failed to fork a tile farm worker !");
+        }
+        if (pid == 0) {
+            // The coordinator ends of the earlier workers came along too
+            close(sockets[0]);
+            for (uint32_t j = 0; j < i; ++j) {
+                close(workers[j].socket);
+            }
+            workerMain(i, sockets[1], setup);
+        }
+        close(sockets[1]);
+        workers[i].pid = pid;
+        workers[i].socket = sockets[0];
+    }
+    last_stats.workers.resize(workerCount);
+    spdlog::info("Tile farm: {} workers, {} tiles of {} px.", workerCount,
+                 tiles.size(), tileSize);
+}
+
+TileFarm::~TileFarm() { stopWorkers(); }
+
+void TileFarm::stopWorkers() {
+    for (Worker& worker : workers) {
+        if (worker.socket >= 0) {
+            TileCommand command{CommandType::Quit, 0};
+            send(worker.socket, &command, sizeof(command), MSG_NOSIGNAL);
+            close(worker.socket);
+            worker.socket = -1;
+        }
+        if (worker.pid > 0) {
+            waitpid(worker.pid, nullptr, 0);
+            worker.pid = -1;
+        }
+    }
+    if (shared) {
+        munmap(shared, shared_size);
+        shared = nullptr;
+    }
+}
+
+void TileFarm::workerMain(uint32_t index, int socket,
+                          const WorkerSetup& setup) {
+    int status = EXIT_SUCCESS;
+    try {
+        TileFunction render = setup(index);
+        const auto& header = *static_cast<const SharedHeader*>(shared);
+        TileCommand command;
+        while (recv(socket, &command, sizeof(command), 0) ==
+                   sizeof(command) &&
+               command.type == CommandType::Render) {
+            const Tile& tile = tiles[command.tile];
+            auto start = Clock::now();
+            render(tile,
+                   std::span<const std::byte>(header.parameters,
+                                              header.parameter_size),
+                   pixels + tile.y * getPitch() + size_t(tile.x) * 4,
+                   getPitch());
+            TileResult result{command.tile, elapsedMs(start)};
+            if (send(socket, &result, sizeof(result), MSG_NOSIGNAL) !=
+                sizeof(result)) {
+                break;
+            }
+        }
+    } catch (const std::exception& e) {
+        spdlog::error("Tile farm worker {} failed: {}", index, e.what());
+        status = EXIT_FAILURE;
+    }
+    close(socket);
+    // Skip the destructors and atexit handlers of the coordinator's copy
+    _exit(status);
+}
+
+void TileFarm::renderFrame(std::span<const std::byte> parameters) {
+    if (parameters.size() > MAX_PARAMETER_BYTES) {
+        throw std::runtime_error("Tile farm frame parameters too large !");
+    }
+    auto start = Clock::now();
+    auto& header = *static_cast<SharedHeader*>(shared);
+    std::memcpy(header.parameters, parameters.data(), parameters.size());
+    header.parameter_size = parameters.size();
+
+    // Contiguous runs of tiles, so each worker starts on one image region
+    std::vector<uint32_t> alive;
+    for (uint32_t i = 0; i < workers.size(); ++i) {
+        bool was_alive = workers[i].stats.alive;
+        workers[i].stats = WorkerStats();
+        workers[i].stats.alive = was_alive;
+        if (was_alive) {
+            alive.push_back(i);
+        }
+    }
+    if (alive.empty()) {
+        throw std::runtime_error("No tile farm worker left !");
+    }
+    const size_t tile_count = tiles.size();
+    for (size_t k = 0; k < alive.size(); ++k) {
+        Worker& worker = workers[alive[k]];
+        worker.queue.clear();
+        worker.queue_begin = 0;
+        worker.in_flight.clear();
+        for (size_t t = tile_count * k / alive.size();
+             t < tile_count * (k + 1) / alive.size(); ++t) {
+            worker.queue.push_back(static_cast<uint32_t>(t));
+        }
+    }
+    for (uint32_t index : alive) {
+        dispatch(index);
+    }
+
+    size_t remaining = tile_count;
+    std::vector<pollfd> fds;
+    std::vector<uint32_t> fd_workers;
+    while (remaining > 0) {
+        fds.clear();
+        fd_workers.clear();
+        for (uint32_t i = 0; i < workers.size(); ++i) {
+            if (workers[i].stats.alive) {
+                fds.push_back({workers[i].socket, POLLIN, 0});
+                fd_workers.push_back(i);
+            }
+        }
+        if (fds.empty()) {
+            throw std::runtime_error("No tile farm worker left !");
+        }
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error("Tile farm poll failed !");
+        }
+        for (size_t f = 0; f < fds.size(); ++f) {
+            if (fds[f].revents == 0) {
+                continue;
+            }
+            uint32_t index = fd_workers[f];
+            Worker& worker = workers[index];
+            if (!worker.stats.alive) {
+                continue;  // Retired while handing on another's tiles
+            }
+            TileResult result;
+            if ((fds[f].revents & POLLIN) == 0 ||
+                recv(worker.socket, &result, sizeof(result), 0) !=
+                    sizeof(result)) {
+                retire(index);  // Hung up or crashed
+                continue;
+            }
+            auto sent = std::find(worker.in_flight.begin(),
+                                  worker.in_flight.end(), result.tile);
+            if (sent == worker.in_flight.end()) {
+                continue;  // Not ours; ignore rather than double count
+            }
+            worker.in_flight.erase(sent);
+            const Tile& tile = tiles[result.tile];
+            worker.stats.tiles++;
+            worker.stats.pixels += uint64_t(tile.width) * tile.height;
+            worker.stats.busy_ms += result.render_ms;
+            --remaining;
+            dispatch(index);
+        }
+    }
+
+    last_stats.frame_ms = elapsedMs(start);
+    last_stats.workers.clear();
+    for (const Worker& worker : workers) {
+        last_stats.workers.push_back(worker.stats);
+    }
+}
+
+void TileFarm::dispatch(uint32_t index) {
+    Worker& worker = workers[index];
+    while (worker.stats.alive && worker.in_flight.size() < TILES_IN_FLIGHT) {
+        if (worker.queue_begin == worker.queue.size() && !steal(index)) {
+            return;
+        }
+        uint32_t tile = worker.queue[worker.queue_begin];
+        TileCommand command{CommandType::Render, tile};
+        if (send(worker.socket, &command, sizeof(command), MSG_NOSIGNAL) !=
+            sizeof(command)) {
+            retire(index);  // Still queued, so it is handed on
+            return;
+        }
+        worker.queue_begin++;
+        worker.in_flight.push_back(tile);
+    }
+}
+
+bool TileFarm::steal(uint32_t thief) {
+    Worker* victim = nullptr;
+    size_t most = 0;
+    for (uint32_t i = 0; i < workers.size(); ++i) {
+        size_t queued = workers[i].queue.size() - workers[i].queue_begin;
+        if (i != thief && workers[i].stats.alive && queued > most) {
+            victim = &workers[i];
+            most = queued;
+        }
+    }
+    if (!victim) {
+        return false;
+    }
+    // The back half, farthest from where the victim is working
+    size_t take = (most + 1) / 2;
+    Worker& worker = workers[thief];
+    worker.queue.assign(victim->queue.end() - take, victim->queue.end());
+    worker.queue_begin = 0;
+    victim->queue.resize(victim->queue.size() - take);
+    worker.stats.steals++;
+    return true;
+}
+
+void TileFarm::retire(uint32_t index) {
+    Worker& worker = workers[index];
+    if (worker.pid <= 0) {
+        return;  // Already retired; waitpid(-1) would wait for any child
+    }
+    std::vector<uint32_t> lost(worker.in_flight);
+    lost.insert(lost.end(), worker.queue.begin() + worker.queue_begin,
+                worker.queue.end());
+    worker.in_flight.clear();
+    worker.queue.clear();
+    worker.queue_begin = 0;
+    worker.stats.alive = false;
+    close(worker.socket);
+    worker.socket = -1;
+    waitpid(worker.pid, nullptr, 0);
+    worker.pid = -1;
+    spdlog::warn("Tile farm worker {} exited; {} tiles reassigned.", index,
+                 lost.size());
+
+    std::vector<uint32_t> alive;
+    for (uint32_t i = 0; i < workers.size(); ++i) {
+        if (workers[i].stats.alive) {
+            alive.push_back(i);
+        }
+    }
+    if (alive.empty()) {
+        throw std::runtime_error("No tile farm worker left !");
+    }
+    // Partly written tiles are simply rendered again
+    for (size_t t = 0; t < lost.size(); ++t) {
+        workers[alive[t % alive.size()]].queue.push_back(lost[t]);
+    }
+    for (uint32_t i : alive) {
+        dispatch(i);  // Some may have gone idle with nothing to steal
+    }
+}
+#else
+TileFarm::TileFarm(uint32_t, uint32_t width, uint32_t height, uint32_t,
+                   WorkerSetup)
+    : width(width), height(height) {
+    throw std::runtime_error("Tile farm requires Linux !");
+}
+
+TileFarm::~TileFarm() = default;
+
+void TileFarm::stopWorkers() {}
+
+void TileFarm::renderFrame(std::span<const std::byte>) {}
+
+void TileFarm::workerMain(uint32_t, int, const WorkerSetup&) { std::abort(); }
+
+void TileFarm::dispatch(uint32_t) {}
+
+bool TileFarm::steal(uint32_t) { return false; }
+
+void TileFarm::retire(uint32_t) {}
+#endif
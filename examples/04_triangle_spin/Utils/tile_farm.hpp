@@ -0,0 +1,117 @@
+/*
+ * @author: Avidel
+ * @LastEditors: Avidel
+ */
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// --- Tile Farm ---
+// Renders frames across local worker processes (Linux only). The
+// constructor forks the workers; each calls WorkerSetup once and then renders
+// the tiles the coordinator sends it over a Unix domain socket straight into
+// a framebuffer mapped shared by all processes, so results are gathered
+// without copies. Per-frame parameters (e.g. FrameUniforms) travel the same
+// way.
+//
+// Every worker starts a frame with a contiguous run of tiles in its queue,
+// keeping two in flight to hide the round trip. A worker whose queue runs
+// dry steals half of the longest queue, so workers stuck with slow tiles
+// hand the rest over. Tiles of a worker that dies go to the others.
+//
+// Create it before starting threads (e.g. a JobSystem): only the forking
+// thread exists in the workers, which should make their own.
+class TileFarm {
+public:
+    static constexpr size_t MAX_PARAMETER_BYTES = 4096;
+    static constexpr uint32_t TILES_IN_FLIGHT = 2;  // Per worker
+
+    struct Tile {
+        uint32_t x, y;  // Top left, in pixels
+        uint32_t width, height;
+    };
+
+    // Renders tile into pixels: RGBA8 rows of pitch bytes starting at the
+    // tile's top left corner. Runs in a worker process.
+    using TileFunction = std::function<void(
+        const Tile& tile, std::span<const std::byte> parameters,
+        uint8_t* pixels, size_t pitch)>;
+    // Runs once in each worker process after the fork
+    using WorkerSetup = std::function<TileFunction(uint32_t worker)>;
+
+    struct WorkerStats {
+        uint64_t tiles = 0;
+        uint64_t pixels = 0;
+        uint64_t steals = 0;     // Times it took tiles from another queue
+        double busy_ms = 0.0;    // Rendering, as measured by the worker
+        bool alive = true;
+    };
+
+    struct Stats {
+        double frame_ms = 0.0;
+        std::vector<WorkerStats> workers;
+    };
+
+    // workerCount 0 picks the hardware thread count
+    TileFarm(uint32_t workerCount, uint32_t width, uint32_t height,
+             uint32_t tileSize, WorkerSetup setup);
+    ~TileFarm();  // Stops and reaps the workers
+
+    TileFarm(const TileFarm&) = delete;
+    TileFarm& operator=(const TileFarm&) = delete;
+
+    // Renders every tile; throws once no worker is left
+    void renderFrame(std::span<const std::byte> parameters = {});
+
+    uint32_t getWidth() const { return width; }
+    uint32_t getHeight() const { return height; }
+    uint32_t getWorkerCount() const {
+        return static_cast<uint32_t>(workers.size());
+    }
+    size_t getTileCount() const { return tiles.size(); }
+    // RGBA8 rows of getPitch() bytes, complete after renderFrame()
+    const uint8_t* getPixels() const { return pixels; }
+    size_t getPitch() const { return size_t(width) * 4; }
+
+    const Stats& getLastStats() const { return last_stats; }
+
+    // viewProj with clip space narrowed to tile, for rendering the tile as
+    // an image of its own: pixel (i, j) of it covers pixel (x + i, y + j) of
+    // the width x height frame
+    static glm::mat4 cropViewProj(const glm::mat4& viewProj, const Tile& tile,
+                                  uint32_t width, uint32_t height);
+
+private:
+    struct Worker {
+        int pid = -1;
+        int socket = -1;  // Coordinator end
+        std::vector<uint32_t> queue;      // Tiles, taken from the front
+        size_t queue_begin = 0;
+        std::vector<uint32_t> in_flight;  // Sent, oldest first
+        WorkerStats stats;
+    };
+
+    [[noreturn]] void workerMain(uint32_t index, int socket,
+                                 const WorkerSetup& setup);
+    // Keep TILES_IN_FLIGHT tiles sent, stealing when the queue is empty
+    void dispatch(uint32_t index);
+    bool steal(uint32_t thief);
+    void retire(uint32_t index);  // A worker hung up or died
+    void stopWorkers();           // Also unmaps the framebuffer
+
+    uint32_t width;
+    uint32_t height;
+    std::vector<Tile> tiles;
+    std::vector<Worker> workers;
+
+    void* shared = nullptr;  // Parameter block, then the pixels
+    size_t shared_size = 0;
+    uint8_t* pixels = nullptr;
+
+    Stats last_stats;
+};
@@ -4,29 +4,61 @@
  */
 #include "vulkan_util.hpp"
 
+#include "embedded_shaders.hpp"
+
 #include <SDL3/SDL_error.h>
 #include <SDL3/SDL_events.h>  // For SDL_Event
+#include <SDL3/SDL_timer.h>
 #include <SDL3/SDL_vulkan.h>
 #include <spdlog/spdlog.h>
 
 #include <algorithm>  // For std::clamp
 #include <chrono>     // For time
+#include <cmath>
+#include <csignal>
 #include <cstdint>
 #include <cstring>  // For strcmp
-#include <fstream>  // For readFile
+#include <exception>
+#include <functional>
 #include <set>      // For unique queue families
+#include <span>
 #include <stdexcept>
+#include <type_traits>
 #include <vector>
 #include <vulkan/vulkan_core.h>
 
+namespace {
+// Interface of the whole pipeline: vertex stage merged with fragment stage
+ShaderReflection reflectShaders(std::span<const uint32_t> vert,
+                                std::span<const uint32_t> frag) {
+    ShaderReflection reflection = reflectSpirv(vert);
+    reflection.merge(reflectSpirv(frag));
+    return reflection;
+}
+
+// The service SIGINT and SIGTERM stop while runService() is serving
+std::atomic<RenderService*> signalled_service{nullptr};
+
+void stopServiceOnSignal(int) {
+    if (RenderService* service = signalled_service.load()) {
+        service->stop();  // Async-signal safe
+    }
+}
+}  // namespace
+
 // --- SDLContext Implementation ---
 bool SDLContext::init() {
     if (!SDL_Init(SDL_INIT_VIDEO)) {  // Check return value correctly
         spdlog::error("Failed to initialize SDL: {}", SDL_GetError());
         return false;
     }
-    window.reset(SDL_CreateWindow("Vulkan Triangle", width, height,
-                                  SDL_WINDOW_VULKAN | SDL_WINDOW_RESIZABLE));
+#if EnableSoftwareRasterizer
+    // Presented through the window surface, which a Vulkan window can't use
+    const SDL_WindowFlags flags = SDL_WINDOW_RESIZABLE;
+#else
+    const SDL_WindowFlags flags = SDL_WINDOW_VULKAN | SDL_WINDOW_RESIZABLE;
+#endif
+    window.reset(SDL_CreateWindow("Vulkan Triangle", width, height, flags));
     if (!window) {
         spdlog::error("Failed to create SDL window: {}", SDL_GetError());
         SDL_Quit();
@@ -42,7 +74,8 @@ bool SDLContext::init() {
 // implemented) VulkanContextManager VulkanContextManager::instance; // If using
 // a static member
 
-void VulkanContextManager::initVulkan(SDL_Window* window) {
+void VulkanContextManager::initVulkan(SDL_Window* window,
+                                      VkExtent2D drawableExtent) {
     if (!window) {
         throw std::runtime_error("SDL_Window pointer is null in initVulkan");
     }
@@ -54,10 +87,31 @@ void VulkanContextManager::initVulkan(SDL_Window* window) {
     createSurface(window);  // Pass the window pointer
     pickPhysicalDevice();
     createLogicalDevice();
-    createSwapChain();   // Creates swapchain, images, format, extent
+    createSwapChain(drawableExtent);  // Swapchain, images, format, extent
     createImageViews();  // Creates image views based on swapchain images
 }
 
+void VulkanContextManager::initHeadless() {
+    headless = true;
+    createInstance();
+#if EnableDebug
+    setupDebugMessenger();
+#endif
+    pickPhysicalDevice();
+    createLogicalDevice();
+    spdlog::info("Headless Vulkan context initialized.");
+}
+
+void VulkanContextManager::setOffscreenTarget(VkExtent2D extent,
+                                              VkFormat format) {
+    if (!headless) {
+        throw std::runtime_error("offscreen targets need a headless context!");
+    }
+    swapchain_extent = extent;
+    swapchain_image_format = format;
+    swapchain_image_usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+}
+
 void VulkanContextManager::cleanup() {
     cleanupSwapChain();  // Clean swapchain resources first
 
@@ -102,12 +156,14 @@ void VulkanContextManager::createInstance() {
         .apiVersion = VK_API_VERSION_1_4,  // Example: Use 1.4
     };
 
-    // Get required extensions from SDL
-    uint32_t extension_count = 0;
-    const auto* my_extensions =
-        SDL_Vulkan_GetInstanceExtensions(&extension_count);
-    std::vector<const char*> extensions(my_extensions,
-                                        my_extensions + extension_count);
+    // Get required extensions from SDL (surface extensions, not headless)
+    std::vector<const char*> extensions;
+    if (!headless) {
+        uint32_t extension_count = 0;
+        const auto* my_extensions =
+            SDL_Vulkan_GetInstanceExtensions(&extension_count);
+        extensions.assign(my_extensions, my_extensions + extension_count);
+    }
 
 #if EnableDebug
     extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
@@ -325,8 +381,8 @@ void VulkanContextManager::pickPhysicalDevice() {
 bool VulkanContextManager::isDeviceSuitable(VkPhysicalDevice device) {
     QueueFamilyIndices indices = findQueueFamilies(device);
     bool extensions_supported = checkDeviceExtensionSupport(device);
-    bool swapchain_adequate = false;
-    if (extensions_supported) {
+    bool swapchain_adequate = headless;  // Nothing to present to
+    if (extensions_supported && !headless) {
         SwapChainSupportDetails swapchain_support =
             querySwapChainSupport(device);
         swapchain_adequate = !swapchain_support.formats.empty() &&
@@ -364,9 +420,11 @@ bool VulkanContextManager::checkDeviceExtensionSupport(
                                          available_extensions.data());
 
     std::vector<const char*> required_extensions = {
-        VK_KHR_SWAPCHAIN_EXTENSION_NAME,
         VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME  // 添加扩展动态状态扩展
     };
+    if (!headless) {
+        required_extensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+    }
 #if VKB_ENABLE_PORTABILITY
     required_extensions.push_back(VK_KHR_PORTABILITY_SUBSET_EXTENSION_NAME);
 #endif
@@ -407,10 +465,15 @@ VulkanContextManager::findQueueFamilies(VkPhysicalDevice device) {
             indices.graphics_family = i;
         }
 
-        // Check for presentation support
+        // Check for presentation support (headless: nothing is presented,
+        // so the graphics queue stands in)
         VkBool32 present_support = false;
-        vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface,
-                                             &present_support);
+        if (surface != VK_NULL_HANDLE) {
+            vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface,
+                                                 &present_support);
+        } else {
+            present_support = indices.graphics_family.has_value();
+        }
         if (present_support) {
             indices.present_family = i;
         }
@@ -447,6 +510,17 @@ void VulkanContextManager::createLogicalDevice() {
     VkPhysicalDeviceFeatures
         device_features{};  // Enable features here if needed
     device_features.samplerAnisotropy = VK_TRUE;  // Example feature
+    // Indirect draws for GPU culling, enabled when present: without
+    // firstInstance the renderer culls on the CPU instead
+    VkPhysicalDeviceFeatures supported_features;
+    vkGetPhysicalDeviceFeatures(physical_device, &supported_features);
+    device_features.multiDrawIndirect = supported_features.multiDrawIndirect;
+    device_features.drawIndirectFirstInstance =
+        supported_features.drawIndirectFirstInstance;
+    optional_features.multi_draw_indirect =
+        supported_features.multiDrawIndirect == VK_TRUE;
+    optional_features.draw_indirect_first_instance =
+        supported_features.drawIndirectFirstInstance == VK_TRUE;
 
     // 启用扩展动态状态特性
     VkPhysicalDeviceExtendedDynamicStateFeaturesEXT
@@ -456,16 +530,160 @@ void VulkanContextManager::createLogicalDevice() {
     extended_dynamic_state_features.extendedDynamicState = VK_TRUE;
 
     std::vector<const char*> device_extensions = {
-        VK_KHR_SWAPCHAIN_EXTENSION_NAME,
         VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME  // 添加扩展
     };
+    if (!headless) {
+        device_extensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+    }
 #if VKB_ENABLE_PORTABILITY
     device_extensions.push_back(VK_KHR_PORTABILITY_SUBSET_EXTENSION_NAME);
 #endif
 
+    // --- Optional features: enabled only when the device supports them ---
+    uint32_t extension_count = 0;
+    vkEnumerateDeviceExtensionProperties(physical_device, nullptr,
+                                         &extension_count, nullptr);
+    std::vector<VkExtensionProperties> extension_properties(extension_count);
+    vkEnumerateDeviceExtensionProperties(physical_device, nullptr,
+                                         &extension_count,
+                                         extension_properties.data());
+    std::set<std::string> available_extensions;
+    for (const auto& extension : extension_properties) {
+        available_extensions.insert(extension.extensionName);
+    }
+    // Each enabled feature struct is pushed to the front of this chain
+    void* feature_chain = &extended_dynamic_state_features;
+
+    // Graphics pipeline libraries: compile pipeline parts separately and link
+    VkPhysicalDeviceGraphicsPipelineLibraryFeaturesEXT gpl_features{};
+    gpl_features.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_FEATURES_EXT;
+    if (available_extensions.contains(VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME) &&
+        available_extensions.contains(
+            VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME)) {
+        VkPhysicalDeviceFeatures2 features2{};
+        features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features2.pNext = &gpl_features;
+        vkGetPhysicalDeviceFeatures2(physical_device, &features2);
+
+        if (gpl_features.graphicsPipelineLibrary) {
+            VkPhysicalDeviceGraphicsPipelineLibraryPropertiesEXT gpl_properties{};
+            gpl_properties.sType =
+                VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_PROPERTIES_EXT;
+            VkPhysicalDeviceProperties2 properties2{};
+            properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+            properties2.pNext = &gpl_properties;
+            vkGetPhysicalDeviceProperties2(physical_device, &properties2);
+
+            optional_features.graphics_pipeline_library = true;
+            optional_features.gpl_fast_linking =
+                gpl_properties.graphicsPipelineLibraryFastLinking;
+            device_extensions.push_back(VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME);
+            device_extensions.push_back(
+                VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME);
+            gpl_features.pNext = feature_chain;
+            feature_chain = &gpl_features;
+            spdlog::info(
+                "Graphics pipeline library enabled (fast linking: {}).",
+                optional_features.gpl_fast_linking);
+        }
+    }
+
+    // Extended dynamic state 2/3: more state set per draw, fewer pipelines
+    VkPhysicalDeviceExtendedDynamicState2FeaturesEXT eds2_features{};
+    eds2_features.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_2_FEATURES_EXT;
+    if (available_extensions.contains(
+            VK_EXT_EXTENDED_DYNAMIC_STATE_2_EXTENSION_NAME)) {
+        VkPhysicalDeviceFeatures2 features2{};
+        features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features2.pNext = &eds2_features;
+        vkGetPhysicalDeviceFeatures2(physical_device, &features2);
+
+        if (eds2_features.extendedDynamicState2) {
+            optional_features.extended_dynamic_state2 = true;
+            // Only the core feature is used, not logic op / patch points
+            eds2_features.extendedDynamicState2LogicOp = VK_FALSE;
+            eds2_features.extendedDynamicState2PatchControlPoints = VK_FALSE;
+            device_extensions.push_back(
+                VK_EXT_EXTENDED_DYNAMIC_STATE_2_EXTENSION_NAME);
+            eds2_features.pNext = feature_chain;
+            feature_chain = &eds2_features;
+        }
+    }
+
+    VkPhysicalDeviceExtendedDynamicState3FeaturesEXT eds3_supported{};
+    eds3_supported.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_3_FEATURES_EXT;
+    VkPhysicalDeviceExtendedDynamicState3FeaturesEXT eds3_features{};
+    eds3_features.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_3_FEATURES_EXT;
+    if (available_extensions.contains(
+            VK_EXT_EXTENDED_DYNAMIC_STATE_3_EXTENSION_NAME)) {
+        VkPhysicalDeviceFeatures2 features2{};
+        features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features2.pNext = &eds3_supported;
+        vkGetPhysicalDeviceFeatures2(physical_device, &features2);
+
+        // EDS3 is a bag of independent features; enable just the two we set
+        eds3_features.extendedDynamicState3PolygonMode =
+            eds3_supported.extendedDynamicState3PolygonMode;
+        eds3_features.extendedDynamicState3ColorBlendEnable =
+            eds3_supported.extendedDynamicState3ColorBlendEnable;
+        optional_features.eds3_polygon_mode =
+            eds3_features.extendedDynamicState3PolygonMode;
+        optional_features.eds3_color_blend_enable =
+            eds3_features.extendedDynamicState3ColorBlendEnable;
+        if (optional_features.eds3_polygon_mode ||
+            optional_features.eds3_color_blend_enable) {
+            device_extensions.push_back(
+                VK_EXT_EXTENDED_DYNAMIC_STATE_3_EXTENSION_NAME);
+            eds3_features.pNext = feature_chain;
+            feature_chain = &eds3_features;
+        }
+    }
+    // Descriptor buffers: descriptors are written straight into memory, which
+    // also needs buffer device addresses
+    VkPhysicalDeviceDescriptorBufferFeaturesEXT descriptor_buffer_features{};
+    descriptor_buffer_features.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_BUFFER_FEATURES_EXT;
+    VkPhysicalDeviceBufferDeviceAddressFeatures device_address_features{};
+    device_address_features.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_BUFFER_DEVICE_ADDRESS_FEATURES;
+    if (available_extensions.contains(
+            VK_EXT_DESCRIPTOR_BUFFER_EXTENSION_NAME)) {
+        descriptor_buffer_features.pNext = &device_address_features;
+        VkPhysicalDeviceFeatures2 features2{};
+        features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features2.pNext = &descriptor_buffer_features;
+        vkGetPhysicalDeviceFeatures2(physical_device, &features2);
+
+        if (descriptor_buffer_features.descriptorBuffer &&
+            device_address_features.bufferDeviceAddress) {
+            optional_features.descriptor_buffer = true;
+            descriptor_buffer_features.descriptorBufferCaptureReplay = VK_FALSE;
+            descriptor_buffer_features.descriptorBufferImageLayoutIgnored =
+                VK_FALSE;
+            descriptor_buffer_features.descriptorBufferPushDescriptors =
+                VK_FALSE;
+            device_address_features.bufferDeviceAddressCaptureReplay = VK_FALSE;
+            device_address_features.bufferDeviceAddressMultiDevice = VK_FALSE;
+            device_extensions.push_back(
+                VK_EXT_DESCRIPTOR_BUFFER_EXTENSION_NAME);
+            device_address_features.pNext = feature_chain;
+            feature_chain = &descriptor_buffer_features;
+        }
+    }
+
+    spdlog::info(
+        "Extended dynamic state 2: {}, 3 polygon mode: {}, 3 blend enable: {}.",
+        optional_features.extended_dynamic_state2,
+        optional_features.eds3_polygon_mode,
+        optional_features.eds3_color_blend_enable);
+
     VkDeviceCreateInfo create_info{};
     create_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-    create_info.pNext = &extended_dynamic_state_features;  // 链接特性结构体
+    create_info.pNext = feature_chain;  // 链接特性结构体
     create_info.queueCreateInfoCount =
         static_cast<uint32_t>(queue_create_infos.size());
     create_info.pQueueCreateInfos = queue_create_infos.data();
@@ -550,18 +768,14 @@ VkPresentModeKHR VulkanContextManager::chooseSwapPresentMode(
 }
 
 VkExtent2D VulkanContextManager::chooseSwapExtent(
-    const VkSurfaceCapabilitiesKHR& capabilities, SDL_Window* window) {
+    const VkSurfaceCapabilitiesKHR& capabilities, VkExtent2D drawableExtent) {
     if (capabilities.currentExtent.width != UINT32_MAX) {
         // If extent is fixed, use it
         return capabilities.currentExtent;
     } else {
-        // Otherwise, get size from SDL and clamp to capabilities
-        int width, height;
-        SDL_GetWindowSizeInPixels(window, &width,
-                                  &height);  // Use this for high-DPI
-
-        VkExtent2D actualExtent = {static_cast<uint32_t>(width),
-                                   static_cast<uint32_t>(height)};
+        // Otherwise, use the window's size in pixels (high-DPI) and clamp to
+        // capabilities
+        VkExtent2D actualExtent = drawableExtent;
 
         actualExtent.width =
             std::clamp(actualExtent.width, capabilities.minImageExtent.width,
@@ -574,7 +788,7 @@ VkExtent2D VulkanContextManager::chooseSwapExtent(
     }
 }
 
-void VulkanContextManager::createSwapChain() {
+void VulkanContextManager::createSwapChain(VkExtent2D drawableExtent) {
     SwapChainSupportDetails swapchain_support =
         querySwapChainSupport(physical_device);
 
@@ -583,7 +797,7 @@ void VulkanContextManager::createSwapChain() {
     VkPresentModeKHR present_mode =
         chooseSwapPresentMode(swapchain_support.present_modes);
     VkExtent2D extent =
-        chooseSwapExtent(swapchain_support.capabilities, associated_window);
+        chooseSwapExtent(swapchain_support.capabilities, drawableExtent);
 
     uint32_t image_count = swapchain_support.capabilities.minImageCount +
                            1;  // Request one more than minimum
@@ -655,9 +869,10 @@ void VulkanContextManager::createSwapChain() {
                             swapchain_images.data());
     spdlog::info("Retrieved {} swapchain images.", image_count);
 
-    // Store format and extent
+    // Store format, extent and usage
     swapchain_image_format = surface_format.format;
     swapchain_extent = extent;
+    swapchain_image_usage = create_info.imageUsage;
 }
 
 void VulkanContextManager::createImageViews() {
@@ -712,14 +927,12 @@ void VulkanContextManager::cleanupSwapChain() {
     swapchain_images.clear();
 }
 
-void VulkanContextManager::recreateSwapChain() {
+void VulkanContextManager::recreateSwapChain(VkExtent2D drawableExtent) {
     spdlog::info("Recreating swapchain...");
-    // Handle minimization (wait until window is restored)
-    int width = 0, height = 0;
-    SDL_GetWindowSizeInPixels(associated_window, &width, &height);
-    while (width == 0 || height == 0) {
-        SDL_GetWindowSizeInPixels(associated_window, &width, &height);
-        SDL_WaitEvent(nullptr);  // Wait for events like resize/restore
+    // A minimized window has no size to create images at; callers skip the
+    // frame instead (see Renderer::recreateSwapChainIfVisible)
+    if (drawableExtent.width == 0 || drawableExtent.height == 0) {
+        throw std::runtime_error("cannot recreate a swapchain at 0x0!");
     }
 
     vkDeviceWaitIdle(
@@ -728,7 +941,7 @@ void VulkanContextManager::recreateSwapChain() {
     cleanupSwapChain();  // Destroy old swapchain and image views
 
     // Recreate swapchain and image views with new size/properties
-    createSwapChain();
+    createSwapChain(drawableExtent);
     createImageViews();
     spdlog::info("Swapchain recreated successfully.");
     // Note: Framebuffers and potentially command buffers need to be recreated
@@ -780,6 +993,14 @@ void VulkanContextManager::createBuffer(VkDeviceSize size,
     allocInfo.memoryTypeIndex =
         findMemoryType(memRequirements.memoryTypeBits, properties);
 
+    // vkGetBufferDeviceAddress needs the memory allocated with this flag
+    VkMemoryAllocateFlagsInfo allocFlagsInfo{};
+    allocFlagsInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO;
+    allocFlagsInfo.flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT;
+    if (usage & VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT) {
+        allocInfo.pNext = &allocFlagsInfo;
+    }
+
     if (vkAllocateMemory(device, &allocInfo, nullptr, &bufferMemory) !=
         VK_SUCCESS) {
         throw std::runtime_error("failed to allocate buffer memory!");
@@ -791,6 +1012,30 @@ void VulkanContextManager::createBuffer(VkDeviceSize size,
     vkBindBufferMemory(device, buffer, bufferMemory, 0);
 }
 
+void VulkanContextManager::createImage(const VkImageCreateInfo& imageInfo,
+                                       VkMemoryPropertyFlags properties,
+                                       VkImage& image,
+                                       VkDeviceMemory& imageMemory) {
+    if (vkCreateImage(device, &imageInfo, nullptr, &image) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create image!");
+    }
+
+    VkMemoryRequirements memRequirements;
+    vkGetImageMemoryRequirements(device, image, &memRequirements);
+
+    VkMemoryAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = memRequirements.size;
+    allocInfo.memoryTypeIndex =
+        findMemoryType(memRequirements.memoryTypeBits, properties);
+
+    if (vkAllocateMemory(device, &allocInfo, nullptr, &imageMemory) !=
+        VK_SUCCESS) {
+        throw std::runtime_error("failed to allocate image memory!");
+    }
+    vkBindImageMemory(device, image, imageMemory, 0);
+}
+
 VkCommandBuffer VulkanContextManager::beginSingleTimeCommands(
     VkCommandPool pool) {
     VkCommandBufferAllocateInfo allocInfo{};
@@ -843,7 +1088,10 @@ void VulkanContextManager::copyBuffer(VkCommandPool pool, VkBuffer srcBuffer,
 
 // --- Renderer Implementation ---
 
-Renderer::Renderer(VulkanContextManager* context) : vulkan_context(context) {
+Renderer::Renderer(VulkanContextManager* context)
+    : vulkan_context(context),
+      vert_spirv(embedded_shaders::vert.begin(), embedded_shaders::vert.end()),
+      frag_spirv(embedded_shaders::frag.begin(), embedded_shaders::frag.end()) {
     if (!vulkan_context) {
         throw std::invalid_argument(
             "VulkanContextManager pointer cannot be null for Renderer");
@@ -860,25 +1108,79 @@ void Renderer::init() {
     spdlog::info("Initializing Renderer...");
     createCommandPool();  // Pool needed for buffer copies etc.
     createVertexBuffer();
+    layout_cache = std::make_unique<LayoutCache>(vulkan_context->getDevice());
+#if EnableDescriptorBuffer
+    use_descriptor_buffer =
+        vulkan_context->getOptionalFeatures().descriptor_buffer;
+#endif
+    spdlog::info("Descriptor backend: {}.",
+                 use_descriptor_buffer ? "descriptor buffer" : "pool");
     createDescriptorSetLayout();  // Must be before pipeline layout
+    const auto& features = vulkan_context->getOptionalFeatures();
+#if EnableGpuOcclusionCulling
+    if (features.draw_indirect_first_instance) {
+        hiz_culler = std::make_unique<HiZCuller>(
+            vulkan_context, *layout_cache, MAX_FRAMES_IN_FLIGHT,
+            MAX_SCENE_NODES, features.multi_draw_indirect);
+    }
+#endif
+    spdlog::info("Occlusion culling: {}.", hiz_culler ? "GPU Hi-Z" : "CPU");
+    // The Hi-Z prepass fills the depth buffer, the color pass only tests
+    triangle_draw_state.depth_test = true;
+    triangle_draw_state.depth_write = !hiz_culler;
+    depth_prepass_state = triangle_draw_state;
+    depth_prepass_state.depth_write = true;
+    createDepthResources();  // Before the render pass checks its format
     createRenderPass();
+    pipeline_manager = std::make_unique<PipelineManager>(
+        vulkan_context->getDevice(), MAX_FRAMES_IN_FLIGHT);
+    if (features.graphics_pipeline_library && features.gpl_fast_linking) {
+        pipeline_manager->enableLibraries();
+    }
+    DynamicStateTracker::Support dynamic_support;
+    dynamic_support.extended_dynamic_state2 = features.extended_dynamic_state2;
+    dynamic_support.eds3_polygon_mode = features.eds3_polygon_mode;
+    dynamic_support.eds3_color_blend_enable = features.eds3_color_blend_enable;
+    dynamic_state_tracker = std::make_unique<DynamicStateTracker>(
+        vulkan_context->getDevice(), dynamic_support);
     createGraphicsPipeline();  // Depends on layout and render pass
     createFramebuffers();    // Depends on swapchain image views and render pass
     createUniformBuffers();  // Create UBOs
+    job_system = std::make_unique<JobSystem>();
+    occlusion_culler = std::make_unique<OcclusionCuller>(*job_system);
+    createScene();
+    createInstanceBuffers();  // Sized for the scene
+    if (hiz_culler) {
+        hiz_culler->createTargets(depth_image_view,
+                                  vulkan_context->getSwapChainExtent(),
+                                  instance_buffers);
+    }
     createDescriptorPool();  // Create pool for descriptor sets
     createDescriptorSets();  // Allocate and bind descriptor sets
     createCommandBuffers();  // Depends on framebuffers, pipeline, etc.
     createSyncObjects();
+    frame_capture =
+        std::make_unique<FrameCapture>(vulkan_context, MAX_FRAMES_IN_FLIGHT);
+#if EnableShaderHotReload
+    if (!vulkan_context->isHeadless()) {  // Nothing on screen to refresh
+        startShaderHotReload();
+    }
+#endif
     spdlog::info("Renderer initialized successfully.");
 }
 
 void Renderer::cleanup() {
     spdlog::info("Cleaning up Renderer...");
+    // Stop the watcher first so no new compiles are queued while we tear down
+    shader_watcher.reset();
+
     // Wait for device idle before destroying resources
     vkDeviceWaitIdle(vulkan_context->getDevice());
 
     cleanupSwapChainDependents();  // Clean things that depend on the swapchain
                                    // first
+    hiz_culler.reset();
+    frame_capture.reset();  // Writes out the frames it still holds
 
     // Destroy UBOs and their memory
     for (size_t i = 0; i < uniform_buffers.size(); i++) {
@@ -887,21 +1189,46 @@ void Renderer::cleanup() {
                             nullptr);
         }
         if (uniform_buffers_memory[i] != VK_NULL_HANDLE) {
+            vkUnmapMemory(vulkan_context->getDevice(),
+                          uniform_buffers_memory[i]);
             vkFreeMemory(vulkan_context->getDevice(), uniform_buffers_memory[i],
                          nullptr);
         }
     }
     uniform_buffers.clear();
     uniform_buffers_memory.clear();
+    uniform_buffers_mapped.clear();
     spdlog::debug("Uniform buffers destroyed.");
 
-    // Destroy descriptor set layout
-    if (descriptor_set_layout != VK_NULL_HANDLE) {
-        vkDestroyDescriptorSetLayout(vulkan_context->getDevice(),
-                                     descriptor_set_layout, nullptr);
-        descriptor_set_layout = VK_NULL_HANDLE;
-        spdlog::debug("Descriptor set layout destroyed.");
+    for (size_t i = 0; i < instance_buffers.size(); i++) {
+        vkDestroyBuffer(vulkan_context->getDevice(), instance_buffers[i],
+                        nullptr);
+        vkUnmapMemory(vulkan_context->getDevice(), instance_buffers_memory[i]);
+        vkFreeMemory(vulkan_context->getDevice(), instance_buffers_memory[i],
+                     nullptr);
     }
+    instance_buffers.clear();
+    instance_buffers_memory.clear();
+    instance_buffers_mapped.clear();
+    occlusion_culler.reset();  // Holds a reference to the job system
+    job_system.reset();
+    spdlog::debug("Instance buffers destroyed.");
+
+    // Joins the compile workers and destroys the pipeline cache
+    pipeline_manager.reset();
+    spdlog::debug("Pipeline manager destroyed.");
+
+    if (dynamic_state_tracker) {
+        const auto& stats = dynamic_state_tracker->getStats();
+        spdlog::info("Dynamic state: {} vkCmdSet* calls, {} redundant skipped.",
+                     stats.set_calls, stats.skipped);
+        dynamic_state_tracker.reset();
+    }
+
+    // Destroys the descriptor set layout and pipeline layout
+    descriptor_set_layout = VK_NULL_HANDLE;
+    layout_cache.reset();
+    spdlog::debug("Layout cache destroyed.");
 
     // Destroy vertex buffer
     if (vertex_buffer != VK_NULL_HANDLE) {
@@ -959,6 +1286,21 @@ void Renderer::cleanupSwapChainDependents() {
     swapchain_framebuffers.clear();
     spdlog::debug("Framebuffers destroyed.");
 
+    // Depth buffer and the Hi-Z targets built on it
+    if (hiz_culler) {
+        hiz_culler->destroyTargets();
+    }
+    if (depth_image_view != VK_NULL_HANDLE) {
+        vkDestroyImageView(vulkan_context->getDevice(), depth_image_view,
+                           nullptr);
+        vkDestroyImage(vulkan_context->getDevice(), depth_image, nullptr);
+        vkFreeMemory(vulkan_context->getDevice(), depth_image_memory, nullptr);
+        depth_image_view = VK_NULL_HANDLE;
+        depth_image = VK_NULL_HANDLE;
+        depth_image_memory = VK_NULL_HANDLE;
+        spdlog::debug("Depth buffer destroyed.");
+    }
+
     // Descriptor Pool (needs recreation because count depends on swapchain
     // images)
     if (descriptor_pool != VK_NULL_HANDLE) {
@@ -968,12 +1310,26 @@ void Renderer::cleanupSwapChainDependents() {
         spdlog::debug("Descriptor pool destroyed.");
     }
     // Descriptor sets are implicitly freed by pool destruction
+    descriptor_ring.reset();
+    ubo_descriptors.clear();
+    instance_descriptors.clear();
 
     // Command Buffers (if allocated - might be freed with pool instead)
     // vkFreeCommandBuffers(vulkan_context->getDevice(), command_pool,
     // static_cast<uint32_t>(command_buffers.size()), command_buffers.data());
     // command_buffers.clear(); // Clear the vector if freeing manually
 
+    // Async pipelines reference the render pass, drop them before it goes.
+    // Callers have waited for the device to go idle.
+    pending_pipeline_key = 0;
+    pending_prepass_key = 0;
+    pipelines_pending = false;
+    active_pipeline_key = 0;
+    active_prepass_key = 0;
+    if (pipeline_manager) {
+        pipeline_manager->clear();
+    }
+
     // Graphics Pipeline
     if (graphics_pipeline != VK_NULL_HANDLE) {
         vkDestroyPipeline(vulkan_context->getDevice(), graphics_pipeline,
@@ -981,15 +1337,15 @@ void Renderer::cleanupSwapChainDependents() {
         graphics_pipeline = VK_NULL_HANDLE;
         spdlog::debug("Graphics pipeline destroyed.");
     }
-
-    // Pipeline Layout
-    if (pipeline_layout != VK_NULL_HANDLE) {
-        vkDestroyPipelineLayout(vulkan_context->getDevice(), pipeline_layout,
-                                nullptr);
-        pipeline_layout = VK_NULL_HANDLE;
-        spdlog::debug("Pipeline layout destroyed.");
+    if (depth_prepass_pipeline != VK_NULL_HANDLE) {
+        vkDestroyPipeline(vulkan_context->getDevice(), depth_prepass_pipeline,
+                          nullptr);
+        depth_prepass_pipeline = VK_NULL_HANDLE;
     }
 
+    // Pipeline Layout (owned by layout_cache, reused after recreation)
+    pipeline_layout = VK_NULL_HANDLE;
+
     // Render Pass
     if (render_pass != VK_NULL_HANDLE) {
         vkDestroyRenderPass(vulkan_context->getDevice(), render_pass, nullptr);
@@ -1001,17 +1357,26 @@ void Renderer::cleanupSwapChainDependents() {
 }
 
 void Renderer::handleSwapChainRecreation() {
+    // Keep the hot-reload thread from queueing work against the old render
+    // pass. Reloaded sources are already committed, so the re-request in
+    // createGraphicsPipeline() picks them up.
+    std::lock_guard<std::mutex> lock(pipeline_mutex);
     cleanupSwapChainDependents();  // Clean old resources first
 
     // Recreate resources that depend on the new swapchain properties
+    createDepthResources();       // Sized like the swapchain
     createRenderPass();           // Might depend on new format
     createDescriptorSetLayout();  // Recreate layout (though it might not
                                   // strictly depend on swapchain)
     createGraphicsPipeline();     // Depends on layout and render pass
     createFramebuffers();         // Depends on new image views and render pass
-    createUniformBuffers();       // Recreate UBOs for the new number of images
-    createDescriptorPool();       // Recreate pool for new number of sets
-    createDescriptorSets();       // Recreate descriptor sets
+    if (hiz_culler) {
+        hiz_culler->createTargets(depth_image_view,
+                                  vulkan_context->getSwapChainExtent(),
+                                  instance_buffers);
+    }
+    createDescriptorPool();       // Uniform buffers are per frame in flight
+    createDescriptorSets();       // and survive, only the sets are rebuilt
     createCommandBuffers();       // Depends on framebuffers, pipeline, etc.
 }
 
@@ -1030,6 +1395,10 @@ void Renderer::createRenderPass() {
     color_attachment.finalLayout =
         VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;  // Layout after render pass (for
                                           // presentation)
+    if (vulkan_context->isHeadless()) {
+        // No swapchain extension to present with (setOffscreenTarget)
+        color_attachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    }
 
     VkAttachmentReference color_attachment_ref{};
     color_attachment_ref.attachment =
@@ -1037,36 +1406,78 @@ void Renderer::createRenderPass() {
     color_attachment_ref.layout =
         VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;  // Layout during the subpass
 
+    // Depth: filled by the Hi-Z prepass and only tested here, or cleared
+    // and written here when culling on the CPU
+    VkAttachmentDescription depth_attachment{};
+    depth_attachment.format = HiZCuller::DEPTH_FORMAT;
+    depth_attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+    depth_attachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depth_attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    depth_attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    VkAttachmentReference depth_attachment_ref{};
+    depth_attachment_ref.attachment = 1;
+    if (hiz_culler) {
+        depth_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+        depth_attachment.initialLayout =
+            VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+        depth_attachment.finalLayout =
+            VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+        depth_attachment_ref.layout =
+            VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+    } else {
+        depth_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        depth_attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        depth_attachment.finalLayout =
+            VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+        depth_attachment_ref.layout =
+            VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    }
+
     VkSubpassDescription subpass{};
     subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
     subpass.colorAttachmentCount = 1;
     subpass.pColorAttachments = &color_attachment_ref;
-    // pDepthStencilAttachment = nullptr; // No depth buffer yet
+    subpass.pDepthStencilAttachment = &depth_attachment_ref;
 
-    // Subpass dependency to handle layout transitions
+    // Subpass dependency to handle layout transitions: wait for the previous
+    // color output and for depth writes (prepass or previous frame)
+    const VkPipelineStageFlags fragment_tests =
+        VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+        VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
     VkSubpassDependency dependency{};
     dependency.srcSubpass =
         VK_SUBPASS_EXTERNAL;    // Implicit subpass before render pass
     dependency.dstSubpass = 0;  // Our first (and only) subpass
     dependency.srcStageMask =
-        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;  // Wait for color output
-                                                        // stage
-    dependency.srcAccessMask = 0;  // No access needed before
+        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | fragment_tests;
+    dependency.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
     dependency.dstStageMask =
-        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;  // Stage where writes
-                                                        // happen
-    dependency.dstAccessMask =
-        VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;  // We will write to the color
-                                               // attachment
-
+        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | fragment_tests;
+    dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+                               VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+                               VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    // Frame capture copies the image right after the pass: finish the color
+    // writes and the final transition before transfers
+    VkSubpassDependency capture_dependency{};
+    capture_dependency.srcSubpass = 0;
+    capture_dependency.dstSubpass = VK_SUBPASS_EXTERNAL;
+    capture_dependency.srcStageMask =
+        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    capture_dependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    capture_dependency.dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    capture_dependency.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    VkSubpassDependency dependencies[] = {dependency, capture_dependency};
+
+    VkAttachmentDescription attachments[] = {color_attachment,
+                                             depth_attachment};
     VkRenderPassCreateInfo render_pass_info{};
     render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-    render_pass_info.attachmentCount = 1;
-    render_pass_info.pAttachments = &color_attachment;
+    render_pass_info.attachmentCount = 2;
+    render_pass_info.pAttachments = attachments;
     render_pass_info.subpassCount = 1;
     render_pass_info.pSubpasses = &subpass;
-    render_pass_info.dependencyCount = 1;
-    render_pass_info.pDependencies = &dependency;
+    render_pass_info.dependencyCount = 2;
+    render_pass_info.pDependencies = dependencies;
 
     if (vkCreateRenderPass(vulkan_context->getDevice(), &render_pass_info,
                            nullptr, &render_pass) != VK_SUCCESS) {
@@ -1077,213 +1488,275 @@ void Renderer::createRenderPass() {
 
 // 新增：创建描述符集布局
 void Renderer::createDescriptorSetLayout() {
-    VkDescriptorSetLayoutBinding ubo_layout_binding{};
-    ubo_layout_binding.binding = 0;  // layout(binding = 0) in shader
-    ubo_layout_binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    ubo_layout_binding.descriptorCount = 1;  // 一个 UBO
-    ubo_layout_binding.stageFlags =
-        VK_SHADER_STAGE_VERTEX_BIT |
-        VK_SHADER_STAGE_FRAGMENT_BIT;  // UBO 在顶点和片段着色器中都可用
-    ubo_layout_binding.pImmutableSamplers = nullptr;  // Optional
+    // Bindings, push constants and vertex inputs all come from the SPIR-V, so
+    // editing vert.glsl cannot leave a hand-written layout out of sync
+    shader_reflection = reflectShaders(vert_spirv, frag_spirv);
+    if (shader_reflection.getSetCount() != 1) {
+        throw std::runtime_error("shaders must use exactly descriptor set 0!");
+    }
+    std::vector<VkVertexInputBindingDescription> bindings;
+    std::vector<VkVertexInputAttributeDescription> attributes;
+    if (shader_reflection.getVertexInput(bindings, attributes) !=
+        sizeof(Vertex)) {
+        throw std::runtime_error("vertex shader inputs do not match Vertex!");
+    }
+    // Binding 0: per-frame uniforms, binding 1: per-instance world matrices
+    std::vector<VkDescriptorSetLayoutBinding> set_bindings =
+        shader_reflection.getSetBindings(0);
+    if (set_bindings.size() != 2 ||
+        set_bindings[0].descriptorType != VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER ||
+        set_bindings[1].descriptorType != VK_DESCRIPTOR_TYPE_STORAGE_BUFFER) {
+        throw std::runtime_error("shader set 0 must be a UBO and an SSBO!");
+    }
+
+    VkDescriptorSetLayoutCreateFlags flags = 0;
+    if (use_descriptor_buffer) {
+        flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_DESCRIPTOR_BUFFER_BIT_EXT;
+    }
+    // Cached by hash: swapchain recreation gets the same handles back
+    LayoutCache::PipelineLayoutInfo layouts =
+        layout_cache->getLayouts(shader_reflection, flags);
+    descriptor_set_layout = layouts.set_layouts[0];
+    pipeline_layout = layouts.pipeline_layout;
+    spdlog::debug("Descriptor set layout and pipeline layout ready.");
+}
 
-    VkDescriptorSetLayoutCreateInfo layout_info{};
-    layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-    layout_info.bindingCount = 1;
-    layout_info.pBindings = &ubo_layout_binding;
+void Renderer::createGraphicsPipeline() {
+    // The generic fallback always uses the embedded SPIR-V (compiled at build
+    // time, no file I/O) and is built right here so the first frame can draw
+    PipelineDesc fallback_desc = makePipelineDesc();
+    fallback_desc.vert_spirv.assign(embedded_shaders::vert.begin(),
+                                    embedded_shaders::vert.end());
+    fallback_desc.frag_spirv.assign(embedded_shaders::frag.begin(),
+                                    embedded_shaders::frag.end());
+    graphics_pipeline = pipeline_manager->createPipeline(fallback_desc);
+    pipeline_manager->setFallback(graphics_pipeline);
+    spdlog::debug("Fallback graphics pipeline created.");
+    if (hiz_culler) {
+        // Drawn with it for now, like the fallback
+        depth_prepass_pipeline = pipeline_manager->createPipeline(
+            makeDepthPrepassDesc(fallback_desc));
+        spdlog::debug("Fallback depth prepass pipeline created.");
+    }
+
+    // The real pipelines (hot-reloaded sources, full state) compile on the
+    // manager's workers; identical state is served from the pipeline cache
+    requestPipelines();
+}
 
-    if (vkCreateDescriptorSetLayout(vulkan_context->getDevice(), &layout_info,
-                                    nullptr,
-                                    &descriptor_set_layout) != VK_SUCCESS) {
-        throw std::runtime_error("failed to create descriptor set layout!");
-    }
-    spdlog::debug("Descriptor set layout created.");
+void Renderer::requestPipelines() {
+    PipelineDesc desc = makePipelineDesc();
+    PipelineManager::PipelineKey key = pipeline_manager->request(desc);
+    PipelineManager::PipelineKey prepass_key = 0;
+    if (hiz_culler) {
+        // Never drawn with the color fallback: it has another render pass
+        prepass_key = pipeline_manager->request(
+            makeDepthPrepassDesc(desc), PipelineManager::Fallback::Skip);
+    }
+    // Superseded requests were never bound
+    if (pending_pipeline_key != 0 && pending_pipeline_key != key &&
+        pending_pipeline_key != active_pipeline_key) {
+        pipeline_manager->retire(pending_pipeline_key, 0);
+    }
+    if (pending_prepass_key != 0 && pending_prepass_key != prepass_key &&
+        pending_prepass_key != active_prepass_key) {
+        pipeline_manager->retire(pending_prepass_key, 0);
+    }
+    pending_pipeline_key = key;
+    pending_prepass_key = prepass_key;
+    pipelines_pending = true;
 }
 
-std::vector<char> Renderer::readFile(const std::string& filename) {
-    // Open file at the end to easily get the size
-    std::filesystem::path absolute_path = std::filesystem::absolute(filename);
-    spdlog::debug("Attempting to read file from absolute path: {}", absolute_path.string()); 
-    std::ifstream file(filename, std::ios::ate | std::ios::binary);
+PipelineDesc Renderer::makePipelineDesc() const {
+    PipelineDesc desc;
+    desc.vert_spirv = vert_spirv;
+    desc.frag_spirv = frag_spirv;
+    shader_reflection.getVertexInput(desc.bindings, desc.attributes);
+    // 默认设置为三角形列表，稍后会动态更改
+    desc.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+    desc.polygon_mode = VK_POLYGON_MODE_FILL;  // 用于三角形
+    desc.cull_mode = VK_CULL_MODE_NONE;
+    desc.front_face =
+        VK_FRONT_FACE_COUNTER_CLOCKWISE;  // 改为逆时针，匹配 glm::lookAt
+                                          // 和透视投影
+    desc.depth_attachment = true;
+    desc.layout = pipeline_layout;
+    desc.render_pass = render_pass;
+    desc.subpass = 0;
+    // Cull mode, front face, depth (and blend/polygon mode with EDS3) come
+    // from triangle_draw_state at record time instead
+    dynamic_state_tracker->normalize(desc);
+    if (use_descriptor_buffer) {
+        desc.create_flags |= VK_PIPELINE_CREATE_DESCRIPTOR_BUFFER_BIT_EXT;
+    }
+    return desc;
+}
 
-    if (!file.is_open()) {
-        throw std::runtime_error("failed to open file: " + filename);
+void Renderer::startShaderHotReload() {
+    shader_watcher =
+        std::make_unique<ShaderWatcher>(SHADER_SOURCE_DIR, GLSLC_EXECUTABLE);
+    shader_watcher->addShader("vert.glsl", "vertex");
+    shader_watcher->addShader("frag.glsl", "fragment");
+    bool started = shader_watcher->start(
+        [this](const std::string& name, std::vector<uint32_t> spirv) {
+            onShaderReloaded(name, std::move(spirv));
+        });
+    if (!started) {
+        shader_watcher.reset();
     }
+}
 
-    size_t file_size = (size_t)file.tellg();
-    std::vector<char> buffer(file_size);
+void Renderer::onShaderReloaded(const std::string& name,
+                                std::vector<uint32_t> spirv) {
+    std::lock_guard<std::mutex> lock(pipeline_mutex);
+    std::span<const uint32_t> new_vert = vert_spirv;
+    std::span<const uint32_t> new_frag = frag_spirv;
+    if (name == "vert") {
+        new_vert = spirv;
+    } else if (name == "frag") {
+        new_frag = spirv;
+    } else {
+        return;
+    }
 
-    file.seekg(0);  // Go back to the beginning
-    file.read(buffer.data(), file_size);
-    file.close();
+    // The pipeline layout and vertex buffer stay as they are, so only accept
+    // shaders with the same interface
+    try {
+        if (!reflectShaders(new_vert, new_frag)
+                 .sameInterface(shader_reflection)) {
+            spdlog::error(
+                "Shader {} changed its descriptors, push constants or vertex "
+                "inputs; restart to apply it.",
+                name);
+            return;
+        }
+    } catch (const std::exception& e) {
+        spdlog::error("Reflecting reloaded shader {} failed: {}", name,
+                      e.what());
+        return;
+    }
+    if (name == "vert") {
+        vert_spirv = std::move(spirv);
+    } else {
+        frag_spirv = std::move(spirv);
+    }
 
-    return buffer;
+    // Compiles on manager workers; drawFrame swaps them in once both are
+    // ready and keeps drawing with the current pipelines until then
+    requestPipelines();
 }
 
-VkShaderModule Renderer::createShaderModule(const std::vector<char>& code) {
-    VkShaderModuleCreateInfo create_info{};
-    create_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-    create_info.codeSize = code.size();
-    // Note: pointer needs to be uint32_t*, safe cast if vector stores char/byte
-    create_info.pCode = reinterpret_cast<const uint32_t*>(code.data());
+void Renderer::swapInPendingPipeline() {
+    if (!pipelines_pending.load()) {
+        return;
+    }
+    // The watcher thread is replacing the request: look again next frame
+    // rather than wait for it
+    std::unique_lock<std::mutex> lock(pipeline_mutex, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        return;
+    }
+    PipelineManager::PipelineKey color = pending_pipeline_key;
+    PipelineManager::PipelineKey prepass = pending_prepass_key;
+    using Status = PipelineManager::Status;
+    Status color_status = pipeline_manager->getStatus(color);
+    Status prepass_status =
+        prepass != 0 ? pipeline_manager->getStatus(prepass) : Status::Ready;
+    if (color_status == Status::Pending || prepass_status == Status::Pending) {
+        return;  // Keep drawing with the current pipelines meanwhile
+    }
+    pending_pipeline_key = 0;
+    pending_prepass_key = 0;
+    pipelines_pending = false;
+    lock.unlock();
+
+    if (color_status != Status::Ready || prepass_status != Status::Ready) {
+        spdlog::error("Pipeline compile failed, keeping current pipeline.");
+        // Swapping in half of the pair would let the passes disagree on depth
+        if (color != active_pipeline_key) {
+            pipeline_manager->retire(color, 0);
+        }
+        if (prepass != 0 && prepass != active_prepass_key) {
+            pipeline_manager->retire(prepass, 0);
+        }
+        return;
+    }
+    // The old pipelines may still be used by frames in flight
+    if (color != active_pipeline_key) {
+        pipeline_manager->retire(active_pipeline_key, frame_counter);
+        active_pipeline_key = color;
+    }
+    if (prepass != active_prepass_key) {
+        if (active_prepass_key != 0) {
+            pipeline_manager->retire(active_prepass_key, frame_counter);
+        }
+        active_prepass_key = prepass;
+    }
+    PipelineManager::Stats stats = pipeline_manager->getStats();
+    spdlog::info(
+        "Pipeline swapped in: latency {:.1f} ms (avg {:.1f}, max {:.1f}), "
+        "compile avg {:.1f} ms, queue depth {}, compiling {}",
+        stats.last_latency_ms, stats.avg_latency_ms, stats.max_latency_ms,
+        stats.avg_compile_ms, stats.queue_depth, stats.compiling);
+}
 
-    VkShaderModule shader_module;
-    if (vkCreateShaderModule(vulkan_context->getDevice(), &create_info, nullptr,
-                             &shader_module) != VK_SUCCESS) {
-        throw std::runtime_error("failed to create shader module!");
+void Renderer::createDepthResources() {
+    VkFormatProperties properties;
+    vkGetPhysicalDeviceFormatProperties(vulkan_context->getPhysicalDevice(),
+                                        HiZCuller::DEPTH_FORMAT, &properties);
+    VkFormatFeatureFlags required =
+        VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT;
+    VkImageUsageFlags usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+    if (hiz_culler) {
+        // The Hi-Z reduce pass samples it
+        required |= VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT;
+        usage |= VK_IMAGE_USAGE_SAMPLED_BIT;
     }
-    return shader_module;
+    if ((properties.optimalTilingFeatures & required) != required) {
+        throw std::runtime_error("D32_SFLOAT depth buffer not supported!");
+    }
+
+    VkExtent2D extent = vulkan_context->getSwapChainExtent();
+    VkImageCreateInfo image_info{};
+    image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    image_info.imageType = VK_IMAGE_TYPE_2D;
+    image_info.format = HiZCuller::DEPTH_FORMAT;
+    image_info.extent = {extent.width, extent.height, 1};
+    image_info.mipLevels = 1;
+    image_info.arrayLayers = 1;
+    image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+    image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+    image_info.usage = usage;
+    image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    vulkan_context->createImage(image_info,
+                                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                                depth_image, depth_image_memory);
+
+    VkImageViewCreateInfo view_info{};
+    view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    view_info.image = depth_image;
+    view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    view_info.format = HiZCuller::DEPTH_FORMAT;
+    view_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+    view_info.subresourceRange.levelCount = 1;
+    view_info.subresourceRange.layerCount = 1;
+    if (vkCreateImageView(vulkan_context->getDevice(), &view_info, nullptr,
+                          &depth_image_view) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create depth image view!");
+    }
+    spdlog::debug("Depth buffer created ({}x{}).", extent.width,
+                  extent.height);
 }
 
-void Renderer::createGraphicsPipeline() {
-    // 使用相对路径或确保工作目录正确
-    std::string shader_dir = "./shaders/"; // 使用相对路径
-    auto vert_shader_code = readFile(shader_dir + "vert.spv");
-    auto frag_shader_code = readFile(shader_dir + "frag.spv");
-
-    VkShaderModule vert_shader_module = createShaderModule(vert_shader_code);
-    VkShaderModule frag_shader_module = createShaderModule(frag_shader_code);
-    spdlog::debug("Shader modules created.");
-
-    // --- Shader Stage Creation ---
-    VkPipelineShaderStageCreateInfo vert_shader_stage_info{};
-    vert_shader_stage_info.sType =
-        VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    vert_shader_stage_info.stage = VK_SHADER_STAGE_VERTEX_BIT;
-    vert_shader_stage_info.module = vert_shader_module;
-    vert_shader_stage_info.pName = "main";  // Entry point function name
-
-    VkPipelineShaderStageCreateInfo frag_shader_stage_info{};
-    frag_shader_stage_info.sType =
-        VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    frag_shader_stage_info.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-    frag_shader_stage_info.module = frag_shader_module;
-    frag_shader_stage_info.pName = "main";
-
-    VkPipelineShaderStageCreateInfo shader_stages[] = {vert_shader_stage_info,
-                                                       frag_shader_stage_info};
-
-    // --- Vertex Input State ---
-    auto binding_description = Vertex::getBindingDescription();
-    auto attribute_descriptions = Vertex::getAttributeDescriptions();
-
-    VkPipelineVertexInputStateCreateInfo vertex_input_info{};
-    vertex_input_info.sType =
-        VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-    vertex_input_info.vertexBindingDescriptionCount = 1;
-    vertex_input_info.pVertexBindingDescriptions = &binding_description;
-    vertex_input_info.vertexAttributeDescriptionCount =
-        static_cast<uint32_t>(attribute_descriptions.size());
-    vertex_input_info.pVertexAttributeDescriptions =
-        attribute_descriptions.data();
-
-    // --- Input Assembly State ---
-    VkPipelineInputAssemblyStateCreateInfo input_assembly{};
-    input_assembly.sType =
-        VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-    // 默认设置为三角形列表，稍后会动态更改
-    input_assembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-    input_assembly.primitiveRestartEnable = VK_FALSE;
-
-    // --- Viewport and Scissor --- (Dynamic state, but need placeholder here)
-    VkPipelineViewportStateCreateInfo viewport_state{};
-    viewport_state.sType =
-        VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-    viewport_state.viewportCount = 1;  // One viewport
-    viewport_state.scissorCount = 1;   // One scissor rectangle
-
-    // --- Rasterization State ---
-    VkPipelineRasterizationStateCreateInfo rasterizer{};
-    rasterizer.sType =
-        VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-    rasterizer.depthClampEnable = VK_FALSE;
-    rasterizer.rasterizerDiscardEnable = VK_FALSE;
-    rasterizer.polygonMode = VK_POLYGON_MODE_FILL;  // 用于三角形
-    rasterizer.lineWidth = 1.0f;  // 点的大小通过 gl_PointSize 控制
-    rasterizer.cullMode = VK_CULL_MODE_NONE;
-    rasterizer.frontFace =
-        VK_FRONT_FACE_COUNTER_CLOCKWISE;  // 改为逆时针，匹配 glm::lookAt
-                                          // 和透视投影
-    rasterizer.depthBiasEnable = VK_FALSE;
-
-    // --- Multisampling State ---
-    VkPipelineMultisampleStateCreateInfo multisampling{};
-    multisampling.sType =
-        VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-    multisampling.sampleShadingEnable = VK_FALSE;
-    multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
-
-    // --- Depth/Stencil State --- (Not used in this example)
-    // VkPipelineDepthStencilStateCreateInfo depthStencil{};
-
-    // --- Color Blend State ---
-    VkPipelineColorBlendAttachmentState color_blend_attachment{};
-    color_blend_attachment.colorWriteMask =
-        VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
-        VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-    color_blend_attachment.blendEnable = VK_FALSE;
-
-    VkPipelineColorBlendStateCreateInfo color_blending{};
-    color_blending.sType =
-        VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-    color_blending.logicOpEnable = VK_FALSE;
-    color_blending.attachmentCount = 1;
-    color_blending.pAttachments = &color_blend_attachment;
-
-    // --- Dynamic State ---
-    std::vector<VkDynamicState> dynamic_states = {
-        VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR,
-        VK_DYNAMIC_STATE_PRIMITIVE_TOPOLOGY_EXT  // 添加动态拓扑状态
-    };
-    VkPipelineDynamicStateCreateInfo dynamic_state{};
-    dynamic_state.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-    dynamic_state.dynamicStateCount =
-        static_cast<uint32_t>(dynamic_states.size());
-    dynamic_state.pDynamicStates = dynamic_states.data();
-
-    // --- Pipeline Layout ---
-    VkPipelineLayoutCreateInfo pipeline_layout_info{};
-    pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    pipeline_layout_info.setLayoutCount = 1;  // 使用一个描述符集布局
-    pipeline_layout_info.pSetLayouts = &descriptor_set_layout;  // 关联布局
-    pipeline_layout_info.pushConstantRangeCount = 0;
-
-    if (vkCreatePipelineLayout(vulkan_context->getDevice(),
-                               &pipeline_layout_info, nullptr,
-                               &pipeline_layout) != VK_SUCCESS) {
-        throw std::runtime_error("failed to create pipeline layout!");
-    }
-    spdlog::debug("Pipeline layout created.");
-
-    // --- Graphics Pipeline Creation ---
-    VkGraphicsPipelineCreateInfo pipeline_info{};
-    pipeline_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-    pipeline_info.stageCount = 2;
-    pipeline_info.pStages = shader_stages;
-    pipeline_info.pVertexInputState = &vertex_input_info;
-    pipeline_info.pInputAssemblyState = &input_assembly;
-    pipeline_info.pViewportState = &viewport_state;
-    pipeline_info.pRasterizationState = &rasterizer;
-    pipeline_info.pMultisampleState = &multisampling;
-    pipeline_info.pDepthStencilState = nullptr;
-    pipeline_info.pColorBlendState = &color_blending;
-    pipeline_info.pDynamicState = &dynamic_state;
-    pipeline_info.layout = pipeline_layout;
-    pipeline_info.renderPass = render_pass;
-    pipeline_info.subpass = 0;
-
-    if (vkCreateGraphicsPipelines(vulkan_context->getDevice(), VK_NULL_HANDLE,
-                                  1, &pipeline_info, nullptr,
-                                  &graphics_pipeline) != VK_SUCCESS) {
-        throw std::runtime_error("failed to create graphics pipeline!");
-    }
-    spdlog::debug("Graphics pipeline created.");
-
-    // --- Cleanup Shader Modules ---
-    vkDestroyShaderModule(vulkan_context->getDevice(), frag_shader_module,
-                          nullptr);
-    vkDestroyShaderModule(vulkan_context->getDevice(), vert_shader_module,
-                          nullptr);
-    spdlog::debug("Shader modules destroyed.");
+PipelineDesc Renderer::makeDepthPrepassDesc(
+    const PipelineDesc& colorDesc) const {
+    // Same shaders, layout and dynamic states, so the prepass produces the
+    // depth the color pass tests against; just no color attachment
+    PipelineDesc depth_desc = colorDesc;
+    depth_desc.render_pass = hiz_culler->getDepthRenderPass();
+    depth_desc.color_attachment_count = 0;
+    return depth_desc;
 }
 
 void Renderer::createFramebuffers() {
@@ -1291,12 +1764,12 @@ void Renderer::createFramebuffers() {
     swapchain_framebuffers.resize(swapchain_views.size());
 
     for (size_t i = 0; i < swapchain_views.size(); i++) {
-        VkImageView attachments[] = {swapchain_views[i]};
+        VkImageView attachments[] = {swapchain_views[i], depth_image_view};
 
         VkFramebufferCreateInfo framebuffer_info{};
         framebuffer_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
         framebuffer_info.renderPass = render_pass;  // Compatible render pass
-        framebuffer_info.attachmentCount = 1;       // One attachment (color)
+        framebuffer_info.attachmentCount = 2;       // Color and depth
         framebuffer_info.pAttachments = attachments;
         framebuffer_info.width = vulkan_context->getSwapChainExtent().width;
         framebuffer_info.height = vulkan_context->getSwapChainExtent().height;
@@ -1368,37 +1841,336 @@ void Renderer::createVertexBuffer() {
 
 // 新增：创建 Uniform Buffers
 void Renderer::createUniformBuffers() {
-    VkDeviceSize buffer_size = sizeof(UniformBufferObject);
-
-    size_t swapchain_image_count = vulkan_context->getSwapChainImages().size();
-    uniform_buffers.resize(swapchain_image_count);
-    uniform_buffers_memory.resize(swapchain_image_count);
-
-    for (size_t i = 0; i < swapchain_image_count; i++) {
+    // One buffer per frame in flight: the fence wait in drawFrame guarantees
+    // the GPU is done with it before it is rewritten
+    VkDeviceSize buffer_size = sizeof(FrameUniforms);
+    uniform_buffers.resize(MAX_FRAMES_IN_FLIGHT);
+    uniform_buffers_memory.resize(MAX_FRAMES_IN_FLIGHT);
+    uniform_buffers_mapped.resize(MAX_FRAMES_IN_FLIGHT);
+
+    // Descriptor buffers reference the UBOs by device address
+    VkBufferUsageFlags usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+    if (use_descriptor_buffer) {
+        usage |= VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+    }
+    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
         vulkan_context->createBuffer(
-            buffer_size, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+            buffer_size, usage,
             VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
                 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
             uniform_buffers[i], uniform_buffers_memory[i]);
+        // Mapped once; per-frame updates are a memcpy
+        vkMapMemory(vulkan_context->getDevice(), uniform_buffers_memory[i], 0,
+                    buffer_size, 0, &uniform_buffers_mapped[i]);
     }
     spdlog::debug("Created {} uniform buffers.", uniform_buffers.size());
 }
 
+void Renderer::createInstanceBuffers() {
+    // Like the UBOs, one copy per frame in flight, brought up to date by
+    // updateScene() once that frame's fence has been waited on
+    VkDeviceSize buffer_size = sizeof(glm::mat4) * MAX_SCENE_NODES;
+    instance_buffers.resize(MAX_FRAMES_IN_FLIGHT);
+    instance_buffers_memory.resize(MAX_FRAMES_IN_FLIGHT);
+    instance_buffers_mapped.resize(MAX_FRAMES_IN_FLIGHT);
+
+    VkBufferUsageFlags usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    if (use_descriptor_buffer) {
+        usage |= VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+    }
+    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        vulkan_context->createBuffer(
+            buffer_size, usage,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            instance_buffers[i], instance_buffers_memory[i]);
+        void* data;
+        vkMapMemory(vulkan_context->getDevice(), instance_buffers_memory[i], 0,
+                    buffer_size, 0, &data);
+        instance_buffers_mapped[i] = static_cast<glm::mat4*>(data);
+    }
+    spdlog::debug("Created {} instance buffers ({} matrices each).",
+                  instance_buffers.size(), MAX_SCENE_NODES);
+}
+
+void Renderer::createScene() {
+    // The original triangle at the root, smaller copies orbiting it, and a
+    // moon around each of those
+    constexpr int ORBIT_COUNT = 6;
+    scene_root = scene.createNode();
+    for (int i = 0; i < ORBIT_COUNT; i++) {
+        Scene::NodeId orbit = scene.createNode(scene_root);
+        scene.setScale(orbit, glm::vec3(0.3f));
+        orbit_nodes.push_back(orbit);
+
+        Scene::NodeId moon = scene.createNode(orbit);
+        scene.setTranslation(moon, glm::vec3(0.0f, -1.2f, 0.0f));
+        scene.setScale(moon, glm::vec3(0.4f));
+    }
+    spdlog::debug("Scene created with {} nodes.", scene.getNodeCount());
+
+    // The step the simulation starts from, also as the previous one
+    for (Scene::NodeId node = 0; node < scene.getNodeCount(); node++) {
+        current_state.translations.push_back(scene.getTranslation(node));
+        current_state.rotations.push_back(scene.getRotation(node));
+        current_state.scales.push_back(scene.getScale(node));
+    }
+    animateScene(current_state);
+    previous_state = current_state;
+}
+
+void Renderer::animateScene(SimulationState& state) const {
+    const float time = static_cast<float>(state.time);
+    const glm::vec3 z_axis(0.0f, 0.0f, 1.0f);
+    state.rotations[scene_root] =
+        glm::angleAxis(time * glm::radians(30.0f), z_axis);
+    for (size_t i = 0; i < orbit_nodes.size(); i++) {
+        float angle = glm::radians(360.0f) * i / orbit_nodes.size();
+        state.translations[orbit_nodes[i]] =
+            glm::vec3(cos(angle), sin(angle), 0.0f) * 0.8f;
+        state.rotations[orbit_nodes[i]] =
+            glm::angleAxis(time * glm::radians(-120.0f), z_axis);
+    }
+}
+
+void Renderer::stepSimulation(double dt) {
+    previous_state = current_state;  // Reuses its vectors
+    current_state.time += dt;
+    animateScene(current_state);
+}
+
+void Renderer::writePacket(RenderPacket& packet, float alpha) {
+    // Only transforms that differ from what the scene holds are set, so it
+    // keeps recomputing just the nodes that moved. Values equal in both
+    // steps are taken as is: blending them could round differently.
+    auto blend = [alpha](const auto& from, const auto& to) {
+        using Value = std::decay_t<decltype(to)>;
+        if (from == to) {
+            return to;
+        }
+        if constexpr (std::is_same_v<Value, glm::quat>) {
+            return glm::slerp(from, to, alpha);
+        } else {
+            return glm::mix(from, to, alpha);
+        }
+    };
+    for (Scene::NodeId node = 0; node < current_state.rotations.size();
+         node++) {
+        glm::vec3 translation = blend(previous_state.translations[node],
+                                      current_state.translations[node]);
+        if (translation != scene.getTranslation(node)) {
+            scene.setTranslation(node, translation);
+        }
+        glm::quat rotation = blend(previous_state.rotations[node],
+                                   current_state.rotations[node]);
+        if (rotation != scene.getRotation(node)) {
+            scene.setRotation(node, rotation);
+        }
+        glm::vec3 scale =
+            blend(previous_state.scales[node], current_state.scales[node]);
+        if (scale != scene.getScale(node)) {
+            scene.setScale(node, scale);
+        }
+    }
+    // Camera and light are functions of time, so blending it blends them
+    packet.time = static_cast<float>(
+        previous_state.time +
+        (current_state.time - previous_state.time) * alpha);
+
+    // The render thread never touches the scene, only the matrices that
+    // changed since the previous packet
+    scene.update(*job_system);
+    packet.node_count = static_cast<uint32_t>(scene.getNodeCount());
+    packet.changed_nodes.clear();
+    packet.changed_matrices.clear();
+    scene.collectChanges(packet_scene_version, packet.changed_nodes,
+                         packet.changed_matrices);
+}
+
+void Renderer::applySceneChanges(const RenderPacket& packet) {
+    static_assert(MAX_FRAMES_IN_FLIGHT <= 8, "one mask bit per frame");
+    if (packet.node_count > MAX_SCENE_NODES) {
+        throw std::runtime_error("scene exceeds the instance buffer!");
+    }
+    world_matrices.resize(packet.node_count);
+    stale_instance_masks.resize(packet.node_count, 0);
+    stale_instances.resize(MAX_FRAMES_IN_FLIGHT);
+    // Each instance buffer is written only in its own frame, so a change
+    // stays pending for every buffer until that buffer catches up
+    constexpr uint8_t ALL_FRAMES = (1u << MAX_FRAMES_IN_FLIGHT) - 1;
+    for (size_t i = 0; i < packet.changed_nodes.size(); i++) {
+        Scene::NodeId node = packet.changed_nodes[i];
+        world_matrices[node] = packet.changed_matrices[i];
+        uint8_t newly_stale = ALL_FRAMES & ~stale_instance_masks[node];
+        stale_instance_masks[node] = ALL_FRAMES;
+        for (uint32_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++) {
+            if (newly_stale & (1u << frame)) {
+                stale_instances[frame].push_back(node);
+            }
+        }
+    }
+}
+
+void Renderer::updateScene(uint32_t currentFrame) {
+    // Only the matrices changed since this copy was last written
+    glm::mat4* instances = instance_buffers_mapped[currentFrame];
+    for (Scene::NodeId node : stale_instances[currentFrame]) {
+        instances[node] = world_matrices[node];
+        stale_instance_masks[node] &= ~(1u << currentFrame);
+    }
+    stale_instances[currentFrame].clear();
+}
+
+void Renderer::cullScene() {
+    // Every node draws the same triangle, so its world bounds are the
+    // triangle's local bounds under the node's world matrix
+    Aabb triangle_bounds;
+    for (uint32_t i = 0; i < num_triangle_vertices; i++) {
+        triangle_bounds.expand(glm::vec3(vertices[i].pos, 0.0f));
+    }
+    node_bounds.resize(world_matrices.size());
+    for (Scene::NodeId node = 0; node < node_bounds.size(); node++) {
+        node_bounds[node] = triangle_bounds.transformed(world_matrices[node]);
+    }
+    // Nodes move every frame: refit, and rebuild only once the tree degrades.
+    // pick() needs it even when the GPU culls.
+    scene_bvh.update(node_bounds);
+    if (hiz_culler) {
+        // Frustum and occlusion tests run in hiz_cull.comp
+        hiz_culler->update(current_frame, current_view_proj, triangle_bounds,
+                           static_cast<uint32_t>(node_bounds.size()),
+                           num_triangle_vertices);
+        return;
+    }
+
+    visible_nodes.clear();
+    scene_bvh.queryFrustum(Frustum::fromMatrix(current_view_proj),
+                           visible_nodes);
+    std::sort(visible_nodes.begin(), visible_nodes.end());
+#if EnableOcclusionCulling
+    occludeScene();
+#endif
+}
+
+void Renderer::occludeScene() {
+    // Follow the swapchain aspect so depth buffer pixels stay square
+    VkExtent2D extent = vulkan_context->getSwapChainExtent();
+    occlusion_culler->setResolution(
+        OCCLUSION_BUFFER_WIDTH,
+        OCCLUSION_BUFFER_WIDTH * extent.height / std::max(1u, extent.width));
+    occlusion_culler->beginFrame(current_view_proj);
+
+    // Only the largest nodes on screen are worth rasterizing as occluders
+    std::vector<std::pair<float, uint32_t>> candidates;
+    candidates.reserve(visible_nodes.size());
+    for (uint32_t node : visible_nodes) {
+        float area = occlusion_culler->getScreenArea(node_bounds[node]);
+        if (area > 0.0f) {
+            candidates.emplace_back(area, node);
+        }
+    }
+    size_t occluder_count = std::min(candidates.size(), MAX_OCCLUDERS);
+    std::partial_sort(candidates.begin(), candidates.begin() + occluder_count,
+                      candidates.end(), std::greater<>());
+    glm::vec3 triangle[3];
+    for (uint32_t i = 0; i < 3; i++) {
+        triangle[i] = glm::vec3(vertices[i].pos, 0.0f);
+    }
+    for (size_t i = 0; i < occluder_count; i++) {
+        occlusion_culler->addOccluder(triangle,
+                                      world_matrices[candidates[i].second]);
+    }
+    occlusion_culler->rasterize();
+    occlusion_culler->cullBoxes(node_bounds, visible_nodes);
+
+    const OcclusionCuller::Stats& stats = occlusion_culler->getLastStats();
+    occlusion_totals.occluder_triangles += stats.occluder_triangles;
+    occlusion_totals.tested += stats.tested;
+    occlusion_totals.occluded += stats.occluded;
+    occlusion_totals.raster_ms += stats.raster_ms;
+    occlusion_totals.test_ms += stats.test_ms;
+    if (++occlusion_frames == OCCLUSION_REPORT_FRAMES) {
+        double frames = occlusion_frames;
+        spdlog::info(
+            "Occlusion culling: {:.1f} of {:.1f} nodes occluded per frame, "
+            "{:.1f} occluder triangles, {:.3f} ms raster + {:.3f} ms test",
+            occlusion_totals.occluded / frames,
+            occlusion_totals.tested / frames,
+            occlusion_totals.occluder_triangles / frames,
+            occlusion_totals.raster_ms / frames,
+            occlusion_totals.test_ms / frames);
+        occlusion_totals = OcclusionCuller::Stats();
+        occlusion_frames = 0;
+    }
+}
+
+std::optional<Scene::NodeId> Renderer::pick(float windowX,
+                                            float windowY) const {
+    // Unproject the point on the near and far plane (Vulkan depth 0..1).
+    // The projection already flips Y, so window Y maps straight to NDC Y.
+    glm::mat4 inverse_view_proj = glm::inverse(current_view_proj);
+    glm::vec2 ndc(windowX * 2.0f - 1.0f, windowY * 2.0f - 1.0f);
+    glm::vec4 near_point = inverse_view_proj * glm::vec4(ndc, 0.0f, 1.0f);
+    glm::vec4 far_point = inverse_view_proj * glm::vec4(ndc, 1.0f, 1.0f);
+    near_point /= near_point.w;
+    far_point /= far_point.w;
+
+    Ray ray;
+    ray.origin = glm::vec3(near_point);
+    ray.direction = glm::vec3(far_point) - ray.origin;
+    ray.t_max = 1.0f;  // Up to the far plane
+
+    // Exact, double-sided ray/triangle test (Moller-Trumbore) in world space
+    auto hit_triangle = [this](uint32_t node, const Ray& ray, float& t) {
+        const glm::mat4& world = world_matrices[node];
+        glm::vec3 v0(world * glm::vec4(vertices[0].pos, 0.0f, 1.0f));
+        glm::vec3 v1(world * glm::vec4(vertices[1].pos, 0.0f, 1.0f));
+        glm::vec3 v2(world * glm::vec4(vertices[2].pos, 0.0f, 1.0f));
+        glm::vec3 edge1 = v1 - v0;
+        glm::vec3 edge2 = v2 - v0;
+        glm::vec3 p = glm::cross(ray.direction, edge2);
+        float determinant = glm::dot(edge1, p);
+        if (std::abs(determinant) < 1e-8f) {
+            return false;  // Parallel to the triangle
+        }
+        float inv_determinant = 1.0f / determinant;
+        glm::vec3 to_origin = ray.origin - v0;
+        float u = glm::dot(to_origin, p) * inv_determinant;
+        glm::vec3 q = glm::cross(to_origin, edge1);
+        float v = glm::dot(ray.direction, q) * inv_determinant;
+        if (u < 0.0f || v < 0.0f || u + v > 1.0f) {
+            return false;
+        }
+        t = glm::dot(edge2, q) * inv_determinant;
+        return t >= 0.0f && t < ray.t_max;
+    };
+
+    RayHit hit = scene_bvh.raycast(ray, hit_triangle);
+    if (!hit.isHit()) {
+        return std::nullopt;
+    }
+    return hit.primitive;
+}
+
 // 新增：创建描述符池
 void Renderer::createDescriptorPool() {
-    size_t swapchain_image_count = vulkan_context->getSwapChainImages().size();
-
+    if (use_descriptor_buffer) {
+        return;  // The descriptor ring replaces the pool
+    }
     VkDescriptorPoolSize pool_size{};
     pool_size.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    pool_size.descriptorCount = static_cast<uint32_t>(
-        swapchain_image_count);  // 一个 UBO 描述符 per frame
+    // 一个 UBO 描述符 per frame in flight
+    pool_size.descriptorCount = MAX_FRAMES_IN_FLIGHT;
+    VkDescriptorPoolSize instance_pool_size{};
+    instance_pool_size.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    instance_pool_size.descriptorCount = MAX_FRAMES_IN_FLIGHT;
+    VkDescriptorPoolSize pool_sizes[] = {pool_size, instance_pool_size};
 
     VkDescriptorPoolCreateInfo pool_info{};
     pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-    pool_info.poolSizeCount = 1;
-    pool_info.pPoolSizes = &pool_size;
-    pool_info.maxSets =
-        static_cast<uint32_t>(swapchain_image_count);  // 池中最大描述符集数量
+    pool_info.poolSizeCount = 2;
+    pool_info.pPoolSizes = pool_sizes;
+    pool_info.maxSets = MAX_FRAMES_IN_FLIGHT;  // 池中最大描述符集数量
 
     if (vkCreateDescriptorPool(vulkan_context->getDevice(), &pool_info, nullptr,
                                &descriptor_pool) != VK_SUCCESS) {
@@ -1409,18 +2181,34 @@ void Renderer::createDescriptorPool() {
 
 // 新增：创建描述符集
 void Renderer::createDescriptorSets() {
-    size_t swapchain_image_count = vulkan_context->getSwapChainImages().size();
-    std::vector<VkDescriptorSetLayout> layouts(swapchain_image_count,
+    if (use_descriptor_buffer) {
+        // One set per frame in flight; the UBO descriptors are fetched once
+        // here and memcpy'd into the ring while recording
+        descriptor_ring = std::make_unique<DescriptorBufferRing>(
+            vulkan_context, descriptor_set_layout, MAX_FRAMES_IN_FLIGHT, 1);
+        ubo_descriptors.resize(MAX_FRAMES_IN_FLIGHT);
+        instance_descriptors.resize(MAX_FRAMES_IN_FLIGHT);
+        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+            ubo_descriptors[i] = descriptor_ring->getUniformBufferDescriptor(
+                uniform_buffers[i], sizeof(FrameUniforms));
+            instance_descriptors[i] =
+                descriptor_ring->getStorageBufferDescriptor(
+                    instance_buffers[i], sizeof(glm::mat4) * MAX_SCENE_NODES);
+        }
+        spdlog::debug("Created descriptor buffer ring ({} bytes per set).",
+                      descriptor_ring->getSetSize());
+        return;
+    }
+    std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT,
                                                descriptor_set_layout);
 
     VkDescriptorSetAllocateInfo alloc_info{};
     alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
     alloc_info.descriptorPool = descriptor_pool;
-    alloc_info.descriptorSetCount =
-        static_cast<uint32_t>(swapchain_image_count);
+    alloc_info.descriptorSetCount = MAX_FRAMES_IN_FLIGHT;
     alloc_info.pSetLayouts = layouts.data();
 
-    descriptor_sets.resize(swapchain_image_count);
+    descriptor_sets.resize(MAX_FRAMES_IN_FLIGHT);
     if (vkAllocateDescriptorSets(vulkan_context->getDevice(), &alloc_info,
                                  descriptor_sets.data()) != VK_SUCCESS) {
         throw std::runtime_error("failed to allocate descriptor sets!");
@@ -1428,11 +2216,11 @@ void Renderer::createDescriptorSets() {
     spdlog::debug("Allocated {} descriptor sets.", descriptor_sets.size());
 
     // 将 Buffer 绑定到描述符集
-    for (size_t i = 0; i < swapchain_image_count; i++) {
+    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
         VkDescriptorBufferInfo buffer_info{};
         buffer_info.buffer = uniform_buffers[i];
         buffer_info.offset = 0;
-        buffer_info.range = sizeof(UniformBufferObject);
+        buffer_info.range = sizeof(FrameUniforms);
 
         VkWriteDescriptorSet descriptor_write{};
         descriptor_write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
@@ -1445,8 +2233,19 @@ void Renderer::createDescriptorSets() {
         descriptor_write.pImageInfo = nullptr;        // Optional
         descriptor_write.pTexelBufferView = nullptr;  // Optional
 
-        vkUpdateDescriptorSets(vulkan_context->getDevice(), 1,
-                               &descriptor_write, 0, nullptr);
+        VkDescriptorBufferInfo instance_info{};
+        instance_info.buffer = instance_buffers[i];
+        instance_info.offset = 0;
+        instance_info.range = sizeof(glm::mat4) * MAX_SCENE_NODES;
+
+        VkWriteDescriptorSet instance_write = descriptor_write;
+        instance_write.dstBinding = 1;
+        instance_write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        instance_write.pBufferInfo = &instance_info;
+
+        VkWriteDescriptorSet writes[] = {descriptor_write, instance_write};
+        vkUpdateDescriptorSets(vulkan_context->getDevice(), 2, writes, 0,
+                               nullptr);
     }
     spdlog::debug("Updated descriptor sets with buffer info.");
 }
@@ -1469,98 +2268,163 @@ void Renderer::createCommandBuffers() {
 }
 
 // 新增：更新 Uniform Buffer
-void Renderer::updateUniformBuffer(uint32_t currentImage) {
-    static auto start_time = std::chrono::high_resolution_clock::now();
-
-    auto current_time = std::chrono::high_resolution_clock::now();
-    float time = std::chrono::duration<float, std::chrono::seconds::period>(
-                     current_time - start_time)
-                     .count();
-
-    UniformBufferObject ubo{};
+void Renderer::updateUniformBuffer(uint32_t currentFrame, float time) {
+    // 模型矩阵由 updateScene() 写入 instance buffer
+    VkExtent2D extent = vulkan_context->getSwapChainExtent();
+    FrameUniforms frame =
+        makeFrameUniforms(time, extent.width / (float)extent.height);
+    current_view_proj = frame.view_proj;
 
-    // 模型矩阵：保持不变（单位矩阵）或根据需要旋转/缩放模型
-    ubo.model = glm::mat4(1.0f);
-    // ubo.model = glm::rotate(glm::mat4(1.0f), time * glm::radians(90.0f),
-    // glm::vec3(0.0f, 0.0f, 1.0f));
+    // 复制数据到 Uniform Buffer（持久映射，无需每帧 map/unmap）
+    memcpy(uniform_buffers_mapped[currentFrame], &frame, sizeof(frame));
+}
 
+FrameUniforms Renderer::makeFrameUniforms(float time, float aspect) {
     // 视图矩阵：相机围绕 Y 轴旋转
     float radius = 2.0f;
     float camX = sin(time * glm::radians(45.0f)) * radius;
     float camZ = cos(time * glm::radians(45.0f)) * radius;
-    ubo.view = glm::lookAt(glm::vec3(camX, 0.0f, camZ),   // Eye position
-                           glm::vec3(0.0f, 0.0f, 0.0f),   // Center position
-                           glm::vec3(0.0f, 1.0f, 0.0f));  // Up direction
+    glm::mat4 view =
+        glm::lookAt(glm::vec3(camX, 0.0f, camZ),   // Eye position
+                    glm::vec3(0.0f, 0.0f, 0.0f),   // Center position
+                    glm::vec3(0.0f, 1.0f, 0.0f));  // Up direction
 
     // 投影矩阵：透视投影
-    VkExtent2D extent = vulkan_context->getSwapChainExtent();
-    ubo.proj = glm::perspective(
-        glm::radians(45.0f), extent.width / (float)extent.height, 0.1f, 10.0f);
+    glm::mat4 proj =
+        glm::perspective(glm::radians(45.0f), aspect, 0.1f, 10.0f);
     // GLM 设计用于 OpenGL，其 Y 坐标是反的。Vulkan 中需要翻转 Y 轴。
-    ubo.proj[1][1] *= -1;
+    proj[1][1] *= -1;
 
-    // 动态颜色：随时间在红绿蓝之间循环
-    ubo.lightColor.r = (sin(time * 1.0f) + 1.0f) / 2.0f;
-    ubo.lightColor.g = (sin(time * 0.7f + glm::radians(120.0f)) + 1.0f) / 2.0f;
-    ubo.lightColor.b = (sin(time * 0.4f + glm::radians(240.0f)) + 1.0f) / 2.0f;
-    // 保证亮度
-    // ubo.lightColor = glm::normalize(ubo.lightColor) * 0.5f + 0.5f;
+    FrameUniforms frame{};
+    // Multiplied once here instead of per vertex in the shader
+    frame.view_proj = proj * view;
 
-    // 复制数据到 Uniform Buffer
-    void* data;
-    vkMapMemory(vulkan_context->getDevice(),
-                uniform_buffers_memory[currentImage], 0, sizeof(ubo), 0, &data);
-    memcpy(data, &ubo, sizeof(ubo));
-    vkUnmapMemory(vulkan_context->getDevice(),
-                  uniform_buffers_memory[currentImage]);
+    // 动态颜色：随时间在红绿蓝之间循环
+    frame.light_color.r = (sin(time * 1.0f) + 1.0f) / 2.0f;
+    frame.light_color.g =
+        (sin(time * 0.7f + glm::radians(120.0f)) + 1.0f) / 2.0f;
+    frame.light_color.b =
+        (sin(time * 0.4f + glm::radians(240.0f)) + 1.0f) / 2.0f;
+    frame.light_color.a = 1.0f;
+    return frame;
 }
 
 void Renderer::recordCommandBuffer(VkCommandBuffer command_buffer,
-                                   uint32_t image_index) {
+                                   VkFramebuffer framebuffer,
+                                   VkExtent2D extent, VkImage capture_image) {
     VkCommandBufferBeginInfo begin_info{};
     begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
 
     if (vkBeginCommandBuffer(command_buffer, &begin_info) != VK_SUCCESS) {
         throw std::runtime_error("failed to begin recording command buffer!");
     }
+    dynamic_state_tracker->reset();  // Nothing is set on a fresh buffer
+
+    // Scene set of this frame; bound again for every pass below
+    VkDeviceSize set_offset = 0;
+    if (descriptor_ring) {
+        set_offset = descriptor_ring->allocateSet();
+        descriptor_ring->write(set_offset, 0, ubo_descriptors[current_frame]);
+        descriptor_ring->write(set_offset, 1,
+                               instance_descriptors[current_frame]);
+    }
+    if (hiz_culler) {
+        recordDepthPrepass(command_buffer, set_offset, extent);
+    }
 
     // Start Render Pass
     VkRenderPassBeginInfo render_pass_info{};
     render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
     render_pass_info.renderPass = render_pass;
-    render_pass_info.framebuffer = swapchain_framebuffers[image_index];
+    render_pass_info.framebuffer = framebuffer;
     render_pass_info.renderArea.offset = {0, 0};
-    render_pass_info.renderArea.extent = vulkan_context->getSwapChainExtent();
+    render_pass_info.renderArea.extent = extent;
 
-    VkClearValue clear_color = {{{0.0f, 0.0f, 0.0f, 1.0f}}};
-    render_pass_info.clearValueCount = 1;
-    render_pass_info.pClearValues = &clear_color;
+    VkClearValue clear_values[2]{};
+    clear_values[0].color = {{0.0f, 0.0f, 0.0f, 1.0f}};
+    clear_values[1].depthStencil = {1.0f, 0};  // Unused when loaded
+    render_pass_info.clearValueCount = 2;
+    render_pass_info.pClearValues = clear_values;
 
     vkCmdBeginRenderPass(command_buffer, &render_pass_info,
                          VK_SUBPASS_CONTENTS_INLINE);
 
-    // Bind Graphics Pipeline
+    // Bind Graphics Pipeline (the fallback until the real one is compiled)
+    VkPipeline pipeline = pipeline_manager->get(active_pipeline_key);
     vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                      graphics_pipeline);
+                      pipeline);
+    bindSceneResources(command_buffer, set_offset, extent);
+
+    // Draw Triangle
+    dynamic_state_tracker->apply(command_buffer, triangle_draw_state);
+    if (hiz_culler) {
+        // Both phases' lists, depth tested against the prepass
+        hiz_culler->recordDraws(command_buffer, current_frame,
+                                HiZCuller::Phase::Early);
+        hiz_culler->recordDraws(command_buffer, current_frame,
+                                HiZCuller::Phase::Late);
+    } else {
+        // One instance per visible node, firstInstance selects its world
+        // matrix. Consecutive node ids share one draw.
+        for (size_t run_begin = 0; run_begin < visible_nodes.size();) {
+            size_t run_end = run_begin + 1;
+            while (run_end < visible_nodes.size() &&
+                   visible_nodes[run_end] == visible_nodes[run_end - 1] + 1) {
+                ++run_end;
+            }
+            vkCmdDraw(command_buffer, num_triangle_vertices,
+                      static_cast<uint32_t>(run_end - run_begin), 0,
+                      visible_nodes[run_begin]);
+            run_begin = run_end;
+        }
+    }
+
+    // Draw Points
+    // DynamicDrawState point_draw_state = triangle_draw_state;
+    // point_draw_state.topology = VK_PRIMITIVE_TOPOLOGY_POINT_LIST;
+    // dynamic_state_tracker->apply(command_buffer, point_draw_state);
+    // vkCmdDraw(command_buffer, num_point_vertices, 1, num_triangle_vertices,
+    //           0);  // 从第 3 个顶点开始，画 4 个点
+
+    // End Render Pass
+    vkCmdEndRenderPass(command_buffer);
+
+    // Copy into the capture ring; read back once this frame's fence is
+    // waited on again
+    if (frame_capture->isActive()) {
+        frame_capture->recordCopy(command_buffer, current_frame,
+                                  frame_counter, capture_image);
+    }
 
+    // End Recording
+    if (vkEndCommandBuffer(command_buffer) != VK_SUCCESS) {
+        throw std::runtime_error("failed to record command buffer!");
+    }
+}
+
+void Renderer::bindSceneResources(VkCommandBuffer command_buffer,
+                                  VkDeviceSize set_offset, VkExtent2D extent) {
     // Bind Vertex Buffer
     VkBuffer vertex_buffers[] = {vertex_buffer};
     VkDeviceSize offsets[] = {0};
     vkCmdBindVertexBuffers(command_buffer, 0, 1, vertex_buffers, offsets);
 
     // Bind Descriptor Set for UBO
-    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                            pipeline_layout, 0, 1,
-                            &descriptor_sets[image_index], 0, nullptr);
+    if (descriptor_ring) {
+        descriptor_ring->bind(command_buffer, pipeline_layout, 0, set_offset);
+    } else {
+        vkCmdBindDescriptorSets(command_buffer,
+                                VK_PIPELINE_BIND_POINT_GRAPHICS,
+                                pipeline_layout, 0, 1,
+                                &descriptor_sets[current_frame], 0, nullptr);
+    }
 
     // Set Dynamic Viewport
     VkViewport viewport{};
     viewport.x = 0.0f;
     viewport.y = 0.0f;
-    viewport.width =
-        static_cast<float>(vulkan_context->getSwapChainExtent().width);
-    viewport.height =
-        static_cast<float>(vulkan_context->getSwapChainExtent().height);
+    viewport.width = static_cast<float>(extent.width);
+    viewport.height = static_cast<float>(extent.height);
     viewport.minDepth = 0.0f;
     viewport.maxDepth = 1.0f;
     vkCmdSetViewport(command_buffer, 0, 1, &viewport);
@@ -1568,38 +2432,50 @@ void Renderer::recordCommandBuffer(VkCommandBuffer command_buffer,
     // Set Dynamic Scissor
     VkRect2D scissor{};
     scissor.offset = {0, 0};
-    scissor.extent = vulkan_context->getSwapChainExtent();
+    scissor.extent = extent;
     vkCmdSetScissor(command_buffer, 0, 1, &scissor);
+}
 
-    // 获取 vkCmdSetPrimitiveTopologyEXT 函数指针
-    auto vkCmdSetPrimitiveTopologyEXT =
-        (PFN_vkCmdSetPrimitiveTopologyEXT)vkGetDeviceProcAddr(
-            vulkan_context->getDevice(), "vkCmdSetPrimitiveTopologyEXT");
-    if (!vkCmdSetPrimitiveTopologyEXT) {
-        throw std::runtime_error(
-            "Failed to get function pointer for vkCmdSetPrimitiveTopologyEXT!");
-    }
-
-    // Draw Triangle
-    vkCmdSetPrimitiveTopologyEXT(command_buffer,
-                                 VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
-    vkCmdDraw(command_buffer, num_triangle_vertices, 1, 0, 0);
-
-    // Draw Points
-    // vkCmdSetPrimitiveTopologyEXT(command_buffer,
-    //                              VK_PRIMITIVE_TOPOLOGY_POINT_LIST);
-    // vkCmdDraw(command_buffer, num_point_vertices, 1, num_triangle_vertices,
-    //           0);  // 从第 3 个顶点开始，画 4 个点
+void Renderer::recordDepthPrepass(VkCommandBuffer command_buffer,
+                                  VkDeviceSize set_offset, VkExtent2D extent) {
+    // Swapped in only together with the color pipeline it matches
+    VkPipeline prepass_pipeline =
+        active_prepass_key != 0 ? pipeline_manager->get(active_prepass_key)
+                                : depth_prepass_pipeline;
+
+    // Phase 1: last frame's visible set, which also clears the depth buffer
+    hiz_culler->recordCull(command_buffer, current_frame,
+                           HiZCuller::Phase::Early);
+    hiz_culler->beginDepthPass(command_buffer, HiZCuller::Phase::Early);
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                      prepass_pipeline);
+    bindSceneResources(command_buffer, set_offset, extent);
+    dynamic_state_tracker->apply(command_buffer, depth_prepass_state);
+    hiz_culler->recordDraws(command_buffer, current_frame,
+                            HiZCuller::Phase::Early);
+    vkCmdEndRenderPass(command_buffer);
 
-    // End Render Pass
+    // Phase 2: everything else against the pyramid of that depth
+    hiz_culler->recordPyramid(command_buffer);
+    hiz_culler->recordCull(command_buffer, current_frame,
+                           HiZCuller::Phase::Late);
+    hiz_culler->beginDepthPass(command_buffer, HiZCuller::Phase::Late);
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                      prepass_pipeline);
+    bindSceneResources(command_buffer, set_offset, extent);
+    hiz_culler->recordDraws(command_buffer, current_frame,
+                            HiZCuller::Phase::Late);
     vkCmdEndRenderPass(command_buffer);
+}
 
-    // End Recording
-    if (vkEndCommandBuffer(command_buffer) != VK_SUCCESS) {
-        throw std::runtime_error("failed to record command buffer!");
-    }
+void Renderer::captureFrames(uint32_t frameCount) {
+    frame_capture->start(CAPTURE_DIRECTORY, frameCount);
 }
 
+void Renderer::stopCapture() { frame_capture->stop(); }
+
+bool Renderer::isCapturing() const { return frame_capture->isActive(); }
+
 void Renderer::createSyncObjects() {
     image_available_semaphores.resize(MAX_FRAMES_IN_FLIGHT);
     render_finished_semaphores.resize(MAX_FRAMES_IN_FLIGHT);
@@ -1632,7 +2508,31 @@ void Renderer::createSyncObjects() {
                   MAX_FRAMES_IN_FLIGHT);
 }
 
-void Renderer::drawFrame() {
+bool Renderer::recreateSwapChainIfVisible(VkExtent2D drawableExtent) {
+    // Nothing to draw into while minimized: skip the frame rather than wait
+    // here, so the render thread keeps draining packets and can be joined
+    if (drawableExtent.width == 0 || drawableExtent.height == 0) {
+        framebuffer_resized = true;  // Retried on the next packet
+        return false;
+    }
+    framebuffer_resized = false;
+    vulkan_context->recreateSwapChain(drawableExtent);
+    handleSwapChainRecreation();
+    return true;
+}
+
+void Renderer::drawFrame(const RenderPacket& packet) {
+    // Before anything can skip the frame: the next packet only carries
+    // what changes after this one
+    applySceneChanges(packet);
+
+    // A resize since the last frame, or a recreation left pending while the
+    // window was minimized
+    if (framebuffer_resized &&
+        !recreateSwapChainIfVisible(packet.drawable_extent)) {
+        return;
+    }
+
     VkDevice device = vulkan_context->getDevice();
     VkSwapchainKHR swapchain = vulkan_context->getSwapChain();
     VkQueue graphics_queue = vulkan_context->getGraphicsQueue();
@@ -1642,6 +2542,23 @@ void Renderer::drawFrame() {
     vkWaitForFences(device, 1, &in_flight_fences[current_frame], VK_TRUE,
                     UINT64_MAX);
 
+    // Frame boundary: swap in a freshly compiled pipeline, free retired ones
+    swapInPendingPipeline();
+    pipeline_manager->collectGarbage(frame_counter);
+    if (descriptor_ring) {
+        descriptor_ring->beginFrame(current_frame);  // GPU is done with it
+    }
+    frame_capture->collect(current_frame);  // Its copies are complete too
+    if (packet.capture == CaptureRequest::Screenshot) {
+        captureFrames(1);
+    } else if (packet.capture == CaptureRequest::ToggleSequence) {
+        if (isCapturing()) {
+            stopCapture();
+        } else {
+            captureFrames(0);
+        }
+    }
+
     // 2. Acquire an image from the swap chain
     uint32_t image_index;
     VkResult result =
@@ -1651,16 +2568,21 @@ void Renderer::drawFrame() {
 
     if (result == VK_ERROR_OUT_OF_DATE_KHR) {
         spdlog::warn("Swapchain out of date during acquire, recreating...");
-        vulkan_context->recreateSwapChain();
-        handleSwapChainRecreation();
-        framebuffer_resized = false;
+        recreateSwapChainIfVisible(packet.drawable_extent);
         return;
     } else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
         throw std::runtime_error("failed to acquire swap chain image!");
     }
 
     // --- Update Uniform Buffer ---
-    updateUniformBuffer(image_index);  // 更新当前图像索引对应的 UBO
+    updateScene(current_frame);          // 此帧的 fence 已经等待过
+    updateUniformBuffer(current_frame, packet.time);
+    cullScene();
+    for (const glm::vec2& point : packet.picks) {
+        if (auto node = pick(point.x, point.y)) {
+            spdlog::info("Picked scene node {}", *node);
+        }
+    }
 
     // Check if a previous frame is still using this image
     if (images_in_flight.size() <= image_index) {
@@ -1674,7 +2596,10 @@ void Renderer::drawFrame() {
 
     // 3. Record the command buffer
     vkResetCommandBuffer(command_buffers[current_frame], 0);
-    recordCommandBuffer(command_buffers[current_frame], image_index);
+    recordCommandBuffer(command_buffers[current_frame],
+                        swapchain_framebuffers[image_index],
+                        vulkan_context->getSwapChainExtent(),
+                        vulkan_context->getSwapChainImages()[image_index]);
 
     // 4. Submit the command buffer
     VkSubmitInfo submit_info{};
@@ -1720,15 +2645,39 @@ void Renderer::drawFrame() {
         framebuffer_resized) {
         spdlog::warn("Swapchain out of date or suboptimal during present, or "
                      "window resized. Recreating...");
-        framebuffer_resized = false;
-        vulkan_context->recreateSwapChain();
-        handleSwapChainRecreation();
+        recreateSwapChainIfVisible(packet.drawable_extent);
     } else if (result != VK_SUCCESS) {
         throw std::runtime_error("failed to present swap chain image!");
     }
 
     // Advance to the next frame index
     current_frame = (current_frame + 1) % MAX_FRAMES_IN_FLIGHT;
+    ++frame_counter;
+}
+
+void Renderer::prepareOffscreenFrame(const RenderPacket& packet) {
+    if (!vulkan_context->isHeadless()) {
+        throw std::runtime_error("offscreen frames need a headless context!");
+    }
+    applySceneChanges(packet);
+    updateScene(current_frame);
+    updateUniformBuffer(current_frame, packet.time);
+    cullScene();
+}
+
+VkCommandBuffer Renderer::recordOffscreenFrame(VkFramebuffer framebuffer,
+                                               VkImage colorImage) {
+    if (!vulkan_context->isHeadless()) {
+        throw std::runtime_error("offscreen frames need a headless context!");
+    }
+    if (descriptor_ring) {
+        descriptor_ring->beginFrame(current_frame);  // Frame boundary
+    }
+    VkCommandBuffer command_buffer = command_buffers[current_frame];
+    vkResetCommandBuffer(command_buffer, 0);
+    recordCommandBuffer(command_buffer, framebuffer,
+                        vulkan_context->getSwapChainExtent(), colorImage);
+    return command_buffer;
 }
 
 // --- TriangleApplication Implementation ---
@@ -1745,6 +2694,30 @@ void TriangleApplication::run() {
     cleanup();  // Ensure cleanup happens
 }
 
+void TriangleApplication::runService(const std::string& socketPath) {
+    std::exception_ptr failure;
+    try {
+        // No window: the device is all the service needs, and it stays up
+        // for every job
+        vulkan_manager = VulkanContextManager::getInstance();
+        vulkan_manager->initHeadless();
+        render_service = std::make_unique<RenderService>(vulkan_manager);
+        signalled_service.store(render_service.get());
+        std::signal(SIGINT, stopServiceOnSignal);
+        std::signal(SIGTERM, stopServiceOnSignal);
+        render_service->run(socketPath);
+    } catch (const std::exception&) {
+        failure = std::current_exception();
+    }
+    std::signal(SIGINT, SIG_DFL);
+    std::signal(SIGTERM, SIG_DFL);
+    signalled_service.store(nullptr);
+    cleanup();  // run() already removed the socket file if it made one
+    if (failure) {
+        std::rethrow_exception(failure);  // main() exits with EXIT_FAILURE
+    }
+}
+
 void TriangleApplication::initWindow() {
     sdl_context = std::make_unique<SDLContext>(800, 600);  // Or desired size
     if (!sdl_context->init()) {
@@ -1753,8 +2726,18 @@ void TriangleApplication::initWindow() {
 }
 
 void TriangleApplication::initVulkan() {
+#if EnableSoftwareRasterizer
+    software_renderer =
+        std::make_unique<SoftwareRenderer>(sdl_context->getWindowPtr());
+    software_renderer->init();
+    return;
+#endif
+    int width = 0, height = 0;
+    SDL_GetWindowSizeInPixels(sdl_context->getWindowPtr(), &width, &height);
     vulkan_manager = VulkanContextManager::getInstance();
-    vulkan_manager->initVulkan(sdl_context->getWindowPtr());
+    vulkan_manager->initVulkan(
+        sdl_context->getWindowPtr(),
+        {static_cast<uint32_t>(width), static_cast<uint32_t>(height)});
 
     renderer = std::make_unique<Renderer>(vulkan_manager);
     renderer->init();
@@ -1763,50 +2746,173 @@ void TriangleApplication::initVulkan() {
 void TriangleApplication::mainLoop() {
     SDL_Event e;
     app_running = true;
-    while (app_running) {
-        while (SDL_PollEvent(&e) != 0) {
-            // 处理事件
-            if (e.type == SDL_EVENT_QUIT) {
-                app_running = false;
-            } else if (e.type == SDL_EVENT_WINDOW_RESIZED) {
-                // 通知渲染器，窗口大小已更改
-                if (renderer) {
-                    renderer->signalFramebufferResize();
-                }
-                // 更新SDL上下文中存储的大小
-                if (sdl_context) {
-                    int width, height;
-                    SDL_GetWindowSizeInPixels(sdl_context->getWindowPtr(),
-                                              &width, &height);
-                    sdl_context->setSize(width, height);
-                }
+#if EnableSoftwareRasterizer
+    if (software_renderer) {
+        // Presents through the window surface, so it draws on this thread
+        while (app_running) {
+            while (SDL_PollEvent(&e) != 0) {
+                handleEvent(e);
             }
-        }
-
-        // 绘制当前帧
-        if (renderer) {
             try {
-                renderer->drawFrame();
+                software_renderer->drawFrame();
             } catch (const std::exception& e) {
                 spdlog::error("Error during frame rendering: {}", e.what());
                 app_running = false;
             }
         }
+        return;
+    }
+#endif
+
+    // This thread handles events and simulates; frames are recorded,
+    // submitted and presented by the render thread, so a fence wait there
+    // never holds back input, and simulating frame N+1 overlaps drawing N
+    frame_done_event = SDL_RegisterEvents(1);
+    if (frame_done_event == 0) {
+        throw std::runtime_error("failed to register the frame done event!");
+    }
+    frame_queue =
+        std::make_unique<FrameQueue<RenderPacket>>(frame_queue_depth);
+    render_thread = std::thread(&TriangleApplication::renderLoop, this);
+    spdlog::info("Render thread started, up to {} frames queued.",
+                 frame_queue_depth);
+
+    SDL_Window* window = sdl_context->getWindowPtr();
+    FixedTimestep timestep(SIMULATION_STEP, MAX_SIMULATION_STEPS);
+    auto last_time = std::chrono::steady_clock::now();
+    uint64_t sequence = 0;
+    while (app_running) {
+        RenderPacket* packet = frame_queue->tryBeginPush();
+        bool minimized =
+            (SDL_GetWindowFlags(window) & SDL_WINDOW_MINIMIZED) != 0;
+        if (packet == nullptr || minimized) {
+            // Queue full, or nothing to show: sleep until input arrives or
+            // the render thread frees a slot (frame_done_event)
+            if (SDL_WaitEvent(&e)) {
+                handleEvent(e);
+            }
+        }
+        while (SDL_PollEvent(&e) != 0) {
+            handleEvent(e);
+        }
+        if (!app_running || packet == nullptr || minimized) {
+            continue;
+        }
+
+        // However long frames take, the scene moves in fixed steps; the
+        // packet shows it in between the last two
+        auto now = std::chrono::steady_clock::now();
+        uint32_t steps = timestep.accumulate(
+            std::chrono::duration<double>(now - last_time).count());
+        last_time = now;
+        for (uint32_t i = 0; i < steps; i++) {
+            renderer->stepSimulation(timestep.getStep());
+        }
+
+        packet->sequence = sequence++;
+        renderer->writePacket(*packet, timestep.getAlpha());
+        int width = 0, height = 0;
+        SDL_GetWindowSizeInPixels(window, &width, &height);
+        packet->drawable_extent = {static_cast<uint32_t>(width),
+                                   static_cast<uint32_t>(height)};
+        packet->picks.swap(pending_picks);
+        pending_picks.clear();
+        packet->capture = pending_capture;
+        pending_capture = CaptureRequest::None;
+        frame_queue->endPush();
     }
 
+    // The render thread draws what is still queued, then returns
+    frame_queue->close();
+    render_thread.join();
+    frame_queue.reset();
+
     // 等待设备完成操作后再退出循环并清理
     if (vulkan_manager && vulkan_manager->getDevice() != VK_NULL_HANDLE) {
         vkDeviceWaitIdle(vulkan_manager->getDevice());
     }
 }
 
+void TriangleApplication::renderLoop() {
+    bool failed = false;
+    while (RenderPacket* packet = frame_queue->beginPop()) {
+        if (!failed) {
+            try {
+                renderer->drawFrame(*packet);
+            } catch (const std::exception& e) {
+                spdlog::error("Error during frame rendering: {}", e.what());
+                // Quit from the game thread; until it closes the queue, keep
+                // popping so it never blocks on a full one
+                failed = true;
+                SDL_Event quit{};
+                quit.type = SDL_EVENT_QUIT;
+                SDL_PushEvent(&quit);
+            }
+        }
+        frame_queue->endPop();
+
+        SDL_Event done{};
+        done.type = frame_done_event;
+        SDL_PushEvent(&done);
+    }
+}
+
+void TriangleApplication::handleEvent(const SDL_Event& e) {
+    // 处理事件
+    if (e.type == SDL_EVENT_QUIT) {
+        app_running = false;
+    } else if (e.type == SDL_EVENT_WINDOW_RESIZED) {
+        // 通知渲染器，窗口大小已更改
+        if (renderer) {
+            renderer->signalFramebufferResize();
+        }
+#if EnableSoftwareRasterizer
+        if (software_renderer) {
+            software_renderer->signalFramebufferResize();
+        }
+#endif
+        // 更新SDL上下文中存储的大小
+        if (sdl_context) {
+            int width, height;
+            SDL_GetWindowSizeInPixels(sdl_context->getWindowPtr(), &width,
+                                      &height);
+            sdl_context->setSize(width, height);
+        }
+    } else if (e.type == SDL_EVENT_MOUSE_BUTTON_DOWN &&
+               e.button.button == SDL_BUTTON_LEFT && renderer) {
+        // Mouse coordinates are in window units, not pixels. Picked by the
+        // render thread with the next packet.
+        int width, height;
+        SDL_GetWindowSize(sdl_context->getWindowPtr(), &width, &height);
+        if (width > 0 && height > 0) {
+            pending_picks.emplace_back(e.button.x / width,
+                                       e.button.y / height);
+        }
+    } else if (e.type == SDL_EVENT_KEY_DOWN && !e.key.repeat && renderer) {
+        // F12: screenshot, F11: start or stop an image sequence
+        if (e.key.key == SDLK_F12) {
+            pending_capture = CaptureRequest::Screenshot;
+        } else if (e.key.key == SDLK_F11) {
+            pending_capture = CaptureRequest::ToggleSequence;
+        }
+    }
+}
+
 void TriangleApplication::cleanup() {
     spdlog::info("Cleaning up application...");
+    if (render_thread.joinable()) {  // mainLoop() threw
+        frame_queue->close();
+        render_thread.join();
+    }
     // Cleanup renderer first (depends on VulkanContextManager)
     if (renderer) {
         renderer->cleanup();
         renderer.reset();  // Release unique_ptr
     }
+#if EnableSoftwareRasterizer
+    software_renderer.reset();
+#endif
+    render_service.reset();  // Waits for its jobs on the GPU
     // Cleanup Vulkan context
     if (vulkan_manager) {
         vulkan_manager->cleanup();
@@ -3,77 +3,72 @@
  * @LastEditors: Avidel
  */
 #pragma once
+#include <SDL3/SDL_events.h>
 #include <SDL3/SDL_init.h>
 #include <SDL3/SDL_video.h>
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE // Vulkan 使用 [0, 1] 深度范围
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <atomic>
 #include <memory>
+#include <mutex>
 #include <optional>  // For optional queue indices
 // #include <stdexcept> // For error handling
 #include <string>  // Added for shader loading
+#include <thread>
 #include <vector>
 #include <vulkan/vulkan.h>
 #include <vulkan/vulkan_core.h>
+#include "bvh.hpp"
+#include "descriptor_buffer.hpp"
+#include "dynamic_state.hpp"
+#include "fixed_timestep.hpp"
+#include "frame_capture.hpp"
+#include "frame_queue.hpp"
+#include "frustum_culling.hpp"
+#include "hiz_culling.hpp"
+#include "job_system.hpp"
+#include "layout_cache.hpp"
+#include "occlusion_culling.hpp"
+#include "pipeline_manager.hpp"
+#include "render_service.hpp"
+#include "render_types.hpp"
+#include "scene.hpp"
+#include "shader_watcher.hpp"
+#include "software_renderer.hpp"
+#include "spirv_reflect.hpp"
 #define EnableDebug 1
+// Recompile GLSL and rebuild the pipeline when shaders/ changes (Linux only)
+#define EnableShaderHotReload 1
+// Write descriptors into a mapped buffer instead of pool-allocated sets when
+// VK_EXT_descriptor_buffer is available
+#define EnableDescriptorBuffer 1
+// Rasterize the largest nodes into a CPU depth buffer and skip the nodes
+// hidden behind them
+#define EnableOcclusionCulling 1
+// Cull on the GPU instead: a depth prepass, a Hi-Z pyramid and two-phase
+// indirect draws, when the device supports indirect firstInstance
+#define EnableGpuOcclusionCulling 1
+// Draw with the tiled CPU rasterizer and present through the SDL window
+// surface instead of creating a Vulkan device
+#define EnableSoftwareRasterizer 0
 #if defined(__APPLE__)
 #define VKB_ENABLE_PORTABILITY 1
 #define VK_KHR_PORTABILITY_SUBSET_EXTENSION_NAME "VK_KHR_portability_subset"
 #endif
 
 static constexpr int MAX_FRAMES_IN_FLIGHT = 2;
-
-// --- Uniform Buffer Object ---
-struct UniformBufferObject {
-    alignas(16) glm::mat4 model;
-    alignas(16) glm::mat4 view;
-    alignas(16) glm::mat4 proj;
-    alignas(16) glm::vec3 lightColor; // 用于动态颜色
-};
-
-// --- Vertex Data Structure ---
-struct Vertex {
-    glm::vec2 pos;
-    glm::vec3 color;
-
-    // Describes how to bind vertex data
-    static VkVertexInputBindingDescription getBindingDescription() {
-        VkVertexInputBindingDescription binding_description{};
-        binding_description.binding = 0;  // Binding index
-        binding_description.stride =
-            sizeof(Vertex);  // Size of one vertex entry
-        binding_description.inputRate =
-            VK_VERTEX_INPUT_RATE_VERTEX;  // Move to next data entry for each
-                                          // vertex
-        return binding_description;
-    }
-
-    // Describes the attributes within a vertex (position, color)
-    static std::vector<VkVertexInputAttributeDescription>
-    getAttributeDescriptions() {
-        std::vector<VkVertexInputAttributeDescription> attribute_descriptions(
-            2);
-
-        // Position attribute
-        attribute_descriptions[0].binding =
-            0;  // From which binding the data comes
-        attribute_descriptions[0].location =
-            0;  // layout(location = 0) in vertex shader
-        attribute_descriptions[0].format = VK_FORMAT_R32G32_SFLOAT;  // vec2
-        attribute_descriptions[0].offset =
-            offsetof(Vertex, pos);  // Offset within the struct
-
-        // Color attribute
-        attribute_descriptions[1].binding = 0;
-        attribute_descriptions[1].location =
-            1;  // layout(location = 1) in vertex shader
-        attribute_descriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;  // vec3
-        attribute_descriptions[1].offset = offsetof(Vertex, color);
-
-        return attribute_descriptions;
-    }
-};
+static constexpr uint32_t MAX_SCENE_NODES = 1024;  // Instance buffer capacity
+static constexpr uint32_t OCCLUSION_BUFFER_WIDTH = 256;  // Pixels
+static constexpr size_t MAX_OCCLUDERS = 16;  // Largest on screen, per frame
+static constexpr uint32_t OCCLUSION_REPORT_FRAMES = 600;
+static constexpr const char* CAPTURE_DIRECTORY = "captures";
+// Render packets the game thread may queue ahead of the render thread
+static constexpr uint32_t FRAME_QUEUE_DEPTH = 2;
+// The scene animates in fixed steps; frames in between are interpolated
+static constexpr double SIMULATION_STEP = 1.0 / 60.0;  // Seconds
+static constexpr uint32_t MAX_SIMULATION_STEPS = 8;  // Per frame, after stalls
 
 // --- SDL Window Management ---
 struct SDLWindowDeleter {
@@ -121,6 +116,7 @@ class Renderer;
 class VulkanContextManager {
     friend class Renderer;  // Allow Renderer to access private members for
                             // setup
+    friend class RenderService;  // Same, for its command pool
 
 public:
     static VulkanContextManager* getInstance() {
@@ -135,12 +131,23 @@ public:
     VulkanContextManager& operator=(VulkanContextManager&&) = delete;
 
     // Initialization and cleanup
-    void initVulkan(SDL_Window* window);  // Initialize core Vulkan objects
+    // Initialize core Vulkan objects; drawableExtent is the window size in
+    // pixels
+    void initVulkan(SDL_Window* window, VkExtent2D drawableExtent);
+    // Instance and device only: no window, surface or swapchain. Used by
+    // benchmarks and offscreen rendering.
+    void initHeadless();
+    // Headless: the size and format a Renderer builds its render pass and
+    // depth buffer for in place of the swapchain's. There are no images;
+    // frames are recorded into the caller's framebuffers.
+    void setOffscreenTarget(VkExtent2D extent, VkFormat format);
     void cleanup();  // Clean up all Vulkan resources managed here
 
     // Swapchain handling (public for recreation)
-    void createSwapChain();
-    void recreateSwapChain();  // Recreate based on current window state
+    // Sized for drawableExtent when the surface leaves the size to us. It
+    // comes from the thread owning the window: SDL only queries it there.
+    void createSwapChain(VkExtent2D drawableExtent);
+    void recreateSwapChain(VkExtent2D drawableExtent);  // Not while 0x0
     void cleanupSwapChain();   // Clean up only swapchain related resources
     bool checkDeviceExtensionSupport(VkPhysicalDevice device);
 
@@ -163,6 +170,11 @@ public:
 
     VkExtent2D getSwapChainExtent() const { return swapchain_extent; }
 
+    // TRANSFER_SRC when the surface allows it (frame capture)
+    VkImageUsageFlags getSwapChainImageUsage() const {
+        return swapchain_image_usage;
+    }
+
     const std::vector<VkImage>& getSwapChainImages() const {
         return swapchain_images;
     }
@@ -171,6 +183,26 @@ public:
         return swapchain_image_views;
     }
 
+    bool isHeadless() const { return headless; }
+
+    // --- Optional Device Features ---
+    // Detected in createLogicalDevice() and enabled when the device has them
+    struct OptionalFeatures {
+        // VK_EXT_graphics_pipeline_library
+        bool graphics_pipeline_library = false;
+        bool gpl_fast_linking = false;  // Linking libraries is cheap
+        bool extended_dynamic_state2 = false;  // VK_EXT_extended_dynamic_state2
+        bool eds3_polygon_mode = false;  // VK_EXT_extended_dynamic_state3
+        bool eds3_color_blend_enable = false;
+        bool descriptor_buffer = false;  // VK_EXT_descriptor_buffer + BDA
+        bool multi_draw_indirect = false;  // drawCount > 1 per indirect call
+        bool draw_indirect_first_instance = false;  // Non-zero firstInstance
+    };
+
+    const OptionalFeatures& getOptionalFeatures() const {
+        return optional_features;
+    }
+
     // --- Utility Functions ---
     uint32_t findMemoryType(uint32_t typeFilter,
                             VkMemoryPropertyFlags properties);
@@ -178,6 +210,10 @@ public:
     void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
                       VkMemoryPropertyFlags properties, VkBuffer& buffer,
                       VkDeviceMemory& bufferMemory);
+    // Same for images: create, allocate and bind dedicated memory
+    void createImage(const VkImageCreateInfo& imageInfo,
+                     VkMemoryPropertyFlags properties, VkImage& image,
+                     VkDeviceMemory& imageMemory);
     // Helper to copy buffer data (used by Renderer)
     void copyBuffer(VkCommandPool pool, VkBuffer srcBuffer, VkBuffer dstBuffer,
                     VkDeviceSize size);
@@ -232,7 +268,7 @@ private:
     VkPresentModeKHR chooseSwapPresentMode(
         const std::vector<VkPresentModeKHR>& availablePresentModes);
     VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities,
-                                SDL_Window* window);
+                                VkExtent2D drawableExtent);
 
     // --- Core Vulkan Objects ---
 #if EnableDebug
@@ -252,9 +288,39 @@ private:
         swapchain_image_views;        // Views into the swapchain images
     VkFormat swapchain_image_format;  // Format of swapchain images
     VkExtent2D swapchain_extent;      // Resolution of swapchain images
+    VkImageUsageFlags swapchain_image_usage = 0;
 
     // Keep track of window for swapchain recreation
     SDL_Window* associated_window = nullptr;
+    bool headless = false;  // No surface/swapchain (initHeadless)
+    OptionalFeatures optional_features;
+};
+
+// --- Render Packets ---
+// F12 and F11, applied by the render thread
+enum class CaptureRequest : uint8_t {
+    None,
+    Screenshot,      // captureFrames(1)
+    ToggleSequence,  // captureFrames(0), or stopCapture() while capturing
+};
+
+// Snapshot of one simulated frame, written by the game thread into a
+// FrameQueue slot and drawn by the render thread. Slots are reused, so the
+// vectors keep their capacity.
+struct RenderPacket {
+    uint64_t sequence = 0;  // Simulated frames before this one
+    float time = 0.0f;      // Seconds, between the last two steps
+    // Window size in pixels, 0x0 while minimized. Queried by the game thread:
+    // SDL video calls must stay on the thread that created the window.
+    VkExtent2D drawable_extent{0, 0};
+    // World matrices changed since the previous packet; every node is
+    // listed in the first one
+    uint32_t node_count = 0;
+    std::vector<Scene::NodeId> changed_nodes;
+    std::vector<glm::mat4> changed_matrices;  // Parallel to changed_nodes
+    // Input since the previous packet
+    std::vector<glm::vec2> picks;  // Normalized window coordinates
+    CaptureRequest capture = CaptureRequest::None;
 };
 
 // --- Rendering Logic ---
@@ -275,37 +341,130 @@ public:
     // Clean up rendering resources
     void cleanup();
 
-    // Draw a single frame
-    void drawFrame();
+    // Game thread: advance the animation by one fixed step of dt seconds
+    void stepSimulation(double dt);
+    // Game thread: blend the last two steps at alpha (0..1, see
+    // FixedTimestep) and store the time and changed world matrices in the
+    // packet. Every packet written must be drawn, or its changes are lost.
+    void writePacket(RenderPacket& packet, float alpha);
+    // Render thread: draw the packet's frame
+    void drawFrame(const RenderPacket& packet);
 
     // Call this when the window resizes / swapchain becomes invalid
     void handleSwapChainRecreation();
 
-    // Signal that the framebuffer needs resizing (called from application event
-    // loop)
+    // Signal that the framebuffer needs resizing (called from the game
+    // thread's event loop; the next drawFrame() recreates the swapchain)
     void signalFramebufferResize() { framebuffer_resized = true; }
 
+    // Scene node under a point given in normalized window coordinates
+    // (0..1, origin top left), using the last drawn frame's camera and
+    // matrices. Render thread; drawFrame() runs the packet's picks.
+    std::optional<Scene::NodeId> pick(float windowX, float windowY) const;
+
+    // Orbiting camera and cycling light color at a time in seconds, as
+    // updateUniformBuffer() writes them; aspect is width / height
+    static FrameUniforms makeFrameUniforms(float time, float aspect);
+
+    // Write the next frameCount presented frames to CAPTURE_DIRECTORY as
+    // PNGs, or every frame until stopCapture() with 0 (see FrameCapture).
+    // Render thread; the game thread sends a CaptureRequest instead.
+    void captureFrames(uint32_t frameCount);
+    void stopCapture();
+    bool isCapturing() const;
+
+    // --- Offscreen Recording ---
+    // Headless contexts only (see VulkanContextManager::setOffscreenTarget);
+    // nothing is submitted. What drawFrame() does with a packet before
+    // recording, without waiting for a fence or acquiring an image.
+    void prepareOffscreenFrame(const RenderPacket& packet);
+    // Records the prepared frame into framebuffer and returns the command
+    // buffer. framebuffer pairs colorImage's view with getDepthImageView()
+    // for getRenderPass(), at the offscreen target's extent.
+    VkCommandBuffer recordOffscreenFrame(VkFramebuffer framebuffer,
+                                         VkImage colorImage);
+    VkRenderPass getRenderPass() const { return render_pass; }
+    VkImageView getDepthImageView() const { return depth_image_view; }
+
 private:
     // --- Initialization Steps ---
     void createRenderPass();
-    void createDescriptorSetLayout(); // 新增：创建描述符集布局
+    // Reflects the shaders and fetches the set layout from layout_cache
+    void createDescriptorSetLayout();
+    // Creates the synchronous fallback pipeline and requests the real one.
+    // Called from init() before the shader watcher starts, otherwise with
+    // pipeline_mutex held.
     void createGraphicsPipeline();
+    // Depth buffer, recreated with the swapchain
+    void createDepthResources();
+    // Depth-only twin of the color pipeline for the Hi-Z prepass. It has to
+    // rasterize exactly like the pipeline drawn with, so it is always made
+    // from the same desc and swapped in together with it.
+    PipelineDesc makeDepthPrepassDesc(const PipelineDesc& colorDesc) const;
+    // Queues the color pipeline and its prepass twin for the current
+    // shaders; caller holds pipeline_mutex once the shader watcher runs
+    void requestPipelines();
     void createFramebuffers();
     void createCommandPool();
     void createVertexBuffer();
     void createUniformBuffers();      // 新增：创建Uniform Buffers
+    void createInstanceBuffers();     // Per-frame world matrices
+    void createScene();               // Triangle hierarchy
     void createDescriptorPool();      // 新增：创建描述符池
     void createDescriptorSets();      // 新增：创建描述符集
     void createCommandBuffers();
     void createSyncObjects();  // Semaphores and fences
 
+    // --- Simulation ---
+    // Local transforms of every node at one fixed step, indexed by NodeId
+    struct SimulationState {
+        double time = 0.0;  // Seconds
+        std::vector<glm::vec3> translations;
+        std::vector<glm::quat> rotations;
+        std::vector<glm::vec3> scales;
+    };
+    // Poses the animated nodes of state at state.time
+    void animateScene(SimulationState& state) const;
+
     // --- Helper Functions ---
-    void updateUniformBuffer(uint32_t currentImage); // 新增：更新Uniform Buffer
+    // Takes a packet's changed world matrices, also when its frame is skipped
+    void applySceneChanges(const RenderPacket& packet);
+    // Copies the world matrices changed since this frame in flight's
+    // instance buffer was last written into it
+    void updateScene(uint32_t currentFrame);
+    // Writes the frame uniforms at a time in seconds into this frame in
+    // flight
+    void updateUniformBuffer(uint32_t currentFrame, float time);
+    // Recreates the swapchain at the packet's drawable extent unless it is
+    // 0x0 (minimized), in which case it stays pending for the next packet
+    bool recreateSwapChainIfVisible(VkExtent2D drawableExtent);
+    // Refits the scene BVH and collects the nodes inside the view frustum
+    void cullScene();
+    // Drops the visible nodes hidden behind the largest ones
+    void occludeScene();
+    // Records this frame in flight into framebuffer, made with render_pass
+    // at extent. captureImage is its color image, copied out while
+    // capturing.
     void recordCommandBuffer(VkCommandBuffer commandBuffer,
-                             uint32_t imageIndex);
-    VkShaderModule createShaderModule(const std::vector<char>& code);
-    static std::vector<char> readFile(
-        const std::string& filename);   // Utility to load shader SPIR-V files
+                             VkFramebuffer framebuffer, VkExtent2D extent,
+                             VkImage captureImage);
+    // Vertex buffer, scene descriptor set, viewport and scissor
+    void bindSceneResources(VkCommandBuffer commandBuffer,
+                            VkDeviceSize setOffset, VkExtent2D extent);
+    // Both Hi-Z cull phases with their depth passes, before the color pass
+    void recordDepthPrepass(VkCommandBuffer commandBuffer,
+                            VkDeviceSize setOffset, VkExtent2D extent);
+    // Full pipeline state for the triangle; caller holds pipeline_mutex once
+    // the shader watcher is running
+    PipelineDesc makePipelineDesc() const;
+    // At the frame boundary, switch to a freshly compiled pipeline
+    void swapInPendingPipeline();
+
+    // --- Shader Hot Reload ---
+    void startShaderHotReload();
+    // Runs on the watcher thread: queues an async compile of the new shaders
+    void onShaderReloaded(const std::string& name,
+                          std::vector<uint32_t> spirv);
     void cleanupSwapChainDependents();  // Clean up resources that depend on the
                                         // swapchain
 
@@ -313,13 +472,41 @@ private:
     VulkanContextManager* vulkan_context;  // Pointer to the core Vulkan manager
 
     VkRenderPass render_pass{VK_NULL_HANDLE};
+    // Layouts are owned by layout_cache and derived from SPIR-V reflection
+    std::unique_ptr<LayoutCache> layout_cache;
     VkDescriptorSetLayout descriptor_set_layout{VK_NULL_HANDLE}; // 新增
     VkPipelineLayout pipeline_layout{
         VK_NULL_HANDLE};  // Defines uniforms/push constants
     VkPipeline graphics_pipeline{
-        VK_NULL_HANDLE};  // The triangle rendering pipeline
+        VK_NULL_HANDLE};  // Generic fallback, compiled synchronously
+
+    // --- Async Pipelines ---
+    std::unique_ptr<PipelineManager> pipeline_manager;
+    std::atomic<PipelineManager::PipelineKey> active_pipeline_key{
+        0};  // Drawn with; read by the watcher thread
+    PipelineManager::PipelineKey active_prepass_key = 0;  // 0: the fallback
+    // Compiling in the background, swapped in as a pair once both are ready
+    // (guarded by pipeline_mutex)
+    PipelineManager::PipelineKey pending_pipeline_key = 0;
+    PipelineManager::PipelineKey pending_prepass_key = 0;
+    std::atomic<bool> pipelines_pending{false};  // Checked every frame
+    uint64_t frame_counter = 0;  // Total frames submitted
+
+    // --- Dynamic State ---
+    std::unique_ptr<DynamicStateTracker> dynamic_state_tracker;
+    DynamicDrawState triangle_draw_state;  // Set per draw, not in the pipeline
+
+    // --- Shader Hot Reload State ---
+    std::mutex pipeline_mutex;  // Guards SPIR-V sources, render pass, layout
+    std::vector<uint32_t> vert_spirv;  // Current vertex shader words
+    std::vector<uint32_t> frag_spirv;  // Current fragment shader words
+    ShaderReflection shader_reflection;  // Interface of the current shaders
+    std::unique_ptr<ShaderWatcher> shader_watcher;
     std::vector<VkFramebuffer>
         swapchain_framebuffers;  // Framebuffers for each swapchain image view
+    VkImage depth_image{VK_NULL_HANDLE};  // Shared by every framebuffer
+    VkDeviceMemory depth_image_memory{VK_NULL_HANDLE};
+    VkImageView depth_image_view{VK_NULL_HANDLE};
 
     VkCommandPool command_pool{
         VK_NULL_HANDLE};  // Pool to allocate command buffers from
@@ -333,9 +520,51 @@ private:
     // --- UBO Resources ---
     std::vector<VkBuffer> uniform_buffers;          // 新增
     std::vector<VkDeviceMemory> uniform_buffers_memory; // 新增
+    std::vector<void*> uniform_buffers_mapped;  // Persistently mapped
     VkDescriptorPool descriptor_pool{VK_NULL_HANDLE}; // 新增
     std::vector<VkDescriptorSet> descriptor_sets;     // 新增
 
+    // --- Descriptor Buffer Backend ---
+    bool use_descriptor_buffer = false;  // Replaces pool and sets when set
+    std::unique_ptr<DescriptorBufferRing> descriptor_ring;
+    std::vector<std::vector<uint8_t>>
+        ubo_descriptors;  // Descriptor bytes per uniform buffer
+    std::vector<std::vector<uint8_t>>
+        instance_descriptors;  // Descriptor bytes per instance buffer
+
+    // --- Scene ---
+    std::unique_ptr<JobSystem> job_system;  // Shared by both threads
+    Scene scene;  // Game thread, after init()
+    Scene::NodeId scene_root = Scene::NO_PARENT;
+    std::vector<Scene::NodeId> orbit_nodes;  // Children circling the root
+    SimulationState previous_state;  // Game thread: the last two steps
+    SimulationState current_state;
+    uint64_t packet_scene_version = 0;  // Game thread: changes already sent
+    // Render thread: every node's world matrix, for culling and picking
+    std::vector<glm::mat4> world_matrices;
+    // Render thread: per node, a bit for each frame in flight whose instance
+    // buffer lacks its matrix, and per frame in flight those nodes
+    std::vector<uint8_t> stale_instance_masks;
+    std::vector<std::vector<Scene::NodeId>> stale_instances;
+    std::vector<VkBuffer> instance_buffers;  // Per frame in flight
+    std::vector<VkDeviceMemory> instance_buffers_memory;
+    std::vector<glm::mat4*> instance_buffers_mapped;  // Persistently mapped
+    Bvh4 scene_bvh;                   // Over world bounds, one per node
+    std::vector<Aabb> node_bounds;    // Indexed by NodeId
+    std::vector<uint32_t> visible_nodes;  // Sorted; drawn this frame
+    glm::mat4 current_view_proj{1.0f};    // Written by updateUniformBuffer
+    std::unique_ptr<OcclusionCuller> occlusion_culler;
+    OcclusionCuller::Stats occlusion_totals;  // Since the last report
+    uint32_t occlusion_frames = 0;
+
+    // --- GPU Occlusion Culling ---
+    std::unique_ptr<HiZCuller> hiz_culler;  // Null: culled on the CPU
+    VkPipeline depth_prepass_pipeline{
+        VK_NULL_HANDLE};  // Fallback shaders, until active_prepass_key
+    DynamicDrawState depth_prepass_state;  // Test and write depth
+
+    std::unique_ptr<FrameCapture> frame_capture;
+
     // --- Synchronization ---
     // We use multiple frames in flight to allow CPU to work while GPU renders
     std::vector<VkSemaphore>
@@ -348,8 +577,8 @@ private:
         images_in_flight;  // Track which frame is using which swapchain image
     uint32_t current_frame = 0;  // Index for the current frame in flight
 
-    bool framebuffer_resized =
-        false;  // Flag set by Application on resize events
+    std::atomic<bool> framebuffer_resized{
+        false};  // Set by the game thread on resize events
 
     // --- Triangle and Point Vertex Data ---
     const std::vector<Vertex> vertices = {
@@ -371,17 +600,37 @@ private:
 class TriangleApplication {
 public:
     void run();  // Main entry point to start the application
+    // Packets the game thread may simulate ahead of the one being drawn:
+    // more smooths out spikes, fewer keeps input latency down. Before run().
+    void setFrameQueueDepth(uint32_t depth) { frame_queue_depth = depth; }
+    // Headless: serve render jobs on a Unix domain socket until SIGINT or
+    // SIGTERM (see RenderService). Errors are rethrown after cleanup().
+    void runService(const std::string& socketPath);
 
 private:
     void initWindow();  // Initialize SDL and the window
     void initVulkan();  // Initialize Vulkan context and renderer
-    void mainLoop();    // Run the main event and rendering loop
+    void mainLoop();    // Game thread: events and simulation
+    void renderLoop();  // Render thread: draws the queued packets
+    void handleEvent(const SDL_Event& event);
     void cleanup();     // Clean up all resources
 
     std::unique_ptr<SDLContext> sdl_context;  // Manages the SDL window
     VulkanContextManager* vulkan_manager =
         nullptr;  // Pointer to the singleton Vulkan manager
     std::unique_ptr<Renderer> renderer;  // Manages rendering logic
+#if EnableSoftwareRasterizer
+    std::unique_ptr<SoftwareRenderer> software_renderer;  // Replaces renderer
+#endif
+    std::unique_ptr<RenderService> render_service;  // runService() only
+
+    // --- Render Thread ---
+    uint32_t frame_queue_depth = FRAME_QUEUE_DEPTH;
+    std::unique_ptr<FrameQueue<RenderPacket>> frame_queue;
+    std::thread render_thread;
+    Uint32 frame_done_event = 0;  // Pushed per drawn packet, wakes mainLoop
+    std::vector<glm::vec2> pending_picks;  // Input for the next packet
+    CaptureRequest pending_capture = CaptureRequest::None;
 
     bool app_running = true;  // Controls the main loop execution
 };
\ No newline at end of file
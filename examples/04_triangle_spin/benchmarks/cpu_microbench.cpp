@@ -0,0 +1,801 @@
+/*
+ * @author: Avidel
+ * @LastEditors: Avidel
+ */
+// Microbenchmarks of the per-frame CPU paths: glm matrix math, the frame
+// uniforms, vertex packing, scene transforms, BVH refit and query, SIMD
+// culling and job system dispatch; with --gpu also buffer creation and
+// command buffer recording on a headless device. Each case reports ns/op,
+// heap allocations/op and, on Linux, instructions and L1D / last level cache
+// misses per op from perf_event_open. --json writes the same numbers for
+// comparing runs.
+//
+// Counters cover the calling thread only, so cases that fan out over the job
+// system undercount them; time and allocations include every thread. Linux
+// hides the counters from unprivileged users at perf_event_paranoid > 2,
+// they are reported as "-" (null in JSON) then.
+#include "Utils/vulkan_util.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <new>
+#include <optional>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// --- Allocation Counting ---
+// Every global new in the process goes through here. Over-aligned new keeps
+// the default implementation and is not counted.
+namespace {
+std::atomic<uint64_t> allocation_count{0};
+}  // namespace
+
+void* operator new(std::size_t size) {
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    if (void* memory = std::malloc(size ? size : 1)) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept { std::free(memory); }
+void operator delete(void* memory, std::size_t) noexcept { std::free(memory); }
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+constexpr int SAMPLES = 5;  // Timed samples per case, median reported
+constexpr double DEFAULT_SAMPLE_MS = 40.0;
+constexpr uint64_t MAX_ITERATIONS = uint64_t(1) << 32;
+
+double elapsedNs(Clock::time_point since) {
+    return std::chrono::duration<double, std::nano>(Clock::now() - since)
+        .count();
+}
+
+// Opaque to the optimizer: the value is computed and stored
+template <typename T>
+void keep(const T& value) {
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "m"(value) : "memory");
+#else
+    const volatile char* bytes = reinterpret_cast<const volatile char*>(&value);
+    (void)*bytes;
+#endif
+}
+
+// --- Hardware Counters ---
+enum Counter { INSTRUCTIONS, L1D_MISSES, LLC_MISSES, COUNTER_COUNT };
+constexpr const char* COUNTER_NAMES[COUNTER_COUNT] = {
+    "instructions", "l1d_misses", "llc_misses"};
+using CounterValues = std::array<std::optional<double>, COUNTER_COUNT>;
+
+// One group, so all counters see the same instructions; the ones the CPU or
+// hypervisor lacks are left out
+class PerfCounters {
+public:
+    PerfCounters() {
+#if defined(__linux__)
+        for (int counter = 0; counter < COUNTER_COUNT; ++counter) {
+            perf_event_attr attr{};
+            attr.size = sizeof(attr);
+            if (counter == INSTRUCTIONS) {
+                attr.type = PERF_TYPE_HARDWARE;
+                attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+            } else if (counter == L1D_MISSES) {
+                attr.type = PERF_TYPE_HW_CACHE;
+                attr.config = PERF_COUNT_HW_CACHE_L1D |
+                              (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                              (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            } else {
+                attr.type = PERF_TYPE_HARDWARE;
+                attr.config = PERF_COUNT_HW_CACHE_MISSES;
+            }
+            attr.disabled = leader < 0;  // Members follow the leader
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP |
+                               PERF_FORMAT_TOTAL_TIME_ENABLED |
+                               PERF_FORMAT_TOTAL_TIME_RUNNING;
+            int fd = static_cast<int>(
+                syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0));
+            if (fd < 0) {
+                continue;
+            }
+            if (leader < 0) {
+                leader = fd;
+            }
+            fds.push_back(fd);
+            counters.push_back(static_cast<Counter>(counter));
+        }
+#endif
+    }
+
+    ~PerfCounters() {
+#if defined(__linux__)
+        for (int fd : fds) {
+            close(fd);
+        }
+#endif
+    }
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    bool isAvailable() const { return leader >= 0; }
+
+    void start() {
+#if defined(__linux__)
+        if (leader >= 0) {
+            ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+            ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        }
+#endif
+    }
+
+    CounterValues stop() {
+        CounterValues values;
+#if defined(__linux__)
+        if (leader < 0) {
+            return values;
+        }
+        ioctl(leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+        // nr, time enabled, time running, then one value per counter
+        uint64_t data[3 + COUNTER_COUNT] = {};
+        if (read(leader, data, sizeof(data)) < 0 || data[2] == 0) {
+            return values;
+        }
+        // Scaled up if the kernel had to multiplex the group
+        double scale = double(data[1]) / double(data[2]);
+        for (size_t i = 0; i < data[0] && i < counters.size(); ++i) {
+            values[counters[i]] = double(data[3 + i]) * scale;
+        }
+#endif
+        return values;
+    }
+
+private:
+    int leader = -1;
+    std::vector<int> fds;
+    std::vector<Counter> counters;  // In group order
+};
+
+// --- Harness ---
+// A case runs its operation `iterations` times per call, so the harness adds
+// no per-op overhead
+struct BenchCase {
+    std::string name;
+    std::function<void(uint64_t iterations)> body;
+};
+
+struct BenchResult {
+    std::string name;
+    uint64_t iterations = 0;  // Per sample
+    double ns_per_op = 0.0;   // Median sample
+    double min_ns_per_op = 0.0;
+    double allocations_per_op = 0.0;
+    CounterValues counters;  // Per op, over all samples
+};
+
+BenchResult runCase(const BenchCase& bench, PerfCounters& perf,
+                    double sampleMs) {
+    // Once untimed for lazily sized buffers and sleeping workers, then grow
+    // the iteration count until one sample takes long enough
+    bench.body(1);
+    uint64_t iterations = 1;
+    for (;;) {
+        auto start = Clock::now();
+        bench.body(iterations);
+        double ms = elapsedNs(start) * 1e-6;
+        if (ms >= sampleMs || iterations >= MAX_ITERATIONS) {
+            break;
+        }
+        iterations *= ms < sampleMs * 0.1 ? 10 : 2;
+    }
+
+    BenchResult result;
+    result.name = bench.name;
+    result.iterations = iterations;
+    std::vector<double> ns_per_op;
+    uint64_t allocations = 0;
+    std::array<double, COUNTER_COUNT> totals{};
+    std::array<bool, COUNTER_COUNT> counted;
+    counted.fill(true);
+    for (int sample = 0; sample < SAMPLES; ++sample) {
+        uint64_t allocations_before =
+            allocation_count.load(std::memory_order_relaxed);
+        perf.start();
+        auto start = Clock::now();
+        bench.body(iterations);
+        double ns = elapsedNs(start);
+        CounterValues values = perf.stop();
+        allocations +=
+            allocation_count.load(std::memory_order_relaxed) -
+            allocations_before;
+        ns_per_op.push_back(ns / double(iterations));
+        for (int counter = 0; counter < COUNTER_COUNT; ++counter) {
+            if (values[counter]) {
+                totals[counter] += *values[counter];
+            } else {
+                counted[counter] = false;
+            }
+        }
+    }
+
+    std::sort(ns_per_op.begin(), ns_per_op.end());
+    double ops = double(iterations) * SAMPLES;
+    result.ns_per_op = ns_per_op[SAMPLES / 2];
+    result.min_ns_per_op = ns_per_op.front();
+    result.allocations_per_op = double(allocations) / ops;
+    for (int counter = 0; counter < COUNTER_COUNT; ++counter) {
+        if (counted[counter]) {
+            result.counters[counter] = totals[counter] / ops;
+        }
+    }
+    return result;
+}
+
+std::string formatCounter(const std::optional<double>& value) {
+    if (!value) {
+        return "-";
+    }
+    char text[32];
+    std::snprintf(text, sizeof(text), "%.1f", *value);
+    return text;
+}
+
+void printResult(const BenchResult& result) {
+    std::printf("%-28s %11.1f %9.2f %11s %9s %9s\n", result.name.c_str(),
+                result.ns_per_op, result.allocations_per_op,
+                formatCounter(result.counters[INSTRUCTIONS]).c_str(),
+                formatCounter(result.counters[L1D_MISSES]).c_str(),
+                formatCounter(result.counters[LLC_MISSES]).c_str());
+}
+
+std::string jsonNumber(double value) {
+    char text[32];
+    std::snprintf(text, sizeof(text), "%.6g", value);
+    return text;
+}
+
+// Case names are plain identifiers, nothing needs escaping
+bool writeJson(const std::string& path,
+               const std::vector<BenchResult>& results,
+               bool countersAvailable) {
+    std::ofstream file(path);
+    if (!file) {
+        return false;
+    }
+    file << "{\n  \"samples\": " << SAMPLES
+         << ",\n  \"counters_available\": "
+         << (countersAvailable ? "true" : "false") << ",\n  \"results\": [";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchResult& result = results[i];
+        file << (i ? ",\n" : "\n") << "    {\"name\": \"" << result.name
+             << "\", \"iterations\": " << result.iterations
+             << ", \"ns_per_op\": " << jsonNumber(result.ns_per_op)
+             << ", \"min_ns_per_op\": " << jsonNumber(result.min_ns_per_op)
+             << ", \"allocations_per_op\": "
+             << jsonNumber(result.allocations_per_op);
+        for (int counter = 0; counter < COUNTER_COUNT; ++counter) {
+            const auto& value = result.counters[counter];
+            file << ", \"" << COUNTER_NAMES[counter] << "_per_op\": "
+                 << (value ? jsonNumber(*value) : "null");
+        }
+        file << "}";
+    }
+    file << "\n  ]\n}\n";
+    return static_cast<bool>(file);
+}
+
+// --- CPU Cases ---
+constexpr size_t VERTEX_COUNT = 4096;
+constexpr size_t SCENE_ROOTS = 16;  // 16 + 16 * 15 + 16 * 15 * 16 = 4096
+constexpr size_t SCENE_CHILDREN = 15;
+constexpr size_t SCENE_GRANDCHILDREN = 16;
+constexpr size_t CULL_OBJECT_COUNT = 65536;
+constexpr size_t JOB_COUNT = 4096;  // parallelFor indices, no work each
+constexpr size_t JOB_GRAIN = 256;
+
+// State shared by the cases; built once so setup stays out of the timings
+struct CpuFixture {
+    JobSystem jobs;
+    std::mt19937 rng{1234};
+
+    // Vertex packing: separate streams in, interleaved Vertex out, as a
+    // mapped vertex buffer would be written
+    std::vector<glm::vec2> positions;
+    std::vector<glm::vec3> colors;
+    std::vector<Vertex> vertices;
+    std::vector<Vertex> mapped_vertices;
+
+    // The demo hierarchy of Renderer::createScene(), and a large one
+    Scene demo_scene;
+    Scene::NodeId demo_root = 0;
+    std::vector<Scene::NodeId> demo_orbits;
+    Scene large_scene;
+    std::vector<Scene::NodeId> large_roots;
+    std::vector<glm::mat4> instance_matrices;
+    Scene::InstanceTarget demo_target;
+    Scene::InstanceTarget large_target;
+
+    // Bounds of the large scene's nodes for the BVH and the culler
+    std::vector<Aabb> node_bounds;
+    Bvh4 bvh;
+    Frustum frustum;
+    SphereBounds spheres;
+    FrustumCuller culler{jobs};
+    std::vector<uint32_t> visible;
+
+    FrameUniforms mapped_uniforms;  // Stands in for the mapped UBO
+
+    CpuFixture() {
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        for (size_t i = 0; i < VERTEX_COUNT; ++i) {
+            positions.emplace_back(unit(rng) * 2.0f - 1.0f,
+                                   unit(rng) * 2.0f - 1.0f);
+            colors.emplace_back(unit(rng), unit(rng), unit(rng));
+            vertices.push_back({positions.back(), colors.back()});
+        }
+        mapped_vertices.resize(VERTEX_COUNT);
+
+        constexpr int ORBIT_COUNT = 6;
+        demo_root = demo_scene.createNode();
+        for (int i = 0; i < ORBIT_COUNT; ++i) {
+            Scene::NodeId orbit = demo_scene.createNode(demo_root);
+            demo_scene.setScale(orbit, glm::vec3(0.3f));
+            demo_orbits.push_back(orbit);
+            Scene::NodeId moon = demo_scene.createNode(orbit);
+            demo_scene.setTranslation(moon, glm::vec3(0.0f, -1.2f, 0.0f));
+            demo_scene.setScale(moon, glm::vec3(0.4f));
+        }
+
+        std::uniform_real_distribution<float> position(-50.0f, 50.0f);
+        for (size_t r = 0; r < SCENE_ROOTS; ++r) {
+            Scene::NodeId root = large_scene.createNode();
+            large_roots.push_back(root);
+            large_scene.setTranslation(
+                root, glm::vec3(position(rng), position(rng), position(rng)));
+            for (size_t c = 0; c < SCENE_CHILDREN; ++c) {
+                Scene::NodeId child = large_scene.createNode(root);
+                large_scene.setTranslation(
+                    child, glm::vec3(unit(rng), unit(rng), unit(rng)) * 8.0f);
+                for (size_t g = 0; g < SCENE_GRANDCHILDREN; ++g) {
+                    Scene::NodeId leaf = large_scene.createNode(child);
+                    large_scene.setTranslation(
+                        leaf, glm::vec3(unit(rng), unit(rng), unit(rng)));
+                    large_scene.setScale(leaf, glm::vec3(0.2f));
+                }
+            }
+        }
+        instance_matrices.resize(large_scene.getNodeCount());
+        demo_target.matrices = instance_matrices.data();
+        demo_target.capacity = instance_matrices.size();
+        large_target = demo_target;
+        large_scene.update(jobs, &large_target);
+
+        node_bounds.resize(large_scene.getNodeCount());
+        updateBounds();
+        bvh.build(node_bounds);
+
+        glm::mat4 view =
+            glm::lookAt(glm::vec3(0.0f, 0.0f, 60.0f), glm::vec3(0.0f),
+                        glm::vec3(0.0f, 1.0f, 0.0f));
+        glm::mat4 proj =
+            glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 200.0f);
+        proj[1][1] *= -1;
+        frustum = Frustum::fromMatrix(proj * view);
+        for (size_t i = 0; i < CULL_OBJECT_COUNT; ++i) {
+            spheres.add(glm::vec3(position(rng), position(rng), position(rng)),
+                        0.5f + unit(rng));
+        }
+    }
+
+    // A unit box per node under its world matrix, as Renderer::cullScene
+    // bounds its triangle
+    void updateBounds() {
+        Aabb local;
+        local.expand(glm::vec3(-0.5f));
+        local.expand(glm::vec3(0.5f));
+        for (Scene::NodeId node = 0; node < node_bounds.size(); ++node) {
+            node_bounds[node] =
+                local.transformed(large_scene.getWorldMatrix(node));
+        }
+    }
+};
+
+std::vector<BenchCase> makeCpuCases(CpuFixture& fixture) {
+    std::vector<BenchCase> cases;
+    const glm::vec3 z_axis(0.0f, 0.0f, 1.0f);
+
+    // --- glm ---
+    cases.push_back({"glm/mat4_multiply", [](uint64_t iterations) {
+        glm::mat4 step = glm::rotate(glm::mat4(1.0f), 0.01f,
+                                     glm::vec3(0.0f, 1.0f, 0.0f));
+        glm::mat4 m(1.0f);
+        for (uint64_t i = 0; i < iterations; ++i) {
+            m = m * step;  // Dependent chain, nothing to hoist
+            keep(m);
+        }
+    }});
+    cases.push_back({"glm/view_proj", [](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; ++i) {
+            float t = float(i) * 1e-3f;
+            glm::mat4 view = glm::lookAt(
+                glm::vec3(std::sin(t), 0.0f, std::cos(t)) * 2.0f,
+                glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+            glm::mat4 proj = glm::perspective(glm::radians(45.0f),
+                                              16.0f / 9.0f, 0.1f, 10.0f);
+            glm::mat4 view_proj = proj * view;
+            keep(view_proj);
+        }
+    }});
+
+    // --- Frame Uniforms ---
+    // Renderer::updateUniformBuffer minus the swapchain: clock, matrices
+    // and color, copy into the mapped buffer
+    cases.push_back({"uniforms/update", [&fixture](uint64_t iterations) {
+        auto start_time = std::chrono::high_resolution_clock::now();
+        for (uint64_t i = 0; i < iterations; ++i) {
+            float time = std::chrono::duration<float>(
+                             std::chrono::high_resolution_clock::now() -
+                             start_time)
+                             .count();
+            FrameUniforms frame =
+                Renderer::makeFrameUniforms(time, 16.0f / 9.0f);
+            std::memcpy(&fixture.mapped_uniforms, &frame, sizeof(frame));
+            keep(fixture.mapped_uniforms);
+        }
+    }});
+
+    // --- Vertex Packing ---
+    cases.push_back({"vertex/copy_4096", [&fixture](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; ++i) {
+            std::memcpy(fixture.mapped_vertices.data(),
+                        fixture.vertices.data(),
+                        sizeof(Vertex) * VERTEX_COUNT);
+            keep(fixture.mapped_vertices[i % VERTEX_COUNT]);
+        }
+    }});
+    cases.push_back({"vertex/interleave_4096", [&fixture](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; ++i) {
+            Vertex* out = fixture.mapped_vertices.data();
+            for (size_t v = 0; v < VERTEX_COUNT; ++v) {
+                out[v].pos = fixture.positions[v];
+                out[v].color = fixture.colors[v];
+            }
+            keep(out[i % VERTEX_COUNT]);
+        }
+    }});
+
+    // --- Scene ---
+    // Renderer::writePacket: root and orbits animated, moons follow
+    cases.push_back({"scene/update_demo", [&fixture, z_axis](uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) {
+            float time = float(i) * 0.016f;
+            fixture.demo_scene.setRotation(
+                fixture.demo_root,
+                glm::angleAxis(time * glm::radians(30.0f), z_axis));
+            size_t orbits = fixture.demo_orbits.size();
+            for (size_t o = 0; o < orbits; ++o) {
+                float angle = glm::radians(360.0f) * o / orbits;
+                fixture.demo_scene.setTranslation(
+                    fixture.demo_orbits[o],
+                    glm::vec3(std::cos(angle), std::sin(angle), 0.0f) * 0.8f);
+                fixture.demo_scene.setRotation(
+                    fixture.demo_orbits[o],
+                    glm::angleAxis(time * glm::radians(-120.0f), z_axis));
+            }
+            fixture.demo_scene.update(fixture.jobs, &fixture.demo_target);
+        }
+    }});
+    // Every root turns, so all 4096 world matrices are recomputed
+    cases.push_back({"scene/update_4096", [&fixture, z_axis](uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) {
+            glm::quat rotation = glm::angleAxis(float(i) * 0.01f, z_axis);
+            for (Scene::NodeId root : fixture.large_roots) {
+                fixture.large_scene.setRotation(root, rotation);
+            }
+            fixture.large_scene.update(fixture.jobs, &fixture.large_target);
+        }
+    }});
+
+    // --- BVH ---
+    cases.push_back({"bvh/refit_4096", [&fixture](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; ++i) {
+            // Every refit moves one box; odd passes over the boxes move them
+            // back, so the tree alternates between two poses without drift
+            size_t count = fixture.node_bounds.size();
+            Aabb& box = fixture.node_bounds[i % count];
+            float offset = ((i / count) & 1) ? 0.01f : -0.01f;
+            box.min.x += offset;
+            box.max.x += offset;
+            keep(fixture.bvh.update(fixture.node_bounds));
+        }
+    }});
+    cases.push_back({"bvh/query_frustum_4096", [&fixture](uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) {
+            fixture.visible.clear();
+            fixture.bvh.queryFrustum(fixture.frustum, fixture.visible);
+            keep(fixture.visible.size());
+        }
+    }});
+
+    // --- Culling ---
+    cases.push_back({"cull/spheres_65536", [&fixture](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; ++i) {
+            keep(fixture.culler.cullSpheres(fixture.frustum, fixture.spheres,
+                                            fixture.visible));
+        }
+    }});
+
+    // --- Job System ---
+    // Dispatch and join of JOB_COUNT / JOB_GRAIN chunks doing nothing
+    cases.push_back({"jobs/parallel_for_empty", [&fixture](uint64_t n) {
+        std::atomic<size_t> ranges{0};
+        for (uint64_t i = 0; i < n; ++i) {
+            fixture.jobs.parallelFor(JOB_COUNT, JOB_GRAIN,
+                                     [&](size_t, size_t) {
+                                         ranges.fetch_add(
+                                             1, std::memory_order_relaxed);
+                                     });
+        }
+        keep(ranges);
+    }});
+    return cases;
+}
+
+// --- GPU Cases ---
+// The CPU cost of Vulkan calls on a headless device; nothing is submitted
+constexpr VkDeviceSize BUFFER_SIZE = 64 * 1024;
+constexpr VkExtent2D TARGET_EXTENT = {256, 256};
+constexpr VkFormat TARGET_FORMAT = VK_FORMAT_R8G8B8A8_UNORM;
+
+// The renderer's frame recording on a headless context, into a color image
+// of its own. The demo scene is simulated and culled once up front, so
+// every recording draws the same visible set.
+class RecordingFixture {
+public:
+    explicit RecordingFixture(VulkanContextManager* context)
+        : context(context), device(context->getDevice()) {
+        context->setOffscreenTarget(TARGET_EXTENT, TARGET_FORMAT);
+        renderer = std::make_unique<Renderer>(context);
+        renderer->init();
+        createTarget();
+
+        RenderPacket packet;
+        renderer->writePacket(packet, 0.0f);
+        renderer->prepareOffscreenFrame(packet);
+    }
+
+    ~RecordingFixture() {
+        vkDestroyFramebuffer(device, framebuffer, nullptr);
+        vkDestroyImageView(device, image_view, nullptr);
+        vkDestroyImage(device, image, nullptr);
+        vkFreeMemory(device, image_memory, nullptr);
+        renderer.reset();  // Before the context is cleaned up
+    }
+
+    RecordingFixture(const RecordingFixture&) = delete;
+    RecordingFixture& operator=(const RecordingFixture&) = delete;
+
+    // One frame's command buffer, as drawFrame() records it
+    VkCommandBuffer record() {
+        return renderer->recordOffscreenFrame(framebuffer, image);
+    }
+
+private:
+    // Color image and a framebuffer pairing it with the renderer's depth
+    // buffer, for the renderer's render pass
+    void createTarget() {
+        VkImageCreateInfo image_info{};
+        image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        image_info.imageType = VK_IMAGE_TYPE_2D;
+        image_info.format = TARGET_FORMAT;
+        image_info.extent = {TARGET_EXTENT.width, TARGET_EXTENT.height, 1};
+        image_info.mipLevels = 1;
+        image_info.arrayLayers = 1;
+        image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+        image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+        image_info.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+        image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        context->createImage(image_info, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                             image, image_memory);
+
+        VkImageViewCreateInfo view_info{};
+        view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        view_info.image = image;
+        view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        view_info.format = TARGET_FORMAT;
+        view_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        view_info.subresourceRange.levelCount = 1;
+        view_info.subresourceRange.layerCount = 1;
+        if (vkCreateImageView(device, &view_info, nullptr, &image_view) !=
+            VK_SUCCESS) {
+            throw std::runtime_error("failed to create target image view!");
+        }
+
+        VkImageView attachments[] = {image_view,
+                                     renderer->getDepthImageView()};
+        VkFramebufferCreateInfo framebuffer_info{};
+        framebuffer_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+        framebuffer_info.renderPass = renderer->getRenderPass();
+        framebuffer_info.attachmentCount = 2;
+        framebuffer_info.pAttachments = attachments;
+        framebuffer_info.width = TARGET_EXTENT.width;
+        framebuffer_info.height = TARGET_EXTENT.height;
+        framebuffer_info.layers = 1;
+        if (vkCreateFramebuffer(device, &framebuffer_info, nullptr,
+                                &framebuffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create framebuffer!");
+        }
+    }
+
+    VulkanContextManager* context;
+    VkDevice device;
+    std::unique_ptr<Renderer> renderer;
+    VkImage image{VK_NULL_HANDLE};
+    VkDeviceMemory image_memory{VK_NULL_HANDLE};
+    VkImageView image_view{VK_NULL_HANDLE};
+    VkFramebuffer framebuffer{VK_NULL_HANDLE};
+};
+
+std::vector<BenchCase> makeGpuCases(VulkanContextManager* context,
+                                    RecordingFixture& recording) {
+    std::vector<BenchCase> cases;
+    // Create, allocate and bind, then free: what every createBuffer caller
+    // pays, dominated by vkAllocateMemory
+    cases.push_back({"vk/create_buffer_64k", [context](uint64_t iterations) {
+        VkDevice device = context->getDevice();
+        for (uint64_t i = 0; i < iterations; ++i) {
+            VkBuffer buffer;
+            VkDeviceMemory memory;
+            context->createBuffer(BUFFER_SIZE,
+                                  VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+                                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                      VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                                  buffer, memory);
+            vkDestroyBuffer(device, buffer, nullptr);
+            vkFreeMemory(device, memory, nullptr);
+        }
+    }});
+    cases.push_back({"vk/record_frame", [&recording](uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) {
+            keep(recording.record());
+        }
+    }});
+    return cases;
+}
+
+struct Options {
+    std::string filter;  // Substring of the case names to run
+    std::string json_path;
+    bool gpu = false;
+    double sample_ms = DEFAULT_SAMPLE_MS;
+};
+
+void printUsage(const char* program) {
+    std::printf(
+        "Usage: %s [options]\n"
+        "  --filter <text>   only cases whose name contains text\n"
+        "  --json <file>     also write the results as JSON\n"
+        "  --gpu             add the Vulkan cases (headless device)\n"
+        "  --sample-ms <x>   target duration of one timed sample\n",
+        program);
+}
+
+bool parseOptions(int argc, char* argv[], Options& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        auto takesValue = [&] {
+            if (!value) {
+                std::printf("%s needs a value\n", arg.c_str());
+                return false;
+            }
+            ++i;
+            return true;
+        };
+        if (arg == "--gpu") {
+            options.gpu = true;
+        } else if (arg == "--filter") {
+            if (!takesValue()) {
+                return false;
+            }
+            options.filter = value;
+        } else if (arg == "--json") {
+            if (!takesValue()) {
+                return false;
+            }
+            options.json_path = value;
+        } else if (arg == "--sample-ms") {
+            if (!takesValue()) {
+                return false;
+            }
+            options.sample_ms = std::max(1.0, std::atof(value));
+        } else {
+            std::printf("Unknown option %s\n", arg.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+void runCases(const std::vector<BenchCase>& cases, const Options& options,
+              PerfCounters& perf, std::vector<BenchResult>& results) {
+    for (const BenchCase& bench : cases) {
+        if (bench.name.find(options.filter) == std::string::npos) {
+            continue;
+        }
+        results.push_back(runCase(bench, perf, options.sample_ms));
+        printResult(results.back());
+    }
+}
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    spdlog::set_level(spdlog::level::warn);  // Keep the table readable
+
+    PerfCounters perf;
+    if (!perf.isAvailable()) {
+        std::printf("Hardware counters unavailable, see perf_event_paranoid\n");
+    }
+    std::printf("%-28s %11s %9s %11s %9s %9s\n", "case", "ns/op", "alloc/op",
+                "instr/op", "L1D/op", "LLC/op");
+
+    std::vector<BenchResult> results;
+    try {
+        CpuFixture fixture;
+        runCases(makeCpuCases(fixture), options, perf, results);
+
+        if (options.gpu) {
+            VulkanContextManager* context =
+                VulkanContextManager::getInstance();
+            context->initHeadless();
+            {
+                RecordingFixture recording(context);
+                runCases(makeGpuCases(context, recording), options, perf,
+                         results);
+            }
+            context->cleanup();
+        }
+    } catch (const std::exception& e) {
+        spdlog::critical("Benchmark failed: {}", e.what());
+        return EXIT_FAILURE;
+    }
+
+    if (!options.json_path.empty()) {
+        if (!writeJson(options.json_path, results, perf.isAvailable())) {
+            std::printf("Could not write %s\n", options.json_path.c_str());
+            return EXIT_FAILURE;
+        }
+        std::printf("Wrote %s\n", options.json_path.c_str());
+    }
+    return EXIT_SUCCESS;
+}
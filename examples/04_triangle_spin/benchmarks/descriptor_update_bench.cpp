@@ -0,0 +1,224 @@
+/*
+ * @author: Avidel
+ * @LastEditors: Avidel
+ */
+// Descriptor update throughput: vkUpdateDescriptorSets on pool-allocated sets
+// against memcpy into a VK_EXT_descriptor_buffer ring. CPU side only, runs
+// headless.
+#include "Utils/descriptor_buffer.hpp"
+#include "Utils/vulkan_util.hpp"
+#include "spdlog/spdlog.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+constexpr uint32_t SET_COUNT = 256;   // Distinct sets / UBOs updated per pass
+constexpr uint32_t ITERATIONS = 200;  // Passes over all sets
+constexpr VkDeviceSize UBO_SIZE = sizeof(FrameUniforms);
+
+double elapsedNs(Clock::time_point since) {
+    return std::chrono::duration<double, std::nano>(Clock::now() - since)
+        .count();
+}
+
+VkDescriptorSetLayout createUboSetLayout(
+    VkDevice device, VkDescriptorSetLayoutCreateFlags flags) {
+    VkDescriptorSetLayoutBinding ubo_binding{};
+    ubo_binding.binding = 0;
+    ubo_binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    ubo_binding.descriptorCount = 1;
+    ubo_binding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+    VkDescriptorSetLayoutCreateInfo layout_info{};
+    layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layout_info.flags = flags;
+    layout_info.bindingCount = 1;
+    layout_info.pBindings = &ubo_binding;
+
+    VkDescriptorSetLayout set_layout;
+    if (vkCreateDescriptorSetLayout(device, &layout_info, nullptr,
+                                    &set_layout) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create descriptor set layout!");
+    }
+    return set_layout;
+}
+
+void printResult(const char* name, double totalNs) {
+    double updates = static_cast<double>(SET_COUNT) * ITERATIONS;
+    std::printf("%-28s %8.1f ns/update  %8.2f M updates/s\n", name,
+                totalNs / updates, updates / totalNs * 1e3);
+}
+
+// Pool path: one vkUpdateDescriptorSets call per set, like createDescriptorSets
+double benchPoolSingle(VkDevice device,
+                       const std::vector<VkDescriptorSet>& sets,
+                       const std::vector<VkBuffer>& buffers) {
+    auto start = Clock::now();
+    for (uint32_t iteration = 0; iteration < ITERATIONS; ++iteration) {
+        for (uint32_t i = 0; i < SET_COUNT; ++i) {
+            VkDescriptorBufferInfo buffer_info{buffers[i], 0, UBO_SIZE};
+            VkWriteDescriptorSet descriptor_write{};
+            descriptor_write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptor_write.dstSet = sets[i];
+            descriptor_write.dstBinding = 0;
+            descriptor_write.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+            descriptor_write.descriptorCount = 1;
+            descriptor_write.pBufferInfo = &buffer_info;
+            vkUpdateDescriptorSets(device, 1, &descriptor_write, 0, nullptr);
+        }
+    }
+    return elapsedNs(start);
+}
+
+// Pool path, best case: all writes of a pass batched into one call
+double benchPoolBatched(VkDevice device,
+                        const std::vector<VkDescriptorSet>& sets,
+                        const std::vector<VkBuffer>& buffers) {
+    std::vector<VkDescriptorBufferInfo> buffer_infos(SET_COUNT);
+    std::vector<VkWriteDescriptorSet> writes(SET_COUNT);
+    auto start = Clock::now();
+    for (uint32_t iteration = 0; iteration < ITERATIONS; ++iteration) {
+        for (uint32_t i = 0; i < SET_COUNT; ++i) {
+            buffer_infos[i] = {buffers[i], 0, UBO_SIZE};
+            writes[i] = {};
+            writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            writes[i].dstSet = sets[i];
+            writes[i].dstBinding = 0;
+            writes[i].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+            writes[i].descriptorCount = 1;
+            writes[i].pBufferInfo = &buffer_infos[i];
+        }
+        vkUpdateDescriptorSets(device, SET_COUNT, writes.data(), 0, nullptr);
+    }
+    return elapsedNs(start);
+}
+
+// Descriptor buffer path with descriptors fetched per update
+double benchRingFetch(DescriptorBufferRing& ring,
+                      const std::vector<VkBuffer>& buffers) {
+    auto start = Clock::now();
+    for (uint32_t iteration = 0; iteration < ITERATIONS; ++iteration) {
+        ring.beginFrame(0);
+        for (uint32_t i = 0; i < SET_COUNT; ++i) {
+            VkDeviceSize offset = ring.allocateSet();
+            ring.write(offset, 0,
+                       ring.getUniformBufferDescriptor(buffers[i], UBO_SIZE));
+        }
+    }
+    return elapsedNs(start);
+}
+
+// Descriptor buffer path as the renderer uses it: cached bytes, plain memcpy
+double benchRingCached(DescriptorBufferRing& ring,
+                       const std::vector<std::vector<uint8_t>>& descriptors) {
+    auto start = Clock::now();
+    for (uint32_t iteration = 0; iteration < ITERATIONS; ++iteration) {
+        ring.beginFrame(0);
+        for (uint32_t i = 0; i < SET_COUNT; ++i) {
+            VkDeviceSize offset = ring.allocateSet();
+            ring.write(offset, 0, descriptors[i]);
+        }
+    }
+    return elapsedNs(start);
+}
+}  // namespace
+
+int main(int /*argc*/, char* /*argv*/[]) {
+    spdlog::set_level(spdlog::level::warn);  // Keep the table readable
+
+    VulkanContextManager* context = VulkanContextManager::getInstance();
+    try {
+        context->initHeadless();
+        if (!context->getOptionalFeatures().descriptor_buffer) {
+            std::printf("VK_EXT_descriptor_buffer not supported, skipping.\n");
+            context->cleanup();
+            return EXIT_SUCCESS;
+        }
+        VkDevice device = context->getDevice();
+
+        std::vector<VkBuffer> buffers(SET_COUNT);
+        std::vector<VkDeviceMemory> buffer_memory(SET_COUNT);
+        for (uint32_t i = 0; i < SET_COUNT; ++i) {
+            context->createBuffer(UBO_SIZE,
+                                  VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT |
+                                      VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                      VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                                  buffers[i], buffer_memory[i]);
+        }
+
+        // --- Pool-based sets ---
+        VkDescriptorSetLayout pool_layout = createUboSetLayout(device, 0);
+        VkDescriptorPoolSize pool_size{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+                                       SET_COUNT};
+        VkDescriptorPoolCreateInfo pool_info{};
+        pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        pool_info.poolSizeCount = 1;
+        pool_info.pPoolSizes = &pool_size;
+        pool_info.maxSets = SET_COUNT;
+        VkDescriptorPool pool;
+        if (vkCreateDescriptorPool(device, &pool_info, nullptr, &pool) !=
+            VK_SUCCESS) {
+            throw std::runtime_error("failed to create descriptor pool!");
+        }
+        std::vector<VkDescriptorSetLayout> layouts(SET_COUNT, pool_layout);
+        VkDescriptorSetAllocateInfo alloc_info{};
+        alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        alloc_info.descriptorPool = pool;
+        alloc_info.descriptorSetCount = SET_COUNT;
+        alloc_info.pSetLayouts = layouts.data();
+        std::vector<VkDescriptorSet> sets(SET_COUNT);
+        if (vkAllocateDescriptorSets(device, &alloc_info, sets.data()) !=
+            VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate descriptor sets!");
+        }
+
+        // --- Descriptor buffer ring ---
+        VkDescriptorSetLayout ring_layout = createUboSetLayout(
+            device, VK_DESCRIPTOR_SET_LAYOUT_CREATE_DESCRIPTOR_BUFFER_BIT_EXT);
+        double ring_fetch_ns = 0.0;
+        double ring_cached_ns = 0.0;
+        VkDeviceSize set_size = 0;
+        {
+            DescriptorBufferRing ring(context, ring_layout, 1, SET_COUNT);
+            set_size = ring.getSetSize();
+            std::vector<std::vector<uint8_t>> descriptors(SET_COUNT);
+            for (uint32_t i = 0; i < SET_COUNT; ++i) {
+                descriptors[i] =
+                    ring.getUniformBufferDescriptor(buffers[i], UBO_SIZE);
+            }
+            ring_fetch_ns = benchRingFetch(ring, buffers);
+            ring_cached_ns = benchRingCached(ring, descriptors);
+        }
+        double pool_single_ns = benchPoolSingle(device, sets, buffers);
+        double pool_batched_ns = benchPoolBatched(device, sets, buffers);
+
+        std::printf("Sets: %u, passes: %u, descriptor set size: %llu bytes\n",
+                    SET_COUNT, ITERATIONS,
+                    static_cast<unsigned long long>(set_size));
+        printResult("Pool, one write per call", pool_single_ns);
+        printResult("Pool, batched writes", pool_batched_ns);
+        printResult("Buffer, vkGetDescriptorEXT", ring_fetch_ns);
+        printResult("Buffer, cached memcpy", ring_cached_ns);
+
+        vkDestroyDescriptorSetLayout(device, ring_layout, nullptr);
+        vkDestroyDescriptorPool(device, pool, nullptr);
+        vkDestroyDescriptorSetLayout(device, pool_layout, nullptr);
+        for (uint32_t i = 0; i < SET_COUNT; ++i) {
+            vkDestroyBuffer(device, buffers[i], nullptr);
+            vkFreeMemory(device, buffer_memory[i], nullptr);
+        }
+        context->cleanup();
+    } catch (const std::exception& e) {
+        spdlog::critical("Benchmark failed: {}", e.what());
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,415 @@
+/*
+ * @author: Avidel
+ * @LastEditors: Avidel
+ */
+// Golden-image regression check: renders the reference scenes listed in
+// golden/scenes.txt headlessly through the render service, compares each
+// image with golden/<name>.png (SSIM and a FLIP-style color error) and its
+// frame times with golden/baselines.txt. Exits with failure on any image or
+// performance regression beyond the thresholds, so scripts can gate on it.
+//
+// Run it on a software Vulkan ICD (lavapipe) so the images do not depend on
+// the GPU and driver, e.g. --icd /usr/share/vulkan/icd.d/lvp_icd.x86_64.json.
+// Baselines are only comparable on the machine that recorded them; pass
+// --no-perf elsewhere. --update renders the goldens and baselines anew.
+// Until a set has been recorded (no baselines.txt and no golden at all),
+// every scene is reported as skipped and the run exits with EXIT_SKIPPED
+// (ctest's SKIP_RETURN_CODE). Once one exists, a scene whose golden is
+// missing or unreadable fails, as does one without a baseline when frame
+// times are checked.
+#include "Utils/image_compare.hpp"
+#include "Utils/render_service.hpp"
+#include "Utils/vulkan_util.hpp"
+#include "stb_image_write.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+constexpr uint32_t WARMUP_RUNS = 3;  // Scene load, pipeline and caches
+constexpr int EXIT_SKIPPED = 77;     // Nothing recorded; see CMakeLists.txt
+
+struct Options {
+    std::filesystem::path golden_dir = GOLDEN_DIR;
+    std::filesystem::path output_dir =
+        std::filesystem::temp_directory_path() / "golden_test";
+    bool update = false;
+    bool check_perf = true;
+    uint32_t runs = 30;  // Timed renders per scene
+    double min_ssim = 0.98;
+    float pixel_threshold = 0.05f;  // Color error that makes a pixel differ
+    double max_error_fraction = 0.001;  // Of the pixels
+    double perf_tolerance = 0.25;  // Median frame time over the baseline
+};
+
+struct ReferenceScene {
+    std::string name;
+    std::string scene_file;  // Relative to the golden directory
+    RenderService::RequestHeader request;
+};
+
+struct FrameTimes {
+    double median_ms = 0.0;
+    double p95_ms = 0.0;
+};
+
+void setEnvironment(const char* name, const char* value) {
+#if defined(_WIN32)
+    _putenv_s(name, value);
+#else
+    setenv(name, value, 1);
+#endif
+}
+
+void printUsage(const char* program) {
+    std::printf(
+        "Usage: %s [options]\n"
+        "  --update              write new goldens and baselines\n"
+        "  --icd <json>          Vulkan driver to load (VK_DRIVER_FILES)\n"
+        "  --golden <dir>        scenes, goldens and baselines\n"
+        "  --output <dir>        actual and diff images of failures\n"
+        "  --runs <n>            timed renders per scene\n"
+        "  --min-ssim <x>        lowest SSIM that passes\n"
+        "  --pixel-threshold <x> color error that makes a pixel differ\n"
+        "  --max-differing <x>   highest fraction of differing pixels\n"
+        "  --perf-tolerance <x>  allowed median slowdown, 0.25 = 25%%\n"
+        "  --no-perf             skip the frame time check\n",
+        program);
+}
+
+bool parseOptions(int argc, char* argv[], Options& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        auto takesValue = [&] {
+            if (!value) {
+                std::printf("%s needs a value\n", arg.c_str());
+                return false;
+            }
+            ++i;
+            return true;
+        };
+        if (arg == "--update") {
+            options.update = true;
+        } else if (arg == "--no-perf") {
+            options.check_perf = false;
+        } else if (arg == "--icd") {
+            if (!takesValue()) {
+                return false;
+            }
+            // Newer loaders read the first, older ones the second
+            setEnvironment("VK_DRIVER_FILES", value);
+            setEnvironment("VK_ICD_FILENAMES", value);
+        } else if (arg == "--golden") {
+            if (!takesValue()) {
+                return false;
+            }
+            options.golden_dir = value;
+        } else if (arg == "--output") {
+            if (!takesValue()) {
+                return false;
+            }
+            options.output_dir = value;
+        } else if (arg == "--runs") {
+            if (!takesValue()) {
+                return false;
+            }
+            options.runs = std::max(1, std::atoi(value));
+        } else if (arg == "--min-ssim") {
+            if (!takesValue()) {
+                return false;
+            }
+            options.min_ssim = std::atof(value);
+        } else if (arg == "--pixel-threshold") {
+            if (!takesValue()) {
+                return false;
+            }
+            options.pixel_threshold = static_cast<float>(std::atof(value));
+        } else if (arg == "--max-differing") {
+            if (!takesValue()) {
+                return false;
+            }
+            options.max_error_fraction = std::atof(value);
+        } else if (arg == "--perf-tolerance") {
+            if (!takesValue()) {
+                return false;
+            }
+            options.perf_tolerance = std::atof(value);
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+// One scene per line:
+//   <name> <scene file> <width> <height> <eye x y z> <target x y z> <fov>
+std::vector<ReferenceScene> loadSceneList(const std::filesystem::path& path) {
+    std::ifstream file(path);
+    if (!file) {
+        throw std::runtime_error("Cannot open " + path.string() + " !");
+    }
+    std::vector<ReferenceScene> scenes;
+    std::string line;
+    for (size_t line_number = 1; std::getline(file, line); line_number++) {
+        line = line.substr(0, line.find('#'));
+        std::istringstream stream(line);
+        ReferenceScene scene;
+        if (!(stream >> scene.name)) {
+            continue;
+        }
+        RenderService::RequestHeader& request = scene.request;
+        if (!(stream >> scene.scene_file >> request.width >> request.height >>
+              request.eye[0] >> request.eye[1] >> request.eye[2] >>
+              request.target[0] >> request.target[1] >> request.target[2] >>
+              request.fov_degrees)) {
+            throw std::runtime_error(path.string() + ":" +
+                                     std::to_string(line_number) +
+                                     ": invalid scene entry !");
+        }
+        scenes.push_back(std::move(scene));
+    }
+    return scenes;
+}
+
+// <name> <median ms> <p95 ms> per line
+std::map<std::string, FrameTimes> loadBaselines(
+    const std::filesystem::path& path) {
+    std::map<std::string, FrameTimes> baselines;
+    std::ifstream file(path);
+    std::string line;
+    while (std::getline(file, line)) {
+        line = line.substr(0, line.find('#'));
+        std::istringstream stream(line);
+        std::string name;
+        FrameTimes times;
+        if (stream >> name >> times.median_ms >> times.p95_ms) {
+            baselines[name] = times;
+        }
+    }
+    return baselines;
+}
+
+bool writePng(const std::filesystem::path& path,
+              const RenderService::RequestHeader& request,
+              const std::vector<uint8_t>& pixels) {
+    int width = static_cast<int>(request.width);
+    return stbi_write_png(path.string().c_str(), width,
+                          static_cast<int>(request.height), 4, pixels.data(),
+                          width * 4) != 0;
+}
+
+// Renders the scene WARMUP_RUNS + runs times; pixels of the last one
+bool renderScene(RenderService& service, const Options& options,
+                 const ReferenceScene& scene, std::vector<uint8_t>& pixels,
+                 FrameTimes& times) {
+    const std::string scene_path =
+        (options.golden_dir / scene.scene_file).string();
+    std::vector<double> frame_ms;
+    for (uint32_t run = 0; run < WARMUP_RUNS + options.runs; ++run) {
+        RenderService::JobMetrics metrics;
+        std::string error;
+        if (service.render(scene.request, scene_path, pixels, metrics,
+                           error) != RenderService::Status::Ok) {
+            std::printf("%-12s FAIL  %s\n", scene.name.c_str(), error.c_str());
+            return false;
+        }
+        if (run >= WARMUP_RUNS) {
+            frame_ms.push_back(metrics.prepare_ms + metrics.execute_ms);
+        }
+    }
+    std::sort(frame_ms.begin(), frame_ms.end());
+    times.median_ms = frame_ms[frame_ms.size() / 2];
+    times.p95_ms = frame_ms[frame_ms.size() * 95 / 100];
+    return true;
+}
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    spdlog::set_level(spdlog::level::warn);  // Keep the report readable
+
+    VulkanContextManager* context = VulkanContextManager::getInstance();
+    int failures = 0;
+    int skipped = 0;
+    try {
+        const std::vector<ReferenceScene> scenes =
+            loadSceneList(options.golden_dir / "scenes.txt");
+        const std::filesystem::path baseline_path =
+            options.golden_dir / "baselines.txt";
+        const auto baselines = loadBaselines(baseline_path);
+        // A missing golden is a regression once any of the set exists
+        bool recorded = std::filesystem::exists(baseline_path);
+        for (const ReferenceScene& scene : scenes) {
+            if (std::filesystem::exists(options.golden_dir /
+                                        (scene.name + ".png"))) {
+                recorded = true;
+            }
+        }
+        std::filesystem::create_directories(options.output_dir);
+
+        context->initHeadless();
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(context->getPhysicalDevice(),
+                                      &properties);
+        std::printf("%zu scenes on %s, %u timed runs each\n", scenes.size(),
+                    properties.deviceName, options.runs);
+
+        auto service = std::make_unique<RenderService>(context, 1);
+        std::ofstream baseline_file;
+        if (options.update) {
+            baseline_file.open(baseline_path);
+            baseline_file << "# <name> <median ms> <p95 ms>, recorded on "
+                          << properties.deviceName << "\n";
+        }
+        for (const ReferenceScene& scene : scenes) {
+            std::vector<uint8_t> pixels;
+            FrameTimes times;
+            if (!renderScene(*service, options, scene, pixels, times)) {
+                ++failures;
+                continue;
+            }
+            const std::filesystem::path golden_path =
+                options.golden_dir / (scene.name + ".png");
+            if (options.update) {
+                if (!writePng(golden_path, scene.request, pixels)) {
+                    throw std::runtime_error("Cannot write " +
+                                             golden_path.string() + " !");
+                }
+                baseline_file << scene.name << " " << times.median_ms << " "
+                              << times.p95_ms << "\n";
+                std::printf("%-12s saved  %6.2f ms median, %6.2f ms p95\n",
+                            scene.name.c_str(), times.median_ms,
+                            times.p95_ms);
+                continue;
+            }
+
+            // --- Image ---
+            if (!std::filesystem::exists(golden_path)) {
+                if (recorded) {
+                    std::printf("%-12s FAIL  no golden, but the set was "
+                                "recorded; rerun --update\n",
+                                scene.name.c_str());
+                    ++failures;
+                } else {
+                    // Not a regression: nothing was recorded to compare with
+                    std::printf("%-12s skip  no golden, record the set with "
+                                "--update on the pinned ICD\n",
+                                scene.name.c_str());
+                    ++skipped;
+                }
+                continue;
+            }
+            int width = 0;
+            int height = 0;
+            int channels = 0;
+            stbi_uc* golden = stbi_load(golden_path.string().c_str(), &width,
+                                        &height, &channels, 4);
+            if (!golden) {
+                std::printf("%-12s FAIL  cannot read %s: %s\n",
+                            scene.name.c_str(), golden_path.string().c_str(),
+                            stbi_failure_reason());
+                ++failures;
+                continue;
+            }
+            bool passed = true;
+            std::string report;
+            if (uint32_t(width) != scene.request.width ||
+                uint32_t(height) != scene.request.height) {
+                passed = false;
+                report = "golden size differs";
+            } else {
+                std::vector<uint8_t> error_map;
+                ImageDifference difference = compareImages(
+                    golden, pixels.data(), scene.request.width,
+                    scene.request.height, options.pixel_threshold,
+                    &error_map);
+                char text[128];
+                std::snprintf(text, sizeof(text),
+                              "ssim %.4f, %.3f%% differing, max error %.3f",
+                              difference.ssim,
+                              difference.error_fraction * 100.0,
+                              difference.max_error);
+                report = text;
+                if (difference.ssim < options.min_ssim ||
+                    difference.error_fraction > options.max_error_fraction) {
+                    passed = false;
+                    writePng(options.output_dir / (scene.name + "_diff.png"),
+                             scene.request, error_map);
+                }
+            }
+            stbi_image_free(golden);
+            if (!passed) {
+                writePng(options.output_dir / (scene.name + "_actual.png"),
+                         scene.request, pixels);
+            }
+
+            // --- Frame Time ---
+            char timing[128];
+            std::snprintf(timing, sizeof(timing),
+                          "%6.2f ms median, %6.2f ms p95", times.median_ms,
+                          times.p95_ms);
+            std::string perf = timing;
+            auto baseline = baselines.find(scene.name);
+            if (options.check_perf && baseline != baselines.end()) {
+                double limit =
+                    baseline->second.median_ms * (1.0 + options.perf_tolerance);
+                std::snprintf(timing, sizeof(timing), " (baseline %.2f)",
+                              baseline->second.median_ms);
+                perf += timing;
+                if (times.median_ms > limit) {
+                    passed = false;
+                    perf += " SLOWER";
+                }
+            } else if (options.check_perf) {
+                passed = false;  // Recorded with the golden by --update
+                perf += " (no baseline)";
+            }
+            std::printf("%-12s %s  %s; %s\n", scene.name.c_str(),
+                        passed ? "ok  " : "FAIL", report.c_str(),
+                        perf.c_str());
+            if (!passed) {
+                ++failures;
+            }
+        }
+        service.reset();
+    } catch (const std::exception& e) {
+        std::printf("Error: %s\n", e.what());
+        ++failures;
+    }
+    context->cleanup();
+
+    if (options.update) {
+        return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (failures > 0) {
+        std::printf("%d scene(s) failed; images of failures in %s\n",
+                    failures, options.output_dir.string().c_str());
+        return EXIT_FAILURE;
+    }
+    if (skipped > 0) {
+        std::printf("%d scene(s) skipped without a golden\n", skipped);
+        return EXIT_SKIPPED;
+    }
+    std::printf("All scenes passed\n");
+    return EXIT_SUCCESS;
+}
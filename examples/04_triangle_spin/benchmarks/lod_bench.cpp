@@ -0,0 +1,216 @@
+/*
+ * @author: Avidel
+ * @LastEditors: Avidel
+ */
+// Mesh LODs end to end: quadric simplification of a dense mesh, then a flight
+// over a field of 200k instances with screen-space error selection, the
+// triangle budget, hysteresis against level flicker, and level streaming
+// with a memory budget. CPU only, needs no Vulkan device.
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include "Utils/job_system.hpp"
+#include "Utils/mesh_lod.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+constexpr uint32_t HERO_SEGMENTS = 256;  // 64k triangles
+constexpr uint32_t SCENE_SEGMENTS = 64;  // 4k triangles per scene mesh
+constexpr uint32_t REGIONS = 8;          // Per axis, one mesh each
+constexpr float FIELD_SIZE = 4000.0f;
+constexpr size_t INSTANCE_COUNT = 200'000;
+constexpr uint32_t FRAMES = 120;
+constexpr float VIEWPORT_HEIGHT = 1080.0f;
+constexpr uint64_t TRIANGLE_BUDGET = 14'000'000;
+
+struct Mesh {
+    std::vector<glm::vec3> positions;
+    std::vector<uint32_t> indices;
+};
+
+double elapsedMs(Clock::time_point since) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - since)
+        .count();
+}
+
+// UV sphere with a bumpy radius. The seam column and the pole rows repeat
+// positions like a textured mesh would, which the simplifier welds.
+Mesh makeBumpySphere(uint32_t segments, float frequency) {
+    uint32_t rings = segments / 2;
+    Mesh mesh;
+    for (uint32_t r = 0; r <= rings; ++r) {
+        float theta = 3.14159265f * r / rings;
+        for (uint32_t s = 0; s <= segments; ++s) {
+            float phi = 6.28318531f * (s % segments) / segments;
+            float radius = 1.0f + 0.05f * std::sin(frequency * theta) *
+                                      std::sin(frequency * phi);
+            if (r == 0 || r == rings) {
+                phi = 0.0f;  // Poles: one position
+                radius = 1.0f;
+            }
+            mesh.positions.emplace_back(
+                radius * std::sin(theta) * std::cos(phi),
+                radius * std::cos(theta),
+                radius * std::sin(theta) * std::sin(phi));
+        }
+    }
+    for (uint32_t r = 0; r < rings; ++r) {
+        for (uint32_t s = 0; s < segments; ++s) {
+            uint32_t a = r * (segments + 1) + s;
+            uint32_t b = a + segments + 1;
+            if (r != 0) {
+                mesh.indices.insert(mesh.indices.end(), {a, b, a + 1});
+            }
+            if (r + 1 != rings) {
+                mesh.indices.insert(mesh.indices.end(), {a + 1, b, b + 1});
+            }
+        }
+    }
+    return mesh;
+}
+
+// Jitters back and forth by a few centimeters every frame like a hand-held
+// camera, and flies along +Z at eye height unless hovering
+glm::vec3 cameraAt(uint32_t frame, bool hover) {
+    float jitter = (frame % 2 == 0) ? 0.05f : -0.05f;
+    float z = hover ? 0.0f : -FIELD_SIZE * 0.5f + 20.0f * frame;
+    return {0.0f, 2.0f, z + jitter};
+}
+}  // namespace
+
+int main(int /*argc*/, char* /*argv*/[]) {
+    // --- Simplification ---
+    Mesh hero = makeBumpySphere(HERO_SEGMENTS, 12.0f);
+    auto build_start = Clock::now();
+    LodChain hero_chain = buildLodChain(hero.positions, hero.indices);
+    double build_ms = elapsedMs(build_start);
+    std::printf("LOD chain of %zu triangles: %.1f ms (%.2f M tri/s)\n",
+                hero.indices.size() / 3, build_ms,
+                hero.indices.size() / 3 / (build_ms * 1e3));
+    for (uint32_t l = 0; l < hero_chain.getLevelCount(); ++l) {
+        const LodChain::Level& level = hero_chain.levels[l];
+        std::printf("  level %u: %7u triangles, error %.5f\n", l,
+                    level.index_count / 3, level.error);
+    }
+
+    // --- Scene ---
+    std::vector<Mesh> meshes;
+    std::vector<LodChain> chains;
+    for (uint32_t i = 0; i < REGIONS * REGIONS; ++i) {
+        meshes.push_back(makeBumpySphere(SCENE_SEGMENTS, 4.0f + i % 7));
+        chains.push_back(
+            buildLodChain(meshes.back().positions, meshes.back().indices));
+    }
+
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> position(-FIELD_SIZE * 0.5f,
+                                                   FIELD_SIZE * 0.5f);
+    std::uniform_real_distribution<float> size(0.5f, 3.0f);
+    std::vector<LodInstance> instances(INSTANCE_COUNT);
+    uint64_t full_triangles = 0;
+    for (LodInstance& instance : instances) {
+        instance.center = glm::vec3(position(rng), 0.0f, position(rng));
+        instance.scale = size(rng);
+        // Each region of the field uses its own mesh
+        auto region = [](float x) {
+            float cell = (x / FIELD_SIZE + 0.5f) * REGIONS;
+            return std::min(static_cast<uint32_t>(cell), REGIONS - 1);
+        };
+        instance.chain =
+            region(instance.center.z) * REGIONS + region(instance.center.x);
+        instance.radius = chains[instance.chain].radius * instance.scale;
+        full_triangles += chains[instance.chain].levels[0].index_count / 3;
+    }
+    std::printf("Scene: %zu instances of %zu meshes, %.1f M triangles at "
+                "full detail\n",
+                instances.size(), chains.size(), full_triangles * 1e-6);
+
+    // --- Selection ---
+    JobSystem jobs;
+    const float fov = glm::radians(60.0f);
+    struct Run {
+        const char* name;
+        bool hover;
+        float hysteresis;
+        uint64_t budget;
+    };
+    for (const Run& run : {Run{"hover", true, 0.0f, 0},
+                           Run{"hover", true, 0.25f, 0},
+                           Run{"flight", false, 0.25f, 0},
+                           Run{"flight", false, 0.25f, TRIANGLE_BUDGET}}) {
+        LodSelector selector(jobs);
+        selector.setSettings({1.0f, run.hysteresis, run.budget});
+        std::vector<uint8_t> levels;
+        double total_ms = 0.0;
+        uint64_t max_triangles = 0;
+        uint64_t max_error_triangles = 0;
+        size_t changes = 0;
+        for (uint32_t frame = 0; frame < FRAMES; ++frame) {
+            selector.setCamera(cameraAt(frame, run.hover), fov,
+                               VIEWPORT_HEIGHT);
+            auto start = Clock::now();
+            selector.select(chains, instances, levels);
+            total_ms += elapsedMs(start);
+            const LodSelector::Stats& stats = selector.getLastStats();
+            max_triangles = std::max(max_triangles, stats.triangles);
+            max_error_triangles =
+                std::max(max_error_triangles, stats.error_triangles);
+            changes += frame > 0 ? stats.level_changes : 0;
+        }
+        std::printf("%-6s hysteresis %.2f budget %4.1f M: %6.3f ms/frame, "
+                    "max %5.2f M tri (%5.2f M by error), %5.0f changes/frame\n",
+                    run.name, run.hysteresis, run.budget * 1e-6,
+                    total_ms / FRAMES, max_triangles * 1e-6,
+                    max_error_triangles * 1e-6,
+                    double(changes) / (FRAMES - 1));
+    }
+
+    // --- Streaming ---
+    size_t all_bytes = 0;
+    for (const LodChain& chain : chains) {
+        all_bytes += chain.indices.size() * sizeof(uint32_t);
+    }
+    LodStreamer streamer(
+        [&](uint32_t mesh, uint32_t level) {
+            std::span<const uint32_t> indices = chains[mesh].getIndices(level);
+            return std::vector<uint32_t>(indices.begin(), indices.end());
+        },
+        all_bytes / 4);
+    for (const LodChain& chain : chains) {
+        streamer.addMesh(chain.getLevelCount());
+    }
+    LodSelector selector(jobs);
+    selector.setSettings({1.0f, 0.25f, TRIANGLE_BUDGET});
+    std::vector<uint8_t> levels;
+    size_t fallbacks = 0;
+    size_t max_resident = 0;
+    for (uint32_t frame = 0; frame < FRAMES; ++frame) {
+        selector.setCamera(cameraAt(frame, false), fov, VIEWPORT_HEIGHT);
+        selector.select(chains, instances, levels);
+        for (size_t i = 0; i < instances.size(); ++i) {
+            uint32_t drawn = streamer.request(instances[i].chain, levels[i]);
+            fallbacks += drawn != levels[i] ? 1 : 0;
+        }
+        streamer.update();
+        max_resident =
+            std::max(max_resident, streamer.getStats().resident_bytes);
+    }
+    LodStreamer::Stats stats = streamer.getStats();
+    std::printf("Streaming: %.1f of %.1f MB resident at most (budget %.1f), "
+                "%llu loads, %llu evictions, %.1f coarser draws/frame\n",
+                max_resident / 1048576.0, all_bytes / 1048576.0,
+                all_bytes / 4 / 1048576.0,
+                static_cast<unsigned long long>(stats.loads),
+                static_cast<unsigned long long>(stats.evictions),
+                double(fallbacks) / FRAMES);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,144 @@
+/*
+ * @author: Avidel
+ * @LastEditors: Avidel
+ */
+// Path tracer throughput against thread count: samples/s and rays/s, in
+// total and per core, on a field of instanced grid meshes in front of a
+// backdrop, so paths bounce between surfaces. CPU only, needs no Vulkan
+// device or GPU. Pass a path to also write a converged reference image as a
+// PNG.
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "Utils/job_system.hpp"
+#include "Utils/path_tracer.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+constexpr uint32_t WIDTH = 640;
+constexpr uint32_t HEIGHT = 360;
+constexpr uint32_t GRID = 16;         // Quads per side of the instanced mesh
+constexpr size_t INSTANCES = 400;     // ~200k triangles
+constexpr int PASSES = 4;             // Samples per pixel per thread count
+constexpr int REFERENCE_PASSES = 64;  // For the PNG
+
+double elapsedMs(Clock::time_point since) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - since)
+        .count();
+}
+
+// GRID x GRID quads over [-0.5, 0.5]^2 as a triangle list, colored by position
+std::vector<Vertex> makeGrid(uint32_t grid) {
+    std::vector<Vertex> vertices;
+    auto corner = [&](uint32_t x, uint32_t y) {
+        float u = float(x) / grid;
+        float v = float(y) / grid;
+        return Vertex{{u - 0.5f, v - 0.5f}, {u, v, 1.0f - u}};
+    };
+    for (uint32_t y = 0; y < grid; ++y) {
+        for (uint32_t x = 0; x < grid; ++x) {
+            vertices.insert(vertices.end(), {corner(x, y), corner(x + 1, y),
+                                             corner(x + 1, y + 1)});
+            vertices.insert(vertices.end(), {corner(x, y),
+                                             corner(x + 1, y + 1),
+                                             corner(x, y + 1)});
+        }
+    }
+    return vertices;
+}
+
+FrameUniforms makeFrame() {
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 0.0f, 6.0f),
+                                 glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::mat4 proj = glm::perspective(glm::radians(45.0f),
+                                      float(WIDTH) / HEIGHT, 0.1f, 20.0f);
+    proj[1][1] *= -1;
+    FrameUniforms frame{};
+    frame.view_proj = proj * view;
+    frame.light_color = glm::vec4(1.0f);
+    return frame;
+}
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> position(-2.5f, 2.5f);
+    std::uniform_real_distribution<float> angle(0.0f, glm::radians(360.0f));
+
+    const std::vector<Vertex> vertices = makeGrid(GRID);
+    std::vector<glm::mat4> models;
+    for (size_t i = 0; i < INSTANCES; ++i) {
+        glm::mat4 model = glm::translate(
+            glm::mat4(1.0f),
+            glm::vec3(position(rng), position(rng) * 0.6f, position(rng)));
+        model = glm::rotate(model, angle(rng), glm::vec3(0.3f, 1.0f, 0.2f));
+        models.push_back(glm::scale(model, glm::vec3(0.8f)));
+    }
+    // Backdrop
+    models.push_back(glm::scale(
+        glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, -3.0f)),
+        glm::vec3(16.0f)));
+
+    std::vector<uint32_t> thread_counts;
+    uint32_t hardware = std::max(1u, std::thread::hardware_concurrency());
+    for (uint32_t threads = 1; threads < hardware; threads *= 2) {
+        thread_counts.push_back(threads);
+    }
+    thread_counts.push_back(hardware);
+
+    const FrameUniforms frame = makeFrame();
+    std::printf("%ux%u, tiles of %u, %d passes of 1 sample per pixel\n",
+                WIDTH, HEIGHT, PathTracer::TILE_SIZE, PASSES);
+    for (uint32_t threads : thread_counts) {
+        JobSystem jobs(threads);
+        PathTracer tracer(jobs, WIDTH, HEIGHT);
+        auto build_start = Clock::now();
+        tracer.setScene(vertices, models);
+        double build_ms = elapsedMs(build_start);
+        tracer.setCamera(frame);
+
+        double total_ms = 0.0;
+        uint64_t samples = 0;
+        uint64_t rays = 0;
+        for (int pass = 0; pass < PASSES; ++pass) {
+            tracer.renderPass();
+            const PathTracer::Stats& stats = tracer.getLastStats();
+            total_ms += stats.render_ms;
+            samples += stats.samples;
+            rays += stats.rays;
+        }
+        double samples_per_s = samples / (total_ms * 1e-3);
+        double rays_per_s = rays / (total_ms * 1e-3);
+        std::printf("%3u thr: %zu triangles built in %7.1f ms, %8.1f ms/pass "
+                    "%6.2f M samples/s %6.2f /core  %6.2f M rays/s %6.2f "
+                    "/core\n",
+                    threads, tracer.getTriangleCount(), build_ms,
+                    total_ms / PASSES, samples_per_s * 1e-6,
+                    samples_per_s * 1e-6 / threads, rays_per_s * 1e-6,
+                    rays_per_s * 1e-6 / threads);
+
+        if (argc > 1 && threads == thread_counts.back()) {
+            while (tracer.getSampleCount() < REFERENCE_PASSES) {
+                tracer.renderPass();
+            }
+            if (!tracer.writePng(argv[1])) {
+                std::printf("Failed to write %s\n", argv[1]);
+                return EXIT_FAILURE;
+            }
+            std::printf("Wrote %s at %u samples per pixel\n", argv[1],
+                        tracer.getSampleCount());
+        }
+    }
+    return EXIT_SUCCESS;
+}
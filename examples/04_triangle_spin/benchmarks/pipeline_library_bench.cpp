@@ -0,0 +1,192 @@
+/*
+ * @author: Avidel
+ * @LastEditors: Avidel
+ */
+// Compares monolithic pipeline creation against graphics pipeline library
+// parts + fast linking over a set of state permutations. Runs headless.
+#include "Utils/embedded_shaders.hpp"
+#include "Utils/layout_cache.hpp"
+#include "Utils/pipeline_library.hpp"
+#include "Utils/pipeline_manager.hpp"
+#include "Utils/spirv_reflect.hpp"
+#include "Utils/vulkan_util.hpp"
+#include "spdlog/spdlog.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+double elapsedMs(Clock::time_point since) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - since)
+        .count();
+}
+
+VkRenderPass createBenchRenderPass(VkDevice device) {
+    VkAttachmentDescription color_attachment{};
+    color_attachment.format = VK_FORMAT_R8G8B8A8_UNORM;
+    color_attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+    color_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    color_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    color_attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    color_attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    color_attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    color_attachment.finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+
+    VkAttachmentReference color_ref{};
+    color_ref.attachment = 0;
+    color_ref.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+    VkSubpassDescription subpass{};
+    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpass.colorAttachmentCount = 1;
+    subpass.pColorAttachments = &color_ref;
+
+    VkRenderPassCreateInfo render_pass_info{};
+    render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+    render_pass_info.attachmentCount = 1;
+    render_pass_info.pAttachments = &color_attachment;
+    render_pass_info.subpassCount = 1;
+    render_pass_info.pSubpasses = &subpass;
+
+    VkRenderPass render_pass;
+    if (vkCreateRenderPass(device, &render_pass_info, nullptr, &render_pass) !=
+        VK_SUCCESS) {
+        throw std::runtime_error("failed to create render pass!");
+    }
+    return render_pass;
+}
+
+// Every combination of the states that land in different library parts:
+// topology (vertex input), cull/front face (pre-rasterization), blend (output)
+std::vector<PipelineDesc> makePermutations(VkPipelineLayout layout,
+                                           VkRenderPass renderPass) {
+    PipelineDesc base;
+    base.vert_spirv.assign(embedded_shaders::vert.begin(),
+                           embedded_shaders::vert.end());
+    base.frag_spirv.assign(embedded_shaders::frag.begin(),
+                           embedded_shaders::frag.end());
+    reflectSpirv(embedded_shaders::vert)
+        .getVertexInput(base.bindings, base.attributes);
+    base.layout = layout;
+    base.render_pass = renderPass;
+
+    std::vector<PipelineDesc> permutations;
+    for (VkPrimitiveTopology topology :
+         {VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+          VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP}) {
+        for (VkCullModeFlags cull_mode :
+             {VK_CULL_MODE_NONE, VK_CULL_MODE_FRONT_BIT, VK_CULL_MODE_BACK_BIT,
+              VK_CULL_MODE_FRONT_AND_BACK}) {
+            for (VkFrontFace front_face : {VK_FRONT_FACE_COUNTER_CLOCKWISE,
+                                           VK_FRONT_FACE_CLOCKWISE}) {
+                for (bool blend_enable : {false, true}) {
+                    PipelineDesc desc = base;
+                    desc.topology = topology;
+                    desc.cull_mode = cull_mode;
+                    desc.front_face = front_face;
+                    desc.blend_enable = blend_enable;
+                    permutations.push_back(std::move(desc));
+                }
+            }
+        }
+    }
+    return permutations;
+}
+
+void destroyAll(VkDevice device, std::vector<VkPipeline>& pipelines) {
+    for (VkPipeline pipeline : pipelines) {
+        vkDestroyPipeline(device, pipeline, nullptr);
+    }
+    pipelines.clear();
+}
+}  // namespace
+
+int main(int /*argc*/, char* /*argv*/[]) {
+    spdlog::set_level(spdlog::level::warn);  // Keep the table readable
+
+    VulkanContextManager* context = VulkanContextManager::getInstance();
+    try {
+        context->initHeadless();
+        const auto& features = context->getOptionalFeatures();
+        if (!features.graphics_pipeline_library) {
+            std::printf(
+                "VK_EXT_graphics_pipeline_library not supported, skipping.\n");
+            context->cleanup();
+            return EXIT_SUCCESS;
+        }
+
+        VkDevice device = context->getDevice();
+        VkRenderPass render_pass = createBenchRenderPass(device);
+        // Same reflected layouts as the renderer, owned by the cache
+        auto layout_cache = std::make_unique<LayoutCache>(device);
+        ShaderReflection reflection = reflectSpirv(embedded_shaders::vert);
+        reflection.merge(reflectSpirv(embedded_shaders::frag));
+        VkPipelineLayout layout =
+            layout_cache->getLayouts(reflection).pipeline_layout;
+        std::vector<PipelineDesc> permutations =
+            makePermutations(layout, render_pass);
+
+        std::vector<VkPipeline> pipelines;
+        double monolithic_ms = 0.0;
+        double cold_link_ms = 0.0;
+        double warm_link_ms = 0.0;
+        size_t part_count = 0;
+        {
+            // Separate managers so neither path profits from the other's
+            // pipeline cache
+            PipelineManager monolithic(device, 1, 1);
+            for (const auto& desc : permutations) {
+                auto start = Clock::now();
+                pipelines.push_back(monolithic.createMonolithicPipeline(desc));
+                monolithic_ms += elapsedMs(start);
+            }
+            destroyAll(device, pipelines);
+
+            PipelineManager linked(device, 1, 1);
+            PipelineLibraryCache libraries(device, linked.getCache());
+            // Cold: parts are built the first time a subset shows up
+            for (const auto& desc : permutations) {
+                auto start = Clock::now();
+                pipelines.push_back(libraries.link(desc));
+                cold_link_ms += elapsedMs(start);
+            }
+            destroyAll(device, pipelines);
+            part_count = libraries.getPartCount();
+
+            // Warm: every part is cached, only the fast link remains
+            for (const auto& desc : permutations) {
+                auto start = Clock::now();
+                pipelines.push_back(libraries.link(desc));
+                warm_link_ms += elapsedMs(start);
+            }
+            destroyAll(device, pipelines);
+        }
+
+        double count = static_cast<double>(permutations.size());
+        std::printf("Permutations:               %zu\n", permutations.size());
+        std::printf("Library parts built:        %zu\n", part_count);
+        std::printf("Fast linking (driver):      %s\n",
+                    features.gpl_fast_linking ? "yes" : "no");
+        std::printf("Monolithic        avg (ms): %8.3f  total %8.2f\n",
+                    monolithic_ms / count, monolithic_ms);
+        std::printf("Parts + link      avg (ms): %8.3f  total %8.2f\n",
+                    cold_link_ms / count, cold_link_ms);
+        std::printf("Link only         avg (ms): %8.3f  total %8.2f\n",
+                    warm_link_ms / count, warm_link_ms);
+
+        layout_cache.reset();
+        vkDestroyRenderPass(device, render_pass, nullptr);
+        context->cleanup();
+    } catch (const std::exception& e) {
+        spdlog::critical("Benchmark failed: {}", e.what());
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
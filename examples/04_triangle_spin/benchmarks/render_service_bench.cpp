@@ -0,0 +1,203 @@
+/*
+ * @author: Avidel
+ * @LastEditors: Avidel
+ */
+// Client for the headless render service (04_triangle_spin --serve <socket>):
+// sends the same number of jobs with 1, 2, 4 and 8 of them in flight and
+// reports throughput, latency as seen by the client and the average stage
+// times the service measured. Linux only. Usage:
+//   render_service_bench <socket> [scene] [png of the last image]
+// Without a scene, a grid of triangles is written to the temp directory.
+#include "Utils/render_service.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#if defined(__linux__)
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+constexpr uint32_t WIDTH = 256;
+constexpr uint32_t HEIGHT = 256;
+constexpr int JOBS = 200;  // Per depth
+constexpr int GRID = 8;    // Triangles per side of the default scene
+constexpr uint32_t DEPTHS[] = {1, 2, 4, 8};
+
+double elapsedMs(Clock::time_point since) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - since)
+        .count();
+}
+
+std::string writeDefaultScene() {
+    std::filesystem::path path = std::filesystem::temp_directory_path() /
+                                 "render_service_bench_scene.txt";
+    std::ofstream file(path);
+    file << "# GRID x GRID triangles on the XZ plane, turned by position\n";
+    for (int z = 0; z < GRID; ++z) {
+        for (int x = 0; x < GRID; ++x) {
+            file << "i " << (x - GRID / 2) * 0.5f << " 0 "
+                 << (z - GRID / 2) * 0.5f << " " << (x * 37 + z * 11) % 360
+                 << " 0.4\n";
+        }
+    }
+    return path.string();
+}
+
+#if defined(__linux__)
+bool sendAll(int socket, const void* data, size_t size) {
+    const auto* bytes = static_cast<const uint8_t*>(data);
+    while (size > 0) {
+        ssize_t sent = send(socket, bytes, size, MSG_NOSIGNAL);
+        if (sent <= 0) {
+            return false;
+        }
+        bytes += sent;
+        size -= static_cast<size_t>(sent);
+    }
+    return true;
+}
+
+bool receiveAll(int socket, void* data, size_t size) {
+    auto* bytes = static_cast<uint8_t*>(data);
+    while (size > 0) {
+        ssize_t received = recv(socket, bytes, size, 0);
+        if (received <= 0) {
+            return false;
+        }
+        bytes += received;
+        size -= static_cast<size_t>(received);
+    }
+    return true;
+}
+
+bool sendRequest(int socket, const std::string& scene, int job) {
+    // Orbit the scene, one step per job
+    float angle = job * 0.1f;
+    RenderService::RequestHeader request;
+    request.width = WIDTH;
+    request.height = HEIGHT;
+    request.eye[0] = std::sin(angle) * 4.0f;
+    request.eye[1] = 2.0f;
+    request.eye[2] = std::cos(angle) * 4.0f;
+    request.path_length = static_cast<uint32_t>(scene.size());
+    return sendAll(socket, &request, sizeof(request)) &&
+           sendAll(socket, scene.data(), scene.size());
+}
+#endif
+}  // namespace
+
+int main(int argc, char* argv[]) {
+#if defined(__linux__)
+    if (argc < 2) {
+        std::printf("Usage: %s <socket> [scene] [png]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    const std::string scene = argc > 2 ? argv[2] : writeDefaultScene();
+    const char* png_path = argc > 3 ? argv[3] : nullptr;
+
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    std::strncpy(address.sun_path, argv[1], sizeof(address.sun_path) - 1);
+    int socket_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (socket_fd < 0 ||
+        connect(socket_fd, reinterpret_cast<sockaddr*>(&address),
+                sizeof(address)) != 0) {
+        std::printf("Cannot connect to %s\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    std::printf("%d jobs of %ux%u per depth, scene %s\n", JOBS, WIDTH,
+                HEIGHT, scene.c_str());
+    std::vector<uint8_t> payload;
+    for (uint32_t depth : DEPTHS) {
+        std::deque<Clock::time_point> in_flight;
+        std::vector<double> latencies;
+        RenderService::JobMetrics totals;
+        size_t bytes = 0;
+        int sent = 0;
+        auto start = Clock::now();
+        while (latencies.size() < size_t(JOBS)) {
+            while (sent < JOBS && in_flight.size() < depth) {
+                in_flight.push_back(Clock::now());
+                if (!sendRequest(socket_fd, scene, sent++)) {
+                    std::printf("Lost the connection\n");
+                    return EXIT_FAILURE;
+                }
+            }
+            RenderService::ResponseHeader response;
+            if (!receiveAll(socket_fd, &response, sizeof(response)) ||
+                response.magic != RenderService::RESPONSE_MAGIC) {
+                std::printf("Lost the connection\n");
+                return EXIT_FAILURE;
+            }
+            payload.resize(response.payload_size);
+            if (!receiveAll(socket_fd, payload.data(), payload.size())) {
+                std::printf("Lost the connection\n");
+                return EXIT_FAILURE;
+            }
+            if (response.status != RenderService::Status::Ok) {
+                std::printf("Job failed: %.*s\n", int(payload.size()),
+                            reinterpret_cast<const char*>(payload.data()));
+                return EXIT_FAILURE;
+            }
+            latencies.push_back(elapsedMs(in_flight.front()));
+            in_flight.pop_front();
+            bytes += payload.size();
+            const RenderService::JobMetrics& metrics = response.metrics;
+            totals.queue_ms += metrics.queue_ms;
+            totals.prepare_ms += metrics.prepare_ms;
+            totals.gpu_render_ms += metrics.gpu_render_ms;
+            totals.gpu_readback_ms += metrics.gpu_readback_ms;
+            totals.execute_ms += metrics.execute_ms;
+            totals.encode_ms += metrics.encode_ms;
+            totals.total_ms += metrics.total_ms;
+        }
+        double total_ms = elapsedMs(start);
+
+        std::sort(latencies.begin(), latencies.end());
+        std::printf("%u in flight: %7.1f jobs/s, %6.1f KB/job, latency ms "
+                    "p50 %6.2f p95 %6.2f max %6.2f\n",
+                    depth, JOBS / (total_ms * 1e-3), bytes / 1024.0 / JOBS,
+                    latencies[latencies.size() / 2],
+                    latencies[latencies.size() * 95 / 100],
+                    latencies.back());
+        std::printf("    service avg ms: queue %.2f prepare %.2f gpu %.2f + "
+                    "%.2f execute %.2f encode %.2f total %.2f\n",
+                    totals.queue_ms / JOBS, totals.prepare_ms / JOBS,
+                    totals.gpu_render_ms / JOBS,
+                    totals.gpu_readback_ms / JOBS, totals.execute_ms / JOBS,
+                    totals.encode_ms / JOBS, totals.total_ms / JOBS);
+    }
+    close(socket_fd);
+
+    if (png_path) {
+        std::ofstream file(png_path, std::ios::binary);
+        file.write(reinterpret_cast<const char*>(payload.data()),
+                   std::streamsize(payload.size()));
+        if (!file) {
+            std::printf("Failed to write %s\n", png_path);
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+#else
+    (void)argc;
+    (void)argv;
+    std::printf("The render service requires Linux\n");
+    return EXIT_FAILURE;
+#endif
+}
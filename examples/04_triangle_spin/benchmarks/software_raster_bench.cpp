@@ -0,0 +1,146 @@
+/*
+ * @author: Avidel
+ * @LastEditors: Avidel
+ */
+// Software rasterizer throughput against thread count at 1080p: a geometry
+// heavy scene of many small triangles and a fill heavy one of a few large
+// overlapping quads. Reports triangles/s and depth-passing pixels/s, in
+// total and per thread. CPU only, needs no Vulkan device or GPU. Pass a path
+// to also write the last geometry heavy frame as a PNG.
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "Utils/job_system.hpp"
+#include "Utils/software_rasterizer.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+constexpr uint32_t WIDTH = 1920;
+constexpr uint32_t HEIGHT = 1080;
+constexpr uint32_t GRID = 32;  // Quads per side of the instanced mesh
+constexpr size_t GEOMETRY_INSTANCES = 500;  // ~1M triangles
+constexpr size_t FILL_INSTANCES = 16;       // Screen-sized quads
+constexpr int ITERATIONS = 5;               // Best of
+
+struct Workload {
+    const char* name;
+    std::vector<Vertex> vertices;
+    std::vector<glm::mat4> models;
+};
+
+double elapsedMs(Clock::time_point since) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - since)
+        .count();
+}
+
+// GRID x GRID quads over [-0.5, 0.5]^2 as a triangle list, colored by position
+std::vector<Vertex> makeGrid(uint32_t grid) {
+    std::vector<Vertex> vertices;
+    auto corner = [&](uint32_t x, uint32_t y) {
+        float u = float(x) / grid;
+        float v = float(y) / grid;
+        return Vertex{{u - 0.5f, v - 0.5f}, {u, v, 1.0f - u}};
+    };
+    for (uint32_t y = 0; y < grid; ++y) {
+        for (uint32_t x = 0; x < grid; ++x) {
+            vertices.insert(vertices.end(), {corner(x, y), corner(x + 1, y),
+                                             corner(x + 1, y + 1)});
+            vertices.insert(vertices.end(), {corner(x, y),
+                                             corner(x + 1, y + 1),
+                                             corner(x, y + 1)});
+        }
+    }
+    return vertices;
+}
+
+FrameUniforms makeFrame() {
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 0.0f, 6.0f),
+                                 glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::mat4 proj = glm::perspective(glm::radians(45.0f),
+                                      float(WIDTH) / HEIGHT, 0.1f, 20.0f);
+    proj[1][1] *= -1;
+    FrameUniforms frame{};
+    frame.view_proj = proj * view;
+    frame.light_color = glm::vec4(1.0f);
+    return frame;
+}
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> position(-2.5f, 2.5f);
+    std::uniform_real_distribution<float> angle(0.0f, glm::radians(360.0f));
+
+    Workload geometry{"geometry", makeGrid(GRID), {}};
+    for (size_t i = 0; i < GEOMETRY_INSTANCES; ++i) {
+        glm::mat4 model = glm::translate(
+            glm::mat4(1.0f),
+            glm::vec3(position(rng), position(rng) * 0.6f, position(rng)));
+        model = glm::rotate(model, angle(rng), glm::vec3(0.3f, 1.0f, 0.2f));
+        geometry.models.push_back(glm::scale(model, glm::vec3(0.8f)));
+    }
+    Workload fill{"fill", makeGrid(1), {}};
+    for (size_t i = 0; i < FILL_INSTANCES; ++i) {
+        // Back to front, so every quad passes the depth test everywhere
+        glm::mat4 model = glm::translate(
+            glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, -2.0f + 0.1f * i));
+        fill.models.push_back(glm::scale(model, glm::vec3(8.0f)));
+    }
+
+    std::vector<uint32_t> thread_counts;
+    uint32_t hardware = std::max(1u, std::thread::hardware_concurrency());
+    for (uint32_t threads = 1; threads < hardware; threads *= 2) {
+        thread_counts.push_back(threads);
+    }
+    thread_counts.push_back(hardware);
+
+    const FrameUniforms frame = makeFrame();
+    std::printf("%ux%u, tiles of %u, best of %d frames\n", WIDTH, HEIGHT,
+                SoftwareRasterizer::TILE_SIZE, ITERATIONS);
+    for (const Workload* workload : {&geometry, &fill}) {
+        for (uint32_t threads : thread_counts) {
+            JobSystem jobs(threads);
+            SoftwareRasterizer rasterizer(jobs, WIDTH, HEIGHT);
+            double best_ms = 1e30;
+            SoftwareRasterizer::Stats best{};
+            for (int i = 0; i < ITERATIONS; ++i) {
+                auto start = Clock::now();
+                rasterizer.beginFrame(glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+                rasterizer.draw(frame, workload->vertices, workload->models);
+                rasterizer.endFrame();
+                double ms = elapsedMs(start);
+                if (ms < best_ms) {
+                    best_ms = ms;
+                    best = rasterizer.getLastStats();
+                }
+            }
+            double triangles_per_s = best.triangles / (best_ms * 1e-3);
+            double pixels_per_s = best.pixels / (best_ms * 1e-3);
+            std::printf("%-8s %3u thr %8.2f ms (geometry %6.2f, raster "
+                        "%6.2f)  %7.1f M tri/s %6.1f /thr  %7.1f M px/s "
+                        "%6.1f /thr\n",
+                        workload->name, threads, best_ms, best.geometry_ms,
+                        best.raster_ms, triangles_per_s * 1e-6,
+                        triangles_per_s * 1e-6 / threads, pixels_per_s * 1e-6,
+                        pixels_per_s * 1e-6 / threads);
+            if (argc > 1 && workload == &geometry &&
+                threads == thread_counts.back() &&
+                !rasterizer.writePng(argv[1])) {
+                std::printf("Failed to write %s\n", argv[1]);
+                return EXIT_FAILURE;
+            }
+        }
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,184 @@
+/*
+ * @author: Avidel
+ * @LastEditors: Avidel
+ */
+// One frame rendered by 1, 2, 4.. worker processes of a TileFarm, with the
+// path tracer (default) or the software rasterizer ("raster") rendering the
+// tiles: frame time, total throughput, and per worker the tiles, busy time,
+// throughput and steals. CPU only, Linux only. Pass a path after the mode to
+// write the last frame as a PNG.
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "Utils/job_system.hpp"
+#include "Utils/path_tracer.hpp"
+#include "Utils/software_rasterizer.hpp"
+#include "Utils/tile_farm.hpp"
+#include "stb_image_write.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace {
+constexpr uint32_t WIDTH = 960;
+constexpr uint32_t HEIGHT = 540;
+constexpr uint32_t PATH_TILE_SIZE = 32;
+constexpr uint32_t RASTER_TILE_SIZE = 128;  // Each tile bins the whole scene
+constexpr uint32_t SAMPLES = 4;             // Per pixel, path tracer
+constexpr uint32_t GRID = 16;      // Quads per side of the instanced mesh
+constexpr size_t INSTANCES = 400;  // ~200k triangles
+
+// GRID x GRID quads over [-0.5, 0.5]^2 as a triangle list, colored by position
+std::vector<Vertex> makeGrid(uint32_t grid) {
+    std::vector<Vertex> vertices;
+    auto corner = [&](uint32_t x, uint32_t y) {
+        float u = float(x) / grid;
+        float v = float(y) / grid;
+        return Vertex{{u - 0.5f, v - 0.5f}, {u, v, 1.0f - u}};
+    };
+    for (uint32_t y = 0; y < grid; ++y) {
+        for (uint32_t x = 0; x < grid; ++x) {
+            vertices.insert(vertices.end(), {corner(x, y), corner(x + 1, y),
+                                             corner(x + 1, y + 1)});
+            vertices.insert(vertices.end(), {corner(x, y),
+                                             corner(x + 1, y + 1),
+                                             corner(x, y + 1)});
+        }
+    }
+    return vertices;
+}
+
+FrameUniforms makeFrame() {
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 0.0f, 6.0f),
+                                 glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::mat4 proj = glm::perspective(glm::radians(45.0f),
+                                      float(WIDTH) / HEIGHT, 0.1f, 20.0f);
+    proj[1][1] *= -1;
+    FrameUniforms frame{};
+    frame.view_proj = proj * view;
+    frame.light_color = glm::vec4(1.0f);
+    return frame;
+}
+
+void copyRows(const uint8_t* source, size_t sourcePitch,
+              const TileFarm::Tile& tile, uint8_t* pixels, size_t pitch) {
+    for (uint32_t y = 0; y < tile.height; ++y) {
+        std::memcpy(pixels + y * pitch, source + y * sourcePitch,
+                    size_t(tile.width) * 4);
+    }
+}
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    const bool raster = argc > 1 && std::strcmp(argv[1], "raster") == 0;
+    const char* png_path = argc > 2 ? argv[2] : nullptr;
+    const uint32_t tile_size = raster ? RASTER_TILE_SIZE : PATH_TILE_SIZE;
+
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> position(-2.5f, 2.5f);
+    std::uniform_real_distribution<float> angle(0.0f, glm::radians(360.0f));
+    const std::vector<Vertex> vertices = makeGrid(GRID);
+    std::vector<glm::mat4> models;
+    for (size_t i = 0; i < INSTANCES; ++i) {
+        glm::mat4 model = glm::translate(
+            glm::mat4(1.0f),
+            glm::vec3(position(rng), position(rng) * 0.6f, position(rng)));
+        model = glm::rotate(model, angle(rng), glm::vec3(0.3f, 1.0f, 0.2f));
+        models.push_back(glm::scale(model, glm::vec3(0.8f)));
+    }
+    models.push_back(glm::scale(
+        glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, -3.0f)),
+        glm::vec3(16.0f)));
+
+    // Runs in each worker: the scene came along with the fork, the
+    // renderer and its single-threaded job system are its own
+    auto setup = [&](uint32_t) -> TileFarm::TileFunction {
+        auto jobs = std::make_shared<JobSystem>(1);
+        if (raster) {
+            auto rasterizer = std::make_shared<SoftwareRasterizer>(
+                *jobs, tile_size, tile_size);
+            return [&, jobs, rasterizer](const TileFarm::Tile& tile,
+                                         std::span<const std::byte> parameters,
+                                         uint8_t* pixels, size_t pitch) {
+                FrameUniforms frame;
+                std::memcpy(&frame, parameters.data(), sizeof(frame));
+                frame.view_proj = TileFarm::cropViewProj(frame.view_proj, tile,
+                                                         WIDTH, HEIGHT);
+                rasterizer->resize(tile.width, tile.height);
+                rasterizer->beginFrame(glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+                rasterizer->draw(frame, vertices, models);
+                rasterizer->endFrame();
+                copyRows(rasterizer->getPixels(), rasterizer->getPitch(), tile,
+                         pixels, pitch);
+            };
+        }
+        auto tracer =
+            std::make_shared<PathTracer>(*jobs, tile_size, tile_size);
+        tracer->setScene(vertices, models);
+        return [jobs, tracer](const TileFarm::Tile& tile,
+                              std::span<const std::byte> parameters,
+                              uint8_t* pixels, size_t pitch) {
+            FrameUniforms frame;
+            std::memcpy(&frame, parameters.data(), sizeof(frame));
+            frame.view_proj =
+                TileFarm::cropViewProj(frame.view_proj, tile, WIDTH, HEIGHT);
+            PathTracer::Settings settings;
+            settings.seed = tile.y * WIDTH + tile.x;
+            tracer->resize(tile.width, tile.height);
+            tracer->setSettings(settings);
+            tracer->setCamera(frame);
+            while (tracer->getSampleCount() < SAMPLES) {
+                tracer->renderPass();
+            }
+            copyRows(tracer->getPixels(), tracer->getPitch(), tile, pixels,
+                     pitch);
+        };
+    };
+
+    std::vector<uint32_t> worker_counts;
+    uint32_t hardware = std::max(1u, std::thread::hardware_concurrency());
+    for (uint32_t workers = 1; workers < hardware; workers *= 2) {
+        worker_counts.push_back(workers);
+    }
+    worker_counts.push_back(hardware);
+
+    const FrameUniforms frame = makeFrame();
+    std::printf("%s, %ux%u in tiles of %u%s\n",
+                raster ? "software rasterizer" : "path tracer", WIDTH, HEIGHT,
+                tile_size, raster ? "" : ", 4 samples per pixel");
+    for (uint32_t workers : worker_counts) {
+        TileFarm farm(workers, WIDTH, HEIGHT, tile_size, setup);
+        farm.renderFrame(std::as_bytes(std::span(&frame, 1)));
+        const TileFarm::Stats& stats = farm.getLastStats();
+        double pixels = double(WIDTH) * HEIGHT;
+        std::printf("%3u workers: %8.1f ms/frame, %7.2f M px/s\n", workers,
+                    stats.frame_ms, pixels / (stats.frame_ms * 1e3));
+        for (size_t i = 0; i < stats.workers.size(); ++i) {
+            const TileFarm::WorkerStats& worker = stats.workers[i];
+            std::printf("    worker %2zu: %4llu tiles, %8.1f ms busy, "
+                        "%7.2f M px/s, %llu steals%s\n",
+                        i, static_cast<unsigned long long>(worker.tiles),
+                        worker.busy_ms,
+                        worker.busy_ms > 0.0
+                            ? worker.pixels / (worker.busy_ms * 1e3)
+                            : 0.0,
+                        static_cast<unsigned long long>(worker.steals),
+                        worker.alive ? "" : " (exited)");
+        }
+        if (png_path && workers == worker_counts.back() &&
+            !stbi_write_png(png_path, int(WIDTH), int(HEIGHT), 4,
+                            farm.getPixels(), int(farm.getPitch()))) {
+            std::printf("Failed to write %s\n", png_path);
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
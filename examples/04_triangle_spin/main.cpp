@@ -6,10 +6,35 @@
  #include "Utils/vulkan_util.hpp" // 包含新的应用程序和 Vulkan 工具类
  #include "spdlog/sinks/stdout_color_sinks.h"
  #include "spdlog/spdlog.h"
+ #include <cstdio>
  #include <cstdlib>   // 为了 EXIT_SUCCESS 和 EXIT_FAILURE
+ #include <cstring>
  #include <exception> // 为了 std::exception
+ #include <string>
+ 
+ int main(int argc, char* argv[]) {
+     // --serve <socket>: headless render service instead of the window
+     // --frame-queue <n>: frames the game thread may simulate ahead
+     std::string service_socket;
+     long queue_depth = FRAME_QUEUE_DEPTH;
+     for (int i = 1; i < argc; i++) {
+         if (std::strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+             service_socket = argv[++i];
+         } else if (std::strcmp(argv[i], "--frame-queue") == 0 &&
+                    i + 1 < argc) {
+             queue_depth = std::strtol(argv[++i], nullptr, 10);
+             if (queue_depth < 1 || queue_depth > 16) {
+                 printf("--frame-queue takes 1 to 16 frames\n");
+                 return EXIT_FAILURE;
+             }
+         } else {
+             printf("Usage: %s [--frame-queue <depth>] "
+                    "[--serve <socket path>]\n",
+                    argv[0]);
+             return EXIT_FAILURE;
+         }
+     }
  
- int main(int /*argc*/, char* /*argv*/[]) {
      // 尽早设置日志记录器
      try {
          auto console = spdlog::stdout_color_mt("console");
@@ -26,8 +51,13 @@
  
      // 创建并运行应用程序实例
      TriangleApplication app;
+     app.setFrameQueueDepth(static_cast<uint32_t>(queue_depth));
      try {
-         app.run(); // 调用 run() 方法来启动初始化、主循环和清理
+         if (service_socket.empty()) {
+             app.run(); // 调用 run() 方法来启动初始化、主循环和清理
+         } else {
+             app.runService(service_socket);
+         }
      } catch (const std::exception& e) {
          // 捕获并记录标准异常
          spdlog::critical("Application encountered an error: {}", e.what());
@@ -3,19 +3,29 @@
 layout(location = 0) in vec2 inPosition;
 layout(location = 1) in vec3 inColor;
 
-layout(binding = 0) uniform UniformBufferObject {
-    mat4 model;
-    mat4 view;
-    mat4 proj;
-    vec3 lightColor; // 虽然这里没用，但 UBO 结构要匹配 C++
-} ubo;
+// 每帧更新一次：proj * view 在 CPU 上预先相乘
+layout(set = 0, binding = 0) uniform FrameUniforms {
+    mat4 viewProj;
+    vec4 lightColor; // 虽然这里没用，但 UBO 结构要匹配 C++
+} frame;
+
+// 每个实例一个世界矩阵，由 Scene::update() 直接写入
+layout(std430, set = 0, binding = 1) readonly buffer InstanceData {
+    mat4 models[];
+} instances;
 
 layout(location = 0) out vec3 fragColor;
 
+// 深度预处理和颜色 pass 用不同的管线绘制，深度必须逐位一致
+invariant gl_Position;
+
 void main() {
-    // 使用 UBO 中的 MVP 矩阵计算最终位置
-    gl_Position = ubo.proj * ubo.view * ubo.model * vec4(inPosition, 0.0, 1.0);
+    mat4 model = instances.models[gl_InstanceIndex];
+    // 两次矩阵乘向量，而不是每个顶点都做 proj * view * model 的矩阵乘法。
+    // 不预乘成 MVP：hiz_cull.comp 需要世界矩阵求包围盒，而相机每帧都在动，
+    // 预乘会让每个实例每帧都要重写，只写改变过的矩阵就没有意义了
+    gl_Position = frame.viewProj * (model * vec4(inPosition, 0.0, 1.0));
     fragColor = inColor;
     // 可选：如果你想让点更大，可以设置 gl_PointSize
     // gl_PointSize = 5.0; // 例如，5 像素大小
-}
\ No newline at end of file
+}
@@ -0,0 +1,146 @@
+/*
+ * @author: Avidel
+ * @LastEditors: Avidel
+ */
+#pragma once
+#include <SDL3/SDL.h>
+
+#include <algorithm>
+#include <cstdint>
+
+// --- Redraw Policy ---
+// Event-driven frames for mostly static content, for SDL_AppIterate:
+//
+//   if (!redraw.beginFrame()) return SDL_APP_CONTINUE;  // Waited instead
+//   ...build the frame, hash what it would show...
+//   if (redraw.isUnchanged(hash)) return SDL_APP_CONTINUE;
+//   ...render and present...
+//   redraw.markPresented(hash);
+//
+// beginFrame() builds a frame at once after an event passed to onEvent() or
+// a timer from wakeIn(); frames from requestFrame() (animation) and the
+// input grace period are paced at the frame interval. With nothing to do it
+// blocks in SDL_WaitEventTimeout until the next event or timer, so an idle
+// window costs neither CPU nor GPU. Content that changed is looked at again
+// the next interval, which lets animations and UI transitions run out and
+// stops once two frames hash the same.
+class RedrawPolicy {
+public:
+    struct Stats {
+        uint64_t built = 0;      // beginFrame() returned true
+        uint64_t presented = 0;  // markPresented()
+        uint64_t skipped = 0;    // Built, but isUnchanged()
+        uint64_t waits = 0;      // beginFrame() blocked for an event
+    };
+
+    // inputGraceNs: after input, keep building paced frames this long, for
+    // content that changes later without more input (e.g. tooltip delays)
+    explicit RedrawPolicy(Uint64 inputGraceNs = 0,
+                          Uint64 frameIntervalNs = SDL_NS_PER_SECOND / 60)
+        : input_grace_ns(inputGraceNs), frame_interval_ns(frameIntervalNs) {}
+
+    void onEvent(const SDL_Event& event) {
+        switch (event.type) {
+        case SDL_EVENT_WINDOW_MINIMIZED:
+        case SDL_EVENT_WINDOW_HIDDEN:
+        case SDL_EVENT_WINDOW_OCCLUDED:
+            hidden = true;
+            return;
+        case SDL_EVENT_WINDOW_RESTORED:
+        case SDL_EVENT_WINDOW_MAXIMIZED:
+        case SDL_EVENT_WINDOW_SHOWN:
+        case SDL_EVENT_WINDOW_EXPOSED:
+            hidden = false;
+            force_present = true;  // The window contents may be lost
+            break;
+        case SDL_EVENT_WINDOW_RESIZED:
+        case SDL_EVENT_WINDOW_PIXEL_SIZE_CHANGED:
+        case SDL_EVENT_WINDOW_DISPLAY_SCALE_CHANGED:
+            force_present = true;
+            break;
+        default:
+            break;
+        }
+        event_pending = true;
+        if (input_grace_ns > 0) {
+            grace_until_ns = SDL_GetTicksNS() + input_grace_ns;
+        }
+    }
+
+    // One more frame at the frame interval; call every frame to animate
+    void requestFrame() { frame_requested = true; }
+
+    // A frame at the latest after ns, e.g. for a clock
+    void wakeIn(Uint64 ns) {
+        Uint64 at = SDL_GetTicksNS() + ns;
+        wake_ns = wake_ns ? std::min(wake_ns, at) : at;
+    }
+
+    // True to build a frame now; otherwise waits for an event or timer and
+    // returns false, so SDL dispatches the event before the next iteration
+    bool beginFrame() {
+        Uint64 now = SDL_GetTicksNS();
+        if (wake_ns != 0 && now >= wake_ns) {
+            wake_ns = 0;
+            event_pending = true;
+        }
+        bool paced = frame_requested || now < grace_until_ns;
+        if (!hidden && (event_pending || (paced && now >= next_paced_ns))) {
+            event_pending = false;
+            frame_requested = false;
+            next_paced_ns = now + frame_interval_ns;
+            stats.built++;
+            return true;
+        }
+
+        Uint64 deadline = wake_ns;
+        if (!hidden && paced) {
+            deadline = deadline ? std::min(deadline, next_paced_ns)
+                                : next_paced_ns;
+        }
+        Sint32 timeout_ms = -1;  // No timer: until the next event
+        if (deadline != 0) {
+            Uint64 remaining = deadline > now ? deadline - now : 0;
+            timeout_ms =
+                Sint32((remaining + SDL_NS_PER_MS - 1) / SDL_NS_PER_MS);
+        }
+        SDL_WaitEventTimeout(nullptr, timeout_ms);  // Leaves it queued
+        stats.waits++;
+        return false;
+    }
+
+    // The built frame shows the same as the presented one: skip rendering
+    bool isUnchanged(uint64_t contentHash) {
+        if (force_present || !has_presented || contentHash != presented_hash) {
+            return false;
+        }
+        stats.skipped++;
+        return true;
+    }
+
+    void markPresented(uint64_t contentHash) {
+        presented_hash = contentHash;
+        has_presented = true;
+        force_present = false;
+        frame_requested = true;  // Changed: see whether it keeps changing
+        stats.presented++;
+    }
+
+    const Stats& getStats() const { return stats; }
+
+private:
+    Uint64 input_grace_ns;
+    Uint64 frame_interval_ns;
+
+    bool event_pending = true;  // The first frame
+    bool frame_requested = false;
+    bool hidden = false;
+    bool force_present = false;
+    Uint64 next_paced_ns = 0;
+    Uint64 grace_until_ns = 0;
+    Uint64 wake_ns = 0;  // 0: no timer
+
+    bool has_presented = false;
+    uint64_t presented_hash = 0;
+    Stats stats;
+};
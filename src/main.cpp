@@ -6,66 +6,303 @@
  * @FilePath: /MiniRender/src/main.cpp
  * @Description: 这是默认设置,请设置`customMade`, 打开koroFileHeader查看配置 进行设置: https://github.com/OBKoro1/koro1FileHeader/wiki/%E9%85%8D%E7%BD%AE
  */
+// Runs entirely on SDL's main callbacks: SDL_AppIterate draws one frame and
+// returns, SDL_AppEvent tracks the window state. Pacing is done here:
+//   focused:   a frame limiter at --fps (default: the display refresh
+//              rate), sleeping until shortly before the deadline and
+//              spinning the rest for precise frame times
+//   unfocused: BACKGROUND_FPS, blocking in SDL_WaitEventTimeout between
+//              frames so input wakes it at once
+//   minimized or occluded: no drawing, block until the next event
+// Once a second the frame rate and the process CPU time per frame are
+// logged. Usage: MiniRenderer [--fps <n>, 0 for unlimited] [--vsync]
 #include <SDL3/SDL_init.h>
 #include <SDL3/SDL.h>
 #include <SDL3/SDL_main.h>
 
- struct AppContext {
-    SDL_Window* window;
-    SDL_Renderer* renderer;
-    SDL_Texture* message_tex, *image_tex;
-    SDL_FRect message_dest;
-    SDL_AudioDeviceID audio_device;
+#include <algorithm>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+namespace {
+constexpr double DEFAULT_FPS = 60.0;     // Display reports no refresh rate
+constexpr double BACKGROUND_FPS = 10.0;  // Unfocused
+constexpr Sint32 HIDDEN_WAIT_MS = 1000;  // Wake at least this often, to log
+// Spin margin before a deadline, tracking how late SDL_DelayNS wakes up
+constexpr Uint64 MIN_SPIN_NS = 200'000;
+constexpr Uint64 MAX_SPIN_NS = 4'000'000;
+constexpr Uint64 REPORT_INTERVAL_NS = SDL_NS_PER_SECOND;
+
+// CPU time of the whole process, so driver and SDL threads count too
+Uint64 processCpuNs() {
+#if defined(_WIN32)
+    FILETIME creation, exit, kernel, user;
+    if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel,
+                         &user)) {
+        return 0;
+    }
+    auto ticks = [](const FILETIME& time) {  // 100 ns units
+        return (Uint64(time.dwHighDateTime) << 32) | time.dwLowDateTime;
+    };
+    return (ticks(kernel) + ticks(user)) * 100;
+#else
+    timespec time{};
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time);
+    return Uint64(time.tv_sec) * SDL_NS_PER_SECOND + Uint64(time.tv_nsec);
+#endif
+}
+
+// --- Frame Limiter ---
+// Deadlines advance by one period per frame, so the rate holds on average
+// even when single frames wake late; after falling behind by more than a
+// period it restarts from now instead of rushing to catch up.
+class FrameLimiter {
+public:
+    // 0 disables the limit; the next frame is due at once
+    void setRate(double fps) {
+        period_ns = fps > 0.0 ? Uint64(SDL_NS_PER_SECOND / fps) : 0;
+        next_ns = 0;
+    }
+
+    bool isDue(Uint64 now) const { return now >= next_ns; }
+
+    // Rounded up, for SDL_WaitEventTimeout
+    Sint32 msUntilDue(Uint64 now) const {
+        Uint64 remaining = next_ns > now ? next_ns - now : 0;
+        return Sint32((remaining + SDL_NS_PER_MS - 1) / SDL_NS_PER_MS);
+    }
+
+    // A frame starts now: set the deadline of the next one
+    void advance(Uint64 now) {
+        if (period_ns == 0) {
+            return;
+        }
+        next_ns = now - next_ns > period_ns ? now + period_ns
+                                            : next_ns + period_ns;
+    }
+
+    // Sleep, then spin until the next frame is due and advance
+    void wait() {
+        if (period_ns == 0) {
+            return;
+        }
+        Uint64 now = SDL_GetTicksNS();
+        if (now + spin_ns < next_ns) {
+            Uint64 request = next_ns - now - spin_ns;
+            SDL_DelayNS(request);
+            Uint64 woke = SDL_GetTicksNS();
+            Uint64 oversleep = woke - now > request ? woke - now - request : 0;
+            // Jump up to a late wakeup at once, relax slowly after it
+            spin_ns = std::clamp(std::max(oversleep, spin_ns - spin_ns / 16),
+                                 MIN_SPIN_NS, MAX_SPIN_NS);
+            now = woke;
+        }
+        while (now < next_ns) {
+            SDL_CPUPauseInstruction();
+            now = SDL_GetTicksNS();
+        }
+        advance(now);
+    }
+
+private:
+    Uint64 period_ns = 0;
+    Uint64 next_ns = 0;           // When the next frame may start
+    Uint64 spin_ns = MAX_SPIN_NS / 4;
+};
+
+// Totals since the last report
+struct FrameStats {
+    Uint64 frames = 0;
+    Uint64 work_ns = 0;  // Drawing and presenting, without the limiter
+    Uint64 start_ns = 0;
+    Uint64 start_cpu_ns = 0;
+
+    void reset(Uint64 now) {
+        frames = 0;
+        work_ns = 0;
+        start_ns = now;
+        start_cpu_ns = processCpuNs();
+    }
+};
+}  // namespace
+
+struct AppContext {
+    SDL_Window* window = nullptr;
+    SDL_Renderer* renderer = nullptr;
     SDL_AppResult app_quit = SDL_APP_CONTINUE;
+
+    double target_fps = 0.0;  // Focused, 0 for unlimited
+    bool focused = true;
+    bool hidden = false;  // Minimized or occluded: nothing to draw
+    FrameLimiter limiter;
+    FrameStats stats;
 };
 
+namespace {
+void updatePacing(AppContext* app) {
+    double fps = app->target_fps;
+    if (!app->focused) {
+        fps = fps > 0.0 ? std::min(fps, BACKGROUND_FPS) : BACKGROUND_FPS;
+    }
+    app->limiter.setRate(fps);  // Also makes the next frame due at once
+}
+
+void reportStats(AppContext* app, Uint64 now) {
+    FrameStats& stats = app->stats;
+    double wall_ms = double(now - stats.start_ns) / SDL_NS_PER_MS;
+    double cpu_ms = double(processCpuNs() - stats.start_cpu_ns) / SDL_NS_PER_MS;
+    double cpu_percent = 100.0 * cpu_ms / wall_ms;  // Of one core
+    if (stats.frames == 0) {
+        SDL_Log("Idle, CPU %.1f%%", cpu_percent);
+    } else {
+        double frames = double(stats.frames);
+        SDL_Log("%.1f fps, frame %.2f ms (work %.2f ms), CPU %.2f ms/frame "
+                "(%.1f%%)",
+                frames * 1000.0 / wall_ms, wall_ms / frames,
+                double(stats.work_ns) / SDL_NS_PER_MS / frames,
+                cpu_ms / frames, cpu_percent);
+    }
+    stats.reset(now);
+}
+}  // namespace
+
 SDL_AppResult SDL_AppInit(void** appstate, int argc, char* argv[]) {
     SDL_SetLogPriorities(SDL_LOG_PRIORITY_VERBOSE);
-    if(!SDL_Init(SDL_INIT_VIDEO)){
+    // Pacing is done in SDL_AppIterate, SDL should not add its own
+    SDL_SetHint(SDL_HINT_MAIN_CALLBACK_RATE, "0");
+    if (!SDL_Init(SDL_INIT_VIDEO)) {
         SDL_Log("SDL_Init failed: %s", SDL_GetError());
         return SDL_APP_FAILURE;
     }
+    auto* app = new AppContext();
+    *appstate = app;  // SDL_AppQuit cleans up, also after a failure
+
+    double fps = -1.0;  // Not given: the display's refresh rate
+    bool vsync = false;
+    for (int i = 1; i < argc; i++) {
+        if (SDL_strcmp(argv[i], "--fps") == 0 && i + 1 < argc) {
+            fps = SDL_max(0.0, SDL_atof(argv[++i]));
+        } else if (SDL_strcmp(argv[i], "--vsync") == 0) {
+            vsync = true;
+        } else {
+            SDL_Log("Usage: %s [--fps <n>, 0 for unlimited] [--vsync]",
+                    argv[0]);
+            return SDL_APP_FAILURE;
+        }
+    }
+
     SDL_Log("Hello, SDL3!");
-    SDL_Window* window(SDL_CreateWindow("Hello, SDL3!", 800, 600, SDL_WINDOW_RESIZABLE));
-    if(window == nullptr){
+    app->window = SDL_CreateWindow("Hello, SDL3!", 800, 600,
+                                   SDL_WINDOW_RESIZABLE);
+    if (app->window == nullptr) {
         SDL_Log("SDL_CreateWindow failed: %s", SDL_GetError());
         return SDL_APP_FAILURE;
     }
-    SDL_SetWindowPosition(window, SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED);
-    SDL_Renderer* renderer(SDL_CreateRenderer(window, nullptr));
-    if(renderer == nullptr){
+    SDL_SetWindowPosition(app->window, SDL_WINDOWPOS_CENTERED,
+                          SDL_WINDOWPOS_CENTERED);
+    app->renderer = SDL_CreateRenderer(app->window, nullptr);
+    if (app->renderer == nullptr) {
         SDL_Log("SDL_CreateRenderer failed: %s", SDL_GetError());
         return SDL_APP_FAILURE;
     }
-    SDL_Event event;
-    bool keep_going = true;
-    while (keep_going){
-        while(SDL_PollEvent(&event)){
-            if(event.type == SDL_EVENT_QUIT){
-                keep_going = false;
-            }
-        }
-        SDL_SetRenderDrawColor(renderer, 10, 20, 30, 255);
-        SDL_RenderClear(renderer);
-        SDL_RenderPresent(renderer);
+    // With vsync the present blocks; the limiter then only caps below it
+    SDL_SetRenderVSync(app->renderer, vsync ? 1 : 0);
+
+    if (fps < 0.0) {
+        const SDL_DisplayMode* mode = SDL_GetCurrentDisplayMode(
+            SDL_GetDisplayForWindow(app->window));
+        fps = mode && mode->refresh_rate > 0.0f ? mode->refresh_rate
+                                                : DEFAULT_FPS;
+    }
+    app->target_fps = fps;
+    app->focused =
+        (SDL_GetWindowFlags(app->window) & SDL_WINDOW_INPUT_FOCUS) != 0;
+    updatePacing(app);
+    app->stats.reset(SDL_GetTicksNS());
+    if (fps > 0.0) {
+        SDL_Log("Frame limit %.1f fps, vsync %s", fps, vsync ? "on" : "off");
+    } else {
+        SDL_Log("No frame limit, vsync %s", vsync ? "on" : "off");
     }
     return SDL_APP_CONTINUE;
 }
 
-SDL_AppResult SDL_AppEvent(void *appstate, SDL_Event* event) {
-    auto* app = (AppContext*)appstate;
-    if(event->type == SDL_EVENT_QUIT)
-    {
+SDL_AppResult SDL_AppEvent(void* appstate, SDL_Event* event) {
+    auto* app = static_cast<AppContext*>(appstate);
+    switch (event->type) {
+    case SDL_EVENT_QUIT:
         app->app_quit = SDL_APP_SUCCESS;
+        break;
+    case SDL_EVENT_WINDOW_MINIMIZED:
+    case SDL_EVENT_WINDOW_OCCLUDED:
+    case SDL_EVENT_WINDOW_HIDDEN:
+        app->hidden = true;
+        break;
+    case SDL_EVENT_WINDOW_RESTORED:
+    case SDL_EVENT_WINDOW_MAXIMIZED:
+    case SDL_EVENT_WINDOW_EXPOSED:
+    case SDL_EVENT_WINDOW_SHOWN:
+        app->hidden = false;
+        updatePacing(app);
+        break;
+    case SDL_EVENT_WINDOW_FOCUS_GAINED:
+    case SDL_EVENT_WINDOW_FOCUS_LOST:
+        app->focused = event->type == SDL_EVENT_WINDOW_FOCUS_GAINED;
+        updatePacing(app);
+        break;
+    default:
+        break;
     }
     return SDL_APP_CONTINUE;
 }
 
-void SDL_AppQuit(void* appstate, SDL_AppResult result) {
+void SDL_AppQuit(void* appstate, SDL_AppResult /*result*/) {
+    auto* app = static_cast<AppContext*>(appstate);
+    if (app) {
+        if (app->renderer) SDL_DestroyRenderer(app->renderer);
+        if (app->window) SDL_DestroyWindow(app->window);
+        delete app;
+    }
     SDL_Quit();
 }
 
-SDL_AppResult SDL_AppIterate(void *appstate) {
-    auto* app = (AppContext*)appstate;
-    return app->app_quit;
-}
\ No newline at end of file
+SDL_AppResult SDL_AppIterate(void* appstate) {
+    auto* app = static_cast<AppContext*>(appstate);
+    if (app->app_quit != SDL_APP_CONTINUE) {
+        return app->app_quit;
+    }
+    Uint64 now = SDL_GetTicksNS();
+    if (now - app->stats.start_ns >= REPORT_INTERVAL_NS) {
+        reportStats(app, now);
+    }
+
+    // Nothing visible: sleep until the window state or input changes
+    if (app->hidden) {
+        SDL_WaitEventTimeout(nullptr, HIDDEN_WAIT_MS);
+        return SDL_APP_CONTINUE;
+    }
+    // Background rate: wait for the frame, or return early on an event
+    if (!app->focused && !app->limiter.isDue(now)) {
+        SDL_WaitEventTimeout(nullptr, app->limiter.msUntilDue(now));
+        return SDL_APP_CONTINUE;
+    }
+
+    SDL_SetRenderDrawColor(app->renderer, 10, 20, 30, 255);
+    SDL_RenderClear(app->renderer);
+    SDL_RenderPresent(app->renderer);
+    Uint64 work_end = SDL_GetTicksNS();
+    app->stats.frames++;
+    app->stats.work_ns += work_end - now;
+
+    if (app->focused) {
+        app->limiter.wait();
+    } else {
+        app->limiter.advance(now);
+    }
+    return SDL_APP_CONTINUE;
+}